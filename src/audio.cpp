@@ -0,0 +1,131 @@
+#include "audio.h"
+
+// ----------------------------------------------------------------------------
+tone_generator::tone_generator(audio_ring* ring)
+    : ring(ring), phase(0), overruns(0) {
+    step = (unsigned int) (((qword) TONE_HZ << 32) / AUDIO_RATE);
+}
+
+// ----------------------------------------------------------------------------
+void tone_generator::frame(bool on) {
+    /* produce exactly one frame of samples. Called from the vm thread once
+     * per timer tick, so it must not allocate, lock or block: the block is
+     * preallocated and if the ring is full the excess is dropped (and
+     * counted) rather than waited on.
+     */
+    if (on) {
+        for (unsigned int i = 0; i < AUDIO_FRAME; ++i, phase += step)
+            block[i] = (phase & 0x80000000) ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+    } else {
+        // restart the wave on each beep, so output depends only on the vm
+        phase = 0;
+        for (unsigned int i = 0; i < AUDIO_FRAME; ++i)
+            block[i] = 0;
+    }
+    overruns += AUDIO_FRAME - ring->push(block, AUDIO_FRAME);
+}
+
+// ----------------------------------------------------------------------------
+qword tone_generator::get_overruns() {
+    return overruns;
+}
+
+// ----------------------------------------------------------------------------
+audio_sink::audio_sink() : underruns(0), samples(0) {
+}
+
+// ----------------------------------------------------------------------------
+audio_sink::~audio_sink() {
+}
+
+// ----------------------------------------------------------------------------
+void audio_sink::pump(audio_ring* ring, unsigned int n) {
+    /* consume `n` samples from the ring, as an output device would; if the
+     * generator hasn't produced them yet, the gap is filled with silence and
+     * reported as an underrun
+     */
+    const unsigned int block_len = sizeof(block) / sizeof(block[0]);
+    bool short_read = false;
+    while (n > 0) {
+        unsigned int want = n < block_len ? n : block_len,
+                     got  = ring->pop(block, want);
+        for (unsigned int i = got; i < want; ++i)
+            block[i] = 0;
+        short_read = short_read || got < want;
+        write(block, want);
+        samples += want;
+        n -= want;
+    }
+    if (short_read)
+        ++underruns;
+}
+
+// ----------------------------------------------------------------------------
+qword audio_sink::get_underruns() {
+    return underruns;
+}
+
+// ----------------------------------------------------------------------------
+qword audio_sink::get_samples() {
+    return samples;
+}
+
+// ----------------------------------------------------------------------------
+void null_sink::write(const short* samples, unsigned int n) {
+}
+
+// ----------------------------------------------------------------------------
+static void put_le(std::ofstream& out, dword v, unsigned int bytes) {
+    for (unsigned int i = 0; i < bytes; ++i)
+        out.put((char) ((v >> (8 * i)) & 0xFF));
+}
+
+// ----------------------------------------------------------------------------
+wav_sink::wav_sink(const std::string& path)
+    : out(path.c_str(), std::ios::binary), data_bytes(0) {
+    if (out)
+        write_header(); // placeholder sizes, patched up in `close`
+}
+
+// ----------------------------------------------------------------------------
+wav_sink::~wav_sink() {
+    close();
+}
+
+// ----------------------------------------------------------------------------
+bool wav_sink::is_open() {
+    return out.is_open() && out.good();
+}
+
+// ----------------------------------------------------------------------------
+void wav_sink::close() {
+    if (!out.is_open())
+        return;
+    out.seekp(0);
+    write_header();
+    out.close();
+}
+
+// ----------------------------------------------------------------------------
+void wav_sink::write(const short* samples, unsigned int n) {
+    for (unsigned int i = 0; i < n; ++i)
+        put_le(out, (word) samples[i], 2);
+    data_bytes += n * 2;
+}
+
+// ----------------------------------------------------------------------------
+void wav_sink::write_header() {
+    /* canonical 44 byte RIFF header: 16-bit mono PCM at AUDIO_RATE */
+    out.write("RIFF", 4);
+    put_le(out, 36 + data_bytes, 4);
+    out.write("WAVEfmt ", 8);
+    put_le(out, 16, 4);             // fmt chunk size
+    put_le(out, 1, 2);              // PCM
+    put_le(out, 1, 2);              // channels
+    put_le(out, AUDIO_RATE, 4);
+    put_le(out, AUDIO_RATE * 2, 4); // byte rate
+    put_le(out, 2, 2);              // block align
+    put_le(out, 16, 2);             // bits per sample
+    out.write("data", 4);
+    put_le(out, data_bytes, 4);
+}
@@ -0,0 +1,74 @@
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+#include "def.h"
+#include "spsc.h"
+#include <fstream>
+#include <string>
+
+/* Sound: while the sound timer is non-zero the vm's tone generator writes a
+ * square wave, one 60Hz frame of samples at a time, into a lock-free ring.
+ * An audio sink drains the ring from whichever thread drives the output
+ * (a device callback, a file writer, ...), padding with silence and
+ * counting an underrun whenever the vm has fallen behind.
+ *
+ * Samples are signed 16-bit mono PCM.
+ */
+const unsigned int AUDIO_RATE      = 44100,
+                   AUDIO_FRAME     = AUDIO_RATE / FREQUENCY, // samples/frame
+                   AUDIO_RING_SIZE = 8192,
+                   TONE_HZ         = 440;
+const short        TONE_AMPLITUDE  = 8000;
+
+typedef spsc_queue<short, AUDIO_RING_SIZE> audio_ring;
+
+class tone_generator {
+    audio_ring* ring;
+    unsigned int phase, step; // 32-bit fixed point phase accumulator
+    short block[AUDIO_FRAME];
+    qword overruns;
+
+    public:
+    tone_generator(audio_ring* ring);
+    void frame(bool on);
+    qword get_overruns();
+};
+
+class audio_sink {
+    short block[1024];
+    qword underruns, samples;
+
+    public:
+    audio_sink();
+    virtual ~audio_sink();
+    void pump(audio_ring* ring, unsigned int n);
+    qword get_underruns();
+    qword get_samples();
+
+    protected:
+    virtual void write(const short* samples, unsigned int n) = 0;
+};
+
+class null_sink : public audio_sink {
+    protected:
+    void write(const short* samples, unsigned int n);
+};
+
+class wav_sink : public audio_sink {
+    std::ofstream out;
+    dword data_bytes;
+
+    public:
+    wav_sink(const std::string& path);
+    ~wav_sink();
+    bool is_open();
+    void close();
+
+    protected:
+    void write(const short* samples, unsigned int n);
+
+    private:
+    void write_header();
+};
+
+#endif
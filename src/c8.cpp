@@ -1,30 +1,204 @@
 #include "c8.h"
 #include "iset.h"
-
-#ifdef DEBUG
-#include <iostream>
-#include <iomanip>
-#include "debug.h"
-#endif
+#include "clock.h"
+#include "gfx.h"
+#include "metrics.h"
+#include <string.h>
+#include <limits.h>
 
 extern void draw_buf(const byte* gfx_buf, const unsigned int size);
 
 // ----------------------------------------------------------------------------
-C8VM::C8VM() {
+C8VM::C8VM() : audio(NULL), exec_profile(NULL), trace(NULL),
+               latency(NULL), coverage(NULL), heat(NULL), traps(false),
+               unmetered(0), unmetered_frames(0) {
+    state.mode = mode_chip8;
+    memset(state.memory, 0x0, sizeof(state.memory));
     init();
+    set_quirks(profile_vip);
+    clear_breakpoints();
 }
 
+static const metric_id metric_instructions = metric_counter(
+        "c8vm_instructions_total",
+        "Guest instructions run, including skipped idle loop iterations");
+static const metric_id metric_frames = metric_counter(
+        "c8vm_frames_total", "Guest frames (1/60s) completed");
+// `do_cycle` instructions between metrics flushes
+static const long METRICS_BATCH = 1024;
+
 // ----------------------------------------------------------------------------
 void C8VM::do_cycle() {
-    if (state.delay_timer > 0)
-        --state.delay_timer;
-    if (state.sound_timer > 0) {
-#if DEBUG
-        std::cerr << "BEEP!" << std::endl;
-#endif
-        --state.sound_timer;
+    long start = state.cycles;
+    (this->*cycle_fn)();
+    state.faults &= ~fault_watch; // the heatmap has the hit
+    if (state.faults == fault_trap) {
+        // stopped short of a trap, as `run` would have
+        state.faults   = 0x0;
+        state.fault_ip = 0x0;
+        return;
     }
+    ++unmetered;
+    if (state.cycles / CYCLES_PER_FRAME != start / CYCLES_PER_FRAME)
+        ++unmetered_frames;
+    if (unmetered >= METRICS_BATCH)
+        flush_metrics();
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::do_frame() {
+    run(0, 1);
+}
+
+// ----------------------------------------------------------------------------
+stop_reason C8VM::run(long max_cycles, long max_frames) {
+    /* run until `max_cycles` instructions have executed or `max_frames`
+     * frame boundaries have been crossed (0 for no limit on either), or
+     * until something the host has to handle: a fault, a breakpoint, the
+     * guest blocking in FX0A (reported at the end of the frame), or the
+     * vm being switched off.
+     */
+    long start = state.cycles;
+    stop_reason r = num_breakpoints > 0
+        ? (this->*run_bp_fn)(max_cycles, max_frames)
+        : (this->*run_fn)(max_cycles, max_frames);
+    unmetered        += r.cycles;
+    unmetered_frames += state.cycles / CYCLES_PER_FRAME -
+                        start / CYCLES_PER_FRAME;
+    flush_metrics();
+    return r;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::flush_metrics() {
+    /* one update per counter for everything run since the last flush,
+     * rather than one per instruction, frame or draw
+     */
+    metric_add(metric_instructions, unmetered);
+    metric_add(metric_frames, unmetered_frames);
+    iset::flush_metrics();
+    unmetered = unmetered_frames = 0;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_quirks(quirk_profile profile) {
+    /* switch to the interpreter core instantiated for `profile`, from the
+     * next instruction on. `set_mode` picks the mode's usual profile, so
+     * call this after it to override that for a ROM.
+     */
+    state.quirks = profile;
+    switch (profile) {
+        case profile_schip:
+            bind_core<quirks_schip>();
+            break;
+        case profile_modern:
+            bind_core<quirks_modern>();
+            break;
+        default:
+            state.quirks = profile_vip;
+            bind_core<quirks_vip>();
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_profile(vm_profile* profile) {
+    /* count executed instructions into `profile` (see profile.h), or stop
+     * counting with NULL. Clear it first: its interval picks between the
+     * counting and the sampling core.
+     */
+    exec_profile = profile;
+    set_quirks((quirk_profile) state.quirks);
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_trace(trace_ring* ring) {
+    /* record every instruction executed into `ring` (see trace.h), or stop
+     * with NULL
+     */
+    trace = ring;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_latency(input_latency* tracker) {
+    /* follow each key event through to the screen with `tracker` (see
+     * latency.h), or stop with NULL. The host reports frames it shows with
+     * `presented`.
+     */
+    latency = tracker;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_coverage(coverage_map* map) {
+    /* count the guest's pc to pc edges into `map` (see coverage.h), or stop
+     * with NULL
+     */
+    coverage = map;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_heatmap(mem_heatmap* map) {
+    /* count memory accesses into `map` (see heatmap.h), stopping on its
+     * watchpoints, or stop with NULL
+     */
+    heat = map;
+    set_quirks((quirk_profile) state.quirks);
+}
+
+// ----------------------------------------------------------------------------
+template <class Q>
+void C8VM::bind_core() {
+    if (!heat)
+        bind_profile<Q, heat_off>();
+    else
+        bind_profile<Q, heat_on>();
+}
+
+// ----------------------------------------------------------------------------
+template <class Q, class H>
+void C8VM::bind_profile() {
+    if (!exec_profile)
+        bind_policy<Q, profile_off, H>();
+    else if (exec_profile->interval > 1)
+        bind_policy<Q, profile_sampled, H>();
+    else
+        bind_policy<Q, profile_every, H>();
+}
+
+// ----------------------------------------------------------------------------
+template <class Q, class P, class H>
+void C8VM::bind_policy() {
+    cycle_fn  = &C8VM::cycle<Q, P, H>;
+    run_fn    = &C8VM::slice<Q, false, P, H>;
+    run_bp_fn = &C8VM::slice<Q, true, P, H>;
+}
+
+// ----------------------------------------------------------------------------
+quirk_profile C8VM::get_quirks() {
+    return (quirk_profile) state.quirks;
+}
+
+// ----------------------------------------------------------------------------
+template <class Q, class P, class H>
+void C8VM::cycle() {
+    // input lands, and the timers count down (at 60Hz), only at the start
+    // of a frame; and only once, if a trap stopped that frame's first
+    // instruction
+    if (state.cycles % CYCLES_PER_FRAME == 0 && state.cycles != trapped_at) {
+        apply_input();
+        tick_timers();
+    }
+    if (state.waiting_key) {
+        // blocked in FX0A: nothing to fetch, just check for a key
+        iset::wait_key_press_store(&state);
+        if (latency)
+            latency->executed(&state);
+        state.cycles++;
+        return;
+    }
+    word pc = state.ip, index = state.index;
     fetch_opcode();
+    P::count(exec_profile, &state, pc);
     byte first  = ((state.curr_opcode & 0xF000) >> 12),
          second = ((state.curr_opcode & 0x0F00) >> 8),
          third  = ((state.curr_opcode & 0x00F0) >> 4),
@@ -36,6 +210,22 @@ void C8VM::do_cycle() {
                 iset::clear_screen(&state);
             else if (third == 0xE && fourth == 0xE)
                 iset::ret_routine(&state);
+            else if (state.mode == mode_chip8 || second != 0x0)
+                iset::call_prog(&state);
+            else if (third == 0xC)
+                iset::scroll_down(&state);
+            else if (third == 0xD && state.mode == mode_xochip)
+                iset::scroll_up(&state);
+            else if (third == 0xF && fourth == 0xB)
+                iset::scroll_right(&state);
+            else if (third == 0xF && fourth == 0xC)
+                iset::scroll_left(&state);
+            else if (third == 0xF && fourth == 0xD)
+                iset::halt(&state);
+            else if (third == 0xF && fourth == 0xE)
+                iset::set_lores(&state);
+            else if (third == 0xF && fourth == 0xF)
+                iset::set_hires(&state);
             else
                 iset::call_prog(&state);
             break;
@@ -52,7 +242,12 @@ void C8VM::do_cycle() {
             iset::skip_if_not_equal(&state);
             break;
         case 0x5:
-            iset::skip_if_equal_regs(&state);
+            if (state.mode == mode_xochip && fourth == 0x2)
+                iset::save_regs_range(&state);
+            else if (state.mode == mode_xochip && fourth == 0x3)
+                iset::load_regs_range(&state);
+            else
+                iset::skip_if_equal_regs(&state);
             break;
         case 0x6:
             iset::set_reg(&state);
@@ -81,13 +276,16 @@ void C8VM::do_cycle() {
                     iset::set_regx_sub_regy(&state);
                     break;
                 case 0x6:
-                    iset::set_regx_rshift(&state);
+                    iset::set_regx_rshift<Q>(&state);
                     break;
                 case 0x7:
                     iset::set_regx_regy_sub_regx(&state);
                     break;
                 case 0xE:
-                    iset::set_regx_lshift(&state);
+                    iset::set_regx_lshift<Q>(&state);
+                    break;
+                default:
+                    iset::invalid_opcode(&state);
                     break;
             }
             break;
@@ -98,19 +296,29 @@ void C8VM::do_cycle() {
             iset::set_index(&state);
             break;
         case 0xB:
-            iset::jump_offset(&state);
+            iset::jump_offset<Q>(&state);
             break;
         case 0xC:
             iset::set_reg_rand_masked(&state);
             break;
         case 0xD:
-            iset::draw_sprite(&state);
+            iset::draw_sprite<Q>(&state);
             break;
         case 0xE:
             if (third == 0x9 && fourth == 0xE)
                 iset::skip_if_key_pressed(&state);
             else if (third == 0xA && fourth == 0x1)
                 iset::skip_if_key_not_pressed(&state);
+            else if (state.curr_opcode == TRAP_OPCODE && traps) {
+                // a debugger's breakpoint: stop with the instruction
+                // not run, and not counted
+                state.ip       = pc;
+                state.faults  |= fault_trap;
+                state.fault_ip = pc;
+                trapped_at     = state.cycles;
+                return;
+            } else
+                iset::invalid_opcode(&state);
             break;
         case 0xF:
             switch (third) {
@@ -119,6 +327,16 @@ void C8VM::do_cycle() {
                         iset::set_reg_delay(&state);
                     else if (fourth == 0xA)
                         iset::wait_key_press_store(&state);
+                    else if (state.mode != mode_xochip)
+                        iset::invalid_opcode(&state);
+                    else if (fourth == 0x0 && second == 0x0)
+                        iset::set_index_long(&state);
+                    else if (fourth == 0x1)
+                        iset::select_planes(&state);
+                    else if (fourth == 0x2 && second == 0x0)
+                        iset::load_audio_pattern(&state);
+                    else
+                        iset::invalid_opcode(&state);
                     break;
                 case 0x1:
                     if (fourth == 0x5)
@@ -127,30 +345,253 @@ void C8VM::do_cycle() {
                         iset::set_sound_regx(&state);
                     else if (fourth == 0xE)
                         iset::add_regx_to_index(&state);
+                    else
+                        iset::invalid_opcode(&state);
                     break;
                 case 0x2:
                     iset::get_sprite_regx(&state);
                     break;
                 case 0x3:
-                    iset::split_decimal(&state);
+                    if (fourth == 0x0 && state.mode != mode_chip8)
+                        iset::get_big_sprite_regx(&state);
+                    else if (fourth == 0xA && state.mode == mode_xochip)
+                        iset::set_pitch(&state);
+                    else
+                        iset::split_decimal(&state);
                     break;
                 case 0x5:
-                    iset::dump_regs_to_regx(&state);
+                    iset::dump_regs_to_regx<Q>(&state);
                     break;
                 case 0x6:
-                    iset::slurp_regs_to_regx(&state);
+                    iset::slurp_regs_to_regx<Q>(&state);
+                    break;
+                case 0x7:
+                    if (state.mode != mode_chip8)
+                        iset::save_flags(&state);
+                    else
+                        iset::invalid_opcode(&state);
+                    break;
+                case 0x8:
+                    if (state.mode != mode_chip8)
+                        iset::load_flags(&state);
+                    else
+                        iset::invalid_opcode(&state);
                     break;
                 default:
-                    break; //TODO: failure here
+                    iset::invalid_opcode(&state);
+                    break;
             }
             break;
-        default:
-            break; // TODO: Failure here
     }
+    if (trace)
+        trace->push(&state, pc);
+    if (latency)
+        latency->executed(&state);
+    if (coverage)
+        coverage_edge(coverage, pc);
     state.cycles++;
 
-    if (state.ip > MEM_SIZE - 2)
-        state.on = false;
+    iset::fault(&state, state.ip > state.mem_mask - 1, fault_ip_overrun, pc);
+    H::access(heat, &state, pc, index);
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::tick_timers() {
+    // the tone sounds for every frame that starts with the sound timer set
+    if (audio)
+        audio->frame(state.sound_timer > 0);
+    if (state.delay_timer > 0)
+        --state.delay_timer;
+    if (state.sound_timer > 0)
+        --state.sound_timer;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::apply_input() {
+    /* drain every queued key event that is due by this frame, in the order
+     * it was posted
+     */
+    long frame = state.cycles / CYCLES_PER_FRAME;
+    key_event e;
+    if (latency)
+        latency->frame(frame);
+    while (keyq.peek(e) && e.frame <= frame) {
+        keyq.pop(e);
+        state.key[e.key & 0xF] = e.down;
+        qword now = monotonic_ns(), ns = now - e.stamp;
+        ++key_stats.applied;
+        key_stats.total_ns += ns;
+        if (ns > key_stats.max_ns)
+            key_stats.max_ns = ns;
+        if (latency)
+            latency->applied(e, frame, now);
+    }
+}
+
+// ----------------------------------------------------------------------------
+template <class Q, bool breakpoints, class P, class H>
+stop_reason C8VM::slice(long max_cycles, long max_frames) {
+    /* `run`, for one quirk profile, with or without breakpoint checks,
+     * counting instructions with profiling policy P and memory accesses
+     * with heatmap policy H.
+     *
+     * Keys and timers cannot change part way through a frame, so once the
+     * guest is spinning in a side-effect free polling loop (or is blocked in
+     * FX0A) every remaining iteration of it this frame is identical, and we
+     * skip them (except when breakpoints are set, as a skipped iteration
+     * could pass over one, or when profiling or counting accesses, so every
+     * one is counted).
+     *
+     * Faults are sticky bits that the handlers set without branching; the
+     * loop tests them together with `on` and the budget, once per
+     * instruction. A debugger's traps (see `set_traps`) ride on the same
+     * test, so they stop this loop without it checking any addresses.
+     */
+    stop_reason reason;
+    long start = state.cycles,
+         cycle_end = max_cycles > 0 ? start + max_cycles : LONG_MAX,
+         frames_left = max_frames > 0 ? max_frames : LONG_MAX;
+    bool first = true; // never stop on the breakpoint we're resuming from
+    reason.fault = 0;
+    reason.addr  = 0;
+    while (state.on && !state.faults) {
+        idle.arrived = -1; // keys may have changed since the last snapshot
+        idle.rejected_head = 1;
+        idle.rejected_tail = 0;
+        long frame_end = state.cycles + CYCLES_PER_FRAME -
+                         state.cycles % CYCLES_PER_FRAME,
+             end = frame_end < cycle_end ? frame_end : cycle_end;
+        do {
+            word pc = state.ip;
+            if (breakpoints && !first && !state.waiting_key &&
+                is_breakpoint(pc)) {
+                reason.kind   = stop_breakpoint;
+                reason.addr   = pc;
+                reason.cycles = state.cycles - start;
+                return reason;
+            }
+            first = false;
+            cycle<Q, P, H>();
+            if (state.waiting_key) {
+                state.cycles = end; // no key down, and none can arrive
+            } else if (!breakpoints && !P::enabled && !H::enabled) {
+                if (pc < idle.head || pc > idle.tail)
+                    idle.armed = false; // left the loop we were watching
+                if (state.ip <= pc &&
+                    (state.curr_opcode & 0xF000) == 0x1000)
+                    skip_idle(pc, end);
+            }
+        } while (state.on & !state.faults & (state.cycles < end));
+
+        if (state.faults || !state.on)
+            break;
+        if (state.cycles == frame_end) {
+            if (state.waiting_key) {
+                reason.kind = stop_waiting_key;
+                break;
+            }
+            if (--frames_left == 0) {
+                reason.kind = stop_frame;
+                break;
+            }
+        }
+        if (state.cycles >= cycle_end) {
+            reason.kind = stop_budget;
+            break;
+        }
+    }
+    bool watched = state.faults & fault_watch;
+    state.faults &= ~fault_watch; // a stop, not a fault
+    if (state.faults == fault_trap) {
+        state.faults   = 0x0;
+        state.fault_ip = 0x0;
+        reason.kind    = stop_breakpoint;
+        reason.addr    = state.ip;
+    } else if (state.faults) {
+        reason.kind  = stop_fault;
+        reason.fault = state.faults;
+        reason.addr  = state.fault_ip;
+    } else if (watched) {
+        reason.kind = stop_watchpoint;
+        reason.addr = heat->hit_addr;
+    } else if (!state.on) {
+        reason.kind = stop_halted;
+    }
+    reason.cycles = state.cycles - start;
+    return reason;
+}
+
+// ----------------------------------------------------------------------------
+bool C8VM::is_idle_block(word head, word tail) {
+    /* true if every instruction in [head, tail] only reads memory, the
+     * timers and the keys, and only writes registers or the index; i.e. one
+     * iteration can be fully described by the registers, the index and the
+     * timers. `tail` is the backwards jump that closes the loop.
+     */
+    if ((unsigned int) (tail - head) > 2 * (IDLE_MAX_BLOCK - 1))
+        return false;
+    for (word addr = head; addr < tail; addr += 2) {
+        c8opcode op = state.memory[addr] << 8 | state.memory[addr + 1];
+        if (op == TRAP_OPCODE)
+            return false; // skipping iterations would pass over it
+        switch (op & 0xF000) {
+            case 0x3000: case 0x4000: case 0x6000: case 0x7000:
+            case 0x8000: case 0x9000: case 0xA000: case 0xE000:
+                break;
+            case 0x5000:
+                if ((op & 0x000F) != 0x0)
+                    return false; // XO-CHIP 5XY2 writes memory
+                break;
+            case 0xF000:
+                switch (op & 0x00FF) {
+                    case 0x07: case 0x1E: case 0x29: case 0x65:
+                        break;
+                    default:
+                        return false;
+                }
+                break;
+            default:
+                return false; // jumps, calls, draws, rand, memory writes
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::skip_idle(word pc, long frame_end) {
+    /* called after the 1NNN at `pc` jumped backwards. If the guest is
+     * provably repeating itself, fast forward to the end of the frame in
+     * whole iterations, leaving exactly the state that running the loop
+     * would have.
+     */
+    long remaining = frame_end - state.cycles;
+    word head = state.ip;
+    if (!idle.armed || idle.head != head || idle.tail != pc) {
+        if (head == idle.rejected_head && pc == idle.rejected_tail)
+            return;
+        if (!is_idle_block(head, pc)) {
+            // don't rescan a busy loop on every iteration of it
+            idle.rejected_head = head;
+            idle.rejected_tail = pc;
+            return;
+        }
+        idle.head  = head;
+        idle.tail  = pc;
+        idle.armed = true;
+    } else if (idle.arrived >= 0 &&
+               memcmp(idle.registers, state.registers, NUM_REGISTERS) == 0 &&
+               idle.index       == state.index &&
+               idle.delay_timer == state.delay_timer &&
+               idle.sound_timer == state.sound_timer) {
+        // back at the head in exactly the state we left it in last time
+        long len = state.cycles - idle.arrived;
+        state.cycles += (remaining / len) * len;
+    }
+    memcpy(idle.registers, state.registers, NUM_REGISTERS);
+    idle.index       = state.index;
+    idle.delay_timer = state.delay_timer;
+    idle.sound_timer = state.sound_timer;
+    idle.arrived     = state.cycles;
 }
 
 // ----------------------------------------------------------------------------
@@ -158,14 +599,9 @@ void C8VM::fetch_opcode() {
     /* fetch the next instruction, increasing the instruction pointer
      * appropriately, and store it in `state.curr_opcode`
      */
-    c8opcode opcode = state.memory[state.ip++] << 8;
-    opcode         |= state.memory[state.ip++];
+    c8opcode opcode = state.memory[state.ip++ & state.mem_mask] << 8;
+    opcode         |= state.memory[state.ip++ & state.mem_mask];
     state.curr_opcode = opcode;
-#ifdef DEBUG
-    std::cerr << "read opcode: "; print_hex(std::cerr, opcode);
-    std::cerr << "  [ip: "; print_hex(std::cerr, state.ip);
-    std::cerr << "]" << std::endl;
-#endif
 }
 
 // ----------------------------------------------------------------------------
@@ -176,18 +612,45 @@ void C8VM::init() {
     state.curr_opcode = 0x0;
     state.gfx_stale   = true;
     state.on          = false;
-    for (unsigned int i = 0; i < GFX_SIZE; ++i)
-        state.gfx_buffer[i] = 0x0;
+    state.waiting_key = false;
+    state.wait_reg    = 0x0;
+    state.delay_timer = 0x0;
+    state.sound_timer = 0x0;
+    state.frequency   = FREQUENCY;
+    state.cycles      = 0;
+    state.rng         = RNG_SEED;
+    state.faults      = 0x0;
+    state.fault_ip    = 0x0;
+    trapped_at        = -1;
+    state.mem_mask    = (state.mode == mode_xochip ? XO_MEM_SIZE : MEM_SIZE) - 1;
+    state.hires       = false;
+    state.planes      = 0x1;
+    state.pitch       = 0x0;
+    for (unsigned int i = 0; i < sizeof(state.flags); ++i)
+        state.flags[i] = 0x0;
+    for (unsigned int i = 0; i < sizeof(state.pattern); ++i)
+        state.pattern[i] = 0x0;
+    for (unsigned int i = 0; i < KEY_SIZE; ++i)
+        state.key[i] = 0x0;
+    idle.armed        = false;
+    keyq.clear();
+    key_stats.applied  = 0;
+    key_stats.total_ns = 0;
+    key_stats.max_ns   = 0;
+    idle.head         = 1; // an empty range, so no pc is ever inside it
+    idle.tail         = 0;
+    for (unsigned int p = 0; p < GFX_PLANES; ++p)
+        gfx_clear(state.gfx[p]);
     for (unsigned int i = 0; i < STACK_SIZE; ++i)
         state.stack[i] = 0x0;
     for (unsigned int i = 0; i < NUM_REGISTERS; ++i)
         state.registers[i] = 0x0;
-    for (unsigned int i = 0; i < MEM_SIZE; ++i)
-        state.memory[i] = 0x0;
+    // only the memory the machine can address; nothing above it is ever
+    // written outside XO-CHIP (see set_mode), so it is still zero
+    memset(state.memory, 0x0, state.mem_mask + 1);
 
     // load fontset in to memory
-    byte  font_offset = 0xA;
-    byte* font_pos    = &state.memory[0x0 + font_offset];
+    byte* font_pos    = &state.memory[FONT_START];
 
     *font_pos   = 0xF0; // ****
     *++font_pos = 0x90; // *  *
@@ -284,21 +747,91 @@ void C8VM::init() {
     *++font_pos = 0xF0; // ****
     *++font_pos = 0x80; // *
     *++font_pos = 0x80; // *
+
+    // SCHIP/XO-CHIP 8x10 font (FX30), one character per line
+    static const byte big_font[16 * 10] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+    };
+    memcpy(&state.memory[BIG_FONT_START], big_font, sizeof(big_font));
 }
 
 // ----------------------------------------------------------------------------
-void C8VM::load(const std::string& bin) {
-    if (bin.size() == 0) {
-#ifdef DEBUG
-        std::cerr << "load called with empty image" << std::endl;
-#endif
-        return;
+bool C8VM::load(const byte* rom, unsigned long len) {
+    /* copy a ROM image in at PROG_START. The image is not retained, so it
+     * can point straight into a mapped file. Returns false, leaving memory
+     * untouched, if the image is empty or won't fit in the machine's
+     * memory (set the mode first).
+     */
+    if (len == 0 || len > get_max_rom_size())
+        return false;
+    memcpy(&state.memory[PROG_START], rom, len);
+    idle.armed = false; // the code under any loop we were watching changed
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool C8VM::load(const std::string& bin) {
+    return load((const byte*) bin.data(), bin.size());
+}
+
+// ----------------------------------------------------------------------------
+unsigned long C8VM::get_max_rom_size() {
+    return (unsigned long) state.mem_mask + 1 - PROG_START;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_mode(machine_mode mode) {
+    /* switch machine variant, and to its usual quirk profile. This resets
+     * the vm, so call it before `load`.
+     */
+    if (state.mode == mode_xochip && mode != mode_xochip)
+        memset(state.memory, 0x0, sizeof(state.memory));
+    state.mode = mode;
+    init();
+    switch (mode) {
+        case mode_schip:  set_quirks(profile_schip);  break;
+        case mode_xochip: set_quirks(profile_modern); break;
+        default:          set_quirks(profile_vip);    break;
     }
-    for (unsigned int i = 0; i < bin.size(); ++i)
-        state.memory[PROG_START + i] = bin.at(i);
-#ifdef DEBUG
-    std::cerr << "loaded image (" << bin.size() << " bytes)" << std::endl;
-#endif
+}
+
+// ----------------------------------------------------------------------------
+machine_mode C8VM::get_mode() {
+    return (machine_mode) state.mode;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_state(const vmstate* snapshot) {
+    /* restore a state previously copied out of `get_state` (by this build),
+     * including its mode and quirk profile. Pending key events are kept,
+     * breakpoints are left as they are. Only the snapshot's `state_size`
+     * bytes are read, so it may be a copy of just those.
+     */
+    word old_mask = state.mem_mask;
+    memmove(&state, snapshot, state_size(snapshot));
+    if (old_mask > state.mem_mask) // keep the memory past the machine's zero
+        memset(&state.memory[state.mem_mask + 1], 0x0,
+               old_mask - state.mem_mask);
+    set_quirks((quirk_profile) state.quirks);
+    trapped_at = -1;
+    idle.armed = false;
+    idle.head  = 1;
+    idle.tail  = 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -321,6 +854,7 @@ void C8VM::pause() {
 
 // ----------------------------------------------------------------------------
 void C8VM::reset() {
+    init();
 }
 
 // ----------------------------------------------------------------------------
@@ -328,16 +862,100 @@ byte* C8VM::get_keys() {
     return state.key;
 }
 
+// ----------------------------------------------------------------------------
+bool C8VM::post_key(byte key, bool down) {
+    /* queue a key event from the host; it is applied at the start of the
+     * next frame. Safe to call from one thread other than the vm's. Returns
+     * false (dropping the event) if the queue is full.
+     */
+    return post_key_at(INPUT_NEXT_FRAME, key, down);
+}
+
+// ----------------------------------------------------------------------------
+bool C8VM::post_key_at(long frame, byte key, bool down) {
+    /* as `post_key`, but applied at the start of `frame` (or the next frame
+     * if that has passed), for scripted or replayed input
+     */
+    key_event e;
+    e.stamp = monotonic_ns();
+    e.frame = frame;
+    e.key   = key;
+    e.down  = down;
+    return keyq.push(e);
+}
+
+// ----------------------------------------------------------------------------
+input_stats C8VM::get_input_stats() {
+    return key_stats;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::clear_input() {
+    /* drop every queued key event, e.g. before replaying input from a
+     * restored state. Only while no other thread is posting.
+     */
+    keyq.clear();
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_audio(tone_generator* gen) {
+    /* `gen` is fed one frame of samples per timer tick; NULL disables sound
+     */
+    audio = gen;
+}
+
 // ----------------------------------------------------------------------------
 
 bool C8VM::is_on() {
-    return state.on;
+    return state.on && !state.faults;
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::set_breakpoint(word addr) {
+    if (!is_breakpoint(addr))
+        ++num_breakpoints;
+    breakpoints[addr / 64] |= 1ULL << (addr % 64);
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::clear_breakpoint(word addr) {
+    if (is_breakpoint(addr))
+        --num_breakpoints;
+    breakpoints[addr / 64] &= ~(1ULL << (addr % 64));
+}
+
+// ----------------------------------------------------------------------------
+void C8VM::clear_breakpoints() {
+    memset(breakpoints, 0, sizeof(breakpoints));
+    num_breakpoints = 0;
 }
 
 // ----------------------------------------------------------------------------
+bool C8VM::is_breakpoint(word addr) {
+    return (breakpoints[addr / 64] >> (addr % 64)) & 1;
+}
 
-byte* C8VM::get_gfx_buf() {
-    return state.gfx_buffer;
+// ----------------------------------------------------------------------------
+void C8VM::set_traps(bool on) {
+    /* with traps on, TRAP_OPCODE written into memory stops `run` with
+     * stop_breakpoint, before the trap and without counting it, instead of
+     * faulting. Unlike `set_breakpoint` this costs the running guest
+     * nothing, as only the invalid opcode path looks for it; but the trap
+     * is in guest memory, for the guest to read too, and resuming from one
+     * stops again at once: the debugger puts the instruction back to step
+     * it (see gdbstub.h).
+     */
+    traps = on;
+}
+
+// ----------------------------------------------------------------------------
+
+bool C8VM::is_blocked() {
+    /* true when nothing will change until the next key event: the guest is
+     * waiting in FX0A and neither timer is still counting down
+     */
+    return state.waiting_key && state.delay_timer == 0 &&
+        state.sound_timer == 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -351,3 +969,28 @@ void C8VM::set_gfx_stale(bool v) {
 bool C8VM::get_gfx_stale() {
     return state.gfx_stale;
 }
+
+// ----------------------------------------------------------------------------
+void C8VM::presented() {
+    /* the host has just put the framebuffer on screen (or handed it on, when
+     * headless), for input latency accounting
+     */
+    if (latency)
+        latency->presented();
+}
+
+// ----------------------------------------------------------------------------
+
+const vmstate* C8VM::get_state() {
+    return &state;
+}
+
+// ----------------------------------------------------------------------------
+vmstate* C8VM::edit_state() {
+    /* the state, for a debugger to change in place between runs: registers,
+     * memory (its traps), timers. Unlike `set_state` nothing else is reset,
+     * so a frame already started by a trap isn't started again.
+     */
+    idle.armed = false; // the loop being watched may have changed
+    return &state;
+}
@@ -2,10 +2,68 @@
 #define __C8_H__
 
 #include "def.h"
+#include "input.h"
+#include "audio.h"
+#include "profile.h"
+#include "trace.h"
+#include "latency.h"
+#include "coverage.h"
+#include "heatmap.h"
 #include <string>
 
+// longest polling loop (in instructions) that idle detection will consider
+const unsigned int IDLE_MAX_BLOCK = 16;
+
+typedef struct idle_loop {
+    bool armed;
+    word head, tail;     // loop body, tail is the backwards 1NNN
+    word rejected_head, rejected_tail; // last loop found not to be idle
+    long arrived;        // cycle count when we last jumped back to head
+    c8register registers[16];
+    word index;
+    byte delay_timer, sound_timer;
+} idle_loop;
+
+// why `C8VM::run` returned
+enum stop_kind {
+    stop_budget,        // ran `max_cycles` instructions
+    stop_frame,         // completed `max_frames` frames
+    stop_waiting_key,   // completed a frame blocked in FX0A
+    stop_fault,         // see `fault` and `addr`
+    stop_breakpoint,    // about to execute the instruction at `addr`
+    stop_halted,        // the vm is off (00FD, `stop`, or never started)
+    stop_watchpoint,    // the instruction just run hit a watch on `addr`
+};
+
+typedef struct stop_reason {
+    stop_kind kind;
+    byte fault;         // fault_code bits, for stop_fault
+    word addr;          // faulting instruction, breakpoint or watch hit
+    long cycles;        // instructions run by this call
+} stop_reason;
+
 class C8VM {
     vmstate state;
+    idle_loop idle;
+    input_queue keyq;
+    input_stats key_stats;
+    tone_generator* audio;
+    vm_profile* exec_profile;
+    trace_ring* trace;
+    input_latency* latency;
+    coverage_map* coverage;
+    mem_heatmap* heat;
+    // the core instantiated for the current quirk profile and profiling
+    void (C8VM::*cycle_fn)();
+    stop_reason (C8VM::*run_fn)(long, long);
+    stop_reason (C8VM::*run_bp_fn)(long, long);
+    qword breakpoints[XO_MEM_SIZE / 64];
+    unsigned int num_breakpoints;
+    bool traps;           // TRAP_OPCODE stops rather than faults
+    long trapped_at;      // cycle whose frame start ran before a trap
+    // instructions and frames run but not yet added to the process
+    // metrics; flushed by `run`, and by `do_cycle` every METRICS_BATCH
+    long unmetered, unmetered_frames;
 
     public:
     C8VM();
@@ -15,17 +73,55 @@ class C8VM {
     void stop();
     void pause();
     void reset();
-    void load(const std::string&);
+    bool load(const byte* rom, unsigned long len);
+    bool load(const std::string&);
+    unsigned long get_max_rom_size();
+    void set_mode(machine_mode mode);
+    machine_mode get_mode();
+    void set_quirks(quirk_profile profile);
+    quirk_profile get_quirks();
+    void set_profile(vm_profile* profile);
+    void set_trace(trace_ring* ring);
+    void set_latency(input_latency* tracker);
+    void set_coverage(coverage_map* map);
+    void set_heatmap(mem_heatmap* map);
     byte* get_keys();
+    bool post_key(byte key, bool down);
+    bool post_key_at(long frame, byte key, bool down);
+    input_stats get_input_stats();
+    void clear_input();
+    void set_audio(tone_generator* gen);
     void do_cycle();
+    void do_frame();
+    stop_reason run(long max_cycles, long max_frames);
+    void set_breakpoint(word addr);
+    void clear_breakpoint(word addr);
+    void clear_breakpoints();
+    bool is_breakpoint(word addr);
+    void set_traps(bool on);
     bool is_on();
-    byte* get_gfx_buf();
+    bool is_blocked();
     bool get_gfx_stale();
     void set_gfx_stale(bool);
+    void presented();
+    const vmstate* get_state();
+    void set_state(const vmstate* snapshot);
+    vmstate* edit_state();
 
     private:
+    template <class Q> void bind_core();
+    template <class Q, class H> void bind_profile();
+    template <class Q, class P, class H> void bind_policy();
+    template <class Q, class P, class H> void cycle();
+    template <class Q, bool breakpoints, class P, class H>
+    stop_reason slice(long max_cycles, long max_frames);
     void fetch_opcode();
+    void tick_timers();
+    void apply_input();
+    bool is_idle_block(word head, word tail);
+    void skip_idle(word pc, long frame_end);
     void init();
     void clean();
+    void flush_metrics();
 };
 #endif
@@ -0,0 +1,134 @@
+#include "c8api.h"
+#include "c8.h"
+#include "clock.h"
+#include "hash.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <dlfcn.h>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8vm_abi_bench: what crossing the C interface costs.
+ *
+ *     c8vm_abi_bench <libc8vm.so> <rom> [frames]
+ *
+ * Runs the ROM for the same number of frames three ways: linked in directly
+ * (one `run` per frame), through the shared library one frame per call, as
+ * a per-frame host loop would, and through it in a single batched call. The
+ * library is dlopen()ed so every call really goes through its exported
+ * entry points, as it would from ctypes or another language's FFI.
+ */
+
+typedef c8vm_handle* (*create_fn)(int, int);
+typedef void (*destroy_fn)(c8vm_handle*);
+typedef int (*load_fn)(c8vm_handle*, const uint8_t*, size_t);
+typedef int (*step_fn)(c8vm_handle*, int64_t, c8vm_stop*);
+typedef uint64_t (*hash_fn)(c8vm_handle*);
+
+typedef struct abi {
+    create_fn  create;
+    destroy_fn destroy;
+    load_fn    load;
+    step_fn    step_frames;
+    hash_fn    state_hash;
+} abi;
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8vm_abi_bench <libc8vm.so> <rom> [frames]" << endl;
+}
+
+// ----------------------------------------------------------------------------
+bool bind(void* lib, abi& fns) {
+    fns.create      = (create_fn)  dlsym(lib, "c8vm_create");
+    fns.destroy     = (destroy_fn) dlsym(lib, "c8vm_destroy");
+    fns.load        = (load_fn)    dlsym(lib, "c8vm_load");
+    fns.step_frames = (step_fn)    dlsym(lib, "c8vm_step_frames");
+    fns.state_hash  = (hash_fn)    dlsym(lib, "c8vm_state_hash");
+    return fns.create && fns.destroy && fns.load && fns.step_frames &&
+        fns.state_hash;
+}
+
+// ----------------------------------------------------------------------------
+void report(const char* name, qword ns, long frames, qword base_ns,
+            qword hash) {
+    cout << setw(18) << left << name << right << fixed << setprecision(1)
+        << setw(10) << (double) ns / frames << " ns/frame"
+        << setw(9) << (double) ns / base_ns * 100.0 - 100.0 << "%"
+        << "  state " << hex << setfill('0') << setw(16) << hash
+        << dec << setfill(' ') << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    long frames = argc > 3 ? atol(argv[3]) : 100000;
+    if (frames <= 0) {
+        print_usage();
+        return 1;
+    }
+    void* lib = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    abi fns;
+    if (!lib || !bind(lib, fns)) {
+        cerr << "could not load " << argv[1] << ": " << dlerror() << endl;
+        return 1;
+    }
+    rom_file rom;
+    if (!rom.open(argv[2])) {
+        cerr << "could not read " << argv[2] << endl;
+        return 1;
+    }
+    machine_mode mode = mode_for_rom(argv[2]);
+
+    // direct, one call per frame
+    C8VM vm;
+    vm.set_mode(mode);
+    if (!vm.load(rom.get_data(), rom.get_size())) {
+        cerr << argv[2] << ": not a loadable ROM" << endl;
+        return 1;
+    }
+    vm.start();
+    qword t0 = monotonic_ns();
+    for (long f = 0; f < frames; ++f)
+        vm.run(0, 1);
+    qword direct_ns = monotonic_ns() - t0;
+    qword direct_hash = hash_state(vm.get_state());
+
+    // through the library, one call per frame
+    c8vm_handle* h = fns.create(mode, C8VM_QUIRKS_DEFAULT);
+    fns.load(h, rom.get_data(), rom.get_size());
+    t0 = monotonic_ns();
+    for (long f = 0; f < frames; ++f)
+        fns.step_frames(h, 1, NULL);
+    qword per_frame_ns = monotonic_ns() - t0;
+    qword per_frame_hash = fns.state_hash(h);
+    fns.destroy(h);
+
+    // through the library, one call in all
+    h = fns.create(mode, C8VM_QUIRKS_DEFAULT);
+    fns.load(h, rom.get_data(), rom.get_size());
+    t0 = monotonic_ns();
+    fns.step_frames(h, frames, NULL);
+    qword batch_ns = monotonic_ns() - t0;
+    qword batch_hash = fns.state_hash(h);
+    fns.destroy(h);
+    dlclose(lib);
+
+    cout << frames << " frames of " << argv[2] << endl;
+    report("direct", direct_ns, frames, direct_ns, direct_hash);
+    report("abi, per frame", per_frame_ns, frames, direct_ns, per_frame_hash);
+    report("abi, batched", batch_ns, frames, direct_ns, batch_hash);
+    if (per_frame_hash != direct_hash || batch_hash != direct_hash) {
+        cerr << "state hashes differ" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,305 @@
+#include "c8api.h"
+#include "c8.h"
+#include "gfx.h"
+#include "hash.h"
+#include "heatmap.h"
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+
+/* The C interface is a thin shim over C8VM; see c8api.h. The handle keeps a
+ * copy of the ROM so that `c8vm_reset` can reload it, and the heatmap while
+ * it's on.
+ */
+struct c8vm_handle {
+    C8VM vm;
+    std::string rom;
+    mem_heatmap* heat;
+};
+
+// snapshot layout: this header, then the raw vmstate, `state_size` bytes of
+// it
+typedef struct snapshot_header {
+    dword magic;
+    dword version;
+    dword state_size;
+    dword reserved;
+} snapshot_header;
+
+const dword SNAPSHOT_MAGIC = 0x4e533843; // "C8SN"
+
+// ----------------------------------------------------------------------------
+static int step(c8vm_handle* h, long max_cycles, long max_frames,
+                c8vm_stop* out) {
+    /* `run` until the budget is used up or the host has to step in. A frame
+     * spent blocked in FX0A still counts against the budget, so unlike
+     * `run` this doesn't return early for it: a batch of frames asked for
+     * is a batch of frames run.
+     */
+    const vmstate* state = h->vm.get_state();
+    long start = state->cycles,
+         start_frame = start / CYCLES_PER_FRAME;
+    stop_reason r;
+    for (;;) {
+        long cycles = state->cycles - start,
+             frames = state->cycles / CYCLES_PER_FRAME - start_frame;
+        r = h->vm.run(max_cycles > 0 ? max_cycles - cycles : 0,
+                      max_frames > 0 ? max_frames - frames : 0);
+        if (r.kind != stop_waiting_key)
+            break;
+        cycles = state->cycles - start;
+        frames = state->cycles / CYCLES_PER_FRAME - start_frame;
+        if (max_frames > 0 && frames >= max_frames) {
+            r.kind = stop_frame;
+            break;
+        }
+        if (max_cycles > 0 && cycles >= max_cycles) {
+            r.kind = stop_budget;
+            break;
+        }
+    }
+    if (out) {
+        out->kind   = r.kind;
+        out->fault  = r.fault;
+        out->addr   = r.addr;
+        out->cycles = state->cycles - start;
+        out->frames = state->cycles / CYCLES_PER_FRAME - start_frame;
+    }
+    return r.kind;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t c8vm_api_version(void) {
+    return C8VM_API_VERSION;
+}
+
+// ----------------------------------------------------------------------------
+c8vm_handle* c8vm_create(int mode, int quirks) {
+    /* a new, empty vm; NULL for an unknown mode or profile
+     */
+    if (mode < C8VM_MODE_CHIP8 || mode > C8VM_MODE_XOCHIP ||
+        quirks < C8VM_QUIRKS_DEFAULT || quirks > C8VM_QUIRKS_MODERN)
+        return NULL;
+    // the input queue is cache line aligned, which plain new doesn't honour
+    void* mem;
+    if (posix_memalign(&mem, 64, sizeof(c8vm_handle)) != 0)
+        return NULL;
+    c8vm_handle* h = new (mem) c8vm_handle;
+    h->heat = NULL;
+    h->vm.set_mode((machine_mode) mode);
+    if (quirks != C8VM_QUIRKS_DEFAULT)
+        h->vm.set_quirks((quirk_profile) quirks);
+    return h;
+}
+
+// ----------------------------------------------------------------------------
+void c8vm_destroy(c8vm_handle* h) {
+    if (!h)
+        return;
+    delete h->heat;
+    h->~c8vm_handle();
+    free(h);
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_load(c8vm_handle* h, const uint8_t* rom, size_t len) {
+    /* reset the vm, load `rom` and switch it on
+     */
+    if (!h || !rom || len == 0 || len > h->vm.get_max_rom_size())
+        return -1;
+    h->rom.assign((const char*) rom, len);
+    c8vm_reset(h);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8vm_reset(c8vm_handle* h) {
+    /* back to power on, keeping the mode, quirks and ROM
+     */
+    if (!h)
+        return;
+    h->vm.reset();
+    if (!h->rom.empty()) {
+        h->vm.load(h->rom);
+        h->vm.start();
+    }
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_step_frames(c8vm_handle* h, int64_t n, c8vm_stop* stop) {
+    if (!h || n <= 0)
+        return -1;
+    return step(h, 0, n, stop);
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_step_cycles(c8vm_handle* h, int64_t n, c8vm_stop* stop) {
+    if (!h || n <= 0)
+        return -1;
+    return step(h, n, 0, stop);
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_key(c8vm_handle* h, uint8_t key, int down) {
+    /* press or release `key` from the start of the next frame; -1 if the
+     * input queue is full
+     */
+    if (!h || key >= KEY_SIZE)
+        return -1;
+    return h->vm.post_key(key, down != 0) ? 0 : -1;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_framebuffer(c8vm_handle* h, c8vm_framebuffer_info* info) {
+    if (!h || !info)
+        return -1;
+    const vmstate* state = h->vm.get_state();
+    info->planes      = (const uint64_t*) &state->gfx[0][0][0];
+    info->width       = gfx_width(state);
+    info->height      = gfx_height(state);
+    info->num_planes  = GFX_PLANES;
+    info->row_words   = GFX_ROW_WORDS;
+    info->plane_words = GFX_HIRES_H * GFX_ROW_WORDS;
+    info->stale       = state->gfx_stale;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8vm_framebuffer_ack(c8vm_handle* h) {
+    if (h) {
+        h->vm.set_gfx_stale(false);
+        h->vm.presented();
+    }
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_framebuffer_unpack(c8vm_handle* h, uint8_t* pixels, size_t len) {
+    /* one byte per visible pixel, row-major, bit n set for plane n; `len`
+     * must cover width * height
+     */
+    if (!h || !pixels)
+        return -1;
+    const vmstate* state = h->vm.get_state();
+    if (len < (size_t) gfx_width(state) * gfx_height(state))
+        return -1;
+    gfx_unpack(state, pixels);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+size_t c8vm_snapshot_size(c8vm_handle* h) {
+    // the state in use only, so about 4 KB outside XO-CHIP (see state_size)
+    return h ? sizeof(snapshot_header) + state_size(h->vm.get_state()) : 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_snapshot(c8vm_handle* h, void* buf, size_t len) {
+    /* copy the whole machine state (not pending key events) into `buf`.
+     * Snapshots are raw, so only restore them into the same build.
+     */
+    if (!h || !buf || len < c8vm_snapshot_size(h))
+        return -1;
+    const vmstate* state = h->vm.get_state();
+    snapshot_header hdr;
+    hdr.magic      = SNAPSHOT_MAGIC;
+    hdr.version    = C8VM_API_VERSION;
+    hdr.state_size = state_size(state);
+    hdr.reserved   = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy((byte*) buf + sizeof(hdr), state, hdr.state_size);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_restore(c8vm_handle* h, const void* buf, size_t len) {
+    /* -1, leaving the vm untouched, if `buf` isn't a snapshot from this
+     * build
+     */
+    snapshot_header hdr;
+    if (!h || !buf || len < sizeof(hdr))
+        return -1;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.magic != SNAPSHOT_MAGIC || hdr.version != C8VM_API_VERSION ||
+        hdr.state_size < offsetof(vmstate, memory) + MEM_SIZE ||
+        hdr.state_size > offsetof(vmstate, memory) + XO_MEM_SIZE ||
+        len - sizeof(hdr) < hdr.state_size)
+        return -1;
+    // the vmstate may be under-aligned in `buf`
+    vmstate* state = new vmstate;
+    memcpy(state, (const byte*) buf + sizeof(hdr), hdr.state_size);
+    word mem_mask = (state->mode == mode_xochip ? XO_MEM_SIZE : MEM_SIZE) - 1;
+    bool ok = state->mode <= mode_xochip && state->quirks <= profile_modern &&
+              state->wait_reg < NUM_REGISTERS && state->mem_mask == mem_mask &&
+              state_size(state) == hdr.state_size;
+    if (ok)
+        h->vm.set_state(state);
+    delete state;
+    return ok ? 0 : -1;
+}
+
+// ----------------------------------------------------------------------------
+uint64_t c8vm_state_hash(c8vm_handle* h) {
+    return h ? hash_state(h->vm.get_state()) : 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_breakpoint(c8vm_handle* h, uint32_t addr, int on) {
+    if (!h || addr >= XO_MEM_SIZE)
+        return -1;
+    if (on)
+        h->vm.set_breakpoint((word) addr);
+    else
+        h->vm.clear_breakpoint((word) addr);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_set_heatmap(c8vm_handle* h, int on) {
+    /* turning it on again keeps the counts and watches it has
+     */
+    if (!h)
+        return -1;
+    if (on && !h->heat) {
+        h->heat = new mem_heatmap;
+        heatmap_clear(h->heat);
+        h->vm.set_heatmap(h->heat);
+    } else if (!on && h->heat) {
+        h->vm.set_heatmap(NULL);
+        delete h->heat;
+        h->heat = NULL;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_heatmap(c8vm_handle* h, c8vm_heatmap_info* info) {
+    /* pointers into the heatmap, valid until it's turned off
+     */
+    if (!h || !h->heat || !info)
+        return -1;
+    info->reads  = (const uint64_t*) h->heat->reads;
+    info->writes = (const uint64_t*) h->heat->writes;
+    info->execs  = (const uint64_t*) h->heat->execs;
+    info->size   = h->vm.get_state()->mem_mask + 1;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int c8vm_watch(c8vm_handle* h, uint32_t lo, uint32_t hi, uint32_t access,
+               int32_t value) {
+    /* -1 for a bad range, kind or value, with the heatmap off, or once
+     * HEAT_MAX_WATCHES are set
+     */
+    if (!h || !h->heat || hi >= XO_MEM_SIZE || value < -1 || value > 0xFF ||
+        (access & ~(uint32_t) (access_read | access_write | access_exec)))
+        return -1;
+    heat_watch watch;
+    watch.lo     = (word) lo;
+    watch.hi     = (word) hi;
+    watch.access = (byte) access;
+    watch.value  = value;
+    watch.skip   = 0;
+    watch.hits   = 0;
+    return heatmap_watch(h->heat, watch) ? 0 : -1;
+}
@@ -0,0 +1,142 @@
+#ifndef __C8API_H__
+#define __C8API_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A plain C interface to the vm, built as libc8vm.so, for hosts that can't
+ * link C++ (Python ctypes, Rust, Go, ...). Everything goes through an
+ * opaque handle, and nothing here changes layout without a bump of
+ * C8VM_API_VERSION.
+ *
+ * Crossing the library boundary costs a call through the PLT per entry
+ * point, so the stepping calls run a whole batch of frames or instructions
+ * per call, and the framebuffer is read in place: `c8vm_framebuffer`
+ * returns pointers into the vm itself, which stay valid (and are updated
+ * by every step) until the handle is destroyed. The heatmap's counts are
+ * read the same way.
+ *
+ * Functions returning int return 0 on success and -1 on bad arguments,
+ * except the step calls, which return one of C8VM_STOP_* (or -1). A handle
+ * must only be used by one thread at a time.
+ */
+#define C8VM_API_VERSION 2
+
+#if defined(__GNUC__)
+#define C8VM_EXPORT __attribute__((visibility("default")))
+#else
+#define C8VM_EXPORT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct c8vm_handle c8vm_handle;
+
+// machine variants, as `machine_mode`
+enum {
+    C8VM_MODE_CHIP8  = 0,
+    C8VM_MODE_SCHIP  = 1,
+    C8VM_MODE_XOCHIP = 2,
+};
+
+// quirk profiles, as `quirk_profile`
+enum {
+    C8VM_QUIRKS_DEFAULT = -1,   // the mode's usual profile
+    C8VM_QUIRKS_VIP     = 0,
+    C8VM_QUIRKS_SCHIP   = 1,
+    C8VM_QUIRKS_MODERN  = 2,
+};
+
+// why a step call returned, as `stop_kind`
+enum {
+    C8VM_STOP_BUDGET      = 0,  // c8vm_step_cycles ran all `n`
+    C8VM_STOP_FRAME       = 1,  // c8vm_step_frames ran all `n`
+    C8VM_STOP_WAITING_KEY = 2,  // (only seen by C++ callers of `run`)
+    C8VM_STOP_FAULT       = 3,
+    C8VM_STOP_BREAKPOINT  = 4,
+    C8VM_STOP_HALTED      = 5,
+    C8VM_STOP_WATCHPOINT  = 6,  // the instruction just run hit a c8vm_watch
+};
+
+// kinds of memory access, as `heat_access`
+enum {
+    C8VM_ACCESS_READ  = 0x1,
+    C8VM_ACCESS_WRITE = 0x2,
+    C8VM_ACCESS_EXEC  = 0x4,
+};
+
+typedef struct c8vm_stop {
+    int32_t  kind;
+    uint32_t fault;     // fault_code bits, for C8VM_STOP_FAULT
+    uint32_t addr;      // faulting instruction, breakpoint or watch hit
+    int64_t  cycles;    // instructions run by the call
+    int64_t  frames;    // frame boundaries crossed by the call
+} c8vm_stop;
+
+/* The packed framebuffer (see gfx.h): `num_planes` planes of `height` rows
+ * of `row_words` 64-bit words, the leftmost pixel in the top bit of a row's
+ * first word, planes `plane_words` words apart. `width` and `height` give
+ * the visible area for the current resolution.
+ */
+typedef struct c8vm_framebuffer_info {
+    const uint64_t* planes;
+    uint32_t width, height;
+    uint32_t num_planes, row_words, plane_words;
+    int32_t  stale;     // drawn to since the last c8vm_framebuffer_ack
+} c8vm_framebuffer_info;
+
+// per address access counts (see heatmap.h), `size` of each
+typedef struct c8vm_heatmap_info {
+    const uint64_t* reads;
+    const uint64_t* writes;
+    const uint64_t* execs;
+    uint32_t size;
+} c8vm_heatmap_info;
+
+C8VM_EXPORT uint32_t c8vm_api_version(void);
+
+C8VM_EXPORT c8vm_handle* c8vm_create(int mode, int quirks);
+C8VM_EXPORT void c8vm_destroy(c8vm_handle* vm);
+C8VM_EXPORT int  c8vm_load(c8vm_handle* vm, const uint8_t* rom, size_t len);
+C8VM_EXPORT void c8vm_reset(c8vm_handle* vm);
+
+C8VM_EXPORT int c8vm_step_frames(c8vm_handle* vm, int64_t n,
+                                 c8vm_stop* stop);
+C8VM_EXPORT int c8vm_step_cycles(c8vm_handle* vm, int64_t n,
+                                 c8vm_stop* stop);
+
+C8VM_EXPORT int c8vm_key(c8vm_handle* vm, uint8_t key, int down);
+
+C8VM_EXPORT int c8vm_framebuffer(c8vm_handle* vm,
+                                 c8vm_framebuffer_info* info);
+C8VM_EXPORT void c8vm_framebuffer_ack(c8vm_handle* vm);
+C8VM_EXPORT int c8vm_framebuffer_unpack(c8vm_handle* vm, uint8_t* pixels,
+                                        size_t len);
+
+// the size of a snapshot of `vm`, which depends on its mode
+C8VM_EXPORT size_t c8vm_snapshot_size(c8vm_handle* vm);
+C8VM_EXPORT int c8vm_snapshot(c8vm_handle* vm, void* buf, size_t len);
+C8VM_EXPORT int c8vm_restore(c8vm_handle* vm, const void* buf, size_t len);
+
+C8VM_EXPORT uint64_t c8vm_state_hash(c8vm_handle* vm);
+
+// stop before the instruction at `addr` (C8VM_STOP_BREAKPOINT), or not
+C8VM_EXPORT int c8vm_breakpoint(c8vm_handle* vm, uint32_t addr, int on);
+
+/* Counting memory accesses slows every instruction down, so it is off until
+ * turned on; turning it off drops the counts and the watches.
+ */
+C8VM_EXPORT int c8vm_set_heatmap(c8vm_handle* vm, int on);
+C8VM_EXPORT int c8vm_heatmap(c8vm_handle* vm, c8vm_heatmap_info* info);
+// stop after an access of a C8VM_ACCESS_* kind in lo-hi (inclusive) that
+// leaves `value` there, or any value for -1; needs the heatmap on
+C8VM_EXPORT int c8vm_watch(c8vm_handle* vm, uint32_t lo, uint32_t hi,
+                           uint32_t access, int32_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,650 @@
+#include "c8.h"
+#include "iset.h"
+#include "gfx.h"
+#include "clock.h"
+#include "rom.h"
+#include "romgen.h"
+#include "memscan.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "string.h"
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8vm_bench: interpreter benchmarks.
+ *
+ *     c8vm_bench [-f filter] [-r roms] [-n cycles] [-i ms] [-o out.json]
+ *                [-b baseline.json] [-t percent]
+ *
+ * Micro-benchmarks time a single piece of the interpreter in a tight loop:
+ *
+ *     handler/<name>    each iset:: handler, called directly on a prepared
+ *                       state (resetting ip, sp, index and the faults each
+ *                       call, so that every call does the same work)
+ *     dispatch/<op>     whole instructions through `run`: fetch, decode,
+ *                       handler and bookkeeping
+ *     decode/classify   iset::classify over every opcode
+ *     draw/<case>       DXYN at assorted heights and positions, aligned,
+ *                       straddling a word and clipped at the edge
+ *     unpack/<screen>   the packed framebuffer to one byte per pixel
+ *     scan/<isa>        one memscan.h filter over SCAN_SESSIONS sessions,
+ *                       every address still a candidate, per instruction
+ *                       set the CPU has
+ *
+ * and macro-benchmarks run programs headlessly for `cycles` instructions:
+ *
+ *     gen/<preset>      a synthetic program per romgen.h preset, seed 1
+ *     rom/<name>        every ROM in `roms`
+ *
+ * A program that faults or halts sooner is timed over the instructions it
+ * did run, and its result marked as stopped early.
+ *
+ * Only benchmarks whose name contains `filter` are run.
+ *
+ * Each benchmark is calibrated to run for at least `ms` milliseconds, and
+ * the best of BENCH_REPEATS such runs is kept. Results are printed, and
+ * with -o written as JSON, one benchmark per line:
+ *
+ *     {"benchmarks": [
+ *      {"name": "handler/add_reg", "ns": 1.52, "iterations": 16777216},
+ *      ...]}
+ *
+ * With -b the results are compared against an earlier -o file, and any
+ * benchmark more than `percent` (default 10) slower is flagged as a
+ * regression; the exit status is then 2.
+ */
+const unsigned int BENCH_REPEATS = 5;
+const unsigned int SCAN_SESSIONS = 10000;
+
+typedef struct bench_result {
+    string name;
+    double ns;          // per iteration
+    qword iterations;
+    bool stopped;       // a program that faulted or halted before `cycles`
+} bench_result;
+
+// state that every micro-benchmark starts from
+typedef struct bench_ctx {
+    vmstate* base;
+    vmstate* state;
+    C8VM* vm;
+    c8opcode opcode;
+    void (*handler)(vmstate*);
+    byte* pixels;
+    mem_scan* scan;
+    const byte** images;    // SCAN_SESSIONS memories to scan
+} bench_ctx;
+
+typedef void (*bench_fn)(bench_ctx& ctx, qword iterations);
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8vm_bench [-f filter] [-r roms] [-n cycles] [-i ms] "
+        << "[-o out.json]" << endl
+        << "                  [-b baseline.json] [-t percent]" << endl;
+}
+
+// ----------------------------------------------------------------------------
+bench_result measure(const string& name, bench_fn fn, bench_ctx& ctx,
+                     qword min_ns) {
+    /* time `fn`, doubling the iterations until a run takes `min_ns`, then
+     * keep the fastest of BENCH_REPEATS runs of that many
+     */
+    qword iterations = 1, ns = 0;
+    for (;;) {
+        qword t0 = monotonic_ns();
+        fn(ctx, iterations);
+        ns = monotonic_ns() - t0;
+        if (ns >= min_ns || iterations >= (1ULL << 40))
+            break;
+        iterations *= 2;
+    }
+    for (unsigned int r = 1; r < BENCH_REPEATS; ++r) {
+        qword t0 = monotonic_ns();
+        fn(ctx, iterations);
+        qword t = monotonic_ns() - t0;
+        if (t < ns)
+            ns = t;
+    }
+    bench_result result;
+    result.name       = name;
+    result.ns         = (double) ns / iterations;
+    result.iterations = iterations;
+    result.stopped    = false;
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// micro-benchmarks
+// ----------------------------------------------------------------------------
+inline void restore_regs(vmstate* s, const vmstate* base) {
+    // undo what a handler may have moved, so the next call repeats it
+    s->ip     = base->ip;
+    s->sp     = base->sp;
+    s->index  = base->index;
+    s->faults = 0;
+    s->on     = true;
+}
+
+// ----------------------------------------------------------------------------
+void bench_handler(bench_ctx& ctx, qword iterations) {
+    vmstate* s = ctx.state;
+    s->curr_opcode = ctx.opcode;
+    for (qword i = 0; i < iterations; ++i) {
+        ctx.handler(s);
+        restore_regs(s, ctx.base);
+    }
+}
+
+// ----------------------------------------------------------------------------
+qword run_cycles(C8VM* vm, qword cycles) {
+    /* `cycles` instructions through the vm's own loop, or fewer if it
+     * faults or halts; returns how many ran
+     */
+    qword done = 0;
+    while (done < cycles) {
+        stop_reason r = vm->run(cycles - done, 0);
+        done += r.cycles;
+        if (r.kind == stop_fault || r.kind == stop_halted)
+            break;
+    }
+    return done;
+}
+
+// ----------------------------------------------------------------------------
+void bench_run(bench_ctx& ctx, qword iterations) {
+    run_cycles(ctx.vm, iterations);
+}
+
+// ----------------------------------------------------------------------------
+void bench_classify(bench_ctx& ctx, qword iterations) {
+    unsigned int sum = 0;
+    for (qword i = 0; i < iterations; ++i)
+        sum += iset::classify((c8opcode) i, ctx.state->mode);
+    ctx.state->registers[0] = sum; // keep the result live
+}
+
+// ----------------------------------------------------------------------------
+void bench_unpack(bench_ctx& ctx, qword iterations) {
+    for (qword i = 0; i < iterations; ++i)
+        gfx_unpack(ctx.state, ctx.pixels);
+}
+
+// ----------------------------------------------------------------------------
+void bench_scan(bench_ctx& ctx, qword iterations) {
+    /* memory never changes, so every address stays a candidate and every
+     * block is compared and snapshotted: the cost of a search's first round
+     */
+    for (qword i = 0; i < iterations; ++i)
+        ctx.scan->filter_all(ctx.images, scan_unchanged, 0);
+}
+
+typedef struct handler_case {
+    const char* name;
+    c8opcode opcode;
+    machine_mode mode;
+    void (*handler)(vmstate*);
+} handler_case;
+
+// one representative opcode per handler; V0 = 1, V1 = 2, I = 0x300
+const handler_case handler_cases[] = {
+    { "call_prog",              0x0123, mode_chip8,  iset::call_prog },
+    { "clear_screen",           0x00E0, mode_chip8,  iset::clear_screen },
+    { "ret_routine",            0x00EE, mode_chip8,  iset::ret_routine },
+    { "jump",                   0x1200, mode_chip8,  iset::jump },
+    { "call_routine",           0x2200, mode_chip8,  iset::call_routine },
+    { "skip_if_equal",          0x3001, mode_chip8,  iset::skip_if_equal },
+    { "skip_if_not_equal",      0x4001, mode_chip8,
+      iset::skip_if_not_equal },
+    { "skip_if_equal_regs",     0x5010, mode_chip8,
+      iset::skip_if_equal_regs },
+    { "set_reg",                0x6201, mode_chip8,  iset::set_reg },
+    { "add_reg",                0x7201, mode_chip8,  iset::add_reg },
+    { "set_regx_regy",          0x8210, mode_chip8,  iset::set_regx_regy },
+    { "set_regx_or_regy",       0x8211, mode_chip8,
+      iset::set_regx_or_regy },
+    { "set_regx_and_regy",      0x8212, mode_chip8,
+      iset::set_regx_and_regy },
+    { "set_regx_xor_regy",      0x8213, mode_chip8,
+      iset::set_regx_xor_regy },
+    { "set_regx_add_regy",      0x8214, mode_chip8,
+      iset::set_regx_add_regy },
+    { "set_regx_sub_regy",      0x8215, mode_chip8,
+      iset::set_regx_sub_regy },
+    { "set_regx_rshift",        0x8216, mode_chip8,
+      iset::set_regx_rshift<quirks_vip> },
+    { "set_regx_regy_sub_regx", 0x8217, mode_chip8,
+      iset::set_regx_regy_sub_regx },
+    { "set_regx_lshift",        0x821E, mode_chip8,
+      iset::set_regx_lshift<quirks_vip> },
+    { "skip_if_not_equal_regs", 0x9010, mode_chip8,
+      iset::skip_if_not_equal_regs },
+    { "set_index",              0xA300, mode_chip8,  iset::set_index },
+    { "jump_offset",            0xB200, mode_chip8,
+      iset::jump_offset<quirks_vip> },
+    { "set_reg_rand_masked",    0xC2FF, mode_chip8,
+      iset::set_reg_rand_masked },
+    { "draw_sprite",            0xD015, mode_chip8,
+      iset::draw_sprite<quirks_vip> },
+    { "skip_if_key_pressed",    0xE09E, mode_chip8,
+      iset::skip_if_key_pressed },
+    { "skip_if_key_not_pressed", 0xE0A1, mode_chip8,
+      iset::skip_if_key_not_pressed },
+    { "set_reg_delay",          0xF207, mode_chip8,  iset::set_reg_delay },
+    { "wait_key_press_store",   0xF20A, mode_chip8,
+      iset::wait_key_press_store },
+    { "set_delay_regx",         0xF015, mode_chip8,  iset::set_delay_regx },
+    { "set_sound_regx",         0xF018, mode_chip8,  iset::set_sound_regx },
+    { "add_regx_to_index",      0xF01E, mode_chip8,
+      iset::add_regx_to_index },
+    { "get_sprite_regx",        0xF029, mode_chip8,  iset::get_sprite_regx },
+    { "split_decimal",          0xF033, mode_chip8,  iset::split_decimal },
+    { "dump_regs_to_regx",      0xFF55, mode_chip8,
+      iset::dump_regs_to_regx<quirks_vip> },
+    { "slurp_regs_to_regx",     0xFF65, mode_chip8,
+      iset::slurp_regs_to_regx<quirks_vip> },
+    { "scroll_down",            0x00C4, mode_schip,  iset::scroll_down },
+    { "scroll_right",           0x00FB, mode_schip,  iset::scroll_right },
+    { "scroll_left",            0x00FC, mode_schip,  iset::scroll_left },
+    { "halt",                   0x00FD, mode_schip,  iset::halt },
+    { "set_lores",              0x00FE, mode_schip,  iset::set_lores },
+    { "set_hires",              0x00FF, mode_schip,  iset::set_hires },
+    { "get_big_sprite_regx",    0xF030, mode_schip,
+      iset::get_big_sprite_regx },
+    { "save_flags",             0xF775, mode_schip,  iset::save_flags },
+    { "load_flags",             0xF785, mode_schip,  iset::load_flags },
+    { "scroll_up",              0x00D4, mode_xochip, iset::scroll_up },
+    { "save_regs_range",        0x50F2, mode_xochip, iset::save_regs_range },
+    { "load_regs_range",        0x50F3, mode_xochip, iset::load_regs_range },
+    { "set_index_long",         0xF000, mode_xochip, iset::set_index_long },
+    { "select_planes",          0xF301, mode_xochip, iset::select_planes },
+    { "load_audio_pattern",     0xF002, mode_xochip,
+      iset::load_audio_pattern },
+    { "set_pitch",              0xF03A, mode_xochip, iset::set_pitch },
+    { "invalid_opcode",         0xE000, mode_chip8,  iset::invalid_opcode },
+};
+
+typedef struct draw_case {
+    const char* name;
+    byte x, y, n;
+    machine_mode mode;
+    bool hires;
+} draw_case;
+
+const draw_case draw_cases[] = {
+    { "draw/h1_x0",         0,  0,  1, mode_chip8,  false },
+    { "draw/h5_x0",         0,  0,  5, mode_chip8,  false },
+    { "draw/h15_x0",        0,  0, 15, mode_chip8,  false },
+    { "draw/h5_x3",         3,  7,  5, mode_chip8,  false },
+    { "draw/h15_x3",        3,  7, 15, mode_chip8,  false },
+    { "draw/h5_x60_clip",  60, 28,  5, mode_chip8,  false },
+    { "draw/h15_x60_clip", 60, 20, 15, mode_chip8,  false },
+    { "draw/16x16_x0",      0,  0,  0, mode_schip,  true  },
+    { "draw/16x16_x61",    61, 30,  0, mode_schip,  true  },
+    { "draw/16x16_x120",  120, 50,  0, mode_schip,  true  },
+};
+
+// ----------------------------------------------------------------------------
+void prepare(bench_ctx& ctx, machine_mode mode) {
+    /* a freshly loaded vm in `mode`, with a few registers set up for the
+     * handler cases, copied out as the base state
+     */
+    static const byte rom[4] = { 0x12, 0x00, 0x00, 0x00 };
+    ctx.vm->set_mode(mode);
+    ctx.vm->load(rom, sizeof(rom));
+    ctx.vm->start();
+    memcpy(ctx.base, ctx.vm->get_state(), sizeof(vmstate));
+    ctx.base->registers[0] = 1;
+    ctx.base->registers[1] = 2;
+    ctx.base->index = 0x300;
+    ctx.base->sp = 1;
+    ctx.base->stack[0] = 0x200;
+    ctx.base->key[1] = 1;
+    for (unsigned int i = 0; i < 32; ++i)
+        ctx.base->memory[0x300 + i] = 0xA5 ^ i;
+    memcpy(ctx.state, ctx.base, sizeof(vmstate));
+}
+
+// ----------------------------------------------------------------------------
+void fill_rom(C8VM& vm, c8opcode op, machine_mode mode) {
+    /* a ROM of `op` repeated, closed by a jump back to the start; far too
+     * long a loop for the idle detector to skip
+     */
+    string rom;
+    for (unsigned int i = 0; i < 0x400; ++i) {
+        rom += (char) (op >> 8);
+        rom += (char) (op & 0xFF);
+    }
+    rom += '\x12';
+    rom += '\x00';
+    vm.set_mode(mode);
+    vm.load(rom);
+    vm.start();
+}
+
+// ----------------------------------------------------------------------------
+bool wanted(const string& name, const string& filter) {
+    return filter.empty() || name.find(filter) != string::npos;
+}
+
+// ----------------------------------------------------------------------------
+void report(const bench_result& r) {
+    cout << left << setw(34) << r.name << right << fixed << setprecision(2)
+        << setw(14) << r.ns << " ns" << setw(14) << r.iterations
+        << (r.stopped ? "  stopped early" : "") << endl;
+}
+
+// ----------------------------------------------------------------------------
+void run_micro(bench_ctx& ctx, const string& filter, qword min_ns,
+               vector<bench_result>& results) {
+    for (unsigned int i = 0;
+         i < sizeof(handler_cases) / sizeof(handler_cases[0]); ++i) {
+        const handler_case& c = handler_cases[i];
+        string name = string("handler/") + c.name;
+        if (!wanted(name, filter))
+            continue;
+        prepare(ctx, c.mode);
+        ctx.opcode  = c.opcode;
+        ctx.handler = c.handler;
+        results.push_back(measure(name, bench_handler, ctx, min_ns));
+        report(results.back());
+    }
+
+    static const struct {
+        const char* name;
+        c8opcode op;
+    } dispatch_cases[] = {
+        { "dispatch/add_reg",   0x7001 },
+        { "dispatch/xor_regs",  0x8013 },
+        { "dispatch/add_index", 0xF01E },
+    };
+    for (unsigned int i = 0; i < 3; ++i) {
+        if (!wanted(dispatch_cases[i].name, filter))
+            continue;
+        fill_rom(*ctx.vm, dispatch_cases[i].op, mode_chip8);
+        results.push_back(measure(dispatch_cases[i].name, bench_run, ctx,
+                                  min_ns));
+        report(results.back());
+    }
+
+    if (wanted("decode/classify", filter)) {
+        prepare(ctx, mode_xochip);
+        results.push_back(measure("decode/classify", bench_classify, ctx,
+                                  min_ns));
+        report(results.back());
+    }
+
+    for (unsigned int i = 0;
+         i < sizeof(draw_cases) / sizeof(draw_cases[0]); ++i) {
+        const draw_case& c = draw_cases[i];
+        if (!wanted(c.name, filter))
+            continue;
+        prepare(ctx, c.mode);
+        ctx.base->hires = ctx.state->hires = c.hires;
+        ctx.state->registers[0] = c.x;
+        ctx.state->registers[1] = c.y;
+        ctx.opcode  = 0xD010 | c.n;
+        ctx.handler = iset::draw_sprite<quirks_vip>;
+        results.push_back(measure(c.name, bench_handler, ctx, min_ns));
+        report(results.back());
+    }
+
+    static const struct {
+        const char* name;
+        machine_mode mode;
+        bool hires;
+        byte planes;
+    } unpack_cases[] = {
+        { "unpack/lores",         mode_chip8,  false, 1 },
+        { "unpack/hires",         mode_schip,  true,  1 },
+        { "unpack/hires_2planes", mode_xochip, true,  3 },
+    };
+    for (unsigned int i = 0; i < 3; ++i) {
+        if (!wanted(unpack_cases[i].name, filter))
+            continue;
+        prepare(ctx, unpack_cases[i].mode);
+        ctx.state->hires  = unpack_cases[i].hires;
+        ctx.state->planes = unpack_cases[i].planes;
+        // a busy screen, so nothing is special cased away
+        for (unsigned int p = 0; p < GFX_PLANES; ++p)
+            for (unsigned int y = 0; y < GFX_HIRES_H; ++y)
+                for (unsigned int w = 0; w < GFX_ROW_WORDS; ++w)
+                    ctx.state->gfx[p][y][w] =
+                        0x9E3779B97F4A7C15ULL * (p * 977 + y * 31 + w + 1);
+        results.push_back(measure(unpack_cases[i].name, bench_unpack, ctx,
+                                  min_ns));
+        report(results.back());
+    }
+
+    vector<scan_isa> isas;
+    for (unsigned int isa = isa_scalar; isa <= scan_best_isa(); ++isa) {
+        if (wanted(string("scan/") + scan_isa_name((scan_isa) isa), filter))
+            isas.push_back((scan_isa) isa);
+    }
+    if (isas.empty())
+        return;
+    // the snapshots alone are 40 MB, so only made when wanted
+    prepare(ctx, mode_chip8);
+    mem_scan scan(SCAN_SESSIONS, MEM_SIZE);
+    vector<const byte*> images(SCAN_SESSIONS, ctx.state->memory);
+    ctx.scan   = &scan;
+    ctx.images = &images[0];
+    for (unsigned int i = 0; i < isas.size(); ++i) {
+        string name = string("scan/") + scan_isa_name(isas[i]);
+        scan.set_isa(isas[i]);
+        results.push_back(measure(name, bench_scan, ctx, min_ns));
+        report(results.back());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// macro-benchmarks
+// ----------------------------------------------------------------------------
+bench_result run_program(const string& name, const byte* rom,
+                         unsigned long len, machine_mode mode, qword cycles) {
+    /* `cycles` instructions of `rom` from reset, best of BENCH_REPEATS;
+     * reported per instruction run, which is fewer if it faults or halts
+     * (every repeat runs the same instructions)
+     */
+    C8VM vm;
+    qword best = 0, ran = 0;
+    for (unsigned int r = 0; r < BENCH_REPEATS; ++r) {
+        vm.set_mode(mode);
+        vm.load(rom, len);
+        vm.start();
+        qword t0 = monotonic_ns();
+        ran = run_cycles(&vm, cycles);
+        qword t = monotonic_ns() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    bench_result result;
+    result.name       = name;
+    result.ns         = ran ? (double) best / ran : 0.0;
+    result.iterations = ran;
+    result.stopped    = ran < cycles;
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+void run_roms(const string& dir, const string& filter, qword cycles,
+              vector<bench_result>& results) {
+    // every ROM in `dir`
+    vector<string> files;
+    if (!list_roms(dir, files)) {
+        cerr << "could not open " << dir << endl;
+        return;
+    }
+    for (unsigned int i = 0; i < files.size(); ++i) {
+        const string& path = files[i];
+        string name = "rom/" + path.substr(dir.size() + 1,
+                                           path.size() - dir.size() - 5);
+        if (!wanted(name, filter))
+            continue;
+        rom_file rom;
+        if (!rom.open(path.c_str())) {
+            cerr << "could not open " << path << endl;
+            continue;
+        }
+        results.push_back(run_program(name, rom.get_data(), rom.get_size(),
+                                      mode_for_rom(path.c_str()), cycles));
+        report(results.back());
+    }
+}
+
+// ----------------------------------------------------------------------------
+void run_generated(const string& filter, qword cycles,
+                   vector<bench_result>& results) {
+    // a synthetic program (romgen.h) per preset, from a fixed seed
+    static const char* presets[] = {
+        "mixed", "decode", "branch", "calls", "draw", "memory", "smc"
+    };
+    for (unsigned int i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i) {
+        string name = string("gen/") + presets[i];
+        if (!wanted(name, filter))
+            continue;
+        romgen_shape shape;
+        romgen_preset(presets[i], &shape);
+        string rom = romgen_generate(shape, 1);
+        results.push_back(run_program(name, (const byte*) rom.data(),
+                                      rom.size(), mode_chip8, cycles));
+        report(results.back());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// results
+// ----------------------------------------------------------------------------
+void write_json(const vector<bench_result>& results, ostream& out) {
+    out << "{\"benchmarks\": [";
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        out << (i ? "," : "") << endl << " {\"name\": \"" << results[i].name
+            << "\", \"ns\": " << fixed << setprecision(3) << results[i].ns
+            << ", \"iterations\": " << results[i].iterations
+            << (results[i].stopped ? ", \"stopped\": true" : "") << "}";
+    }
+    out << "]}" << endl;
+}
+
+// ----------------------------------------------------------------------------
+bool read_json(const string& path, map<string, double>& baseline) {
+    /* the name and ns of each benchmark in a file written by `write_json`
+     * (one per line, so this is not a general JSON reader)
+     */
+    ifstream in(path.c_str());
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line)) {
+        size_t name = line.find("\"name\": \""), ns = line.find("\"ns\": ");
+        if (name == string::npos || ns == string::npos)
+            continue;
+        name += 9;
+        size_t end = line.find('"', name);
+        if (end == string::npos)
+            continue;
+        baseline[line.substr(name, end - name)] = atof(line.c_str() + ns + 6);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+unsigned int compare(const vector<bench_result>& results,
+                     const map<string, double>& baseline, double threshold) {
+    /* print each benchmark against its baseline, returning how many got
+     * slower by more than `threshold` percent
+     */
+    unsigned int regressions = 0;
+    cout << endl << left << setw(34) << "benchmark" << right << setw(14)
+        << "baseline" << setw(14) << "now" << setw(10) << "change" << endl;
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        map<string, double>::const_iterator b =
+            baseline.find(results[i].name);
+        if (b == baseline.end() || b->second <= 0)
+            continue;
+        double change = 100.0 * (results[i].ns - b->second) / b->second;
+        bool slower = change > threshold;
+        regressions += slower;
+        cout << left << setw(34) << results[i].name << right << fixed
+            << setprecision(2) << setw(14) << b->second << setw(14)
+            << results[i].ns << setw(9) << showpos << change << noshowpos
+            << "%" << (slower ? "  REGRESSION" : "")
+            << (results[i].stopped ? "  stopped early" : "") << endl;
+    }
+    cout << regressions << " regression(s) over " << threshold << "%"
+        << endl;
+    return regressions;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    string filter, roms_dir, json_path, baseline_path;
+    qword cycles = 1000000, min_ms = 20;
+    double threshold = 10.0;
+    for (int arg = 1; arg < argc; arg += 2) {
+        string opt(argv[arg]);
+        if (arg + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        if (opt == "-f") {
+            filter = argv[arg + 1];
+        } else if (opt == "-r") {
+            roms_dir = argv[arg + 1];
+        } else if (opt == "-n" && atol(argv[arg + 1]) > 0) {
+            cycles = atol(argv[arg + 1]);
+        } else if (opt == "-i" && atol(argv[arg + 1]) > 0) {
+            min_ms = atol(argv[arg + 1]);
+        } else if (opt == "-o") {
+            json_path = argv[arg + 1];
+        } else if (opt == "-b") {
+            baseline_path = argv[arg + 1];
+        } else if (opt == "-t" && atof(argv[arg + 1]) > 0) {
+            threshold = atof(argv[arg + 1]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    map<string, double> baseline;
+    if (!baseline_path.empty() && !read_json(baseline_path, baseline)) {
+        cerr << "could not read " << baseline_path << endl;
+        return 1;
+    }
+
+    vector<bench_result> results;
+    C8VM vm;
+    bench_ctx ctx;
+    ctx.vm     = &vm;
+    ctx.base   = new vmstate;
+    ctx.state  = new vmstate;
+    ctx.pixels = new byte[GFX_HIRES_W * GFX_HIRES_H];
+    run_micro(ctx, filter, min_ms * 1000000, results);
+    run_generated(filter, cycles, results);
+    if (!roms_dir.empty())
+        run_roms(roms_dir, filter, cycles, results);
+    delete ctx.base;
+    delete ctx.state;
+    delete[] ctx.pixels;
+
+    if (!json_path.empty()) {
+        ofstream json(json_path.c_str());
+        if (!json) {
+            cerr << "could not write " << json_path << endl;
+            return 1;
+        }
+        write_json(results, json);
+    }
+    if (!baseline_path.empty() && compare(results, baseline, threshold))
+        return 2;
+    return 0;
+}
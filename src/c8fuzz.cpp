@@ -0,0 +1,305 @@
+#include "fuzz.h"
+#include "romgen.h"
+#include "rom.h"
+#include "clock.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include "stdlib.h"
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define C8FUZZ_ASAN
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define C8FUZZ_ASAN
+#endif
+#ifdef C8FUZZ_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+using namespace std;
+
+/* c8fuzz: coverage-guided fuzzing of the vm (see fuzz.h).
+ *
+ *     c8fuzz [-m chip8|schip|xochip] [-s seed] [-n budget] [-t seconds]
+ *            [-x execs] [-o findings_dir] [-c corpus_dir] [rom or dir]...
+ *
+ * Starts from the ROMs given (with their `<name>.keys` scripts, if any),
+ * or from one program per c8gen preset if none are, and fuzzes for
+ * `seconds` (default 10) or `execs` cases, each run for at most `budget`
+ * instructions (default 500). Progress is printed every second.
+ *
+ * Each distinct finding is written to `findings_dir` (default .) as
+ * `<outcome>-<n>.ch8` and `.keys`, which c8vm_regress and c8lockstep
+ * replay. If the vm crashes, the case that did it is saved as `crash.ch8`
+ * and `crash.keys` first. -c writes the final corpus out the same way.
+ *
+ * Built with -DC8VM_FUZZ_ASAN=ON the whole target runs under
+ * AddressSanitizer, so out of bounds accesses crash rather than pass
+ * silently. -DC8VM_FUZZ_HOST_COVERAGE=ON builds it with
+ * `-fsanitize-coverage=trace-pc`, adding the vm's own code edges to the
+ * coverage at about ten times the cost per case.
+ *
+ * Exits 1 if there were any findings.
+ */
+
+#ifdef C8VM_HOST_COVERAGE
+#if defined(__clang__)
+#define NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#else
+#define NO_COVERAGE __attribute__((no_sanitize_coverage))
+#endif
+
+// ----------------------------------------------------------------------------
+extern "C" NO_COVERAGE void __sanitizer_cov_trace_pc() {
+    /* called on every host edge. `coverage_edge` is instrumented too, so
+     * the map is taken away while it runs.
+     */
+    coverage_map* map = fuzz_host_map;
+    if (!map)
+        return;
+    fuzz_host_map = NULL;
+    coverage_edge(map, (uintptr_t) __builtin_return_address(0));
+    fuzz_host_map = map;
+}
+#endif
+
+static char crash_rom[4096], crash_keys[4096];
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8fuzz [-m chip8|schip|xochip] [-s seed] [-n budget] "
+        << "[-t seconds]" << endl
+        << "              [-x execs] [-o findings_dir] [-c corpus_dir] "
+        << "[rom or dir]..." << endl;
+}
+
+// ----------------------------------------------------------------------------
+static void put_number(int fd, long n) {
+    // async signal safe
+    char buf[24];
+    unsigned int i = sizeof(buf);
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n && i);
+    if (write(fd, buf + i, sizeof(buf) - i) < 0)
+        return;
+}
+
+// ----------------------------------------------------------------------------
+static void save_crash() {
+    /* write out the case that was running; only async signal safe calls
+     */
+    const fuzz_case* c = fuzz_current;
+    if (!c)
+        return;
+    int fd = open(crash_rom, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, c->rom.data(), c->rom.size()) < 0)
+            c = NULL;
+        close(fd);
+    }
+    fd = open(crash_keys, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !c)
+        return;
+    for (unsigned int i = 0; i < c->events.size(); ++i) {
+        const script_event& e = c->events[i];
+        char kind[4] = { ' ', e.down ? 'd' : 'u', ' ',
+                         "0123456789abcdef"[e.key & 0xF] };
+        put_number(fd, e.frame);
+        if (write(fd, kind, 4) < 0 || write(fd, "\n", 1) < 0)
+            break;
+    }
+    close(fd);
+}
+
+// ----------------------------------------------------------------------------
+static void on_signal(int sig) {
+    save_crash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// ----------------------------------------------------------------------------
+bool read_case(const string& path, fuzz_case* c) {
+    /* a ROM and the key script next to it, in the c8vm_regress format
+     */
+    rom_file rom;
+    if (!rom.open(path.c_str()))
+        return false;
+    c->rom.assign((const char*) rom.get_data(), rom.get_size());
+    if (c->rom.size() > FUZZ_MAX_ROM)
+        c->rom.resize(FUZZ_MAX_ROM);
+    c->events.clear();
+    read_keys(path.substr(0, path.size() - 4) + ".keys", c->events);
+    if (c->events.size() > FUZZ_MAX_EVENTS)
+        c->events.resize(FUZZ_MAX_EVENTS);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool write_case(const string& base, const fuzz_case& c) {
+    ofstream rom((base + ".ch8").c_str(), ios::binary);
+    ofstream keys((base + ".keys").c_str());
+    if (!rom || !keys)
+        return false;
+    rom.write(c.rom.data(), c.rom.size());
+    fuzz_write_keys(c, keys);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void print_progress(const fuzz_stats* s, unsigned int corpus, double secs) {
+    cout << "#" << s->execs << "  " << fixed << setprecision(0)
+        << (secs > 0 ? s->execs / secs : 0.0) << " execs/s  corpus "
+        << corpus << "  edges " << s->guest_edges << " guest, "
+        << s->host_edges << " host  ";
+    for (unsigned int o = 0; o < num_fuzz_outcomes; ++o) {
+        cout << (o ? " " : "") << fuzz_outcome_name((fuzz_outcome) o) << " "
+            << s->outcomes[o];
+    }
+    cout << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    machine_mode mode = mode_chip8;
+    qword seed = 1, max_execs = 0;
+    long budget = FUZZ_BUDGET;
+    double seconds = 10;
+    string findings_dir("."), corpus_dir;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]), val(argv[arg + 1]);
+        if (opt == "-m" && parse_mode(val, &mode)) {
+            continue;
+        } else if (opt == "-s") {
+            seed = strtoull(val.c_str(), NULL, 0);
+        } else if (opt == "-n" && atol(val.c_str()) > 0) {
+            budget = atol(val.c_str());
+        } else if (opt == "-t" && atof(val.c_str()) > 0) {
+            seconds = atof(val.c_str());
+        } else if (opt == "-x" && atol(val.c_str()) > 0) {
+            max_execs = strtoull(val.c_str(), NULL, 0);
+        } else if (opt == "-o") {
+            findings_dir = val;
+        } else if (opt == "-c") {
+            corpus_dir = val;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+#ifdef C8VM_HOST_COVERAGE
+    bool host_coverage = true;
+#else
+    bool host_coverage = false;
+#endif
+    fuzzer f(mode, budget, seed, host_coverage);
+
+    vector<string> roms;
+    for (; arg < argc; ++arg)
+        find_roms(argv[arg], roms);
+    for (unsigned int i = 0; i < roms.size(); ++i) {
+        fuzz_case c;
+        if (!read_case(roms[i], &c) || !f.add(c))
+            cerr << "skipping " << roms[i] << endl;
+    }
+    if (roms.empty()) {
+        static const char* presets[] = {
+            "mixed", "decode", "branch", "calls", "draw", "memory", "smc"
+        };
+        for (unsigned int i = 0; i < sizeof(presets) / sizeof(char*); ++i) {
+            romgen_shape shape;
+            romgen_preset(presets[i], &shape);
+            shape.length = 64;
+            fuzz_case c;
+            c.rom = romgen_generate(shape, seed);
+            if (c.rom.size() > FUZZ_MAX_ROM)
+                c.rom.resize(FUZZ_MAX_ROM);
+            f.add(c);
+        }
+    }
+    if (f.get_corpus().empty()) {
+        cerr << "no seeds" << endl;
+        return 1;
+    }
+
+    snprintf(crash_rom, sizeof(crash_rom), "%s/crash.ch8",
+             findings_dir.c_str());
+    snprintf(crash_keys, sizeof(crash_keys), "%s/crash.keys",
+             findings_dir.c_str());
+    signal(SIGSEGV, on_signal);
+    signal(SIGBUS, on_signal);
+    signal(SIGFPE, on_signal);
+    signal(SIGILL, on_signal);
+    signal(SIGABRT, on_signal);
+#ifdef C8FUZZ_ASAN
+    __sanitizer_set_death_callback(save_crash);
+#endif
+
+    set<string> seen_findings;
+    unsigned int findings = 0;
+    qword t0 = monotonic_ns(), last = t0;
+    qword limit = (qword) (seconds * 1e9);
+    unsigned int rounds = 0;
+    fuzz_case c;
+    string why;
+    for (;;) {
+        fuzz_outcome outcome = f.round(&c, &why);
+        if ((outcome == outcome_stuck || outcome == outcome_broken) &&
+            seen_findings.insert(why).second) {
+            ostringstream base;
+            base << findings_dir << "/" << fuzz_outcome_name(outcome) << "-"
+                << findings++;
+            cout << "finding: " << fuzz_outcome_name(outcome) << ": " << why
+                << " -> " << base.str() << ".ch8" << endl;
+            if (!write_case(base.str(), c))
+                cerr << "could not write " << base.str() << endl;
+        }
+        const fuzz_stats* s = f.get_stats();
+        if (max_execs && s->execs >= max_execs)
+            break;
+        // Reading the clock every round would cost more than a short case.
+        if ((++rounds & 0xFF) != 0)
+            continue;
+        qword now = monotonic_ns();
+        if (now - last >= 1000000000ULL) {
+            print_progress(s, f.get_corpus().size(), (now - t0) / 1e9);
+            last = now;
+        }
+        if (now - t0 >= limit)
+            break;
+    }
+    const fuzz_stats* s = f.get_stats();
+    print_progress(s, f.get_corpus().size(),
+                   (monotonic_ns() - t0) / 1e9);
+    cout << fixed << setprecision(2) << (s->execs ? s->ns / 1000.0 / s->execs
+                                                  : 0.0)
+        << " us per case, " << findings << " findings" << endl;
+    if (!corpus_dir.empty()) {
+        const vector<fuzz_case>& corpus = f.get_corpus();
+        for (unsigned int i = 0; i < corpus.size(); ++i) {
+            ostringstream base;
+            base << corpus_dir << "/" << setfill('0') << setw(5) << i;
+            if (!write_case(base.str(), corpus[i])) {
+                cerr << "could not write " << base.str() << endl;
+                break;
+            }
+        }
+    }
+    return findings ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include "gdbstub.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <string>
+#include "stdlib.h"
+#include <signal.h>
+
+using namespace std;
+
+/* c8gdb: run a ROM headless under a GDB remote protocol stub (see
+ * gdbstub.h), for a debugger to attach to.
+ *
+ *     c8gdb [-m chip8|schip|xochip] [-q vip|schip|modern] [-l port|path]
+ *           <rom>
+ *
+ * Listens on `port` on the loopback interface (default 1234), or on a Unix
+ * socket at `path`, and waits there with the guest stopped at its first
+ * instruction; in gdb, `target remote :1234`. With no window there are no
+ * keys but those sent with `monitor key <hex key> <d|u>`. `monitor scan`
+ * searches memory for a value, to find where a ROM keeps its score or lives
+ * (see `gdb_stub::monitor_scan`). Exits when the debugger detaches or kills
+ * the guest.
+ */
+
+// frames run between looks at the socket, so ^C is seen promptly
+const long FRAMES_PER_POLL = 6;
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8gdb [-m chip8|schip|xochip] [-q vip|schip|modern] "
+        << "[-l port|path] <rom>" << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    bool have_mode = false, have_quirks = false;
+    machine_mode mode = mode_chip8;
+    quirk_profile quirks = profile_vip;
+    string where("1234");
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-m" && parse_mode(argv[arg + 1], &mode)) {
+            have_mode = true;
+        } else if (opt == "-q" && parse_quirks(argv[arg + 1], &quirks)) {
+            have_quirks = true;
+        } else if (opt == "-l") {
+            where = argv[arg + 1];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc != arg + 1) {
+        print_usage();
+        return 1;
+    }
+    const char* rom_path = argv[arg];
+    rom_file rom;
+    if (!rom.open(rom_path)) {
+        cerr << "could not open " << rom_path << endl;
+        return 1;
+    }
+    C8VM vm;
+    vm.set_mode(have_mode ? mode : mode_for_rom(rom_path));
+    if (have_quirks)
+        vm.set_quirks(quirks);
+    if (!vm.load(rom.get_data(), rom.get_size())) {
+        cerr << rom_path << ": not a loadable ROM" << endl;
+        return 1;
+    }
+    rom.close();
+    vm.start();
+
+    // a debugger that goes away mid-write shouldn't take us with it
+    signal(SIGPIPE, SIG_IGN);
+    gdb_stub stub(vm);
+    if (!stub.listen(where)) {
+        cerr << "could not listen on " << where << endl;
+        return 1;
+    }
+    cout << "waiting for a debugger on " << where << endl;
+    if (!stub.accept()) {
+        cerr << "could not accept a debugger" << endl;
+        return 1;
+    }
+    cout << "debugger attached" << endl;
+    // stopped, wait for the debugger; running, just look, unless the guest
+    // is blocked on a key that only the debugger can send
+    while (stub.poll(!stub.is_running() ? -1 : vm.is_blocked() ? 10 : 0))
+        stub.resume(FRAMES_PER_POLL);
+    cout << "debugger detached" << endl;
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "romgen.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8gen: generate synthetic CHIP-8 workloads (see romgen.h).
+ *
+ *     c8gen [-p preset] [-w weights] [-s seed] [-l length] [-d depth]
+ *           [-r routine_length] [-n cycles] <out.ch8>
+ *     c8gen -c <rom.ch8>
+ *
+ * Writes the program for the shape and seed to `out.ch8`, then runs it for
+ * `cycles` instructions (default 100000) as CHIP-8 with the default quirks
+ * and writes the final state hash, with the command that made it, to
+ * `out.ch8.hash`:
+ *
+ *     # c8gen -p draw -s 7
+ *     100000 1f2e3d4c5b6a7988
+ *
+ * -p starts from a preset (mixed, decode, branch, calls, draw, memory,
+ * smc; default mixed). -w then replaces its weights, e.g.
+ * "alu:60,draw:30,smc:10", and -l, -d and -r its sizes.
+ *
+ * -c re-runs a generated ROM and checks it still ends in the state in its
+ * .hash file, exiting 1 if not.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8gen [-p preset] [-w weights] [-s seed] [-l length] "
+        << "[-d depth]" << endl
+        << "             [-r routine_length] [-n cycles] <out.ch8>" << endl
+        << "       c8gen -c <rom.ch8>" << endl;
+}
+
+// ----------------------------------------------------------------------------
+int check(const string& rom_path) {
+    rom_file rom;
+    ifstream in((rom_path + ".hash").c_str());
+    if (!rom.open(rom_path.c_str()) || !in) {
+        cerr << "could not read " << rom_path << " and its .hash" << endl;
+        return 1;
+    }
+    string line;
+    long cycles = 0;
+    qword expected = 0;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        istringstream fields(line);
+        fields >> cycles >> hex >> expected;
+        break;
+    }
+    qword actual;
+    string data((const char*) rom.get_data(), rom.get_size());
+    if (cycles <= 0 || !romgen_reference(data, cycles, &actual)) {
+        cerr << rom_path << ": did not run " << cycles << " cycles" << endl;
+        return 1;
+    }
+    bool pass = actual == expected;
+    cout << (pass ? "[pass] " : "[FAIL] ") << rom_path << ": " << hex
+        << setfill('0') << setw(16) << actual << dec << endl;
+    return pass ? 0 : 1;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    string preset("mixed"), weights, check_path;
+    int length = -1, depth = -1, routine_length = -1;
+    qword seed = 1;
+    long cycles = 100000;
+    ostringstream command;
+    command << "c8gen";
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]), val(argv[arg + 1]);
+        if (opt == "-p") {
+            preset = val;
+        } else if (opt == "-w") {
+            weights = val;
+        } else if (opt == "-s") {
+            seed = strtoull(val.c_str(), NULL, 0);
+        } else if (opt == "-l" && atoi(val.c_str()) > 0) {
+            length = atoi(val.c_str());
+        } else if (opt == "-d" && atoi(val.c_str()) >= 0 &&
+                   atoi(val.c_str()) <= (int) STACK_SIZE) {
+            depth = atoi(val.c_str());
+        } else if (opt == "-r" && atoi(val.c_str()) >= 0) {
+            routine_length = atoi(val.c_str());
+        } else if (opt == "-n" && atol(val.c_str()) > 0) {
+            cycles = atol(val.c_str());
+        } else if (opt == "-c") {
+            check_path = val;
+        } else {
+            print_usage();
+            return 1;
+        }
+        command << " " << opt << " " << val;
+    }
+    if (!check_path.empty())
+        return check(check_path);
+    if (argc <= arg) {
+        print_usage();
+        return 1;
+    }
+    romgen_shape shape;
+    if (!romgen_preset(preset, &shape)) {
+        cerr << "no preset " << preset << endl;
+        return 1;
+    }
+    if (!weights.empty() && !romgen_parse_weights(weights, &shape)) {
+        cerr << "bad weights: " << weights << endl;
+        return 1;
+    }
+    if (length >= 0)
+        shape.length = length;
+    if (depth >= 0)
+        shape.call_depth = depth;
+    if (routine_length >= 0)
+        shape.routine_length = routine_length;
+    if (!romgen_fits(shape)) {
+        cerr << "-d " << shape.call_depth << " routines of -r "
+            << shape.routine_length << " groups don't fit below scratch"
+            << endl;
+        print_usage();
+        return 1;
+    }
+    string out_path(argv[arg]);
+    string rom = romgen_generate(shape, seed);
+    qword hash;
+    if (rom.empty() || !romgen_reference(rom, cycles, &hash)) {
+        cerr << "generated program did not run" << endl;
+        return 1;
+    }
+    ofstream out(out_path.c_str(), ios::binary);
+    ofstream hash_out((out_path + ".hash").c_str());
+    if (!out || !hash_out) {
+        cerr << "could not write " << out_path << endl;
+        return 1;
+    }
+    out.write(rom.data(), rom.size());
+    hash_out << "# " << command.str() << endl << cycles << " " << hex
+        << setfill('0') << setw(16) << hash << endl;
+    cout << out_path << ": " << rom.size() << " bytes, " << dec << cycles
+        << " cycles, state " << hex << setfill('0') << setw(16) << hash
+        << endl;
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "lockstep.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8lockstep: check one engine against another (see lockstep.h).
+ *
+ *     c8lockstep [-a engine] [-b engine] [-m chip8|schip|xochip]
+ *                [-q|-qa|-qb vip|schip|modern] [-n interval]
+ *                [-c cycles] <rom or dir>...
+ *
+ * Runs every ROM given, and every ROM in each directory given, on engines
+ * `a` (default step) and `b` (default run) for `cycles` instructions
+ * (default 1000000), comparing states every `interval` instructions.
+ * -q loads both engines with the same quirk profile; -qa and -qb set one
+ * engine's alone, so that a ROM can be run against itself under two
+ * profiles to find the first instruction that tells them apart.
+ * Key presses are replayed from `<name>.keys` next to a ROM, if there is
+ * one, in the c8vm_regress format. The mode defaults from each ROM's
+ * extension.
+ *
+ * Prints the first divergence of each ROM that has one, and exits 1 if any
+ * did.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8lockstep [-a engine] [-b engine] "
+        << "[-m chip8|schip|xochip]" << endl
+        << "                  [-q|-qa|-qb vip|schip|modern] "
+        << "[-n interval] [-c cycles]" << endl
+        << "                  <rom or dir>..." << endl
+        << "  engines: step, run, profile, breakpoint" << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    engine_kind kind_a, kind_b;
+    string name_a("step"), name_b("run");
+    bool have_mode = false, have_quirks_a = false, have_quirks_b = false;
+    machine_mode mode = mode_chip8;
+    quirk_profile quirks, quirks_a = profile_vip, quirks_b = profile_vip;
+    long interval = LOCKSTEP_INTERVAL, cycles = 1000000;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-a") {
+            name_a = argv[arg + 1];
+        } else if (opt == "-b") {
+            name_b = argv[arg + 1];
+        } else if (opt == "-m" && parse_mode(argv[arg + 1], &mode)) {
+            have_mode = true;
+        } else if (opt == "-q" && parse_quirks(argv[arg + 1], &quirks)) {
+            have_quirks_a = have_quirks_b = true;
+            quirks_a = quirks_b = quirks;
+        } else if (opt == "-qa" && parse_quirks(argv[arg + 1], &quirks_a)) {
+            have_quirks_a = true;
+        } else if (opt == "-qb" && parse_quirks(argv[arg + 1], &quirks_b)) {
+            have_quirks_b = true;
+        } else if (opt == "-n" && atol(argv[arg + 1]) > 0) {
+            interval = atol(argv[arg + 1]);
+        } else if (opt == "-c" && atol(argv[arg + 1]) > 0) {
+            cycles = atol(argv[arg + 1]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc <= arg || !parse_engine(name_a, &kind_a) ||
+        !parse_engine(name_b, &kind_b)) {
+        print_usage();
+        return 1;
+    }
+    vector<string> roms;
+    for (; arg < argc; ++arg)
+        find_roms(argv[arg], roms);
+
+    unsigned int failed = 0;
+    qword total_cycles = 0, total_ns = 0;
+    for (unsigned int i = 0; i < roms.size(); ++i) {
+        rom_file rom;
+        if (!rom.open(roms[i].c_str())) {
+            cerr << "could not open " << roms[i] << endl;
+            ++failed;
+            continue;
+        }
+        string data((const char*) rom.get_data(), rom.get_size());
+        machine_mode m = have_mode ? mode : mode_for_rom(roms[i].c_str());
+        vector<script_event> events;
+        read_keys(roms[i].substr(0, roms[i].size() - 4) + ".keys", events);
+        lockstep_engine a(kind_a), b(kind_b);
+        if (!a.load(data, m, have_quirks_a, quirks_a) ||
+            !b.load(data, m, have_quirks_b, quirks_b)) {
+            cerr << roms[i] << ": not a loadable ROM" << endl;
+            ++failed;
+            continue;
+        }
+        lockstep_result r;
+        ostringstream report;
+        bool same = lockstep_run(a, b, events, cycles, interval, &r, report);
+        total_cycles += r.cycles;
+        total_ns     += r.ns;
+        cout << (same ? "[pass] " : "[FAIL] ") << roms[i] << ": "
+            << r.cycles << " instructions, " << fixed << setprecision(1)
+            << (r.ns ? r.cycles * 1000.0 / r.ns : 0.0) << "M/s" << endl;
+        if (!same) {
+            cout << report.str();
+            ++failed;
+        }
+    }
+    cout << roms.size() - failed << " out of " << roms.size() << " agreed ("
+        << engine_name(kind_a) << " against " << engine_name(kind_b) << ", "
+        << fixed << setprecision(1)
+        << (total_ns ? total_cycles * 1000.0 / total_ns : 0.0)
+        << "M instructions/s)" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+#include "rompack.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "string.h"
+
+using namespace std;
+
+// as `parse_mode` reads them
+const char* MODE_NAMES[] = { "chip8", "schip", "xochip" };
+
+/* c8pack: build and inspect ROM packs (see rompack.h).
+ *
+ *     c8pack create <pack> <rom or dir> ...   pack ROMs (dirs: every *.ch8,
+ *                                             *.sc8 and *.xo8)
+ *     c8pack list <pack>                      list a pack's contents
+ *
+ * ROMs are named by their file name, without any directory, and packed
+ * with the machine mode their extension implies (see `mode_for_rom`), so
+ * XO-CHIP ROMs may be up to XO_MAX_ROM_SIZE.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8pack create <pack> <rom or dir> ..." << endl
+        << "       c8pack list <pack>" << endl;
+}
+
+// ----------------------------------------------------------------------------
+bool add_rom(const string& path, vector<pack_input>& roms) {
+    rom_file rom;
+    if (!rom.open(path)) {
+        cerr << "could not read " << path << endl;
+        return false;
+    }
+    machine_mode mode = mode_for_rom(path);
+    unsigned long max_size = mode == mode_xochip ? XO_MAX_ROM_SIZE
+                                                 : MAX_ROM_SIZE;
+    if (rom.get_size() == 0 || rom.get_size() > max_size) {
+        cerr << path << ": not a loadable ROM (" << rom.get_size()
+            << " bytes), skipped" << endl;
+        return true;
+    }
+    pack_input in;
+    string::size_type slash = path.rfind('/');
+    in.name = slash == string::npos ? path : path.substr(slash + 1);
+    in.data.assign((const char*) rom.get_data(), rom.get_size());
+    in.mode = mode;
+    roms.push_back(in);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool add_path(const string& path, vector<pack_input>& roms) {
+    vector<string> files;
+    find_roms(path, files);
+    for (unsigned int i = 0; i < files.size(); ++i)
+        if (!add_rom(files[i], roms))
+            return false;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+int create(const string& pack, int argc, char** argv) {
+    vector<pack_input> roms;
+    for (int i = 0; i < argc; ++i)
+        if (!add_path(argv[i], roms))
+            return 1;
+    // names are the lookup key, so they have to be unique
+    vector<string> names;
+    for (unsigned int i = 0; i < roms.size(); ++i)
+        names.push_back(roms[i].name);
+    sort(names.begin(), names.end());
+    vector<string>::iterator dup = adjacent_find(names.begin(), names.end());
+    if (dup != names.end()) {
+        cerr << "duplicate ROM name " << *dup << endl;
+        return 1;
+    }
+    if (!write_rom_pack(pack, roms)) {
+        cerr << "could not write " << pack << endl;
+        return 1;
+    }
+    cout << "packed " << roms.size() << " ROMs into " << pack << endl;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int list(const string& path) {
+    rom_pack pack;
+    if (!pack.open(path)) {
+        cerr << path << ": not a ROM pack" << endl;
+        return 1;
+    }
+    for (unsigned int i = 0; i < pack.get_count(); ++i) {
+        rom_span rom;
+        if (!pack.get(i, &rom)) {
+            cerr << "entry " << i << " is corrupt" << endl;
+            return 1;
+        }
+        cout << hex << setfill('0') << setw(16) << rom.hash << dec
+            << setfill(' ') << " " << setw(5) << rom.size << " "
+            << left << setw(6) << MODE_NAMES[rom.mode] << right << " "
+            << string(rom.name, rom.name_len) << endl;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc >= 4 && strcmp(argv[1], "create") == 0)
+        return create(argv[2], argc - 3, argv + 3);
+    if (argc == 3 && strcmp(argv[1], "list") == 0)
+        return list(argv[2]);
+    print_usage();
+    return 1;
+}
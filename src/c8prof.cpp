@@ -0,0 +1,232 @@
+#include "c8.h"
+#include "profile.h"
+#include "heatmap.h"
+#include "clock.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8prof: run a ROM headlessly and report where its time goes.
+ *
+ *     c8prof [-m chip8|schip|xochip] [-q vip|schip|modern] [-n frames]
+ *            [-s interval] [-t top] [-j profile.json] [-f stacks.folded]
+ *            [-H heat.ppm] [-c heat.csv] [-w watch]... <rom>
+ *
+ * Runs `frames` frames (default 600, ten seconds of guest time), counting
+ * every instruction, or every `interval`'th one with -s, and prints the
+ * busiest handlers and the `top` busiest addresses. -j also writes the full
+ * profile as JSON.
+ *
+ * -f samples the guest call stack as well, every `interval` instructions
+ * (PROFILE_STACK_INTERVAL unless -s is given), and writes folded stacks for
+ * flamegraph.pl. It also runs the ROM once first, profiled the same way but
+ * without stacks, and reports what sampling them cost.
+ *
+ * -H and -c count every memory access (see heatmap.h) and write the counts
+ * as a PPM image (red writes, green reads, blue executes; 64 addresses to
+ * a row) or as CSV. Each -w adds a watchpoint, given as
+ * <addr>[-<addr>][:<r|w|x>...][=<value>][@<skip>], whose hits are printed
+ * as they happen.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8prof [-m chip8|schip|xochip] [-q vip|schip|modern] "
+        << "[-n frames]" << endl
+        << "              [-s interval] [-t top] [-j profile.json] "
+        << "[-f stacks.folded]" << endl
+        << "              [-H heat.ppm] [-c heat.csv] [-w watch]... <rom>"
+        << endl;
+}
+
+// ----------------------------------------------------------------------------
+qword run_frames(C8VM& vm, long frames, const mem_heatmap* heat,
+                 stop_reason* last) {
+    /* run up to `frames` frames (fewer if the vm stops), printing watchpoint
+     * hits, returning how long that took
+     */
+    qword t0 = monotonic_ns();
+    long frame = 0;
+    stop_reason r;
+    r.kind = stop_frame;
+    while (frame < frames && vm.is_on()) {
+        r = vm.run(0, frames - frame);
+        frame = vm.get_state()->cycles / CYCLES_PER_FRAME;
+        if (r.kind == stop_watchpoint) {
+            const heat_watch& w = heat->watches[heat->hit];
+            char kind = heat->hit_access == access_read  ? 'r'
+                      : heat->hit_access == access_write ? 'w' : 'x';
+            cout << "watch " << watch_name(w) << ": " << kind << " " << hex
+                << r.addr << " = " << (int) vm.get_state()->memory[r.addr]
+                << " by " << heat->hit_pc << dec << ", cycle "
+                << vm.get_state()->cycles << endl;
+        }
+    }
+    if (last)
+        *last = r;
+    return monotonic_ns() - t0;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    bool have_mode = false, have_quirks = false;
+    machine_mode mode = mode_chip8;
+    quirk_profile quirks = profile_vip;
+    long frames = 600;
+    unsigned int interval = 0, top = 20;
+    string json_path, folded_path, ppm_path, csv_path;
+    mem_heatmap* heat = new mem_heatmap;
+    heatmap_clear(heat);
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-m" && parse_mode(argv[arg + 1], &mode)) {
+            have_mode = true;
+        } else if (opt == "-q" && parse_quirks(argv[arg + 1], &quirks)) {
+            have_quirks = true;
+        } else if (opt == "-n" && atol(argv[arg + 1]) > 0) {
+            frames = atol(argv[arg + 1]);
+        } else if (opt == "-s" && atoi(argv[arg + 1]) > 0) {
+            interval = atoi(argv[arg + 1]);
+        } else if (opt == "-t") {
+            top = atoi(argv[arg + 1]);
+        } else if (opt == "-j") {
+            json_path = argv[arg + 1];
+        } else if (opt == "-f") {
+            folded_path = argv[arg + 1];
+        } else if (opt == "-H") {
+            ppm_path = argv[arg + 1];
+        } else if (opt == "-c") {
+            csv_path = argv[arg + 1];
+        } else if (opt == "-w") {
+            heat_watch w;
+            if (!parse_watch(argv[arg + 1], &w) || !heatmap_watch(heat, w)) {
+                cerr << "bad or too many watches: " << argv[arg + 1] << endl;
+                return 1;
+            }
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc <= arg) {
+        print_usage();
+        return 1;
+    }
+    const char* rom_path = argv[arg];
+    rom_file rom;
+    if (!rom.open(rom_path)) {
+        cerr << "could not open " << rom_path << endl;
+        return 1;
+    }
+
+    if (interval == 0)
+        interval = folded_path.empty() ? 1 : PROFILE_STACK_INTERVAL;
+    mode = have_mode ? mode : mode_for_rom(rom_path);
+    C8VM vm;
+    vm.set_mode(mode);
+    if (have_quirks)
+        vm.set_quirks(quirks);
+    if (!vm.load(rom.get_data(), rom.get_size())) {
+        cerr << rom_path << ": not a loadable ROM" << endl;
+        return 1;
+    }
+    bool counting = !ppm_path.empty() || !csv_path.empty() ||
+                    heat->num_watches > 0;
+    qword base_ns = 0;
+    if (!folded_path.empty()) {
+        /* the same run on the same core, sampling at the same interval and
+         * counting accesses into a scratch heatmap, but without stacks: the
+         * difference is what the stack samples cost
+         */
+        vm_profile* base = new vm_profile;
+        profile_clear(base, interval);
+        vm.set_profile(base);
+        mem_heatmap* scratch = new mem_heatmap;
+        heatmap_clear(scratch);
+        if (counting)
+            vm.set_heatmap(scratch);
+        vm.start();
+        base_ns = run_frames(vm, frames, NULL, NULL);
+        vm.set_heatmap(NULL);
+        vm.set_profile(NULL);
+        delete scratch;
+        delete base;
+        vm.set_mode(mode);
+        if (have_quirks)
+            vm.set_quirks(quirks);
+        vm.load(rom.get_data(), rom.get_size());
+    }
+    vm_profile* profile = new vm_profile;
+    stack_samples stacks;
+    profile_clear(profile, interval);
+    if (!folded_path.empty())
+        profile->stacks = &stacks;
+    vm.set_profile(profile);
+    if (counting)
+        vm.set_heatmap(heat);
+    vm.start();
+    stop_reason r;
+    qword ns = run_frames(vm, frames, heat, &r);
+    long frame = vm.get_state()->cycles / CYCLES_PER_FRAME;
+
+    cout << rom_path << ": " << frame << " frames in " << ns / 1000000
+        << " ms";
+    if (r.kind == stop_fault)
+        cout << ", stopped on fault " << (int) r.fault << " at " << hex
+            << r.addr << dec;
+    else if (r.kind == stop_halted)
+        cout << ", halted";
+    cout << endl;
+    if (!folded_path.empty()) {
+        ofstream folded(folded_path.c_str());
+        if (!folded) {
+            cerr << "could not write " << folded_path << endl;
+            return 1;
+        }
+        stacks.write_folded(folded);
+        cout << "stacks: " << stacks.get_total() << " samples, "
+            << stacks.get_distinct() << " distinct, 1 in " << interval
+            << "; " << ns / 1000 << " us against " << base_ns / 1000
+            << " us without stacks (" << fixed << setprecision(1)
+            << (base_ns ? 100.0 * ((double) ns - base_ns) / base_ns : 0.0)
+            << "% overhead)" << endl;
+    }
+    profile_report(profile, vm.get_state(), top, cout);
+    if (!json_path.empty()) {
+        ofstream json(json_path.c_str());
+        if (!json) {
+            cerr << "could not write " << json_path << endl;
+            return 1;
+        }
+        profile_json(profile, vm.get_state(), json);
+    }
+    if (!ppm_path.empty()) {
+        ofstream ppm(ppm_path.c_str(), ios::binary);
+        if (!ppm) {
+            cerr << "could not write " << ppm_path << endl;
+            return 1;
+        }
+        heatmap_ppm(heat, vm.get_state(), ppm);
+    }
+    if (!csv_path.empty()) {
+        ofstream csv(csv_path.c_str());
+        if (!csv) {
+            cerr << "could not write " << csv_path << endl;
+            return 1;
+        }
+        heatmap_csv(heat, vm.get_state(), csv);
+    }
+    vm.set_profile(NULL);
+    vm.set_heatmap(NULL);
+    delete profile;
+    delete heat;
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "c8.h"
+#include "hash.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "string.h"
+#include "stdlib.h"
+
+using namespace std;
+
+/* Golden frame-hash regression suite.
+ *
+ * Every `<name>.ch8` in the ROM directory (or `.sc8`/`.xo8`, run as
+ * SUPER-CHIP and XO-CHIP) is run headlessly, frame by frame, with key
+ * presses replayed from `<name>.keys` (if present). At each frame
+ * listed in `<name>.golden` the framebuffer and full vm state are hashed and
+ * compared against the stored values. With `bless` the golden files are
+ * (re)written from the current interpreter instead.
+ *
+ *   .keys   - one event per line:   <frame> <d|u> <key (hex)>
+ *   .golden - one checkpoint/line:  <frame> <gfx hash> <state hash>
+ *
+ * Lines starting with '#' are ignored in both.
+ */
+
+// frames we checkpoint when blessing a ROM that has no golden file yet
+const unsigned int DEFAULT_CHECKPOINTS[] = { 1, 10, 60, 120, 300 };
+
+typedef struct checkpoint {
+    unsigned int frame;
+    qword gfx_hash, state_hash;
+} checkpoint;
+
+typedef struct regress_job {
+    string name, rom_path, keys_path, golden_path;
+    bool pass;
+    string report;
+} regress_job;
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8vm_regress [-j N] [bless] <rom dir>" << endl;
+}
+
+// ----------------------------------------------------------------------------
+bool is_comment(const string& line) {
+    return line.empty() || line[0] == '#';
+}
+
+// ----------------------------------------------------------------------------
+bool read_golden(const string& path, vector<checkpoint>& points) {
+    ifstream infs(path.c_str());
+    if (!infs)
+        return false;
+    string line;
+    while (getline(infs, line)) {
+        if (is_comment(line))
+            continue;
+        istringstream ls(line);
+        checkpoint c;
+        if (ls >> dec >> c.frame >> hex >> c.gfx_hash >> c.state_hash)
+            points.push_back(c);
+    }
+    sort(points.begin(), points.end(),
+            [](const checkpoint& a, const checkpoint& b) {
+                return a.frame < b.frame;
+            });
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool write_golden(const string& path, const vector<checkpoint>& points) {
+    ofstream outfs(path.c_str());
+    if (!outfs)
+        return false;
+    outfs << "# frame gfx_hash state_hash" << endl;
+    for (unsigned int i = 0; i < points.size(); ++i) {
+        outfs << dec << points[i].frame << " "
+            << hex << setfill('0')
+            << setw(16) << points[i].gfx_hash << " "
+            << setw(16) << points[i].state_hash << endl;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool run_rom(rom_file& rom, machine_mode mode,
+        const vector<script_event>& events, vector<checkpoint>& points) {
+    /* run `rom` up to the last checkpoint, filling in the hashes of each
+     * checkpoint as its frame completes
+     */
+    C8VM vm;
+    vm.set_mode(mode);
+    if (!vm.load(rom.get_data(), rom.get_size()))
+        return false;
+    vm.start();
+    unsigned int next_event = 0, frame = 0;
+    for (unsigned int i = 0; i < points.size(); ++i) {
+        while (frame < points[i].frame) {
+            // input lands at the start of the frame it is scheduled for
+            while (next_event < events.size() &&
+                   events[next_event].frame <= frame) {
+                vm.post_key_at(frame, events[next_event].key,
+                               events[next_event].down);
+                ++next_event;
+            }
+            vm.do_frame();
+            ++frame;
+        }
+        points[i].gfx_hash   = hash_gfx(vm.get_state());
+        points[i].state_hash = hash_state(vm.get_state());
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void run_job(regress_job* job, bool bless) {
+    rom_file rom;
+    if (!rom.open(job->rom_path)) {
+        job->pass   = false;
+        job->report = "\tcould not read " + job->rom_path + "\n";
+        return;
+    }
+    vector<script_event> events;
+    read_keys(job->keys_path, events);
+
+    vector<checkpoint> golden;
+    bool have_golden = read_golden(job->golden_path, golden);
+    if (!have_golden && !bless) {
+        job->pass   = false;
+        job->report = "\tno golden file (run with `bless` to create one)\n";
+        return;
+    }
+    if (golden.empty()) {
+        for (unsigned int i = 0; i < sizeof(DEFAULT_CHECKPOINTS) /
+                sizeof(DEFAULT_CHECKPOINTS[0]); ++i) {
+            checkpoint c = { DEFAULT_CHECKPOINTS[i], 0, 0 };
+            golden.push_back(c);
+        }
+    }
+
+    vector<checkpoint> actual(golden);
+    if (!run_rom(rom, mode_for_rom(job->rom_path), events, actual)) {
+        job->pass   = false;
+        job->report = "\tnot a loadable ROM (empty or too large)\n";
+        return;
+    }
+
+    if (bless) {
+        job->pass   = write_golden(job->golden_path, actual);
+        job->report = job->pass ? "" : "\tcould not write " +
+                                       job->golden_path + "\n";
+        return;
+    }
+
+    stringstream report;
+    job->pass = true;
+    for (unsigned int i = 0; i < golden.size(); ++i) {
+        if (golden[i].gfx_hash   == actual[i].gfx_hash &&
+            golden[i].state_hash == actual[i].state_hash)
+            continue;
+        job->pass = false;
+        report << hex << setfill('0')
+            << "\tframe " << dec << golden[i].frame << hex
+            << ": expected(gfx " << setw(16) << golden[i].gfx_hash
+            << ", state " << setw(16) << golden[i].state_hash << ")"
+            << " actual(gfx " << setw(16) << actual[i].gfx_hash
+            << ", state " << setw(16) << actual[i].state_hash << ")"
+            << endl;
+    }
+    job->report = report.str();
+}
+
+// ----------------------------------------------------------------------------
+void find_jobs(const string& dir, vector<regress_job>& jobs) {
+    vector<string> roms;
+    list_roms(dir, roms);
+    for (unsigned int i = 0; i < roms.size(); ++i) {
+        string base = roms[i].substr(0, roms[i].size() - 4);
+        regress_job job;
+        job.name        = base.substr(dir.size() + 1);
+        job.rom_path    = roms[i];
+        job.keys_path   = base + ".keys";
+        job.golden_path = base + ".golden";
+        job.pass        = false;
+        jobs.push_back(job);
+    }
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    bool bless = false;
+    unsigned int num_threads = thread::hardware_concurrency();
+    string dir;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "bless") == 0)
+            bless = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            num_threads = atoi(argv[++i]);
+        else
+            dir = argv[i];
+    }
+    if (dir.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    vector<regress_job> jobs;
+    find_jobs(dir, jobs);
+    if (jobs.empty()) {
+        cout << "no ROMs found in " << dir << endl;
+        return 1;
+    }
+
+    // each job owns its vm, so workers only share the index of the next job
+    atomic<unsigned int> next_job(0);
+    num_threads = max(1u, min<unsigned int>(num_threads, jobs.size()));
+    vector<thread> workers;
+    for (unsigned int t = 0; t < num_threads; ++t) {
+        workers.push_back(thread([&]() {
+            unsigned int i;
+            while ((i = next_job++) < jobs.size())
+                run_job(&jobs[i], bless);
+        }));
+    }
+    for (unsigned int t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    int num_passes = 0;
+    for (unsigned int i = 0; i < jobs.size(); ++i) {
+        cout << (jobs[i].pass ? (bless ? "[bless] " : "[pass] ") : "[FAIL] ")
+            << jobs[i].name << endl << jobs[i].report;
+        if (jobs[i].pass) ++num_passes;
+    }
+    cout << num_passes << " out of " << jobs.size() << " passed." << endl;
+    return num_passes == (int) jobs.size() ? 0 : 1;
+}
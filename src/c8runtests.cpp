@@ -1,23 +1,52 @@
 #include "c8tests.h"
+#include "c8.h"
+#include "clock.h"
 #include "iset.h"
 #include "def.h"
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
 #include <map>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
 #include "string.h"
+#include "stdlib.h"
 
 using namespace std;
 
-map<string, void(*)(vmstate*, c8tests::result*)> tests;
+/* c8vm_tests: the unit tests.
+ *
+ *     c8vm_tests [-f filter] [-j jobs] [-o out.json] [concise]
+ *
+ * Every test gets its own freshly reset vmstate, so they are independent
+ * of each other and of the order they run in, and are spread over `jobs`
+ * threads (default: one per core). Only tests whose name contains `filter`
+ * are run. Results are printed in name order once all are done, each with
+ * its time; `concise` prints one character per test instead. -o also
+ * writes them as JSON, one test per line:
+ *
+ *     {"tests": [
+ *      {"name": "jump", "pass": true, "ns": 1234, "expected": "...",
+ *       "actual": "..."}]}
+ *
+ * Exits 1 if any test failed.
+ */
 
+typedef void (*test_fnc)(vmstate*, c8tests::result*);
+
+map<string, test_fnc> tests;
+
+// ----------------------------------------------------------------------------
 void populate_tests() {
     tests["call_prog"] = c8tests::call_prog;
     tests["clear_screen"] = c8tests::clear_screen;
     tests["ret_routine"] = c8tests::ret_routine;
     tests["jump"] = c8tests::jump;
-    tests["call_routine"] = c8tests::jump;
+    tests["call_routine"] = c8tests::call_routine;
     tests["skip_if_equal"] = c8tests::skip_if_equal;
     tests["skip_if_not_equal"] = c8tests::skip_if_not_equal;
     tests["skip_if_equal_regs"] = c8tests::skip_if_equal_regs;
@@ -33,14 +62,49 @@ void populate_tests() {
     tests["set_regx_regy_sub_regx"] = c8tests::set_regx_regy_sub_regx;
     tests["set_regx_lshift"] = c8tests::set_regx_lshift;
     tests["skip_if_not_equal_regs"] = c8tests::skip_if_not_equal_regs;
+    tests["set_reg_rand_masked"] = c8tests::set_reg_rand_masked;
+    tests["wait_key_press_store"] = c8tests::wait_key_press_store;
+    tests["hash_state"] = c8tests::hash_state;
+    tests["idle_skip"] = c8tests::idle_skip;
+    tests["input_queue"] = c8tests::input_queue;
+    tests["sound_timer_tone"] = c8tests::sound_timer_tone;
+    tests["load_bounds"] = c8tests::load_bounds;
+    tests["rom_pack"] = c8tests::rom_pack;
+    tests["draw_sprite"] = c8tests::draw_sprite;
+    tests["scroll_screen"] = c8tests::scroll_screen;
+    tests["xo_chip"] = c8tests::xo_chip;
+    tests["quirk_profiles"] = c8tests::quirk_profiles;
+    tests["run_stop_reasons"] = c8tests::run_stop_reasons;
+    tests["c_api"] = c8tests::c_api;
+    tests["exec_profile"] = c8tests::exec_profile;
+    tests["trace_ring"] = c8tests::trace_ring;
+    tests["stack_samples"] = c8tests::stack_samples;
+    tests["metrics"] = c8tests::metrics;
+    tests["input_latency"] = c8tests::input_latency;
+    tests["rom_generator"] = c8tests::rom_generator;
+    tests["lockstep"] = c8tests::lockstep;
+    tests["fuzz_target"] = c8tests::fuzz_target;
+    tests["debug_stub"] = c8tests::debug_stub;
+    tests["heatmap"] = c8tests::heatmap;
+    tests["memory_scan"] = c8tests::memory_scan;
+    tests["state_search"] = c8tests::state_search;
+}
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8vm_tests [-f filter] [-j jobs] [-o out.json] [concise]"
+        << endl;
 }
 
+// ----------------------------------------------------------------------------
 void print_result(const c8tests::result& result, bool concise) {
     if (!concise) {
         cout << "Test: " << result.name << endl;
         cout << "\tpassed: " << boolalpha << result.pass << endl;
+        cout << "\ttime: " << fixed << setprecision(3)
+            << result.ns / 1000000.0 << " ms" << endl;
         if (!result.pass) {
-            cout << "\texpected(" << std::endl << result.expected 
+            cout << "\texpected(" << std::endl << result.expected
                 << endl << "\t)" << endl
                 << "\tactual("   << std::endl << result.actual
                 << endl << "\t)" << endl;
@@ -53,26 +117,138 @@ void print_result(const c8tests::result& result, bool concise) {
     }
 }
 
-c8tests::result run_test(void (*test_fnc)(vmstate*, c8tests::result*), vmstate* state) {
-    c8tests::result r;
-    c8tests::clear_result(&r);
-    test_fnc(state, &r);
-    return r;
+// ----------------------------------------------------------------------------
+string json_string(const string& s) {
+    ostringstream out;
+    out << '"';
+    for (unsigned int i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c == '\n')
+            out << "\\n";
+        else if (c == '\t')
+            out << "\\t";
+        else if (c < 0x20)
+            out << "\\u" << hex << setfill('0') << setw(4) << (unsigned) c
+                << dec;
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
 }
 
+// ----------------------------------------------------------------------------
+void write_json(const vector<c8tests::result>& results, ostream& out) {
+    out << "{\"tests\": [";
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        const c8tests::result& r = results[i];
+        out << (i ? "," : "") << endl << " {\"name\": " << json_string(r.name)
+            << ", \"pass\": " << (r.pass ? "true" : "false") << ", \"ns\": "
+            << r.ns << ", \"expected\": " << json_string(r.expected)
+            << ", \"actual\": " << json_string(r.actual) << "}";
+    }
+    out << "]}" << endl;
+}
+
+// ----------------------------------------------------------------------------
+void run_test(test_fnc fnc, const vmstate* fresh, c8tests::result* r) {
+    /* on a private copy of `fresh`; on the heap, as it is too big for the
+     * stack of every worker
+     */
+    vmstate* state = new vmstate;
+    memcpy(state, fresh, sizeof(vmstate));
+    string name(r->name);
+    c8tests::clear_result(r);
+    r->name = name;
+    qword t0 = monotonic_ns();
+    fnc(state, r);
+    r->ns = monotonic_ns() - t0;
+    delete state;
+}
+
+// ----------------------------------------------------------------------------
+void worker(const vector<test_fnc>* fncs, const vmstate* fresh,
+            vector<c8tests::result>* results, atomic<unsigned int>* next) {
+    for (;;) {
+        unsigned int i = (*next)++;
+        if (i >= fncs->size())
+            return;
+        run_test((*fncs)[i], fresh, &(*results)[i]);
+    }
+}
+
+// ----------------------------------------------------------------------------
 int main(int argc, char** argv) {
-    populate_tests();
-    vmstate state;
+    int arg = 1;
+    string filter, json_path;
+    unsigned int jobs = thread::hardware_concurrency();
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-f") {
+            filter = argv[arg + 1];
+        } else if (opt == "-j" && atoi(argv[arg + 1]) > 0) {
+            jobs = atoi(argv[arg + 1]);
+        } else if (opt == "-o") {
+            json_path = argv[arg + 1];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
     bool concise = false;
-    if (argc > 1)
-        concise = strncmp("concise", argv[1], 7) == 0;
-    int num_tests = 0, num_passes = 0;
+    if (arg < argc)
+        concise = strncmp("concise", argv[arg], 7) == 0;
+    if (jobs == 0)
+        jobs = 1;
+
+    populate_tests();
+    vector<test_fnc> fncs;
+    vector<c8tests::result> results;
     for (auto i = tests.begin(); i != tests.end(); ++i) {
-        c8tests::result r(run_test(i->second, &state));
+        if (!filter.empty() && i->first.find(filter) == string::npos)
+            continue;
+        c8tests::result r;
+        c8tests::clear_result(&r);
         r.name = i->first;
-        ++num_tests;
-        if (r.pass) ++num_passes;
-        print_result(r, concise);
+        fncs.push_back(i->second);
+        results.push_back(r);
+    }
+    if (jobs > fncs.size())
+        jobs = fncs.size() ? fncs.size() : 1;
+
+    // what every test starts from: the state of a newly made vm
+    C8VM vm;
+    vmstate* fresh = new vmstate;
+    memcpy(fresh, vm.get_state(), sizeof(vmstate));
+
+    qword t0 = monotonic_ns();
+    atomic<unsigned int> next(0);
+    vector<thread> threads;
+    for (unsigned int j = 0; j < jobs; ++j)
+        threads.push_back(thread(worker, &fncs, fresh, &results, &next));
+    for (unsigned int j = 0; j < threads.size(); ++j)
+        threads[j].join();
+    qword wall = monotonic_ns() - t0;
+    delete fresh;
+
+    int num_passes = 0;
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        if (results[i].pass)
+            ++num_passes;
+        print_result(results[i], concise);
+    }
+    cout << endl << num_passes << " out of " << results.size()
+        << " passed (" << fixed << setprecision(1) << wall / 1000000.0
+        << " ms, " << jobs << " jobs)." << endl;
+    if (!json_path.empty()) {
+        ofstream json(json_path.c_str());
+        if (!json) {
+            cerr << "could not write " << json_path << endl;
+            return 1;
+        }
+        write_json(results, json);
     }
-    cout << endl << num_passes << " out of " << num_tests << " passed." << endl;
+    return num_passes == (int) results.size() ? 0 : 1;
 }
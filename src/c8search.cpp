@@ -0,0 +1,134 @@
+#include "search.h"
+#include "rom.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8search: search for the keys that take a ROM to a goal (see search.h).
+ *
+ *     c8search [-m chip8|schip|xochip] [-q vip|schip|modern] [-g goal]
+ *              [-k masks] [-s frames] [-d depth] [-n states] [-w width]
+ *              [-j jobs] <rom>
+ *
+ * Runs the ROM for `frames` frames with no keys held (default 0, to get
+ * past a title screen), then searches breadth first from there, a frame a
+ * level, holding each of `masks` (comma separated hex key masks, bit k for
+ * key k; default each key alone) for a frame. The goal is a byte of memory
+ * or a register, `<addr>=<value>`, `<addr>>=<value>` or `vX>=<value>` in
+ * hex; with none the search runs until it runs out of depth, states or
+ * new positions.
+ *
+ * A line is printed per level, and at the end the counts and the
+ * throughput in states (frames run) per second. If the goal was reached
+ * the inputs that reach it are printed, a key mask per frame, and the exit
+ * status is 0; otherwise it is 2.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8search [-m chip8|schip|xochip] [-q vip|schip|modern] "
+        << "[-g goal]" << endl
+        << "                [-k masks] [-s frames] [-d depth] [-n states] "
+        << "[-w width]" << endl
+        << "                [-j jobs] <rom>" << endl;
+}
+
+// ----------------------------------------------------------------------------
+void print_level(const search_stats& stats, unsigned int width, void*) {
+    cout << "depth " << setw(6) << stats.depth << "  width " << setw(7)
+        << width << "  unique " << setw(10) << stats.unique << "  "
+        << fixed << setprecision(0) << states_per_second(stats)
+        << " states/s" << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    int arg = 1;
+    bool have_mode = false, have_quirks = false;
+    machine_mode mode = mode_chip8;
+    quirk_profile quirks = profile_vip;
+    long settle = 0;
+    search_config config;
+    search_defaults(&config);
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-m" && parse_mode(argv[arg + 1], &mode)) {
+            have_mode = true;
+        } else if (opt == "-q" && parse_quirks(argv[arg + 1], &quirks)) {
+            have_quirks = true;
+        } else if (opt == "-g" && parse_goal(argv[arg + 1], &config.goal)) {
+            config.have_goal = true;
+        } else if (opt == "-k") {
+            if (!parse_inputs(argv[arg + 1], &config.inputs)) {
+                print_usage();
+                return 1;
+            }
+        } else if (opt == "-s") {
+            settle = atol(argv[arg + 1]);
+        } else if (opt == "-d") {
+            config.max_depth = atoi(argv[arg + 1]);
+        } else if (opt == "-n") {
+            config.max_states = strtoull(argv[arg + 1], NULL, 10);
+        } else if (opt == "-w") {
+            config.max_width = atoi(argv[arg + 1]);
+        } else if (opt == "-j") {
+            config.jobs = atoi(argv[arg + 1]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc != arg + 1 || !config.max_width) {
+        print_usage();
+        return 1;
+    }
+    const char* rom_path = argv[arg];
+    rom_file rom;
+    if (!rom.open(rom_path)) {
+        cerr << "could not open " << rom_path << endl;
+        return 1;
+    }
+    C8VM vm;
+    vm.set_mode(have_mode ? mode : mode_for_rom(rom_path));
+    if (have_quirks)
+        vm.set_quirks(quirks);
+    if (!vm.load(rom.get_data(), rom.get_size())) {
+        cerr << rom_path << ": not a loadable ROM" << endl;
+        return 1;
+    }
+    rom.close();
+    vm.start();
+    for (long f = 0; f < settle && vm.is_on(); ++f)
+        vm.run(0, 1);
+    if (!vm.is_on()) {
+        cerr << rom_path << ": stopped within " << settle << " frames"
+            << endl;
+        return 1;
+    }
+
+    search_stats stats;
+    search_run(vm.get_state(), config, &stats, print_level, NULL);
+    cout << stats.expanded << " states from " << stats.depth << " levels: "
+        << stats.unique << " unique, " << stats.duplicates << " duplicates, "
+        << stats.dead << " dead, " << stats.dropped << " dropped" << endl
+        << fixed << setprecision(1) << stats.ns / 1e6 << " ms, "
+        << setprecision(0) << states_per_second(stats) << " states/s ("
+        << (config.jobs ? config.jobs : 1) << " jobs)" << endl;
+    if (!config.have_goal)
+        return 0;
+    if (!stats.found) {
+        cout << "goal not reached" << endl;
+        return 2;
+    }
+    cout << "goal reached in " << stats.path.size() << " frames:";
+    for (unsigned int i = 0; i < stats.path.size(); ++i)
+        cout << " " << hex << stats.path[i] << dec;
+    cout << endl;
+    return 0;
+}
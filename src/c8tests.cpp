@@ -1,13 +1,40 @@
 #include "c8tests.h"
 #include "iset.h"
 #include "debug.h"
+#include "hash.h"
+#include "c8.h"
+#include "rompack.h"
+#include "gfx.h"
+#include "c8api.h"
+#include "profile.h"
+#include "trace.h"
+#include "metrics.h"
+#include "romgen.h"
+#include "lockstep.h"
+#include "fuzz.h"
+#include "gdbstub.h"
+#include "heatmap.h"
+#include "memscan.h"
+#include "search.h"
+#include "hashset.h"
+#include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "stdio.h"
 
 void c8tests::clear_result(result* r) {
     r->pass = false;
     r->expected = "DEFAULT";
     r->actual   = "DEFAULT";
     r->name     = "DEFAULT";
+    r->ns       = 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -19,11 +46,13 @@ void c8tests::call_prog(vmstate* state, result* result) {
 
 // ----------------------------------------------------------------------------
 void c8tests::clear_screen(vmstate* state, result* result) {
+    state->planes = 0x3;
     iset::clear_screen(state);
     result->expected = "cleared";
     result->actual   = "cleared";
-    for (int i = 0; i < 64 * 32; ++i) {
-        if (state->gfx_buffer[i] != 0) {
+    const qword* words = &state->gfx[0][0][0];
+    for (unsigned int i = 0; i < sizeof(state->gfx) / sizeof(qword); ++i) {
+        if (words[i] != 0) {
             result->actual = "not cleared";
             break;
         }
@@ -70,7 +99,7 @@ void c8tests::call_routine(vmstate* state, result* result) {
          expected_ip = 0x0DED;
     iset::call_routine(state);
     word actual_sp = state->sp,
-         actual_sp_follow = state->stack[state->sp],
+         actual_sp_follow = state->stack[state->sp - 1],
          actual_ip = state->ip;
     expected << "sp = " << expected_sp << std::endl
         << "sp follow = " << expected_sp_follow << std::endl
@@ -352,7 +381,7 @@ void c8tests::set_regx_rshift(vmstate* state, result* result) {
     state->curr_opcode    = 0x8AB6;
 
     c8register expected_reg     = 0xAB >> 1;
-    iset::set_regx_rshift(state);
+    iset::set_regx_rshift<quirks_schip>(state);
     word actual_reg = state->registers[0xA];
     expected << "registers[0xA] = " ; print_hex(expected, expected_reg);
     expected << std::endl;
@@ -391,7 +420,7 @@ void c8tests::set_regx_lshift(vmstate* state, result* result) {
     state->curr_opcode    = 0x8ABE;
 
     c8register expected_reg     = 0xAB << 1;
-    iset::set_regx_lshift(state);
+    iset::set_regx_lshift<quirks_schip>(state);
     word actual_reg = state->registers[0xA];
     expected << "registers[0xA] = " ; print_hex(expected, expected_reg);
     expected << std::endl;
@@ -434,3 +463,1454 @@ void c8tests::skip_if_not_equal_regs(vmstate* state, result* result) {
 }
 
 // ----------------------------------------------------------------------------
+void c8tests::set_reg_rand_masked(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    state->rng            = RNG_SEED;
+    state->registers[0x0] = 0xAA;
+    state->registers[0x7] = 0xFF;
+    state->curr_opcode    = 0xC70F;
+
+    /* the random value lands in register X (not register 0), masked, and
+       the same seed always produces the same value */
+    iset::set_reg_rand_masked(state);
+    word first = state->registers[0x7];
+    state->rng = RNG_SEED;
+    iset::set_reg_rand_masked(state);
+    word second = state->registers[0x7];
+    expected << "registers[0x0] = " ; print_hex(expected, 0xAA);
+    expected << std::endl << "masked = true" << std::endl
+        << "repeatable = true" << std::endl;
+    actual   << "registers[0x0] = " ; print_hex(actual, state->registers[0x0]);
+    actual << std::endl << "masked = " << std::boolalpha
+        << ((first & 0xF0) == 0) << std::endl
+        << "repeatable = " << (first == second) << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::wait_key_press_store(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    for (unsigned int i = 0; i < KEY_SIZE; ++i)
+        state->key[i] = 0;
+    state->waiting_key    = false;
+    state->registers[0x4] = 0x0;
+    state->ip             = 0x202;
+    state->curr_opcode    = 0xF40A;
+
+    /* with no key down the vm blocks (without rewinding ip) ... */
+    iset::wait_key_press_store(state);
+    expected << "blocked = true, ip = " ; print_hex(expected, 0x202);
+    expected << std::endl;
+    actual << std::boolalpha << "blocked = " << state->waiting_key
+        << ", ip = " ; print_hex(actual, state->ip);
+    actual << std::endl;
+
+    /* ... and completes once one is, storing it in register X; key F
+       counts too */
+    state->curr_opcode = 0x0000;
+    state->key[0xF]    = 1;
+    iset::wait_key_press_store(state);
+    expected << "blocked = false, registers[0x4] = " ; print_hex(expected, 0xF);
+    expected << std::endl;
+    actual << "blocked = " << state->waiting_key << ", registers[0x4] = " ;
+    print_hex(actual, state->registers[0x4]);
+    actual << std::endl;
+    state->key[0xF] = 0;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::hash_state(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    qword before = ::hash_state(state);
+
+    /* flipping a single pixel must change both hashes, and flipping it back
+       must restore them */
+    state->gfx[0][GFX_H - 1][0] ^= 1;
+    qword flipped = ::hash_state(state),
+          flipped_gfx = hash_gfx(state);
+    state->gfx[0][GFX_H - 1][0] ^= 1;
+    qword after = ::hash_state(state),
+          after_gfx = hash_gfx(state);
+
+    expected << "changed = true" << std::endl
+        << "gfx changed = true" << std::endl
+        << "restored = true" << std::endl;
+    actual << std::boolalpha
+        << "changed = " << (flipped != before) << std::endl
+        << "gfx changed = " << (flipped_gfx != after_gfx) << std::endl
+        << "restored = " << (after == before) << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::idle_skip(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* a delay timer wait loop followed by an FX0A key wait; stepping frame
+       by frame (which fast forwards both) must end in exactly the state that
+       stepping instruction by instruction does */
+    const byte prog[] = {
+        0x63, 0x05,             // 200: V3 = 5
+        0xF3, 0x15,             // 202: DT = V3
+        0xF4, 0x07,             // 204: V4 = DT
+        0x34, 0x00,             // 206: skip if V4 == 0
+        0x12, 0x04,             // 208: jmp 204
+        0x75, 0x01,             // 20A: V5 += 1
+        0xF6, 0x0A,             // 20C: V6 = key
+        0x12, 0x00,             // 20E: jmp 200
+    };
+    std::string bin((const char*) prog, sizeof(prog));
+    C8VM framed, stepped;
+    framed.load(bin);
+    stepped.load(bin);
+    framed.start();
+    stepped.start();
+    for (unsigned int frame = 0; frame < 40; ++frame) {
+        framed.do_frame();
+        for (unsigned int i = 0; i < CYCLES_PER_FRAME; ++i)
+            stepped.do_cycle();
+        if (frame == 20) {
+            framed.get_keys()[0x3]  = 1;
+            stepped.get_keys()[0x3] = 1;
+        }
+    }
+    expected << "state = " << std::hex << ::hash_state(stepped.get_state())
+        << std::endl;
+    actual   << "state = " << std::hex << ::hash_state(framed.get_state())
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::input_queue(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* posted keys only reach the guest at the start of the frame they are
+       due, in the order they were posted */
+    const byte prog[] = { 0x12, 0x00 }; // 200: jmp 200
+    C8VM vm;
+    vm.load(std::string((const char*) prog, sizeof(prog)));
+    vm.start();
+    vm.post_key_at(2, 0x7, true);
+    vm.post_key_at(2, 0x8, true);
+    vm.post_key_at(4, 0x7, false);
+    vm.post_key(0x9, true); // queued behind the scripted events
+    const byte* keys = vm.get_state()->key;
+    expected << "1: 000" << std::endl << "2: 000" << std::endl
+        << "3: 110" << std::endl << "4: 110" << std::endl
+        << "5: 011" << std::endl << "applied = 4" << std::endl;
+    for (unsigned int frame = 1; frame <= 5; ++frame) {
+        // frame 0 ran, so after `frame` calls we've seen frames 0..frame-1
+        vm.do_frame();
+        actual << frame << ": " << (int) keys[0x7] << (int) keys[0x8]
+            << (int) keys[0x9] << std::endl;
+    }
+    actual << "applied = " << vm.get_input_stats().applied << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::sound_timer_tone(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* FX18 with 3 in the register: the tone plays for exactly three frames
+       of samples, then silence; asking the sink for more than was made is
+       an underrun */
+    const byte prog[] = {
+        0x63, 0x03,             // 200: V3 = 3
+        0xF3, 0x18,             // 202: ST = V3
+        0x12, 0x04,             // 204: jmp 204
+    };
+    audio_ring ring;
+    tone_generator tone(&ring);
+    C8VM vm;
+    vm.load(std::string((const char*) prog, sizeof(prog)));
+    vm.set_audio(&tone);
+    vm.start();
+    for (unsigned int frame = 0; frame < 6; ++frame)
+        vm.do_frame();
+    vm.do_cycle(); // first cycle of frame 6, which ticks the timers
+
+    // frame 0 ticked before FX18 ran, so frames 1-3 sound
+    short samples[7 * AUDIO_FRAME];
+    unsigned int got = ring.pop(samples, 7 * AUDIO_FRAME), loud[7] = { 0 };
+    for (unsigned int i = 0; i < got; ++i)
+        loud[i / AUDIO_FRAME] += samples[i] != 0;
+    expected << "samples = " << 7 * AUDIO_FRAME << std::endl
+        << "loud = 0 " << AUDIO_FRAME << " " << AUDIO_FRAME << " "
+        << AUDIO_FRAME << " 0 0 0" << std::endl
+        << "underruns = 1" << std::endl;
+    actual << "samples = " << got << std::endl << "loud =";
+    for (unsigned int i = 0; i < 7; ++i)
+        actual << " " << loud[i];
+    actual << std::endl;
+
+    null_sink sink;
+    sink.pump(&ring, AUDIO_FRAME);
+    actual << "underruns = " << sink.get_underruns() << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::load_bounds(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* a ROM that exactly fills memory above PROG_START loads; one byte more
+       is refused without touching memory, as is an empty image */
+    static byte rom[MAX_ROM_SIZE + 1];
+    for (unsigned int i = 0; i < sizeof(rom); ++i)
+        rom[i] = (byte) i;
+    C8VM vm;
+    const byte* mem = vm.get_state()->memory;
+    bool too_big = vm.load(rom, MAX_ROM_SIZE + 1),
+         empty   = vm.load(rom, 0);
+    byte untouched = mem[MEM_SIZE - 1];
+    bool fits = vm.load(rom, MAX_ROM_SIZE);
+    expected << std::boolalpha << "too big = false, empty = false" << std::endl
+        << "untouched = 0, fits = true, last = " << (int) (byte) (MAX_ROM_SIZE - 1)
+        << std::endl;
+    actual << std::boolalpha << "too big = " << too_big << ", empty = " << empty
+        << std::endl << "untouched = " << (int) untouched << ", fits = " << fits
+        << ", last = " << (int) mem[MEM_SIZE - 1] << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::rom_pack(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* pack three ROMs (two identical), then look them up by name and by
+       content hash, and load one straight out of the mapping, in the mode
+       it was packed with */
+    char path[] = "/tmp/c8tests_rom_pack.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        close(fd);
+    std::vector<pack_input> roms(3);
+    roms[0].name = "a.ch8"; roms[0].data = std::string("\x12\x00", 2);
+    roms[1].name = "b.ch8"; roms[1].data = std::string("\x60\x07\x12\x02", 4);
+    roms[2].name = "c.xo8"; roms[2].data = roms[1].data;
+    roms[2].mode = mode_xochip;
+    bool written = write_rom_pack(path, roms);
+
+    ::rom_pack pack;
+    bool opened = pack.open(path);
+    rom_span b, c, by_hash, missing;
+    bool found_b = pack.find("b.ch8", &b),
+         found_c = pack.find("c.xo8", &c),
+         found_missing = pack.find("d.ch8", &missing),
+         found_hash = found_b && pack.find_hash(b.hash, &by_hash);
+    C8VM vm;
+    if (found_c)
+        vm.set_mode(c.mode);
+    bool loaded = found_c && vm.load(c.data, c.size);
+    vm.start();
+    vm.do_cycle();
+
+    expected << std::boolalpha << "written = true, opened = true, count = 3"
+        << std::endl << "found = true true false true" << std::endl
+        << "shared payload = true, page aligned = true" << std::endl
+        << "loaded = true, registers[0x0] = 7, modes = 0 2" << std::endl;
+    actual << std::boolalpha << "written = " << written << ", opened = "
+        << opened << ", count = " << pack.get_count() << std::endl
+        << "found = " << found_b << " " << found_c << " " << found_missing
+        << " " << found_hash << std::endl
+        << "shared payload = " << (found_b && found_c && b.data == c.data)
+        << ", page aligned = " << (found_b &&
+            ((unsigned long) b.data % PACK_PAGE) == 0) << std::endl
+        << "loaded = " << loaded << ", registers[0x0] = "
+        << (int) vm.get_state()->registers[0x0] << ", modes = "
+        << (found_b ? b.mode : -1) << " " << (found_c ? c.mode : -1)
+        << std::endl;
+    pack.close();
+
+    // an entry whose payload offset would wrap past the end of the mapping,
+    // and slots too few for the count, are both refused
+    std::string image;
+    {
+        std::ifstream in(path, std::ios::binary);
+        image.assign((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    }
+    std::string wrapped(image), crowded(image);
+    uint64_t far_off = ~(uint64_t) 0 - 1;
+    memcpy(&wrapped[sizeof(pack_header) + offsetof(pack_entry, data_off)],
+           &far_off, sizeof(far_off));
+    uint32_t few = 4;
+    memcpy(&crowded[offsetof(pack_header, slots)], &few, sizeof(few));
+    std::ofstream(path, std::ios::binary).write(wrapped.data(),
+                                                wrapped.size());
+    bool wrapped_opened = pack.open(path), got = pack.get(0, &b);
+    pack.close();
+    std::ofstream(path, std::ios::binary).write(crowded.data(),
+                                                crowded.size());
+    bool crowded_opened = pack.open(path);
+    pack.close();
+    remove(path);
+    expected << "corrupt = true false false" << std::endl;
+    actual << "corrupt = " << wrapped_opened << " " << got << " "
+        << crowded_opened << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::draw_sprite(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* an 8 pixel sprite drawn at x = 60 is clipped at the right edge of the
+       lo-res screen; drawing it again erases it and reports the collision */
+    const byte prog[] = {
+        0x60, 0x3C,             // 200: V0 = 60
+        0x61, 0x01,             // 202: V1 = 1
+        0xA2, 0x0E,             // 204: I = 20E
+        0xD0, 0x12,             // 206: draw 8x2 at (V0, V1)
+        0xD0, 0x12,             // 208: draw 8x2 at (V0, V1)
+        0xD0, 0x12,             // 20A: draw 8x2 at (V0, V1)
+        0x12, 0x0C,             // 20C: jmp 20C
+        0xFF, 0x81,             // 20E: sprite
+    };
+    C8VM vm;
+    vm.load(std::string((const char*) prog, sizeof(prog)));
+    vm.start();
+    const vmstate* s = vm.get_state();
+    for (unsigned int i = 0; i < 4; ++i)
+        vm.do_cycle();
+    expected << std::hex << "drawn: f 8 0 vf = 0" << std::endl
+        << "erased: 0 0 vf = 1" << std::endl
+        << "redrawn: f 8 vf = 0" << std::endl;
+    actual << std::hex << "drawn: " << s->gfx[0][1][0] << " "
+        << s->gfx[0][2][0] << " " << s->gfx[0][1][1]
+        << " vf = " << (int) s->registers[0xF] << std::endl;
+    vm.do_cycle();
+    actual << "erased: " << s->gfx[0][1][0] << " " << s->gfx[0][2][0]
+        << " vf = " << (int) s->registers[0xF] << std::endl;
+    vm.do_cycle();
+    actual << "redrawn: " << s->gfx[0][1][0] << " " << s->gfx[0][2][0]
+        << " vf = " << (int) s->registers[0xF] << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::scroll_screen(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* SCHIP hi-res: a row straddling the two words of a 128 pixel line is
+       scrolled right, down and back left */
+    const byte prog[] = {
+        0x00, 0xFF,             // 200: hires
+        0x60, 0x3C,             // 202: V0 = 60
+        0x61, 0x00,             // 204: V1 = 0
+        0xA2, 0x12,             // 206: I = 212
+        0xD0, 0x11,             // 208: draw 8x1 at (V0, V1)
+        0x00, 0xFB,             // 20A: scroll right 4
+        0x00, 0xC2,             // 20C: scroll down 2
+        0x00, 0xFC,             // 20E: scroll left 4
+        0x12, 0x10,             // 210: jmp 210
+        0xFF,                   // 212: sprite
+    };
+    C8VM vm;
+    vm.set_mode(mode_schip);
+    vm.load(std::string((const char*) prog, sizeof(prog)));
+    vm.start();
+    const vmstate* s = vm.get_state();
+    for (unsigned int i = 0; i < 5; ++i)
+        vm.do_cycle();
+    expected << std::hex
+        << "drawn: f f000000000000000" << std::endl
+        << "right: 0 ff00000000000000" << std::endl
+        << "down: 0 0 0 ff00000000000000" << std::endl
+        << "left: f f000000000000000" << std::endl;
+    actual << std::hex << "drawn: " << s->gfx[0][0][0] << " "
+        << s->gfx[0][0][1] << std::endl;
+    vm.do_cycle();
+    actual << "right: " << s->gfx[0][0][0] << " " << s->gfx[0][0][1]
+        << std::endl;
+    vm.do_cycle();
+    actual << "down: " << s->gfx[0][0][1] << " " << s->gfx[0][1][1] << " "
+        << s->gfx[0][2][0] << " " << s->gfx[0][2][1] << std::endl;
+    vm.do_cycle();
+    actual << "left: " << s->gfx[0][2][0] << " " << s->gfx[0][2][1]
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::xo_chip(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* XO-CHIP: 16-bit I, register ranges above 4K, a skip over the four
+       byte F000 NNNN, and a 16x16 sprite drawn into both planes */
+    byte prog[0x80] = {
+        0xF3, 0x01,             // 200: planes = 3
+        0xF0, 0x00, 0x10, 0x00, // 202: I = 1000
+        0x60, 0x05,             // 206: V0 = 5
+        0x61, 0x06,             // 208: V1 = 6
+        0x50, 0x12,             // 20A: save V0-V1 at I
+        0x30, 0x05,             // 20C: skip if V0 == 5
+        0xF0, 0x00, 0x00, 0x00, // 20E: I = 0000
+        0x52, 0x33,             // 212: load V2-V3 from I
+        0x00, 0xFF,             // 214: hires
+        0x64, 0x00,             // 216: V4 = 0
+        0xA2, 0x40,             // 218: I = 240
+        0xD4, 0x40,             // 21A: draw 16x16 at (V4, V4)
+        0x12, 0x1C,             // 21C: jmp 21C
+    };
+    prog[0x40] = 0xAB; prog[0x41] = 0xCD; // 240: plane 0 sprite
+    prog[0x60] = 0x12; prog[0x61] = 0x34; // 260: plane 1 sprite
+    C8VM vm;
+    vm.set_mode(mode_xochip);
+    vm.load(std::string((const char*) prog, sizeof(prog)));
+    vm.start();
+    for (unsigned int i = 0; i < 12; ++i)
+        vm.do_cycle();
+    const vmstate* s = vm.get_state();
+    expected << std::hex << "mem[1000] = 5 6, V2 = 5, V3 = 6" << std::endl
+        << "ip = 21c" << std::endl
+        << "planes = abcd000000000000 1234000000000000" << std::endl;
+    actual << std::hex << "mem[1000] = " << (int) s->memory[0x1000] << " "
+        << (int) s->memory[0x1001] << ", V2 = " << (int) s->registers[0x2]
+        << ", V3 = " << (int) s->registers[0x3] << std::endl
+        << "ip = " << s->ip << std::endl
+        << "planes = " << s->gfx[0][0][0] << " " << s->gfx[1][0][0]
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+template <class Q>
+static void run_quirks(vmstate* state, std::stringstream& out) {
+    state->registers[0x0] = 0x01;
+    state->registers[0x1] = 0x81;
+    state->registers[0x2] = 0x04;
+    state->curr_opcode    = 0x8216;
+    iset::set_regx_rshift<Q>(state);
+    out << "8XY6: " << (int) state->registers[0x2] << " vf "
+        << (int) state->registers[0xF];
+
+    state->mem_mask    = MEM_SIZE - 1;
+    state->index       = 0x300;
+    state->curr_opcode = 0xF255;
+    iset::dump_regs_to_regx<Q>(state);
+    out << ", FX55: i " << state->index;
+
+    state->registers[0x2] = 0x04;
+    state->curr_opcode    = 0xB210;
+    iset::jump_offset<Q>(state);
+    out << ", BNNN: " << state->ip;
+
+    state->mode   = mode_chip8;
+    state->hires  = false;
+    state->planes = 0x1;
+    gfx_clear(state->gfx[0]);
+    state->index          = 0x300;
+    state->memory[0x300]  = 0xFF;
+    state->memory[0x301]  = 0xFF;
+    state->registers[0x0] = 60;
+    state->registers[0x1] = 31;
+    state->curr_opcode    = 0xD012;
+    iset::draw_sprite<Q>(state);
+    out << ", DXYN: " << state->gfx[0][31][0] << " " << state->gfx[0][0][0]
+        << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::quirk_profiles(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* each profile's take on the shift, load/store, jump and sprite edge
+       quirks */
+    expected << std::hex
+        << "8XY6: 40 vf 1, FX55: i 303, BNNN: 211, DXYN: f 0" << std::endl
+        << "8XY6: 2 vf 0, FX55: i 300, BNNN: 214, DXYN: f 0" << std::endl
+        << "8XY6: 40 vf 1, FX55: i 303, BNNN: 211, DXYN: f00000000000000f "
+        << "f00000000000000f" << std::endl;
+    actual << std::hex;
+    run_quirks<quirks_vip>(state, actual);
+    run_quirks<quirks_schip>(state, actual);
+    run_quirks<quirks_modern>(state, actual);
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static void run_and_print(C8VM& vm, long max_cycles, long max_frames,
+                          std::stringstream& out) {
+    const char* kinds[] = {
+        "budget", "frame", "waiting_key", "fault", "breakpoint", "halted"
+    };
+    stop_reason r = vm.run(max_cycles, max_frames);
+    out << kinds[r.kind] << " fault " << (int) r.fault << " addr " << r.addr
+        << " cycles " << std::dec << r.cycles << std::hex << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+static void run_prog(const std::string& prog, machine_mode mode, word bp,
+                     long max_cycles, long max_frames,
+                     std::stringstream& out) {
+    C8VM vm;
+    vm.set_mode(mode);
+    vm.load(prog);
+    if (bp)
+        vm.set_breakpoint(bp);
+    vm.start();
+    run_and_print(vm, max_cycles, max_frames, out);
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::run_stop_reasons(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* one small program per way `run` can return */
+    expected << std::hex
+        << "budget fault 0 addr 0 cycles 25" << std::endl
+        << "frame fault 0 addr 0 cycles 20" << std::endl
+        << "waiting_key fault 0 addr 0 cycles 10" << std::endl
+        << "fault fault 1 addr 200 cycles 17" << std::endl
+        << "fault fault 2 addr 200 cycles 1" << std::endl
+        << "fault fault 4 addr 202 cycles 2" << std::endl
+        << "fault fault 8 addr ffe cycles 2" << std::endl
+        << "breakpoint fault 0 addr 204 cycles 2" << std::endl
+        << "breakpoint fault 0 addr 204 cycles 3" << std::endl
+        << "halted fault 0 addr 0 cycles 1" << std::endl
+        << "sp 10 0" << std::endl;
+    actual << std::hex;
+    std::string spin("\x12\x00", 2),            // 200: jmp 200
+                wait("\xF0\x0A", 2),            // 200: V0 = key
+                recurse("\x22\x00", 2),         // 200: call 200
+                ret("\x00\xEE", 2),             // 200: ret
+                invalid("\x60\x00\x80\x08", 4), // 202: 8008
+                overrun("\x1F\xFE", 2),         // 200: jmp FFE
+                loop("\x60\x01\x70\x01\x70\x01\x12\x02", 8),
+                halt("\x00\xFD", 2);            // 200: exit
+    run_prog(spin, mode_chip8, 0, 25, 0, actual);
+    run_prog(spin, mode_chip8, 0, 0, 2, actual);
+    run_prog(wait, mode_chip8, 0, 0, 5, actual);
+    run_prog(recurse, mode_chip8, 0, 100, 0, actual);
+    run_prog(ret, mode_chip8, 0, 100, 0, actual);
+    run_prog(invalid, mode_chip8, 0, 100, 0, actual);
+    run_prog(overrun, mode_chip8, 0, 100, 0, actual);
+    C8VM vm; // resuming steps off the breakpoint it stopped on
+    vm.load(loop);
+    vm.set_breakpoint(0x204);
+    vm.start();
+    run_and_print(vm, 100, 0, actual);
+    run_and_print(vm, 100, 0, actual);
+    run_prog(halt, mode_schip, 0, 100, 0, actual);
+    // the call or return that faults leaves the stack as it was
+    C8VM deep, shallow;
+    deep.load(recurse);
+    deep.start();
+    deep.run(100, 0);
+    shallow.load(ret);
+    shallow.start();
+    shallow.run(100, 0);
+    actual << "sp " << deep.get_state()->sp << " " << shallow.get_state()->sp
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::c_api(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* drive a vm through the C interface: a batch of frames blocked in
+     * FX0A, a key, the in-place framebuffer, and a snapshot replayed; then
+     * a breakpoint, and a watch on a write seen in the heatmap
+     */
+    expected << std::hex
+        << "frame frames 5 cycles 50" << std::endl
+        << "frame frames 1 row f000000000000000 stale 1 same 1" << std::endl
+        << "budget cycles 19 replay 1 small 1" << std::endl
+        << "bad -1 -1 -1 1" << std::endl
+        << "breakpoint 204 watchpoint 300 1 1 1000" << std::endl
+        << "bad -1 -1 -1 -1" << std::endl;
+    actual << std::hex;
+    // 200: V0 = key, 202: I = glyph(V0), 204: draw at (V1, V1), 206: spin
+    const byte prog[] = { 0xF0, 0x0A, 0xF0, 0x29, 0xD1, 0x15, 0x12, 0x06 };
+    const char* kinds[] = {
+        "budget", "frame", "waiting_key", "fault", "breakpoint", "halted",
+        "watchpoint"
+    };
+    c8vm_handle* vm = c8vm_create(C8VM_MODE_CHIP8, C8VM_QUIRKS_DEFAULT);
+    c8vm_load(vm, prog, sizeof(prog));
+    c8vm_stop stop;
+    c8vm_step_frames(vm, 5, &stop);
+    actual << kinds[stop.kind] << std::dec << " frames " << stop.frames
+        << " cycles " << stop.cycles << std::hex << std::endl;
+
+    c8vm_framebuffer_info before, after;
+    c8vm_framebuffer(vm, &before);
+    c8vm_framebuffer_ack(vm);
+    c8vm_key(vm, 0x7, 1);
+    c8vm_step_frames(vm, 1, &stop);
+    c8vm_framebuffer(vm, &after);
+    actual << kinds[stop.kind] << std::dec << " frames " << stop.frames
+        << std::hex << " row " << after.planes[0] << " stale " << after.stale
+        << " same " << (before.planes == after.planes) << std::endl;
+
+    std::string snap(c8vm_snapshot_size(vm), '\0');
+    c8vm_snapshot(vm, &snap[0], snap.size());
+    c8vm_step_cycles(vm, 19, &stop);
+    qword h = c8vm_state_hash(vm);
+    c8vm_restore(vm, snap.data(), snap.size());
+    c8vm_step_cycles(vm, 19, &stop);
+    actual << kinds[stop.kind] << std::dec << " cycles " << stop.cycles
+        << std::hex << " replay " << (c8vm_state_hash(vm) == h)
+        << " small " << (snap.size() < 2 * MEM_SIZE) << std::endl;
+
+    snap[0] ^= 0xFF;
+    actual << std::dec << "bad "
+        << c8vm_restore(vm, snap.data(), snap.size()) << " "
+        << c8vm_key(vm, KEY_SIZE, 1) << " "
+        << c8vm_step_frames(vm, 0, NULL) << " "
+        << (c8vm_create(7, C8VM_QUIRKS_DEFAULT) == NULL) << std::endl;
+    c8vm_destroy(vm);
+
+    // 200: V0 = 5, 202: I = 300, 204: store V0 at 300, 206: spin
+    const byte store[] = { 0x60, 0x05, 0xA3, 0x00, 0xF0, 0x55, 0x12, 0x06 };
+    vm = c8vm_create(C8VM_MODE_CHIP8, C8VM_QUIRKS_DEFAULT);
+    c8vm_load(vm, store, sizeof(store));
+    c8vm_breakpoint(vm, 0x204, 1);
+    c8vm_step_frames(vm, 1, &stop);
+    actual << std::hex << kinds[stop.kind] << " " << stop.addr;
+    c8vm_breakpoint(vm, 0x204, 0);
+    c8vm_set_heatmap(vm, 1);
+    c8vm_watch(vm, 0x300, 0x300, C8VM_ACCESS_WRITE, 5);
+    c8vm_step_frames(vm, 1, &stop);
+    c8vm_heatmap_info heat;
+    c8vm_heatmap(vm, &heat);
+    actual << " " << kinds[stop.kind] << " " << stop.addr << " "
+        << heat.writes[0x300] << " " << heat.execs[0x204] << " " << heat.size
+        << std::endl;
+    actual << std::dec << "bad " << c8vm_breakpoint(vm, XO_MEM_SIZE, 1) << " "
+        << c8vm_watch(vm, 0x300, 0x300, 0x8, -1) << " "
+        << c8vm_watch(vm, 0x300, 0x300, C8VM_ACCESS_READ, 0x100) << " ";
+    c8vm_set_heatmap(vm, 0);
+    actual << c8vm_heatmap(vm, &heat) << std::endl;
+    c8vm_destroy(vm);
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::exec_profile(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* a 3 instruction loop for two frames: every instruction counted (idle
+     * skipping is off while profiling), then one in four
+     */
+    expected << std::dec
+        << "20 7 6 6 add_reg 7 jump 6 skip_if_equal 6" << std::endl
+        << "5 20 add_reg 8 jump 8" << std::endl
+        << "20 0" << std::endl;
+    // 200: V0 = 0, 202: V0 += 1, 204: skip if V0 == 0 (never), 206: jmp 202
+    std::string loop("\x60\x00\x70\x01\x30\x00\x12\x02", 8);
+    vm_profile* profile = new vm_profile;
+    C8VM vm;
+    vm.load(loop);
+    profile_clear(profile, 1);
+    vm.set_profile(profile);
+    vm.start();
+    vm.run(0, 2);
+    iset::op_class add = iset::classify(0x7001, mode_chip8),
+                   jmp = iset::classify(0x1202, mode_chip8);
+    actual << profile->counted << " " << profile->by_pc[0x202] << " "
+        << profile->by_pc[0x204] << " " << profile->by_pc[0x206] << " "
+        << iset::op_name(add) << " " << profile->by_opcode[0x7001] << " "
+        << iset::op_name(jmp) << " " << profile->by_opcode[0x1202] << " "
+        << iset::op_name(iset::classify(0x3000, mode_chip8)) << " "
+        << profile->by_opcode[0x3000] << std::endl;
+
+    vm.reset();
+    vm.load(loop);
+    profile_clear(profile, 4);
+    vm.set_profile(profile);
+    vm.start();
+    vm.run(0, 2);
+    actual << profile->counted << " " << profile->counted * profile->interval
+        << " add_reg " << profile->by_opcode[0x7001] * profile->interval
+        << " jump " << profile->by_opcode[0x1202] * profile->interval
+        << std::endl;
+
+    // switched off, nothing is counted and idle loops are skipped again
+    vm.set_profile(NULL);
+    profile_clear(profile, 1);
+    vm.run(0, 2);
+    actual << vm.get_state()->cycles / 2 << " " << profile->counted
+        << std::endl;
+    delete profile;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::trace_ring(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* count V0 up to 5, then fault; a ring of 5 (rounded up to 8) keeps the
+     * last 8 instructions, which survive a dump and read back
+     */
+    expected << std::hex
+        << "capacity 8 count 8" << std::endl
+        << "8 204 3005 SE V0, 05 v0 3" << std::endl
+        << "f 208 8008 DW 8008 v0 5" << std::endl
+        << "read 1 mode 0 count 8 same 1" << std::endl
+        << "LD V3, 2A | DRW V1, V2, F | SE V4, V5 | LD I, 123 | SCU 4"
+        << std::endl;
+    const char* path = "c8tests_trace.tmp";
+    std::string prog("\x60\x00\x70\x01\x30\x05\x12\x02\x80\x08", 10);
+    ::trace_ring ring(5);
+    C8VM vm;
+    vm.load(prog);
+    vm.set_trace(&ring);
+    vm.start();
+    vm.run(0, 0);
+    const trace_record &oldest = ring.get(0),
+                       &newest = ring.get(ring.get_count() - 1);
+    actual << std::hex << "capacity " << ring.get_capacity() << " count "
+        << ring.get_count() << std::endl;
+    actual << oldest.cycle << " " << oldest.pc << " " << oldest.opcode << " "
+        << disassemble(oldest.opcode, mode_chip8) << " v0 "
+        << (int) oldest.vx << std::endl;
+    actual << newest.cycle << " " << newest.pc << " " << newest.opcode << " "
+        << disassemble(newest.opcode, mode_chip8) << " v0 "
+        << (int) newest.vx << std::endl;
+
+    std::vector<trace_record> records;
+    byte mode = 0xFF;
+    bool read = ring.dump(path, mode_chip8) &&
+                read_trace(path, records, &mode);
+    bool same = records.size() == ring.get_count();
+    for (unsigned int i = 0; same && i < records.size(); ++i)
+        same = memcmp(&records[i], &ring.get(i), sizeof(trace_record)) == 0;
+    remove(path);
+    actual << "read " << read << " mode " << (int) mode << " count "
+        << records.size() << " same " << same << std::endl;
+    actual << disassemble(0x632A, mode_chip8) << " | "
+        << disassemble(0xD12F, mode_chip8) << " | "
+        << disassemble(0x5450, mode_chip8) << " | "
+        << disassemble(0xA123, mode_chip8) << " | "
+        << disassemble(0x00D4, mode_xochip) << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::stack_samples(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* main calls 206, which calls 20C; sampling every instruction for two
+     * frames sees each of the 5 instructions of the loop 4 times
+     */
+    expected << "20 5" << std::endl
+        << "main;0x0200 4" << std::endl
+        << "main;0x0202 4" << std::endl
+        << "main;sub_206;0x0206 4" << std::endl
+        << "main;sub_206;0x0208 4" << std::endl
+        << "main;sub_206;sub_20c;0x020c 4" << std::endl;
+    std::string prog("\x22\x06\x12\x00\x00\x00\x22\x0C\x00\xEE\x00\x00"
+                     "\x00\xEE", 14);
+    vm_profile* profile = new vm_profile;
+    ::stack_samples stacks;
+    profile_clear(profile, 1);
+    profile->stacks = &stacks;
+    C8VM vm;
+    vm.load(prog);
+    vm.set_profile(profile);
+    vm.start();
+    vm.run(0, 2);
+    actual << stacks.get_total() << " " << stacks.get_distinct()
+        << std::endl;
+    stacks.write_folded(actual);
+    delete profile;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static void metrics_worker(metric_id counter, metric_id hist) {
+    for (unsigned int i = 0; i < 1000; ++i) {
+        metric_add(counter, 1);
+        metric_observe(hist, i);
+    }
+}
+
+// ----------------------------------------------------------------------------
+static bool has_line(const std::string& text, const std::string& line) {
+    return ("\n" + text).find("\n" + line + "\n") != std::string::npos;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::metrics(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* four threads each count 1000 and observe 0-999: the counts from
+     * every thread's shard add up, and the quantiles come out to the low
+     * edge of their bucket. Four more, on the shards the first four gave
+     * back, add to their counts rather than replace them. Histograms
+     * registered past the end of the table get METRIC_NONE, which
+     * updates leave alone, not a share of another histogram.
+     */
+    expected << "4000 -5 4000 1998000 0 480 960" << std::endl
+        << "1 1 1 1 1" << std::endl
+        << "8000 8000" << std::endl
+        << "1 0 8000" << std::endl;
+    metric_id counter = metric_counter("c8tests_metrics_total", "test"),
+              gauge   = metric_gauge("c8tests_metrics_gauge", "test"),
+              hist    = metric_histogram("c8tests_metrics_hist", "test");
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < 4; ++i)
+        threads.push_back(std::thread(metrics_worker, counter, hist));
+    for (unsigned int i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    metric_set(gauge, -5);
+    hist_snapshot* h = new hist_snapshot;
+    metric_read_histogram(hist, h);
+    actual << metric_read_counter(counter) << " " << metric_read_gauge(gauge)
+        << " " << h->count << " " << h->sum << " " << hist_quantile(h, 0)
+        << " " << hist_quantile(h, 0.5) << " " << hist_quantile(h, 0.99)
+        << std::endl;
+    delete h;
+    std::stringstream prom;
+    metrics_write_prometheus(prom);
+    std::string text = prom.str();
+    actual << has_line(text, "# TYPE c8tests_metrics_hist histogram") << " "
+        << has_line(text, "c8tests_metrics_total 4000") << " "
+        << has_line(text, "c8tests_metrics_hist_bucket{le=\"0\"} 4") << " "
+        << has_line(text, "c8tests_metrics_hist_bucket{le=\"+Inf\"} 4000")
+        << " " << has_line(text, "c8tests_metrics_hist_count 4000")
+        << std::endl;
+
+    threads.clear();
+    for (unsigned int i = 0; i < 4; ++i)
+        threads.push_back(std::thread(metrics_worker, counter, hist));
+    for (unsigned int i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    h = new hist_snapshot;
+    metric_read_histogram(hist, h);
+    actual << metric_read_counter(counter) << " " << h->count << std::endl;
+
+    metric_id full = hist;
+    for (unsigned int i = 0; i <= MAX_HISTOGRAMS && full != METRIC_NONE;
+         ++i) {
+        std::ostringstream name;
+        name << "c8tests_metrics_full_" << i;
+        full = metric_histogram(name.str().c_str(), "test");
+    }
+    metric_observe(full, 1);
+    metric_read_histogram(full, h);
+    actual << (full == METRIC_NONE) << " " << h->count << " ";
+    metric_read_histogram(hist, h);
+    actual << h->count << std::endl;
+    delete h;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::input_latency(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* the guest polls key 5 and clears the screen once it is down, so a
+     * press of 5 goes through every stage, and the stages add up to the
+     * total. A press of 7, which nothing reads, expires.
+     */
+    expected << "1 1 1 1 1 1" << std::endl
+        << "1 0 0 0 0 1 0" << std::endl;
+    std::string prog("\x60\x05\xE0\x9E\x12\x02\x00\xE0\x12\x08", 10);
+    ::input_latency tracker;
+    C8VM vm;
+    vm.load(prog);
+    vm.set_latency(&tracker);
+    vm.start();
+    vm.post_key(5, true);
+    vm.run(0, 1);
+    vm.presented();
+    qword stages = 0;
+    for (unsigned int s = 0; s < stage_total; ++s) {
+        actual << tracker.get_histogram((latency_stage) s)->count << " ";
+        stages += tracker.get_histogram((latency_stage) s)->sum;
+    }
+    const hist_snapshot* total = tracker.get_histogram(stage_total);
+    actual << total->count << " " << (total->sum == stages) << std::endl;
+
+    tracker.clear();
+    vm.post_key(7, true);
+    vm.run(0, LATENCY_EXPIRE_FRAMES + 1);
+    vm.presented();
+    for (unsigned int s = 0; s < num_latency_stages; ++s)
+        actual << tracker.get_histogram((latency_stage) s)->count << " ";
+    actual << tracker.get_expired() << " " << tracker.get_dropped()
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::rom_generator(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* a seed always gives the same program, and another seed another one;
+     * every preset runs without faulting for a range of seeds, and the
+     * calls preset goes exactly STACK_SIZE deep. The longest routines that
+     * fit 16 deep below the scratch area run; one group more doesn't fit,
+     * and makes no program rather than one overlapping scratch.
+     */
+    expected << "1 0 1 16" << std::endl
+        << "1 1 0 1" << std::endl;
+    static const char* presets[] = {
+        "mixed", "decode", "branch", "calls", "draw", "memory", "smc"
+    };
+    romgen_shape shape;
+    romgen_preset("mixed", &shape);
+    std::string a = romgen_generate(shape, 42), b = romgen_generate(shape, 42),
+                c = romgen_generate(shape, 43);
+    bool all_ran = true;
+    for (unsigned int p = 0; p < 7; ++p) {
+        romgen_preset(presets[p], &shape);
+        for (qword seed = 1; seed <= 20; ++seed) {
+            qword hash;
+            all_ran &= romgen_reference(romgen_generate(shape, seed), 20000,
+                                        &hash);
+        }
+    }
+    romgen_preset("calls", &shape);
+    C8VM vm;
+    vm.load(romgen_generate(shape, 1));
+    vm.start();
+    word deepest = 0;
+    for (unsigned int i = 0; i < 20000 && vm.is_on(); ++i) {
+        vm.do_cycle();
+        if (vm.get_state()->sp > deepest)
+            deepest = vm.get_state()->sp;
+    }
+    actual << (a == b) << " " << (a == c) << " " << all_ran << " "
+        << deepest << std::endl;
+
+    romgen_preset("calls", &shape);
+    shape.call_depth     = STACK_SIZE;
+    shape.routine_length = 23;
+    qword hash;
+    actual << romgen_fits(shape) << " "
+        << romgen_reference(romgen_generate(shape, 1), 20000, &hash) << " ";
+    shape.routine_length = 24;
+    actual << romgen_fits(shape) << " " << romgen_generate(shape, 1).empty()
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::lockstep(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* the stepping and fast cores agree on a synthetic program; VIP and
+     * SUPER-CHIP shift quirks part at the third instruction (8016), which
+     * bisection finds from a single interval of 1000
+     */
+    expected << "1 50000" << std::endl
+        << "0 3 204 8016" << std::endl;
+    std::vector<script_event> events;
+    script_event e = { 5, 0x1, true };
+    events.push_back(e);
+    std::stringstream report;
+    lockstep_result r;
+
+    romgen_shape shape;
+    romgen_preset("mixed", &shape);
+    std::string prog = romgen_generate(shape, 3);
+    lockstep_engine a(engine_step), b(engine_run);
+    a.load(prog, mode_chip8, false, profile_vip);
+    b.load(prog, mode_chip8, false, profile_vip);
+    actual << lockstep_run(a, b, events, 50000, 1000, &r, report) << " "
+        << r.cycles << std::endl;
+
+    std::string shift("\x60\x05\x61\x03\x80\x16\x12\x06", 8);
+    lockstep_engine c(engine_step), d(engine_run);
+    c.load(shift, mode_chip8, true, profile_vip);
+    d.load(shift, mode_chip8, true, profile_schip);
+    actual << lockstep_run(c, d, events, 5000, 1000, &r, report) << " "
+        << r.cycles << " " << std::hex << r.pc << " " << r.opcode
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::fuzz_target(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* returning with nothing on the stack, and calling with it full, fault
+     * without taking sp past either end; a ROM too big to load is run and
+     * counted as such; a stray write past CHIP-8 memory is caught; and a
+     * short run from a generated seed finds new coverage and nothing wrong
+     */
+    expected << "fault fault unloadable 3" << std::endl
+        << "write past memory, at or after 1005" << std::endl
+        << "stack pointer 17 past the stack" << std::endl
+        << "1 0 0" << std::endl;
+    fuzzer f(mode_chip8, 1000, 1, false);
+    fuzz_case c;
+    std::string why;
+    c.rom = std::string("\x00\xEE", 2);
+    actual << fuzz_outcome_name(f.execute(c, &why)) << " ";
+    c.rom = std::string("\x22\x00", 2);
+    actual << fuzz_outcome_name(f.execute(c, &why)) << " ";
+    c.rom = std::string(MAX_ROM_SIZE + 2, '\x12');
+    actual << fuzz_outcome_name(f.execute(c, &why)) << " "
+        << f.get_stats()->execs << std::endl;
+
+    state->memory[MEM_SIZE + 5] = 0x1;
+    fuzz_check_memory(state, &why);
+    actual << why << std::endl;
+    state->memory[MEM_SIZE + 5] = 0x0;
+    state->sp = STACK_SIZE + 1;
+    fuzz_check_state(state, &why);
+    actual << why << std::endl;
+
+    romgen_shape shape;
+    romgen_preset("mixed", &shape);
+    shape.length = 32;
+    c.rom = romgen_generate(shape, 1);
+    f.add(c);
+    for (unsigned int i = 0; i < 2000; ++i)
+        f.round(&c, &why);
+    const fuzz_stats* s = f.get_stats();
+    actual << (f.get_corpus().size() > 1) << " "
+        << s->outcomes[outcome_stuck] << " " << s->outcomes[outcome_broken]
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static std::string monitor(::gdb_stub& stub, const std::string& cmd) {
+    // `monitor cmd`, and its output if it gave any rather than an error
+    std::ostringstream packet;
+    packet << "qRcmd," << std::hex << std::setfill('0');
+    for (unsigned int i = 0; i < cmd.size(); ++i)
+        packet << std::setw(2) << (unsigned int) (byte) cmd[i];
+    std::string reply, text;
+    stub.handle(packet.str(), &reply);
+    if (reply[0] == 'E')
+        return reply;
+    for (unsigned int i = 0; i + 1 < reply.size(); i += 2)
+        text += (char) strtol(reply.substr(i, 2).c_str(), NULL, 16);
+    return text.substr(0, text.find('\n'));
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::debug_stub(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* packets straight to the stub, no socket: a step, a breakpoint (not
+     * left in memory once hit), a watchpoint on V0 in the state window,
+     * memory writes and reads; a breakpoint hit every few instructions
+     * leaves the guest exactly where an undebugged run does; the guest's
+     * own trap opcode is just invalid; a skip over an XO-CHIP
+     * F000 NNNN with a breakpoint on it still skips all four bytes; one
+     * overlapping another's trap is still hit; and `monitor scan` narrows
+     * memory down to the counter a loop keeps at 0x300
+     */
+    expected << "PacketSize=1000;qXfer:features:read+;QStartNoAckMode+;"
+        << "swbreak+ T05 T05 0202" << std::endl
+        << "OK - T05swbreak:; 0802 801471011204 08" << std::endl
+        << "OK OK - T05watch:10000; 0602 0c" << std::endl
+        << "OK 00e0 E01 $OK#9a" << std::endl
+        << "50 1 1" << std::endl
+        << "T04" << std::endl
+        << "T05 0a02 01" << std::endl
+        << "T05 0702" << std::endl
+        << "E02 4096 left 1 left: 0x300 1 left: 0x300 E01" << std::endl;
+    std::string reply;
+    C8VM vm;
+    vm.load(std::string("\x60\x05\x61\x03\x80\x14\x71\x01\x12\x04", 10));
+    vm.start();
+    ::gdb_stub stub(vm);
+    const char* packets[] = {
+        "qSupported:swbreak+;hwbreak+", "?", "s", "p11", "\n",
+        "Z0,208,2", "c", "", "p11", "m204,6", "p0", "\n",
+        "z0,208,2", "Z2,10000,1", "c", "", "p11", "p0", "\n",
+        "M204,2:00e0", "m204,2", "m1000,1"
+    };
+    const char* sep = "";
+    for (unsigned int i = 0; i < sizeof(packets) / sizeof(packets[0]); ++i) {
+        std::string p(packets[i]);
+        if (p == "\n") {
+            actual << std::endl;
+            sep = "";
+            continue;
+        }
+        actual << sep;
+        sep = " ";
+        if (p.empty())
+            actual << stub.resume(1);
+        else
+            actual << (stub.handle(p, &reply) ? reply : "-");
+    }
+    actual << " " << gdb_packet("OK") << std::endl;
+
+    std::string rom("\x60\x3C\xF0\x15\xF1\x07\x72\x01\x12\x04", 10);
+    C8VM debugged, plain;
+    debugged.load(rom);
+    plain.load(rom);
+    debugged.start();
+    plain.start();
+    ::gdb_stub timed(debugged);
+    timed.handle("Z0,204,2", &reply);
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < 50; ++i) {
+        timed.handle("c", &reply);
+        // a hit can be in the frame after the one `c` started in
+        for (unsigned int f = 0; f < 2 && timed.is_running(); ++f)
+            hits += timed.resume(1) == "T05";
+    }
+    const vmstate* a = debugged.get_state();
+    const vmstate* b = plain.get_state();
+    plain.run(a->cycles, 0);
+    actual << hits << " " << (a->ip == 0x204 && a->delay_timer < 60) << " "
+        << (a->cycles == b->cycles && a->delay_timer == b->delay_timer &&
+            memcmp(a->registers, b->registers, NUM_REGISTERS) == 0 &&
+            memcmp(a->memory, b->memory, MEM_SIZE) == 0)
+        << std::endl;
+
+    C8VM invalid;
+    invalid.load(std::string("\xE0\xFF", 2));
+    invalid.start();
+    ::gdb_stub own(invalid);
+    own.handle("c", &reply);
+    actual << reply << std::endl;
+
+    // 202 skips the long I = 6107 at 204; stepping into it would set V1
+    C8VM xo;
+    xo.set_mode(mode_xochip);
+    xo.load(std::string("\x60\x00\x30\x00\xF0\x00\x61\x07\x71\x01"
+                        "\x12\x0A", 12));
+    xo.start();
+    ::gdb_stub skip(xo);
+    skip.handle("Z0,204,2", &reply);
+    skip.handle("Z0,20a,2", &reply);
+    skip.handle("c", &reply);
+    actual << skip.resume(1);
+    skip.handle("p11", &reply);
+    actual << " " << reply;
+    skip.handle("p1", &reply);
+    actual << " " << reply << std::endl;
+
+    // 202 jumps into the second half of the trap at 206
+    C8VM odd;
+    odd.load(std::string("\x60\x00\x12\x07\x00\x00\x00\x60\x07\x12\x09",
+                         11));
+    odd.start();
+    ::gdb_stub half(odd);
+    half.handle("Z0,206,2", &reply);
+    half.handle("Z0,207,2", &reply);
+    half.handle("c", &reply);
+    actual << half.resume(1);
+    half.handle("p11", &reply);
+    actual << " " << reply << std::endl;
+
+    C8VM counting;
+    counting.load(std::string("\x70\x01\xA3\x00\xF0\x55\x12\x00", 8));
+    counting.start();
+    ::gdb_stub scan(counting);
+    actual << monitor(scan, "scan up");
+    std::string left = monitor(scan, "scan start");
+    actual << " " << left.substr(0, left.find(':'));
+    for (unsigned int i = 0; i < 8; ++i)
+        scan.handle("s", &reply);
+    actual << " " << monitor(scan, "scan up");
+    for (unsigned int i = 0; i < 4; ++i)
+        scan.handle("s", &reply);
+    actual << " " << monitor(scan, "scan delta 1") << " "
+        << monitor(scan, "scan eq 100") << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::heatmap(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* a BCD write, a read back and a draw of the same bytes, counted, and
+     * stopped on by a watch on the value written and one letting the first
+     * read pass; then the CSV and PPM exports,
+     * and watch specs parsed and printed back
+     */
+    expected << "6 302 206 2 3" << std::endl
+        << "6 301 20a 1 2" << std::endl
+        << "0x0200,0,0,1" << std::endl
+        << "0x020A,0,0,20" << std::endl
+        << "0x0300,1,1,0" << std::endl
+        << "0x0302,1,1,0" << std::endl
+        << "P6 512 512 255 786432" << std::endl
+        << "300-30f:rw=ff@2 1 0" << std::endl;
+    // I = 300, V0 = 0x12, BCD V0, load V0 (leaving I at 301), draw 5 rows
+    // from 301, loop
+    std::string rom("\xA3\x00\x60\x12\xF0\x33\xF0\x65\xD0\x05"
+                    "\x12\x0A", 12);
+    C8VM vm;
+    mem_heatmap* heat = new mem_heatmap;
+    heatmap_clear(heat);
+    heat_watch w;
+    parse_watch("302:w=8", &w);
+    heatmap_watch(heat, w);
+    parse_watch("300-305:r@1", &w);
+    heatmap_watch(heat, w);
+    vm.load(rom);
+    vm.set_heatmap(heat);
+    vm.start();
+    for (unsigned int i = 0; i < 2; ++i) {
+        stop_reason r = vm.run(100, 0);
+        actual << r.kind << " " << std::hex << r.addr << " "
+            << vm.get_state()->ip << std::dec << " " << (int) heat->hit_access
+            << " " << r.cycles << std::endl;
+    }
+    vm.run(20, 0);
+    std::stringstream csv;
+    heatmap_csv(heat, vm.get_state(), csv);
+    std::string line;
+    while (std::getline(csv, line)) {
+        if (line.compare(0, 6, "0x0200") == 0 ||
+            line.compare(0, 6, "0x0300") == 0 ||
+            line.compare(0, 6, "0x0302") == 0 ||
+            line.compare(0, 6, "0x020A") == 0)
+            actual << line << std::endl;
+    }
+    std::stringstream ppm;
+    heatmap_ppm(heat, vm.get_state(), ppm);
+    std::string magic;
+    unsigned int width, height, depth;
+    ppm >> magic >> width >> height >> depth;
+    ppm.get();
+    std::string pixels((std::istreambuf_iterator<char>(ppm)),
+                       std::istreambuf_iterator<char>());
+    actual << magic << " " << width << " " << height << " " << depth << " "
+        << pixels.size() << std::endl;
+
+    actual << (parse_watch("300-30f:rw=ff@2", &w) ? watch_name(w) : "-")
+        << " " << (w.access == (access_read | access_write)) << " "
+        << parse_watch("300:q", &w) << std::endl;
+    vm.set_heatmap(NULL);
+    delete heat;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static bool scan_match(scan_predicate p, byte now, byte then, byte value) {
+    switch (p) {
+        case scan_equal:     return now == value;
+        case scan_changed:   return now != then;
+        case scan_unchanged: return now == then;
+        case scan_increased: return now > then;
+        case scan_decreased: return now < then;
+        case scan_delta:     return now == (byte) (then + value);
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::memory_scan(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* two rounds of each predicate over noisy memory, every kernel the CPU
+     * has against a byte at a time; then three sessions of a ROM counting
+     * up in memory, narrowed to the counter
+     */
+    expected << "111111" << std::endl
+        << "1 1 1 3 300 1 0" << std::endl;
+    std::vector<byte> a(MEM_SIZE), b(MEM_SIZE), c(MEM_SIZE);
+    unsigned int seed = 1;
+    for (unsigned int i = 0; i < MEM_SIZE; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = seed >> 16;
+        a[i] = (byte) r;
+        // mostly the same, some up by 3, some down by 1
+        b[i] = a[i] + (r % 5 == 0 ? 3 : r % 7 == 0 ? 0xFF : 0);
+        c[i] = b[i] + (r % 3 == 0 ? 3 : 0);
+    }
+    for (unsigned int p = scan_equal; p <= scan_delta; ++p) {
+        scan_predicate pred = (scan_predicate) p;
+        bool agree = true;
+        for (unsigned int isa = isa_scalar; isa <= scan_best_isa(); ++isa) {
+            mem_scan scan(1, MEM_SIZE);
+            scan.set_isa((scan_isa) isa);
+            scan.start(0, &a[0]);
+            scan.filter(0, &b[0], pred, 3);
+            scan.filter(0, &c[0], pred, 3);
+            for (unsigned int i = 0; i < MEM_SIZE; ++i) {
+                bool want = scan_match(pred, b[i], a[i], 3) &&
+                            scan_match(pred, c[i], b[i], 3);
+                agree = agree && scan.is_candidate(0, i) == want;
+            }
+        }
+        actual << agree;
+    }
+    actual << std::endl;
+
+    // I = 300, V0 += 1, store V0 at 300, loop
+    std::string rom("\xA3\x00\x70\x01\xF0\x55\x12\x00", 8);
+    C8VM vms[3];
+    const byte* memory[3];
+    mem_scan scan(3, MEM_SIZE);
+    for (unsigned int s = 0; s < 3; ++s) {
+        vms[s].load(rom);
+        vms[s].start();
+        vms[s].run(4 * (s + 1), 0);
+        memory[s] = vms[s].get_state()->memory;
+        scan.start(s, memory[s]);
+    }
+    // two more loops each: the counter is up by 2, and nothing else moved
+    for (unsigned int s = 0; s < 3; ++s)
+        vms[s].run(8, 0);
+    scan.filter_all(memory, scan_delta, 2);
+    std::vector<word> found;
+    scan.candidates(2, &found);
+    actual << scan.count(0) << " " << scan.count(1) << " " << scan.count(2)
+        << " " << scan.total() << " " << std::hex
+        << (found.empty() ? 0 : found[0]) << std::dec << " "
+        << scan.is_candidate(1, 0x300) << " " << scan.is_candidate(1, 0x302)
+        << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static void insert_hashes(concurrent_set* set, unsigned int from,
+                          unsigned int* added) {
+    // half the hashes overlap the next thread's
+    *added = 0;
+    for (unsigned int i = from; i < from + 2000; ++i)
+        *added += set->insert(i * 0x9E3779B97F4A7C15ULL);
+}
+
+// ----------------------------------------------------------------------------
+void c8tests::state_search(vmstate* state, result* result) {
+    std::stringstream actual, expected;
+    /* threads racing to insert overlapping hashes each get in once; then a
+     * ROM that counts in V0 only while key 5 is held, searched for V0 >= 8
+     * over no key, 5, and 8 held, on one thread and on four, which must
+     * find the same path and counts. Four frames are needed, only three
+     * of them counting; of the shortest paths the first in input order is
+     * the one found. With room for one state a level, a position cut off
+     * is still kept when it is reached again a level later.
+     */
+    expected << "5000 1 0" << std::endl
+        << "1 0 20 20 20 1 1 1 1" << std::endl
+        << "1 0 20 20 20 1 1 1 1" << std::endl
+        << "1 20 20 20 1 3" << std::endl
+        << "1 1 0" << std::endl;
+    concurrent_set set(16384);
+    std::vector<std::thread> threads;
+    unsigned int added[4];
+    for (unsigned int t = 0; t < 4; ++t)
+        threads.push_back(std::thread(insert_hashes, &set, t * 1000,
+                                      &added[t]));
+    for (unsigned int t = 0; t < 4; ++t)
+        threads[t].join();
+    actual << added[0] + added[1] + added[2] + added[3] << " "
+        << set.contains(4999 * 0x9E3779B97F4A7C15ULL) << " "
+        << set.contains(5000 * 0x9E3779B97F4A7C15ULL) << std::endl;
+
+    // V1 = 5, skip unless key V1 is down, loop; V0 += 1, loop
+    std::string rom("\x61\x05\xE1\x9E\x12\x00\x70\x01\x12\x00", 10);
+    C8VM vm;
+    vm.load(rom);
+    vm.start();
+    search_config config;
+    search_defaults(&config);
+    parse_inputs("0,20,100", &config.inputs);
+    parse_goal("v0>=8", &config.goal);
+    config.have_goal = true;
+    config.max_depth = 20;
+    search_stats first;
+    for (unsigned int jobs = 1; jobs <= 4; jobs += 3) {
+        config.jobs = jobs;
+        search_stats stats;
+        search_run(vm.get_state(), config, &stats, NULL, NULL);
+        if (jobs == 1)
+            first = stats;
+        actual << stats.found << std::hex;
+        for (unsigned int i = 0; i < stats.path.size(); ++i)
+            actual << " " << stats.path[i];
+        actual << std::dec << " " << (stats.expanded == first.expanded) << " "
+            << (stats.unique == first.unique) << " "
+            << (stats.duplicates == first.duplicates) << " "
+            << (stats.duplicates > 0) << std::endl;
+    }
+
+    // V1 = 5, V3 = 8; ten instructions a frame whatever is held: V0 += 1
+    // while 5 is down, V0 = 2 while 8 is, so V0 = 2 is cut off at the
+    // first level, reached again at the second, and leads to V0 = 3
+    std::string cut("\x61\x05\x63\x08\xE1\x9E\x80\x00\xE1\xA1\x70\x01"
+                    "\xE3\x9E\x80\x00\xE3\xA1\x60\x02\x80\x00\x80\x00"
+                    "\x80\x00\x12\x04", 28);
+    C8VM narrow;
+    narrow.load(cut);
+    narrow.start();
+    parse_inputs("20,100", &config.inputs);
+    parse_goal("v0=3", &config.goal);
+    config.max_width = 1;
+    config.jobs = 1;
+    search_stats stats;
+    search_run(narrow.get_state(), config, &stats, NULL, NULL);
+    actual << stats.found << std::hex;
+    for (unsigned int i = 0; i < stats.path.size(); ++i)
+        actual << " " << stats.path[i];
+    actual << std::dec << " " << stats.dropped << " " << stats.unique
+        << std::endl;
+    // the same position reached later is the same position, whatever keys
+    // are held
+    vmstate a = *vm.get_state(), b = a;
+    b.cycles += 10;
+    b.key[3] = 1;
+    actual << (hash_position(&a) == hash_position(&b)) << " "
+        << (hash_state(&a) != hash_state(&b)) << " "
+        << parse_goal("v10>=1", &config.goal) << std::endl;
+
+    result->expected = expected.str();
+    result->actual   = actual.str();
+    result->pass = result->actual.compare(result->expected) == 0;
+}
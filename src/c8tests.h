@@ -7,6 +7,7 @@ namespace c8tests {
     typedef struct result {
         bool pass;
         std::string name, expected, actual;
+        qword ns;       // time taken, filled in by the runner
     };
 
     void clear_result(result* result);
@@ -30,5 +31,31 @@ namespace c8tests {
     void set_regx_regy_sub_regx(vmstate* state, result* result);
     void set_regx_lshift(vmstate* state, result* result);
     void skip_if_not_equal_regs(vmstate* state, result* result);
+    void set_reg_rand_masked(vmstate* state, result* result);
+    void wait_key_press_store(vmstate* state, result* result);
+    void hash_state(vmstate* state, result* result);
+    void idle_skip(vmstate* state, result* result);
+    void input_queue(vmstate* state, result* result);
+    void sound_timer_tone(vmstate* state, result* result);
+    void load_bounds(vmstate* state, result* result);
+    void rom_pack(vmstate* state, result* result);
+    void draw_sprite(vmstate* state, result* result);
+    void scroll_screen(vmstate* state, result* result);
+    void xo_chip(vmstate* state, result* result);
+    void quirk_profiles(vmstate* state, result* result);
+    void run_stop_reasons(vmstate* state, result* result);
+    void c_api(vmstate* state, result* result);
+    void exec_profile(vmstate* state, result* result);
+    void trace_ring(vmstate* state, result* result);
+    void stack_samples(vmstate* state, result* result);
+    void metrics(vmstate* state, result* result);
+    void input_latency(vmstate* state, result* result);
+    void rom_generator(vmstate* state, result* result);
+    void lockstep(vmstate* state, result* result);
+    void fuzz_target(vmstate* state, result* result);
+    void debug_stub(vmstate* state, result* result);
+    void heatmap(vmstate* state, result* result);
+    void memory_scan(vmstate* state, result* result);
+    void state_search(vmstate* state, result* result);
 };
 #endif
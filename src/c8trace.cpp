@@ -0,0 +1,59 @@
+#include "trace.h"
+#include "debug.h"
+#include "def.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "stdlib.h"
+
+using namespace std;
+
+/* c8trace: decode an execution trace dump (see trace.h).
+ *
+ *     c8trace <trace> [last N]
+ *
+ * One line per instruction, oldest first:
+ *
+ *     <cycle> <pc> <opcode> <disassembly>  VX=.. VF=.. I=...
+ *
+ * with the registers as the instruction left them. A gap in the cycle
+ * count is an idle loop the vm skipped.
+ */
+
+// ----------------------------------------------------------------------------
+void print_usage() {
+    cout << "usage: c8trace <trace> [last N]" << endl;
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc < 2 || argc == 3 || argc > 4 ||
+        (argc == 4 && string(argv[2]) != "last")) {
+        print_usage();
+        return 1;
+    }
+    vector<trace_record> records;
+    byte mode;
+    if (!read_trace(argv[1], records, &mode)) {
+        cerr << argv[1] << ": not a c8vm trace" << endl;
+        return 1;
+    }
+    unsigned long first = 0;
+    if (argc == 4) {
+        unsigned long last = strtoul(argv[3], NULL, 10);
+        first = last < records.size() ? records.size() - last : 0;
+    }
+    for (unsigned long i = first; i < records.size(); ++i) {
+        const trace_record& r = records[i];
+        cout << dec << setfill(' ') << setw(12) << r.cycle << "  " << hex
+            << uppercase << setfill('0') << setw(4) << r.pc << "  "
+            << setw(4) << r.opcode << "  " << left << setfill(' ')
+            << setw(16) << disassemble(r.opcode, mode) << right
+            << setfill('0') << "  V" << ((r.opcode >> 8) & 0xF) << "="
+            << setw(2) << (int) r.vx << " VF=" << setw(2) << (int) r.vf
+            << " I=" << setw(4) << r.index << endl;
+    }
+    return 0;
+}
@@ -1,9 +1,14 @@
 #include "c8.h"
 #include "c8_config.h" // CMake configuration file
 #include "debug.h"
+#include "gdbstub.h"
+#include "rom.h"
+#include "gfx.h"
+#include "clock.h"
+#include "metrics.h"
 #include <iostream>
-#include <fstream>
-#include <vector>
+#include "stdlib.h"
+#include <signal.h>
 
 #include <GL/glew.h>
 #include <GL/glut.h>
@@ -20,8 +25,31 @@ int window_h = SCREEN_H * MODIFIER;
 
 C8VM vm;
 
-// external key status
-byte* keys;
+// sound, only generated when there is somewhere to send it
+audio_ring     sound_ring;
+tone_generator tone(&sound_ring);
+wav_sink*      wav = NULL;
+
+// the last instructions run, dumped to `trace_path` if the vm faults
+trace_ring* trace = NULL;
+string      trace_path;
+
+// each key event followed to the screen, reported on exit
+input_latency key_latency;
+
+// metrics, written to `metrics_path` on exit and on SIGUSR1
+string metrics_path;
+volatile sig_atomic_t metrics_wanted = 0;
+const metric_id metric_frame_ns = metric_histogram(
+        "c8vm_frame_time_nanoseconds", "Wall time to run one guest frame");
+const metric_id metric_render_ns = metric_histogram(
+        "c8vm_render_time_nanoseconds", "Wall time to draw the screen");
+const metric_id metric_ips = metric_gauge(
+        "c8vm_instructions_per_second",
+        "Guest instructions run over the last second");
+
+// a debugger attached with -g, which decides when the guest runs
+gdb_stub* stub = NULL;
 
 // ----------------------------------------------------------------------------
 void print_usage() {
@@ -29,94 +57,152 @@ void print_usage() {
     cout << prog << " version "
         << c8vm_VERSION_MAJOR << "." << c8vm_VERSION_MINOR
         << endl;
-    cout << "usage: " << prog << " [[OPT1] [OPT2]] ..." << endl;
+    cout << "usage: " << prog << " [-m chip8|schip|xochip] "
+        << "[-q vip|schip|modern] [-t trace] [-M metrics.prom]" << endl
+        << "       [-g port|path] <rom> [sound.wav]" << endl;
+    cout << "  the mode defaults from the extension (.ch8, .sc8, .xo8), and"
+        << " the quirks from the mode" << endl;
+    cout << "  -t traces the last " << TRACE_DEFAULT_SIZE << " instructions,"
+        << " written to `trace` on a fault (see c8trace)" << endl;
+    cout << "  -M writes metrics in the Prometheus text format to"
+        << " `metrics.prom` on exit and on SIGUSR1" << endl;
+    cout << "  -g waits for a GDB remote protocol debugger on a local port,"
+        << " or a Unix socket" << endl;
 }
 
 // ----------------------------------------------------------------------------
-string& load_binary(string& out, char* path) {
-    ifstream infs(path, ios::binary);
-    if (infs) {
-        /* get filesize so we don't have to read char by char */
-        infs.seekg(0, ios::end);
-        streampos file_len = infs.tellg();
-        infs.seekg(0, ios::beg);
 
-        /* use a vector as the buffer, as they are exception safe and will
-           be tidied up correctly */
-        vector<char> buf(file_len);
-        infs.read(&buf[0], file_len);
-        out = string(buf.begin(), buf.end());
+void draw_buf(const byte* gfx_buf, const unsigned int size) {
+    return;
+}
+// ----------------------------------------------------------------------------
+int map_key(unsigned char key) {
+    /* map a keyboard key to its CHIP-8 key, or -1 if it isn't one:
+     *
+     *     1 2 3 4        1 2 3 C
+     *     q w e r   ->   4 5 6 D
+     *     a s d f        7 8 9 E
+     *     z x c v        A 0 B F
+     */
+    switch(key) {
+        case '1': return 0x1;
+        case '2': return 0x2;
+        case '3': return 0x3;
+        case '4': return 0xC;
+        case 'q': return 0x4;
+        case 'w': return 0x5;
+        case 'e': return 0x6;
+        case 'r': return 0xD;
+        case 'a': return 0x7;
+        case 's': return 0x8;
+        case 'd': return 0x9;
+        case 'f': return 0xE;
+        case 'z': return 0xA;
+        case 'x': return 0x0;
+        case 'c': return 0xB;
+        case 'v': return 0xF;
     }
-    return out;
+    return -1;
 }
 
 // ----------------------------------------------------------------------------
+void vm_loop(void);
 
-void draw_buf(const byte* gfx_buf, const unsigned int size) {
-    return;
-}
 // ----------------------------------------------------------------------------
 void key_down(unsigned char key, int x, int y) {
-    switch(key) {
-        case '1': keys[0x1] = 1; break;
-        case '2': keys[0x2] = 1; break;
-        case '3': keys[0x3] = 1; break;
-        case '4': keys[0xC] = 1; break;
-        case 'q': keys[0x4] = 1; break;
-        case 'w': keys[0x5] = 1; break;
-        case 'e': keys[0x6] = 1; break;
-        case 'r': keys[0xD] = 1; break;
-        case 'a': keys[0x7] = 1; break;
-        case 's': keys[0x8] = 1; break;
-        case 'd': keys[0x9] = 1; break;
-        case 'f': keys[0xE] = 1; break;
-        case 'z': keys[0xA] = 1; break;
-        case 'x': keys[0x0] = 1; break;
-        case 'c': keys[0xB] = 1; break;
-        case 'v': keys[0xF] = 1; break;
-    }
+    int k = map_key(key);
+    if (k < 0)
+        return;
+    // applied by the vm at its next frame boundary, not written directly
+    if (!vm.post_key(k, true))
+        cerr << "input queue full, dropped key down" << endl;
+    // wake the vm up if it was parked waiting on FX0A
+    glutIdleFunc(vm_loop);
 }
 
 // ----------------------------------------------------------------------------
 void key_up(unsigned char key, int x, int y) {
-    switch(key) {
-        case '1': keys[0x1] = 0; break;
-        case '2': keys[0x2] = 0; break;
-        case '3': keys[0x3] = 0; break;
-        case '4': keys[0xC] = 0; break;
-        case 'q': keys[0x4] = 0; break;
-        case 'w': keys[0x5] = 0; break;
-        case 'e': keys[0x6] = 0; break;
-        case 'r': keys[0xD] = 0; break;
-        case 'a': keys[0x7] = 0; break;
-        case 's': keys[0x8] = 0; break;
-        case 'd': keys[0x9] = 0; break;
-        case 'f': keys[0xE] = 0; break;
-        case 'z': keys[0xA] = 0; break;
-        case 'x': keys[0x0] = 0; break;
-        case 'c': keys[0xB] = 0; break;
-        case 'v': keys[0xF] = 0; break;
-    }
+    int k = map_key(key);
+    if (k >= 0 && !vm.post_key(k, false))
+        cerr << "input queue full, dropped key up" << endl;
+}
+
+// ----------------------------------------------------------------------------
+void report_input_latency() {
+    if (vm.get_input_stats().applied == 0)
+        return;
+    key_latency.report(cerr);
+}
+
+// ----------------------------------------------------------------------------
+void close_sound() {
+    if (!wav)
+        return;
+    cerr << "sound: " << wav->get_samples() << " samples, "
+        << wav->get_underruns() << " underruns, "
+        << tone.get_overruns() << " samples dropped" << endl;
+    delete wav; // patches up the wav header
+    wav = NULL;
 }
 
 // ----------------------------------------------------------------------------
-void render(const byte* gfx_buffer) {
+void request_metrics(int) {
+    // only flag it: the dump happens on the next pass through vm_loop
+    metrics_wanted = 1;
+}
+
+// ----------------------------------------------------------------------------
+void dump_metrics() {
+    metrics_wanted = 0;
+    if (!metrics_dump(metrics_path))
+        cerr << "could not write " << metrics_path << endl;
+}
+
+// ----------------------------------------------------------------------------
+void sample_ips() {
+    // refresh the instructions per second gauge, at most once a second
+    static qword last_ns = 0;
+    static long last_cycles = 0;
+    qword now = monotonic_ns();
+    if (now - last_ns < 1000000000ULL)
+        return;
+    long cycles = vm.get_state()->cycles;
+    if (last_ns)
+        metric_set(metric_ips, (cycles - last_cycles) * 1000000000LL /
+                               (long long) (now - last_ns));
+    last_ns = now;
+    last_cycles = cycles;
+}
+
+// ----------------------------------------------------------------------------
+void render(const vmstate* state) {
+    // one colour per combination of the two XO-CHIP planes
+    static const float palette[4][3] = {
+        { 0.0f,  0.0f,  0.0f  },
+        { 1.0f,  1.0f,  1.0f  },
+        { 0.67f, 0.67f, 0.67f },
+        { 0.33f, 0.33f, 0.33f },
+    };
+    static byte gfx_buffer[GFX_HIRES_W * GFX_HIRES_H];
+    qword t0 = monotonic_ns();
+    int w = gfx_width(state), h = gfx_height(state);
+    float size = (float) (SCREEN_W * MODIFIER) / w; // hi-res pixels are half
+    gfx_unpack(state, gfx_buffer);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    for (int y = 0; y < 32; ++y) {
-        for (int x = 0; x < 64; ++x) {
-            if (gfx_buffer[x + (y*64)] == 0)
-                glColor3f(0.0f, 0.0f, 0.0f);
-            else
-                glColor3f(1.0f, 1.0f, 1.0f);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            glColor3fv(palette[gfx_buffer[x + (y*w)] & 0x3]);
             glBegin(GL_QUADS);
-            glVertex3f((x * MODIFIER) + 0.0f, (y * MODIFIER) + 0.0f,    0.0f);
-            glVertex3f((x * MODIFIER) + 0.0f, (y * MODIFIER) + MODIFIER, 0.0f);
-            glVertex3f((x * MODIFIER) + MODIFIER, (y * MODIFIER) + MODIFIER, 0.0f);
-            glVertex3f((x * MODIFIER) + MODIFIER, (y * MODIFIER) + 0.0f,    0.0f);
+            glVertex3f((x * size) + 0.0f, (y * size) + 0.0f, 0.0f);
+            glVertex3f((x * size) + 0.0f, (y * size) + size, 0.0f);
+            glVertex3f((x * size) + size, (y * size) + size, 0.0f);
+            glVertex3f((x * size) + size, (y * size) + 0.0f, 0.0f);
             glEnd();
         }
     }
     glutSwapBuffers();
+    vm.presented();
+    metric_observe(metric_render_ns, monotonic_ns() - t0);
 }
 
 // ----------------------------------------------------------------------------
@@ -136,16 +222,42 @@ void reshape_window(GLsizei w, GLsizei h)
 
 // ----------------------------------------------------------------------------
 void vm_loop(void) {
+    if (metrics_wanted)
+        dump_metrics();
     if (vm.is_on()) {
         if (vm.get_gfx_stale()) {
-            render(vm.get_gfx_buf());
+            render(vm.get_state());
             vm.set_gfx_stale(false);
         }
-        vm.do_cycle();
-#if STEPPED
-        cout << "cycle completed" << endl;
-        cin.get();
-#endif
+        if (stub && stub->poll(stub->is_running() ? 0 : 10)) {
+            // while attached, the guest runs only when the debugger lets
+            // it, a frame at a time so its ^C is seen
+            stub->resume(1);
+            return;
+        }
+        qword t0 = monotonic_ns();
+        stop_reason r = vm.run(0, 1);
+        metric_observe(metric_frame_ns, monotonic_ns() - t0);
+        sample_ips();
+        if (wav)
+            wav->pump(&sound_ring, AUDIO_FRAME);
+        if (r.kind == stop_fault) {
+            cerr << "fault 0x" << hex << (int) r.fault << " at 0x" << r.addr
+                << dec << ", vm stopped" << endl;
+            if (trace && trace->dump(trace_path, vm.get_mode()))
+                cerr << "trace written to " << trace_path << endl;
+            glutIdleFunc(NULL);
+            return;
+        }
+        if (vm.is_blocked()) {
+            /* waiting on FX0A with the timers run down: show the last
+               frame, then stop polling until a key event wakes us */
+            if (vm.get_gfx_stale()) {
+                render(vm.get_state());
+                vm.set_gfx_stale(false);
+            }
+            glutIdleFunc(NULL);
+        }
     }
 }
 
@@ -166,24 +278,92 @@ void opengl_init(int& argc, char** argv) {
 
 // ----------------------------------------------------------------------------
 int main(int argc, char** argv) {
-    if (argc < 2) {
+    int arg = 1;
+    bool have_mode = false, have_quirks = false;
+    machine_mode mode = mode_chip8;
+    quirk_profile quirks = profile_vip;
+    string debug_where;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string opt(argv[arg]);
+        if (opt == "-m" && parse_mode(argv[arg + 1], &mode)) {
+            have_mode = true;
+        } else if (opt == "-q" && parse_quirks(argv[arg + 1], &quirks)) {
+            have_quirks = true;
+        } else if (opt == "-g") {
+            debug_where = argv[arg + 1];
+        } else if (opt == "-t") {
+            trace_path = argv[arg + 1];
+        } else if (opt == "-M") {
+            metrics_path = argv[arg + 1];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc <= arg) {
         print_usage();
         return 0;
     }
+    const char* rom_path = argv[arg];
 
-    // load the binary
-    string bin = "";
-    bin = load_binary(bin, argv[1]);
+    // map the binary
+    rom_file rom;
+    if (!rom.open(rom_path)) {
+        cerr << "could not open " << rom_path << endl;
+        return 1;
+    }
 
     // opengl stuff (window, input callbacks)
     opengl_init(argc, argv);
 
     // init vm
-    keys = vm.get_keys();
-
-    vm.load(bin);
+    vm.set_mode(have_mode ? mode : mode_for_rom(rom_path));
+    if (have_quirks)
+        vm.set_quirks(quirks);
+    if (!vm.load(rom.get_data(), rom.get_size())) {
+        cerr << rom_path << ": not a loadable ROM (" << rom.get_size()
+            << " bytes, must be 1-" << vm.get_max_rom_size() << ")" << endl;
+        return 1;
+    }
+    rom.close();
+    vm.set_latency(&key_latency);
+    if (!trace_path.empty()) {
+        trace = new trace_ring(TRACE_DEFAULT_SIZE);
+        vm.set_trace(trace);
+    }
+    if (argc > arg + 1) {
+        wav = new wav_sink(argv[arg + 1]);
+        if (wav->is_open()) {
+            vm.set_audio(&tone);
+        } else {
+            cerr << "could not open " << argv[arg + 1] << ", sound disabled"
+                << endl;
+            delete wav;
+            wav = NULL;
+        }
+    }
     vm.start();
+    if (!debug_where.empty()) {
+        signal(SIGPIPE, SIG_IGN);
+        stub = new gdb_stub(vm);
+        if (!stub->listen(debug_where)) {
+            cerr << "could not listen on " << debug_where << endl;
+            return 1;
+        }
+        cout << "waiting for a debugger on " << debug_where << endl;
+        if (!stub->accept()) {
+            cerr << "could not accept a debugger" << endl;
+            return 1;
+        }
+    }
 
+    // glut exits the process when the window closes
+    atexit(report_input_latency);
+    atexit(close_sound);
+    if (!metrics_path.empty()) {
+        atexit(dump_metrics);
+        signal(SIGUSR1, request_metrics);
+    }
     glutMainLoop();
 
     return 0;
@@ -0,0 +1,7 @@
+#include "clock.h"
+#include <chrono>
+
+qword monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,9 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include "def.h"
+
+// nanoseconds from an arbitrary, monotonic epoch
+qword monotonic_ns();
+
+#endif
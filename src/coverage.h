@@ -0,0 +1,54 @@
+#ifndef __COVERAGE_H__
+#define __COVERAGE_H__
+
+#include "def.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Edge coverage, AFL style: every location (a guest pc, or a host code
+ * address) is hashed to a 16 bit id, and each transition from one location
+ * to the next bumps the counter at (previous id >> 1) ^ id. The shift makes
+ * A->B and B->A different edges, and tight loops land apart from their
+ * entry. Counters saturate at 255; the fuzzer only cares about which power
+ * of two bucket each is in (see fuzz.h).
+ *
+ * The edges hit are also listed in `touched`, so that clearing the map and
+ * reading it back cost as much as the run covered, not the whole map.
+ *
+ * The vm records the guest's pc transitions into a map set with
+ * `C8VM::set_coverage`, at the cost of a few instructions per cycle.
+ */
+const unsigned int COVERAGE_SIZE = 1 << 16;
+
+typedef struct coverage_map {
+    byte hits[COVERAGE_SIZE];
+    word touched[COVERAGE_SIZE];  // edges with hits, in the order first hit
+    uint32_t count;               // entries in `touched`
+    uint32_t prev;
+} coverage_map;
+
+inline void coverage_edge(coverage_map* map, uintptr_t loc) {
+    uint32_t id = (uint32_t) ((loc * 0x9E3779B97F4A7C15ULL) >> 48);
+    uint32_t edge = (map->prev ^ id) & (COVERAGE_SIZE - 1);
+    byte h = map->hits[edge];
+    if (!h)
+        map->touched[map->count++] = edge;
+    map->hits[edge] = h + (h != 0xFF);
+    map->prev = id >> 1;
+}
+
+inline void coverage_init(coverage_map* map) {
+    memset(map->hits, 0, sizeof(map->hits));
+    map->count = 0;
+    map->prev  = 0;
+}
+
+inline void coverage_clear(coverage_map* map) {
+    // only what was hit since the last clear (or `coverage_init`)
+    for (uint32_t i = 0; i < map->count; ++i)
+        map->hits[map->touched[i]] = 0;
+    map->count = 0;
+    map->prev  = 0;
+}
+
+#endif
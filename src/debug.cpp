@@ -1,4 +1,6 @@
 #include "debug.h"
+#include "gfx.h"
+#include "iset.h"
 #include <iomanip>
 
 void print_hex(std::ostream& stream, c8opcode v) {
@@ -11,23 +13,52 @@ void print_hex(std::ostream& stream, c8opcode v) {
     stream << std::dec;
 }
 
-void debug(debug_kind db_type, vmstate* state, const std::string& str) {
-    switch(db_type) {
-        case iset_decode:
-            std::cerr << " - opcode [";
-            print_hex(std::cerr, state->curr_opcode);
-            std::cerr << "] decoded as " << str << std::endl;
-            break;
-        default:
-            break;
-    };
-}
-
-void print_gfx_buf(const byte* gfx_buf) {
+void print_gfx_buf(const vmstate* state) {
+    byte gfx_buf[GFX_HIRES_W * GFX_HIRES_H];
+    unsigned int w = gfx_width(state), h = gfx_height(state);
+    gfx_unpack(state, gfx_buf);
     std::cerr << "graphics buffer:" << std::endl;
-    for (int i = 0; i < 64*32; ++i) {
+    for (unsigned int i = 0; i < w * h; ++i) {
         std::cerr << "[" << std::setw(1) << (int)gfx_buf[i] << "]";
-        if ((i+1) % 64 == 0)
+        if ((i+1) % w == 0)
             std::cerr << std::endl;
     }
 }
+
+std::string disassemble(c8opcode op, byte mode) {
+    /* `op` in the usual CHIP-8 assembler mnemonics, decoded as the vm
+     * would in `mode` (see iset::classify). In the templates x, y and n are
+     * the opcode's nibbles, $ its low byte, @ its low 12 bits and % the
+     * whole opcode.
+     */
+    static const char* templates[iset::num_op_classes] = {
+        "SYS @", "CLS", "RET", "JP @", "CALL @", "SE Vx, $", "SNE Vx, $",
+        "SE Vx, Vy", "LD Vx, $", "ADD Vx, $", "LD Vx, Vy", "OR Vx, Vy",
+        "AND Vx, Vy", "XOR Vx, Vy", "ADD Vx, Vy", "SUB Vx, Vy",
+        "SHR Vx, Vy", "SUBN Vx, Vy", "SHL Vx, Vy", "SNE Vx, Vy", "LD I, @",
+        "JP V0, @", "RND Vx, $", "DRW Vx, Vy, n", "SKP Vx", "SKNP Vx",
+        "LD Vx, DT", "LD Vx, K", "LD DT, Vx", "LD ST, Vx", "ADD I, Vx",
+        "LD F, Vx", "LD B, Vx", "LD [I], Vx", "LD Vx, [I]",
+        "SCD n", "SCR", "SCL", "EXIT", "LOW", "HIGH", "LD HF, Vx",
+        "LD R, Vx", "LD Vx, R",
+        "SCU n", "SAVE Vx - Vy", "LOAD Vx - Vy", "LD I, LONG", "PLANE x",
+        "AUDIO", "PITCH Vx",
+        "DW %",
+    };
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (const char* t = templates[iset::classify(op, mode)]; *t; ++t) {
+        switch (*t) {
+            case 'x': out += hex[(op >> 8) & 0xF]; break;
+            case 'y': out += hex[(op >> 4) & 0xF]; break;
+            case 'n': out += hex[op & 0xF]; break;
+            case '%': out += hex[op >> 12];          // fall through
+            case '@': out += hex[(op >> 8) & 0xF];   // fall through
+            case '$': out += hex[(op >> 4) & 0xF];
+                      out += hex[op & 0xF];
+                      break;
+            default:  out += *t; break;
+        }
+    }
+    return out;
+}
@@ -1,35 +1,99 @@
 #ifndef __DEF_H__
 #define __DEF_H__
 
+#include <stddef.h>
+
 typedef unsigned char  byte;
 typedef unsigned short word;
 typedef unsigned long  dword;
+typedef unsigned long long qword;
 typedef word c8opcode;
 typedef byte c8register;
 
 const unsigned int NUM_REGISTERS = 16,
-                   MEM_SIZE      = 4096,    // # of bytes
+                   MEM_SIZE      = 4096,    // # of bytes (CHIP-8, SCHIP)
+                   XO_MEM_SIZE   = 65536,   // # of bytes (XO-CHIP)
                    STACK_SIZE    = 16,
                    KEY_SIZE      = 16,
-                   GFX_SIZE      = 64 * 32,
+                   GFX_W         = 64,      // lo-res display
+                   GFX_H         = 32,
+                   GFX_HIRES_W   = 128,     // SCHIP/XO-CHIP hi-res display
+                   GFX_HIRES_H   = 64,
+                   GFX_PLANES    = 2,       // XO-CHIP bit planes
+                   GFX_ROW_WORDS = GFX_HIRES_W / 64,
+                   FONT_START    = 0xA,
+                   BIG_FONT_START = 0x60,   // SCHIP 8x10 digits (FX30)
                    FREQUENCY     = 60,
-                   PROG_START    = 0x200;
+                   CYCLES_PER_FRAME = 10,  // instructions per 60Hz frame
+                   PROG_START    = 0x200,
+                   MAX_ROM_SIZE  = MEM_SIZE - PROG_START,
+                   XO_MAX_ROM_SIZE = XO_MEM_SIZE - PROG_START;
+const qword RNG_SEED = 0x2545F4914F6CDD1DULL;
+
+// machine variants; fixed for the lifetime of a loaded ROM
+enum machine_mode {
+    mode_chip8,
+    mode_schip,   // SUPER-CHIP 1.1: hi-res, scrolling, 16x16 sprites
+    mode_xochip,  // XO-CHIP: SCHIP plus 64K memory and two bit planes
+};
+
+// sticky fault bits; once any is set the vm stops running
+enum fault_code {
+    fault_stack_overflow  = 0x1,  // 2NNN with all 16 stack slots in use
+    fault_stack_underflow = 0x2,  // 00EE with nothing to return to
+    fault_invalid_opcode  = 0x4,
+    fault_ip_overrun      = 0x8,  // ip ran off the end of memory
+    fault_trap            = 0x10, // TRAP_OPCODE; `run` makes it a breakpoint
+    fault_watch           = 0x20, // a heatmap watchpoint hit (see heatmap.h)
+};
+
+// written over an instruction by a debugger (see gdbstub.h); invalid in
+// every mode, so decoding it costs valid instructions nothing
+const c8opcode TRAP_OPCODE = 0xE0FF;
+
+// quirk profiles (see quirks.h); each mode defaults to its own
+enum quirk_profile {
+    profile_vip,
+    profile_schip,
+    profile_modern,
+};
+
 typedef struct vmstate {
     c8opcode curr_opcode;
     c8register registers[16];
     word ip, sp, index; // ip == pc
     word stack[16];
-    byte memory[4096];
-    byte gfx_buffer[64 * 32];
+    word mem_mask;      // addresses wrap to the machine's memory size
+    // packed framebuffer, one bit per pixel per plane. Bit 63 of word 0 is
+    // the leftmost pixel of a row; lo-res only uses word 0 of rows 0-31.
+    qword gfx[GFX_PLANES][GFX_HIRES_H][GFX_ROW_WORDS];
+    byte mode;         // machine_mode
+    byte quirks;       // quirk_profile
+    bool hires;
+    byte planes;       // planes drawn, cleared and scrolled (FN01)
+    byte flags[16];    // SCHIP "RPL" user flags (FX75/FX85)
+    byte pattern[16];  // XO-CHIP audio pattern (F002) and pitch (FX3A)
+    byte pitch;
     byte delay_timer, sound_timer;
     byte key[16];
     unsigned int frequency;
     bool on;
     long cycles;
     bool gfx_stale;
+    bool waiting_key; // blocked in FX0A, storing to register `wait_reg`
+    byte wait_reg;
+    qword rng; // per-vm xorshift state, so CXNN is reproducible
+    byte faults;   // fault_code bits
+    word fault_ip; // address of the instruction that raised the first fault
+    // last, so that the state in use ends with the machine's memory (see
+    // state_size); only the first MEM_SIZE bytes are used outside XO-CHIP,
+    // and the rest is kept zero
+    byte memory[XO_MEM_SIZE];
 }vmstate;
 
-enum debug_kind {
-    iset_decode,
-};
+// the bytes of `state` in use: everything up to the end of the machine's
+// memory, about 4 KB outside XO-CHIP. Copies and snapshots need no more.
+inline size_t state_size(const vmstate* state) {
+    return offsetof(vmstate, memory) + state->mem_mask + 1;
+}
 #endif
@@ -0,0 +1,380 @@
+#include "fuzz.h"
+#include "clock.h"
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+
+coverage_map* fuzz_host_map = NULL;
+const fuzz_case* fuzz_current = NULL;
+
+static const char* outcome_names[num_fuzz_outcomes] = {
+    "budget", "halted", "fault", "stuck", "broken", "unloadable"
+};
+
+// opcodes worth planting whole: the ones that move the stack, the index,
+// the pc, or write memory, with their operand nibbles filled in at random
+static const c8opcode interesting[] = {
+    0x2000, 0x00EE, 0x1000, 0xB000, 0xA000, 0xD000, 0xF033, 0xF055,
+    0xF065, 0xF01E, 0xF029, 0xF030, 0xF075, 0xF085, 0xF00A, 0x00C0,
+    0x00FB, 0x00FC, 0x00FE, 0x00FF, 0x5002, 0x5003, 0xF000, 0xF002,
+    0xF001, 0xF03A, 0x00FD
+};
+static const c8opcode interesting_masks[] = {
+    0x0FFF, 0x0000, 0x0FFF, 0x0FFF, 0x0FFF, 0x0FFF, 0x0F00, 0x0F00,
+    0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x000F,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0FF0, 0x0FF0, 0x0000, 0x0000,
+    0x0F00, 0x0F00, 0x0000
+};
+static const unsigned int NUM_INTERESTING =
+    sizeof(interesting) / sizeof(interesting[0]);
+
+// ----------------------------------------------------------------------------
+const char* fuzz_outcome_name(fuzz_outcome outcome) {
+    return outcome < num_fuzz_outcomes ? outcome_names[outcome] : "invalid";
+}
+
+// ----------------------------------------------------------------------------
+bool fuzz_check_state(const vmstate* state, std::string* why) {
+    /* false, saying why, if `state` is one no ROM should be able to reach.
+     * Writes past the machine's memory are left to `fuzz_check_memory`.
+     */
+    bool pc_past = state->on && !state->faults &&
+                   state->ip > state->mem_mask;
+    bool bad_wait = state->waiting_key && state->wait_reg >= NUM_REGISTERS;
+    bool bad_hires = state->mode == mode_chip8 && state->hires;
+    if (state->sp <= STACK_SIZE && !pc_past && !bad_wait && !bad_hires)
+        return true;
+    std::ostringstream out;
+    if (state->sp > STACK_SIZE)
+        out << "stack pointer " << state->sp << " past the stack";
+    else if (pc_past)
+        out << "pc " << std::hex << state->ip << " past memory";
+    else if (bad_wait)
+        out << "waiting to store a key in V" << (int) state->wait_reg;
+    else
+        out << "hi-res in CHIP-8 mode";
+    *why = out.str();
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+bool fuzz_check_memory(const vmstate* state, std::string* why) {
+    /* false, saying where, if anything past the machine's memory was
+     * written since it was last zero. Reading all of it is most of the
+     * cost of a short case, so the fuzzer only does so every
+     * FUZZ_MEMORY_EVERY cases.
+     */
+    static const byte zeros[XO_MEM_SIZE - MEM_SIZE] = { 0 };
+    if (state->mode == mode_xochip ||
+        memcmp(&state->memory[MEM_SIZE], zeros, sizeof(zeros)) == 0)
+        return true;
+    unsigned int stray = MEM_SIZE;
+    while (!state->memory[stray])
+        ++stray;
+    std::ostringstream out;
+    out << "write past memory, at or after " << std::hex << stray;
+    *why = out.str();
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+void fuzz_write_keys(const fuzz_case& c, std::ostream& out) {
+    // in the c8vm_regress .keys format
+    for (unsigned int i = 0; i < c.events.size(); ++i) {
+        out << c.events[i].frame << " " << (c.events[i].down ? 'd' : 'u')
+            << " " << std::hex << (int) c.events[i].key << std::dec
+            << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------------
+fuzzer::fuzzer(machine_mode mode, long budget, qword seed,
+               bool host_coverage) : mode(mode), budget(budget),
+                                     host_coverage(host_coverage) {
+    rng = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (rng == 0)
+        rng = 1;
+    guest = new coverage_map;
+    host  = new coverage_map;
+    coverage_init(guest);
+    coverage_init(host);
+    seen = new byte[2 * COVERAGE_SIZE];
+    memset(seen, 0, 2 * COVERAGE_SIZE);
+    memset(&stats, 0, sizeof(stats));
+    vm.set_coverage(guest);
+}
+
+// ----------------------------------------------------------------------------
+fuzzer::~fuzzer() {
+    vm.set_coverage(NULL);
+    delete guest;
+    delete host;
+    delete[] seen;
+}
+
+// ----------------------------------------------------------------------------
+qword fuzzer::next() {
+    // xorshift64*, as in romgen
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545F4914F6CDD1DULL;
+}
+
+// ----------------------------------------------------------------------------
+unsigned int fuzzer::pick(unsigned int n) {
+    return (unsigned int) ((next() >> 32) % n);
+}
+
+// ----------------------------------------------------------------------------
+static byte bucket(byte hits) {
+    // AFL's hit count classes: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+    if (hits <= 3)
+        return 1 << (hits - 1);
+    if (hits < 8)
+        return 0x08;
+    if (hits < 16)
+        return 0x10;
+    if (hits < 32)
+        return 0x20;
+    return hits < 128 ? 0x40 : 0x80;
+}
+
+// ----------------------------------------------------------------------------
+static bool merge(const coverage_map* map, byte* seen, unsigned int* edges) {
+    /* fold the hit counts of the last case into `seen`; true if any edge
+     * reached a bucket it hadn't before
+     */
+    bool found = false;
+    for (uint32_t t = 0; t < map->count; ++t) {
+        word i = map->touched[t];
+        byte b = bucket(map->hits[i]);
+        if (seen[i] & b)
+            continue;
+        if (!seen[i])
+            ++*edges;
+        seen[i] |= b;
+        found = true;
+    }
+    return found;
+}
+
+// ----------------------------------------------------------------------------
+bool fuzzer::novel() {
+    bool found = merge(guest, seen, &stats.guest_edges);
+    if (host_coverage)
+        found |= merge(host, seen + COVERAGE_SIZE, &stats.host_edges);
+    return found;
+}
+
+// ----------------------------------------------------------------------------
+fuzz_outcome fuzzer::run_loaded(const fuzz_case& c, std::string* why) {
+    // post `c`'s keys and run the loaded ROM to the end of the budget
+    for (unsigned int i = 0; i < c.events.size(); ++i)
+        vm.post_key_at(c.events[i].frame, c.events[i].key, c.events[i].down);
+    if (host_coverage)
+        fuzz_host_map = host;
+    vm.start();
+    fuzz_outcome outcome = outcome_budget;
+    for (long done = 0; done < budget; ) {
+        stop_reason r = vm.run(budget - done, 0);
+        if (r.kind == stop_fault) {
+            outcome = outcome_fault;
+            break;
+        }
+        if (r.kind == stop_halted) {
+            outcome = outcome_halted;
+            break;
+        }
+        if (r.cycles <= 0 || r.cycles > budget - done) {
+            outcome = outcome_stuck;
+            std::ostringstream out;
+            out << "run of " << budget - done << " returned after "
+                << r.cycles << " (stop " << r.kind << ", pc " << std::hex
+                << vm.get_state()->ip << ")";
+            *why = out.str();
+            break;
+        }
+        done += r.cycles;
+    }
+    fuzz_host_map = NULL;
+    return outcome;
+}
+
+// ----------------------------------------------------------------------------
+fuzz_outcome fuzzer::execute(const fuzz_case& c, std::string* why) {
+    /* run `c` on the vm, reset in place, for at most `budget` instructions
+     * and check the state it ends in. `why` is set for stuck and broken.
+     * The coverage maps are cleared first whatever happens, so a case that
+     * can't be loaded covers nothing rather than what the last one did.
+     */
+    qword t0 = monotonic_ns();
+    coverage_clear(guest);
+    if (host_coverage)
+        coverage_clear(host);
+    fuzz_current = &c;
+    vm.set_mode(mode);
+    fuzz_outcome outcome = outcome_unloadable;
+    if (vm.load(c.rom)) {
+        outcome = run_loaded(c, why);
+        if (outcome != outcome_stuck &&
+            !fuzz_check_state(vm.get_state(), why))
+            outcome = outcome_broken;
+    }
+    fuzz_current = NULL;
+    ++stats.execs;
+    ++stats.outcomes[outcome];
+    stats.ns += monotonic_ns() - t0;
+    return outcome;
+}
+
+// ----------------------------------------------------------------------------
+bool fuzzer::add(const fuzz_case& c) {
+    /* put `c` in the corpus as a seed, whatever coverage it brings
+     */
+    if (c.rom.empty() || c.rom.size() > FUZZ_MAX_ROM)
+        return false;
+    std::string why;
+    execute(c, &why);
+    novel();
+    corpus.push_back(c);
+    unchecked.push_back(c);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void fuzzer::mutate(fuzz_case* c) {
+    /* one to four stacked mutations, AFL "havoc" style
+     */
+    std::string& rom = c->rom;
+    unsigned int n = 1 + pick(4);
+    for (unsigned int m = 0; m < n; ++m) {
+        unsigned int at = pick(rom.size()) & ~1u;
+        switch (pick(9)) {
+            case 0:
+                rom[pick(rom.size())] ^= 1 << pick(8);
+                break;
+            case 1:
+                rom[pick(rom.size())] = (char) pick(256);
+                break;
+            case 2:
+            case 3: {
+                unsigned int k = pick(NUM_INTERESTING);
+                c8opcode op = interesting[k] |
+                              ((c8opcode) next() & interesting_masks[k]);
+                if (at + 1 < rom.size()) {
+                    rom[at]     = (char) (op >> 8);
+                    rom[at + 1] = (char) (op & 0xFF);
+                }
+                break;
+            }
+            case 4:
+                if (rom.size() + 2 <= FUZZ_MAX_ROM) {
+                    char ins[2] = { (char) pick(256), (char) pick(256) };
+                    rom.insert(at, ins, 2);
+                }
+                break;
+            case 5:
+                if (rom.size() > 2)
+                    rom.erase(at, 2);
+                break;
+            case 6: {
+                // splice: our head, another case's tail
+                const std::string& other = corpus[pick(corpus.size())].rom;
+                unsigned int from = pick(other.size());
+                rom = rom.substr(0, at) + other.substr(from);
+                if (rom.size() > FUZZ_MAX_ROM)
+                    rom.resize(FUZZ_MAX_ROM);
+                if (rom.size() < 2)
+                    rom.append("\x12\x00", 2);
+                break;
+            }
+            default: {
+                std::vector<script_event>& events = c->events;
+                long frames = budget / CYCLES_PER_FRAME + 1;
+                unsigned int r = pick(3);
+                if (r == 0 && events.size() < FUZZ_MAX_EVENTS) {
+                    script_event e;
+                    e.frame = pick(frames);
+                    e.key   = pick(KEY_SIZE);
+                    e.down  = pick(2) != 0;
+                    events.push_back(e);
+                } else if (r == 1 && !events.empty()) {
+                    events.erase(events.begin() + pick(events.size()));
+                } else if (!events.empty()) {
+                    events[pick(events.size())].frame = pick(frames);
+                }
+                std::stable_sort(events.begin(), events.end(),
+                        [](const script_event& a, const script_event& b) {
+                            return a.frame < b.frame;
+                        });
+                break;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+fuzz_outcome fuzzer::round(fuzz_case* tried, std::string* why) {
+    /* mutate a corpus case into `tried` and run it, keeping it if it found
+     * new coverage. The corpus must not be empty.
+     */
+    *tried = corpus[pick(corpus.size())];
+    mutate(tried);
+    fuzz_outcome outcome = execute(*tried, why);
+    if (novel())
+        corpus.push_back(*tried);
+    unchecked.push_back(*tried);
+    if (unchecked.size() >= FUZZ_MEMORY_EVERY &&
+        outcome != outcome_stuck && outcome != outcome_broken) {
+        if (!fuzz_check_memory(vm.get_state(), why))
+            outcome = find_stray(outcome, tried, why);
+        unchecked.clear();
+    }
+    return outcome;
+}
+
+// ----------------------------------------------------------------------------
+fuzz_outcome fuzzer::find_stray(fuzz_outcome outcome, fuzz_case* tried,
+                                std::string* why) {
+    /* one of the cases run since the last check wrote past the machine's
+     * memory: run them again one at a time, each from zeros, to find which
+     * and make it the finding. The re-runs aren't counted, and the case
+     * just run, counted as `outcome`, is counted as broken instead.
+     */
+    fuzz_stats before = stats;
+    std::string seen = *why, again;
+    for (unsigned int i = 0; i < unchecked.size(); ++i) {
+        clear_stray();
+        execute(unchecked[i], &again);
+        if (!fuzz_check_memory(vm.get_state(), &again)) {
+            *tried = unchecked[i];
+            seen = again;
+            break;
+        }
+    }
+    // if none did it again, the last case is blamed for what was seen
+    *why = seen;
+    clear_stray();
+    stats = before;
+    --stats.outcomes[outcome];
+    ++stats.outcomes[outcome_broken];
+    return outcome_broken;
+}
+
+// ----------------------------------------------------------------------------
+void fuzzer::clear_stray() {
+    // the memory past the machine's, which `set_mode` leaves as it was
+    byte* memory = vm.edit_state()->memory;
+    memset(&memory[MEM_SIZE], 0x0, XO_MEM_SIZE - MEM_SIZE);
+}
+
+// ----------------------------------------------------------------------------
+const std::vector<fuzz_case>& fuzzer::get_corpus() {
+    return corpus;
+}
+
+// ----------------------------------------------------------------------------
+const fuzz_stats* fuzzer::get_stats() {
+    return &stats;
+}
@@ -0,0 +1,106 @@
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include "c8.h"
+#include "coverage.h"
+#include "rom.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* In-process, coverage-guided fuzzing of the vm with ROMs and key scripts.
+ *
+ * A case is a ROM image and a script of key events. Each round picks a case
+ * from the corpus, mutates it (bit flips, interesting opcodes, byte
+ * inserts and deletes, splices with another case, key events added, moved
+ * or dropped) and runs it on a vm reset in place, for at most `budget`
+ * instructions: the budget is what turns a guest that loops forever into
+ * a case that simply ends, and a host loop that stops making progress into
+ * a finding.
+ *
+ * Coverage is the guest's pc to pc edges (see coverage.h) plus, if the
+ * fuzz target is built with `-fsanitize-coverage=trace-pc`, the host's
+ * edges while the vm runs. A case that puts any edge's hit count into a
+ * power of two bucket not seen before joins the corpus.
+ *
+ * After each case the state is checked for things the vm should never
+ * allow whatever the ROM does: the stack pointer past the stack, the pc
+ * past memory while not faulted. Every FUZZ_MEMORY_EVERY cases the memory
+ * past the machine's size is checked for writes too, and if there were any
+ * the cases since the last check are run again to find the one to blame.
+ * Those, and a run that makes no progress, are findings; guest faults are
+ * the vm doing its job and aren't.
+ */
+const long FUZZ_BUDGET = 500;                // instructions per case
+const unsigned int FUZZ_MAX_ROM    = 1024;   // bytes a mutant may grow to
+const unsigned int FUZZ_MAX_EVENTS = 32;
+const unsigned int FUZZ_MEMORY_EVERY = 64;   // cases per check past memory
+
+typedef struct fuzz_case {
+    std::string rom;
+    std::vector<script_event> events;   // in frame order
+} fuzz_case;
+
+enum fuzz_outcome {
+    outcome_budget,     // ran the whole budget (usual for a game loop)
+    outcome_halted,     // 00FD
+    outcome_fault,      // a guest fault: stopped cleanly
+    outcome_stuck,      // `run` stopped making progress: a finding
+    outcome_broken,     // the state broke an invariant: a finding
+    outcome_unloadable, // the ROM doesn't fit the machine; nothing ran
+    num_fuzz_outcomes
+};
+
+typedef struct fuzz_stats {
+    qword execs;
+    qword ns;                               // spent running cases
+    qword outcomes[num_fuzz_outcomes];
+    unsigned int guest_edges, host_edges;   // distinct edges seen
+} fuzz_stats;
+
+// the host edge map, set only while a case runs (see c8fuzz.cpp), and the
+// case running, for a crash handler to save
+extern coverage_map* fuzz_host_map;
+extern const fuzz_case* fuzz_current;
+
+class fuzzer {
+    C8VM vm;
+    machine_mode mode;
+    long budget;
+    qword rng;
+    std::vector<fuzz_case> corpus;
+    coverage_map* guest;
+    coverage_map* host;
+    bool host_coverage;
+    byte* seen;           // buckets seen per edge, guest then host
+    fuzz_stats stats;
+    std::vector<fuzz_case> unchecked;   // run since memory was last checked
+
+    public:
+    fuzzer(machine_mode mode, long budget, qword seed, bool host_coverage);
+    ~fuzzer();
+    bool add(const fuzz_case& c);
+    fuzz_outcome execute(const fuzz_case& c, std::string* why);
+    fuzz_outcome round(fuzz_case* tried, std::string* why);
+    const std::vector<fuzz_case>& get_corpus();
+    const fuzz_stats* get_stats();
+
+    private:
+    fuzzer(const fuzzer&);            // owns its maps
+    fuzzer& operator=(const fuzzer&);
+    qword next();
+    unsigned int pick(unsigned int n);
+    void mutate(fuzz_case* c);
+    fuzz_outcome run_loaded(const fuzz_case& c, std::string* why);
+    bool novel();
+    fuzz_outcome find_stray(fuzz_outcome outcome, fuzz_case* tried,
+                            std::string* why);
+    void clear_stray();
+};
+
+const char* fuzz_outcome_name(fuzz_outcome outcome);
+bool fuzz_check_state(const vmstate* state, std::string* why);
+bool fuzz_check_memory(const vmstate* state, std::string* why);
+void fuzz_write_keys(const fuzz_case& c, std::ostream& out);
+
+#endif
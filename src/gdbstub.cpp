@@ -0,0 +1,827 @@
+#include "gdbstub.h"
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// ----------------------------------------------------------------------------
+static std::string to_hex(const std::string& bytes) {
+    std::string out;
+    for (unsigned int i = 0; i < bytes.size(); ++i) {
+        byte b = (byte) bytes[i];
+        out += hex_digits[b >> 4];
+        out += hex_digits[b & 0xF];
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+static bool from_hex(const std::string& text, std::string* bytes) {
+    if (text.size() % 2)
+        return false;
+    bytes->clear();
+    for (unsigned int i = 0; i < text.size(); i += 2) {
+        int hi = hex_value(text[i]), lo = hex_value(text[i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        *bytes += (char) (hi << 4 | lo);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+static bool parse_number(const std::string& s, size_t* pos, dword* value) {
+    /* a hex number of up to 8 digits at `*pos`, moving `*pos` past it
+     */
+    size_t start = *pos;
+    *value = 0;
+    for (; *pos < s.size() && hex_value(s[*pos]) >= 0; ++*pos)
+        *value = *value << 4 | hex_value(s[*pos]);
+    return *pos > start && *pos - start <= 8;
+}
+
+// ----------------------------------------------------------------------------
+static bool parse_range(const std::string& s, size_t pos, dword* addr,
+                        dword* len) {
+    // "addr,len" from `pos`, as in m, M, Z and z packets
+    if (!parse_number(s, &pos, addr) || pos >= s.size() || s[pos] != ',')
+        return false;
+    ++pos;
+    return parse_number(s, &pos, len);
+}
+
+// ----------------------------------------------------------------------------
+static unsigned int register_size(unsigned int n) {
+    // i, pc and sp are 16 bits, the rest 8
+    return n >= NUM_REGISTERS && n < NUM_REGISTERS + 3 ? 2 : 1;
+}
+
+// ----------------------------------------------------------------------------
+static unsigned int register_offset(unsigned int n) {
+    // where register `n` is in what `g` sends
+    unsigned int offset = 0;
+    for (unsigned int r = 0; r < n; ++r)
+        offset += register_size(r);
+    return offset;
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_packet(const std::string& payload) {
+    /* `payload` framed for the wire: $payload#checksum
+     */
+    byte sum = 0;
+    for (unsigned int i = 0; i < payload.size(); ++i)
+        sum += (byte) payload[i];
+    std::string out = "$" + payload + "#";
+    out += hex_digits[sum >> 4];
+    out += hex_digits[sum & 0xF];
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+void gdb_window(const vmstate* state, byte window[window_size]) {
+    /* the vmstate fields mapped at GDB_STATE_BASE
+     */
+    memset(window, 0, window_size);
+    memcpy(&window[window_registers], state->registers, NUM_REGISTERS);
+    const word words[] = { state->index, state->ip, state->sp };
+    for (unsigned int i = 0; i < 3; ++i) {
+        window[window_index + 2 * i]     = words[i] & 0xFF;
+        window[window_index + 2 * i + 1] = words[i] >> 8;
+    }
+    window[window_delay_timer] = state->delay_timer;
+    window[window_sound_timer] = state->sound_timer;
+    window[window_waiting_key] = state->waiting_key;
+    window[window_wait_reg]    = state->wait_reg;
+    window[window_hires]       = state->hires;
+    window[window_planes]      = state->planes;
+    window[window_faults]      = state->faults;
+    window[window_on]          = state->on;
+    for (unsigned int i = 0; i < STACK_SIZE; ++i) {
+        window[window_stack + 2 * i]     = state->stack[i] & 0xFF;
+        window[window_stack + 2 * i + 1] = state->stack[i] >> 8;
+    }
+    memcpy(&window[window_key], state->key, KEY_SIZE);
+    memcpy(&window[window_flags], state->flags, sizeof(state->flags));
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_target_xml() {
+    std::ostringstream out;
+    out << "<?xml version=\"1.0\"?>\n"
+        << "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+        << "<target version=\"1.0\">\n"
+        << "  <feature name=\"org.c8vm.chip8\">\n";
+    for (unsigned int i = 0; i < NUM_REGISTERS; ++i) {
+        out << "    <reg name=\"v" << std::hex << i << std::dec
+            << "\" bitsize=\"8\" type=\"uint8\"/>\n";
+    }
+    out << "    <reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+        << "    <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+        << "    <reg name=\"sp\" bitsize=\"16\" type=\"uint16\"/>\n"
+        << "    <reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>\n"
+        << "    <reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>\n"
+        << "  </feature>\n"
+        << "</target>\n";
+    return out.str();
+}
+
+// ----------------------------------------------------------------------------
+static std::string fault_reply(byte faults) {
+    // SIGILL for an opcode the mode doesn't have, SIGSEGV for the rest
+    return faults & fault_invalid_opcode ? "T04" : "T0b";
+}
+
+// ----------------------------------------------------------------------------
+gdb_stub::gdb_stub(C8VM& vm) : vm(vm), listen_fd(-1), conn_fd(-1),
+                               no_ack(false), swbreak(false),
+                               running(false), stop("T05"), scan(NULL) {
+}
+
+// ----------------------------------------------------------------------------
+gdb_stub::~gdb_stub() {
+    close();
+    delete scan;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::listen(const std::string& where) {
+    /* `where` is a port number, for TCP on the loopback interface only, or
+     * a path for a Unix socket
+     */
+    bool tcp = !where.empty() &&
+               where.find_first_not_of("0123456789") == std::string::npos;
+    listen_fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return false;
+    int bound;
+    if (tcp) {
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons((unsigned short) atoi(where.c_str()));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    } else {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (where.size() >= sizeof(addr.sun_path)) {
+            close();
+            return false;
+        }
+        strcpy(addr.sun_path, where.c_str());
+        unlink(where.c_str());
+        bound = bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+        if (bound == 0)
+            unix_path = where;
+    }
+    if (bound != 0 || ::listen(listen_fd, 1) != 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::accept() {
+    /* wait for a debugger. The guest is stopped until it says otherwise.
+     */
+    if (listen_fd < 0)
+        return false;
+    do {
+        conn_fd = ::accept(listen_fd, NULL, NULL);
+    } while (conn_fd < 0 && errno == EINTR);
+    if (conn_fd < 0)
+        return false;
+    int on = 1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    in.clear();
+    no_ack  = false;
+    running = false;
+    stop    = "T05";
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::close() {
+    detach();
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+    listen_fd = -1;
+    if (!unix_path.empty())
+        unlink(unix_path.c_str());
+    unix_path.clear();
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::detach() {
+    /* drop the debugger, leaving the guest running free
+     */
+    lift_traps();
+    running = false;
+    if (conn_fd >= 0)
+        ::close(conn_fd);
+    conn_fd = -1;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::is_attached() {
+    return conn_fd >= 0;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::is_running() {
+    /* the debugger has let the guest go (`resume` runs it) and it hasn't
+     * stopped since
+     */
+    return running;
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::send(const std::string& payload) {
+    last = gdb_packet(payload);
+    if (conn_fd < 0)
+        return;
+    for (size_t done = 0; done < last.size(); ) {
+        ssize_t n = ::write(conn_fd, last.data() + done, last.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            detach();
+            return;
+        }
+        done += n;
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::poll(int timeout_ms) {
+    /* handle whatever the debugger has sent, waiting up to `timeout_ms` for
+     * something (-1 to wait for ever). False once it has gone.
+     */
+    if (conn_fd < 0)
+        return false;
+    struct pollfd p;
+    p.fd      = conn_fd;
+    p.events  = POLLIN;
+    p.revents = 0;
+    if (::poll(&p, 1, timeout_ms) > 0) {
+        char buf[GDB_PACKET_SIZE];
+        ssize_t n = ::read(conn_fd, buf, sizeof(buf));
+        if (n <= 0 && !(n < 0 && errno == EINTR)) {
+            detach();
+            return false;
+        }
+        if (n > 0)
+            in.append(buf, n);
+    }
+    process();
+    return conn_fd >= 0;
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::process() {
+    /* split what's been received into acks, interrupts and packets
+     */
+    while (!in.empty() && conn_fd >= 0) {
+        char c = in[0];
+        if (c != '$') {
+            in.erase(0, 1);
+            if (c == '-' && !last.empty() &&
+                ::write(conn_fd, last.data(), last.size()) < 0)
+                detach();
+            else if (c == 0x03)
+                interrupt();
+            continue;   // '+', or noise between packets
+        }
+        size_t hash = in.find('#');
+        if (hash == std::string::npos || hash + 2 >= in.size())
+            return;     // the rest is still on its way
+        std::string payload = in.substr(1, hash - 1), sum;
+        bool ok = from_hex(in.substr(hash + 1, 2), &sum) &&
+                  gdb_packet(payload) == in.substr(0, hash + 3);
+        in.erase(0, hash + 3);
+        if (!no_ack && ::write(conn_fd, ok ? "+" : "-", 1) < 0) {
+            detach();
+            return;
+        }
+        std::string reply;
+        if (ok && handle(payload, &reply))
+            send(reply);
+        if (payload == "k" || payload.compare(0, 1, "D") == 0 ||
+            payload.compare(0, 6, "vKill;") == 0)
+            detach();
+    }
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::stopped(const std::string& reply) {
+    /* the guest has stopped: take the traps out and say why
+     */
+    lift_traps();
+    running = false;
+    stop    = reply;
+    return reply;
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::interrupt() {
+    // ^C from the debugger
+    if (running)
+        send(stopped("T02"));
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::resume(long max_frames) {
+    /* while running, run the guest for up to `max_frames` frames. If it
+     * stopped for the debugger, returns (and sends) the stop reply; "" if
+     * it's still running.
+     */
+    if (!running)
+        return "";
+    std::string reply;
+    const vmstate* state = vm.get_state();
+    if (watches.empty()) {
+        long end = state->cycles / CYCLES_PER_FRAME + max_frames;
+        while (reply.empty() && state->cycles / CYCLES_PER_FRAME < end) {
+            stop_reason r = vm.run(0, end - state->cycles / CYCLES_PER_FRAME);
+            switch (r.kind) {
+                case stop_breakpoint:
+                    if (breaks.count(r.addr)) {
+                        reply = swbreak ? "T05swbreak:;" : "T05";
+                    } else {
+                        // the guest's own TRAP_OPCODE: just invalid
+                        lift_traps();
+                        vm.do_cycle();
+                        reply = fault_reply(vm.get_state()->faults);
+                    }
+                    break;
+                case stop_fault:
+                    reply = fault_reply(r.fault);
+                    break;
+                case stop_halted:
+                    reply = "W00";
+                    break;
+                default:
+                    break;  // the frames ran, or a frame blocked in FX0A
+            }
+        }
+    } else {
+        for (long n = max_frames * CYCLES_PER_FRAME; n > 0 && reply.empty();
+             --n) {
+            if (!state->waiting_key && breaks.count(state->ip))
+                reply = swbreak ? "T05swbreak:;" : "T05";
+            else
+                reply = step_one();
+        }
+    }
+    if (reply.empty())
+        return "";
+    send(stopped(reply));
+    return reply;
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::step_one() {
+    /* one instruction, with no traps in; the stop reply if that gave the
+     * debugger a reason to stop, else ""
+     */
+    const vmstate* state = vm.get_state();
+    if (state->faults)
+        return fault_reply(state->faults);
+    if (!state->on)
+        return "W00";
+    vm.do_cycle();
+    if (state->faults)
+        return fault_reply(state->faults);
+    if (!state->on)
+        return "W00";
+    return watch_hit();
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::watch_hit() {
+    /* the stop reply for the first watch whose bytes changed, if any; every
+     * watch then takes the current bytes as its new baseline
+     */
+    std::string reply;
+    for (unsigned int i = 0; i < watches.size(); ++i) {
+        std::string now;
+        read(watches[i].addr, watches[i].len, &now);
+        if (now != watches[i].last && reply.empty()) {
+            std::ostringstream out;
+            out << "T05watch:" << std::hex << watches[i].addr << ";";
+            reply = out.str();
+        }
+        watches[i].last = now;
+    }
+    return reply;
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::go(bool step) {
+    /* `s` or `c`. The first instruction is always stepped with the traps
+     * out, so a breakpoint at the pc doesn't stop us where we are; after
+     * that, continuing plants them and leaves the rest to `resume`. `run`
+     * doesn't check the pc it starts at, so a breakpoint there is hit here.
+     */
+    std::string reply = step_one();
+    if (!reply.empty() || step)
+        return stopped(reply.empty() ? "T05" : reply);
+    const vmstate* state = vm.get_state();
+    if (watches.empty() && !state->waiting_key && breaks.count(state->ip))
+        return stopped(swbreak ? "T05swbreak:;" : "T05");
+    running = true;
+    if (watches.empty())
+        plant_traps();
+    return "";
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::plant_traps() {
+    vmstate* state = vm.edit_state();
+    for (std::set<word>::iterator it = breaks.begin(); it != breaks.end();
+         ++it) {
+        word addr = *it;
+        bool no_room = addr >= state->mem_mask || planted.count(addr - 1);
+        c8opcode op = no_room ? 0 : state->memory[addr] << 8 |
+                                    state->memory[addr + 1];
+        if (no_room || (state->mode == mode_xochip && op == 0xF000)) {
+            /* a trap can't go on the last byte, or over half of one
+             * already in; and a skip looks at the next instruction to skip
+             * all four bytes of F000 NNNN, and would skip two of a trap.
+             * The vm checks for these itself instead.
+             */
+            if (!vm.is_breakpoint(addr)) {
+                vm.set_breakpoint(addr);
+                checked.insert(addr);
+            }
+            continue;
+        }
+        planted[addr] = op;
+        state->memory[addr]     = TRAP_OPCODE >> 8;
+        state->memory[addr + 1] = TRAP_OPCODE & 0xFF;
+    }
+    vm.set_traps(!planted.empty());
+}
+
+// ----------------------------------------------------------------------------
+void gdb_stub::lift_traps() {
+    for (std::set<word>::iterator it = checked.begin(); it != checked.end();
+         ++it)
+        vm.clear_breakpoint(*it);
+    checked.clear();
+    if (planted.empty())
+        return;
+    vmstate* state = vm.edit_state();
+    for (std::map<word, c8opcode>::iterator it = planted.begin();
+         it != planted.end(); ++it) {
+        byte* m = &state->memory[it->first];
+        if ((m[0] << 8 | m[1]) != TRAP_OPCODE)
+            continue;   // the guest wrote over it; keep what it wrote
+        m[0] = it->second >> 8;
+        m[1] = it->second & 0xFF;
+    }
+    planted.clear();
+    vm.set_traps(false);
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::read(dword addr, unsigned int len, std::string* out) {
+    /* `len` bytes of guest memory, or of the state window, from `addr`
+     */
+    const vmstate* state = vm.get_state();
+    out->clear();
+    if (addr >= GDB_STATE_BASE) {
+        byte window[window_size];
+        if (addr - GDB_STATE_BASE + len > window_size)
+            return false;
+        gdb_window(state, window);
+        out->assign((const char*) &window[addr - GDB_STATE_BASE], len);
+        return true;
+    }
+    if (addr + len > (dword) state->mem_mask + 1)
+        return false;
+    out->assign((const char*) &state->memory[addr], len);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::write(dword addr, const std::string& bytes) {
+    // guest memory only; the window is read only (registers have P and G)
+    if (addr + bytes.size() > (dword) vm.get_state()->mem_mask + 1)
+        return false;
+    memcpy(&vm.edit_state()->memory[addr], bytes.data(), bytes.size());
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::read_registers() {
+    const vmstate* state = vm.get_state();
+    std::string regs((const char*) state->registers, NUM_REGISTERS);
+    const word words[] = { state->index, state->ip, state->sp };
+    for (unsigned int i = 0; i < 3; ++i) {
+        regs += (char) (words[i] & 0xFF);
+        regs += (char) (words[i] >> 8);
+    }
+    regs += (char) state->delay_timer;
+    regs += (char) state->sound_timer;
+    return regs;
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::write_register(unsigned int n, const std::string& bytes) {
+    /* register `n` (in `g` order) from its little endian bytes
+     */
+    if (n >= GDB_NUM_REGS || bytes.size() != register_size(n))
+        return false;
+    vmstate* state = vm.edit_state();
+    word value = (byte) bytes[0];
+    if (bytes.size() == 2)
+        value |= (byte) bytes[1] << 8;
+    if (n < NUM_REGISTERS)
+        state->registers[n] = value;
+    else if (n == NUM_REGISTERS)
+        state->index = value;
+    else if (n == NUM_REGISTERS + 1)
+        state->ip = value;
+    else if (n == NUM_REGISTERS + 2 && value <= STACK_SIZE)
+        state->sp = value;
+    else if (n == NUM_REGISTERS + 3)
+        state->delay_timer = value;
+    else if (n == NUM_REGISTERS + 4)
+        state->sound_timer = value;
+    else
+        return false;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::query(const std::string& packet) {
+    /* the q packets worth answering; "" (unsupported) for the rest
+     */
+    if (packet.compare(0, 11, "qSupported:") == 0 || packet == "qSupported") {
+        swbreak = packet.find("swbreak+") != std::string::npos;
+        std::ostringstream out;
+        out << "PacketSize=" << std::hex << GDB_PACKET_SIZE
+            << ";qXfer:features:read+;QStartNoAckMode+"
+            << (swbreak ? ";swbreak+" : "");
+        return out.str();
+    }
+    const std::string xfer = "qXfer:features:read:target.xml:";
+    if (packet.compare(0, xfer.size(), xfer) == 0) {
+        dword offset, len;
+        if (!parse_range(packet, xfer.size(), &offset, &len))
+            return "E01";
+        std::string xml = gdb_target_xml();
+        if (offset >= xml.size())
+            return "l";
+        std::string part = xml.substr(offset, len);
+        return (offset + part.size() < xml.size() ? "m" : "l") + part;
+    }
+    if (packet.compare(0, 6, "qRcmd,") == 0) {
+        // monitor key <hex key> <d|u>: a key event, for headless sessions
+        std::string cmd;
+        if (!from_hex(packet.substr(6), &cmd))
+            return "E01";
+        std::istringstream words(cmd);
+        std::string verb;
+        words >> verb;
+        if (verb == "scan")
+            return monitor_scan(words);
+        char kind = 0;
+        unsigned int key = KEY_SIZE;
+        words >> std::hex >> key >> kind;
+        if (verb != "key" || key >= KEY_SIZE || (kind != 'd' && kind != 'u'))
+            return "E01";
+        return vm.post_key((byte) key, kind == 'd') ? "OK" : "E02";
+    }
+    if (packet == "qAttached")
+        return "1";
+    if (packet == "qC")
+        return "QC1";
+    if (packet == "qfThreadInfo")
+        return "m1";
+    if (packet == "qsThreadInfo")
+        return "l";
+    if (packet == "qOffsets")
+        return "Text=0;Data=0;Bss=0";
+    if (packet == "qSymbol::")
+        return "OK";
+    return "";
+}
+
+// ----------------------------------------------------------------------------
+std::string gdb_stub::monitor_scan(std::istream& words) {
+    /* monitor scan start, to make every guest memory address a candidate,
+     * then any of
+     *
+     *     monitor scan changed|unchanged|up|down
+     *     monitor scan eq|delta <hex byte>
+     *
+     * to keep those whose byte, since the last scan, changed, stayed, went
+     * up or down, is the byte given, or went up by it. The reply is
+     * console output for gdb: how many are left, and the first few.
+     */
+    std::string how;
+    words >> how;
+    const vmstate* state = vm.get_state();
+    if (how == "start") {
+        delete scan;
+        scan = new mem_scan(1, state->mem_mask + 1);
+        scan->start(0, state->memory);
+    } else {
+        scan_predicate predicate;
+        unsigned int value = 0;
+        if (how == "changed")
+            predicate = scan_changed;
+        else if (how == "unchanged")
+            predicate = scan_unchanged;
+        else if (how == "up")
+            predicate = scan_increased;
+        else if (how == "down")
+            predicate = scan_decreased;
+        else if (how == "eq" && words >> std::hex >> value && value <= 0xFF)
+            predicate = scan_equal;
+        else if (how == "delta" && words >> std::hex >> value &&
+                 value <= 0xFF)
+            predicate = scan_delta;
+        else
+            return "E01";
+        if (!scan)
+            return "E02";   // nothing started
+        scan->filter(0, state->memory, predicate, (byte) value);
+    }
+    std::vector<word> found;
+    scan->candidates(0, &found);
+    std::ostringstream out;
+    out << std::dec << found.size() << " left";
+    for (unsigned int i = 0; i < found.size() && i < GDB_SCAN_LIST; ++i)
+        out << (i ? " " : ": ") << std::hex << "0x" << found[i];
+    out << (found.size() > GDB_SCAN_LIST ? " ...\n" : "\n");
+    return to_hex(out.str());
+}
+
+// ----------------------------------------------------------------------------
+bool gdb_stub::handle(const std::string& packet, std::string* reply) {
+    /* act on one packet's payload. False if there's nothing to send back
+     * yet (the guest was let go; `resume` sends the stop reply), else the
+     * reply is in `reply`: "" meaning the packet isn't supported.
+     */
+    reply->clear();
+    if (packet.empty() || running)
+        return !running;
+    dword addr, len, n;
+    size_t pos = 1;
+    std::string bytes;
+    switch (packet[0]) {
+        case '?':
+            *reply = stop;
+            break;
+        case 'g':
+            *reply = to_hex(read_registers());
+            break;
+        case 'G':
+            bytes.clear();
+            if (!from_hex(packet.substr(1), &bytes) ||
+                bytes.size() != register_offset(GDB_NUM_REGS)) {
+                *reply = "E01";
+                break;
+            }
+            for (unsigned int r = 0; r < GDB_NUM_REGS; ++r) {
+                write_register(r, bytes.substr(register_offset(r),
+                                               register_size(r)));
+            }
+            *reply = "OK";
+            break;
+        case 'p':
+            if (!parse_number(packet, &pos, &n) || n >= GDB_NUM_REGS) {
+                *reply = "E01";
+                break;
+            }
+            *reply = to_hex(read_registers().substr(register_offset(n),
+                                                    register_size(n)));
+            break;
+        case 'P':
+            *reply = parse_number(packet, &pos, &n) && pos < packet.size() &&
+                     packet[pos] == '=' &&
+                     from_hex(packet.substr(pos + 1), &bytes) &&
+                     write_register(n, bytes) ? "OK" : "E01";
+            break;
+        case 'm':
+            if (!parse_range(packet, 1, &addr, &len) ||
+                2 * len > GDB_PACKET_SIZE || !read(addr, len, &bytes))
+                *reply = "E01";
+            else
+                *reply = to_hex(bytes);
+            break;
+        case 'M':
+            pos = packet.find(':');
+            *reply = parse_range(packet, 1, &addr, &len) &&
+                     pos != std::string::npos &&
+                     from_hex(packet.substr(pos + 1), &bytes) &&
+                     bytes.size() == len && write(addr, bytes) ? "OK" : "E01";
+            break;
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+            // resuming at an address, or with a signal, isn't supported:
+            // there's nowhere to deliver one
+            *reply = go(packet[0] == 's' || packet[0] == 'S');
+            return !reply->empty();
+        case 'v':
+            if (packet == "vCont?") {
+                *reply = "vCont;c;C;s;S";
+            } else if (packet.compare(0, 6, "vCont;") == 0) {
+                char action = packet.size() > 6 ? packet[6] : 0;
+                *reply = go(action == 's' || action == 'S');
+                return !reply->empty();
+            } else if (packet.compare(0, 6, "vKill;") == 0) {
+                vm.stop();
+                *reply = "OK";
+            }
+            break;
+        case 'Z':
+        case 'z':
+            if (packet.size() < 2 || !parse_range(packet, 3, &addr, &len) ||
+                packet[2] != ',') {
+                *reply = "E01";
+            } else if (packet[1] == '0' || packet[1] == '1') {
+                if (addr >= GDB_STATE_BASE) {
+                    *reply = "E01";
+                    break;
+                }
+                if (packet[0] == 'Z')
+                    breaks.insert((word) addr);
+                else
+                    breaks.erase((word) addr);
+                *reply = "OK";
+            } else if (packet[1] == '2') {
+                gdb_watch w;
+                w.addr = addr;
+                w.len  = len;
+                unsigned int i = 0;
+                while (i < watches.size() && (watches[i].addr != addr ||
+                                              watches[i].len != len))
+                    ++i;
+                if (packet[0] == 'z') {
+                    if (i < watches.size())
+                        watches.erase(watches.begin() + i);
+                    *reply = "OK";
+                } else if (len == 0 || !read(addr, len, &w.last)) {
+                    *reply = "E01";
+                } else {
+                    if (i == watches.size())
+                        watches.push_back(w);
+                    *reply = "OK";
+                }
+            }
+            // read and access watchpoints (3, 4) aren't supported
+            break;
+        case 'H':
+        case 'T':
+            *reply = "OK";
+            break;
+        case 'q':
+            *reply = query(packet);
+            break;
+        case 'Q':
+            if (packet == "QStartNoAckMode") {
+                // the OK is the last packet acked
+                no_ack  = true;
+                *reply  = "OK";
+            }
+            break;
+        case 'D':
+            *reply = "OK";
+            break;
+        case 'k':
+            vm.stop();
+            return false;
+    }
+    return true;
+}
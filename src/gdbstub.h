@@ -0,0 +1,123 @@
+#ifndef __GDBSTUB_H__
+#define __GDBSTUB_H__
+
+#include "c8.h"
+#include "memscan.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/* A GDB remote serial protocol stub, so that gdb (or anything else that
+ * speaks the protocol) can attach to a vm over a local TCP port or Unix
+ * socket: read and write registers and memory, step, continue, interrupt,
+ * and set breakpoints and watchpoints.
+ *
+ * The registers, in `g` order and described to the debugger by the
+ * target.xml it can read with qXfer, are v0-vf, i, pc, sp (the number of
+ * return addresses on the stack), dt and st; 16 bit ones are sent little
+ * endian. Below GDB_STATE_BASE addresses are guest memory; from there up
+ * is a read only window onto the rest of the vmstate (see `gdb_window`),
+ * so that a watchpoint can be put on any of it.
+ *
+ * Breakpoints are traps: when the guest is let go, TRAP_OPCODE is written
+ * over each breakpoint's instruction, and the vm (see `C8VM::set_traps`)
+ * stops on one only in its invalid opcode path, so continuing runs the
+ * same fast core, idle loop skipping included, as without a debugger. The
+ * traps are lifted whenever the guest stops, so the debugger never sees
+ * them; a guest that writes over one while running keeps what it wrote.
+ * The guest itself can read them, though, like any software breakpoint.
+ * An XO-CHIP F000 NNNN can't be trapped, as a skip over it would then skip
+ * two bytes rather than four, so a breakpoint on one is left to the vm's
+ * own (slower) breakpoint check.
+ *
+ * Watchpoints (write only, `Z2`) have no such trick: while any is set,
+ * continuing steps the guest an instruction at a time, comparing the
+ * watched bytes after each, and stops once any has changed.
+ *
+ * To find what to watch, `monitor scan` runs a memscan.h value search over
+ * guest memory between stops (see `monitor_scan`).
+ */
+const dword GDB_STATE_BASE  = 0x10000;
+const unsigned int GDB_NUM_REGS    = 21;
+const unsigned int GDB_PACKET_SIZE = 0x1000;
+const unsigned int GDB_SCAN_LIST   = 16;  // candidates `monitor scan` lists
+
+// the window at GDB_STATE_BASE, offsets from it
+enum gdb_window_field {
+    window_registers   = 0x00,  // v0-vf
+    window_index       = 0x10,  // 16 bit fields little endian
+    window_pc          = 0x12,
+    window_sp          = 0x14,
+    window_delay_timer = 0x16,
+    window_sound_timer = 0x17,
+    window_waiting_key = 0x18,
+    window_wait_reg    = 0x19,
+    window_hires       = 0x1A,
+    window_planes      = 0x1B,
+    window_faults      = 0x1C,
+    window_on          = 0x1D,
+    window_stack       = 0x20,  // 16 return addresses
+    window_key         = 0x40,
+    window_flags       = 0x50,
+    window_size        = 0x60,
+};
+
+typedef struct gdb_watch {
+    dword addr;
+    unsigned int len;
+    std::string last;   // the bytes when last compared
+} gdb_watch;
+
+class gdb_stub {
+    C8VM& vm;
+    int listen_fd, conn_fd;
+    std::string unix_path;        // to remove on close
+    std::string in;               // received, not yet handled
+    std::string last;             // the last packet sent, for a resend
+    bool no_ack, swbreak, running;
+    std::string stop;             // the last stop reply, for `?`
+    std::set<word> breaks;
+    std::map<word, c8opcode> planted;  // traps in memory, over these
+    std::set<word> checked;       // vm breakpoints, where a trap can't go
+    std::vector<gdb_watch> watches;
+    mem_scan* scan;               // `monitor scan`'s, once started
+
+    public:
+    gdb_stub(C8VM& vm);
+    ~gdb_stub();
+    bool listen(const std::string& where);
+    bool accept();
+    void close();
+    bool is_attached();
+    bool is_running();
+    bool poll(int timeout_ms);
+    std::string resume(long max_frames);
+    bool handle(const std::string& packet, std::string* reply);
+
+    private:
+    gdb_stub(const gdb_stub&);            // owns its sockets
+    gdb_stub& operator=(const gdb_stub&);
+    void send(const std::string& payload);
+    void process();
+    void detach();
+    void interrupt();
+    std::string stopped(const std::string& reply);
+    std::string go(bool step);
+    std::string step_one();
+    std::string watch_hit();
+    void plant_traps();
+    void lift_traps();
+    bool read(dword addr, unsigned int len, std::string* out);
+    bool write(dword addr, const std::string& bytes);
+    std::string read_registers();
+    bool write_register(unsigned int n, const std::string& bytes);
+    std::string query(const std::string& packet);
+    std::string monitor_scan(std::istream& words);
+};
+
+std::string gdb_packet(const std::string& payload);
+void gdb_window(const vmstate* state, byte window[window_size]);
+std::string gdb_target_xml();
+
+#endif
@@ -0,0 +1,109 @@
+#include "gfx.h"
+#include <string.h>
+
+// ----------------------------------------------------------------------------
+template <bool wrap>
+bool gfx_draw(gfx_plane plane, unsigned int x, unsigned int y,
+              const word* rows, unsigned int n, unsigned int w,
+              unsigned int h) {
+    /* xor `n` sprite rows (16 bits each, leftmost pixel in the top bit) in
+     * at (x, y), which must already be on screen. Pixels falling off the
+     * right or bottom edge are clipped, or with `wrap` come back in on the
+     * opposite edge. Returns true if any pixel was turned off.
+     */
+    qword clip = w > 64 ? ~0ULL : 0; // lo-res never reaches word 1
+    // the part of a row past the right edge, moved back to column 0
+    bool spills = wrap && x + 16 > w;
+    unsigned int spill_shift = spills ? w - x : 0;
+    qword spill_mask = spills ? ~0ULL : 0;
+    bool hit = false;
+    for (unsigned int i = 0; i < n; ++i) {
+        unsigned int row_y = y + i;
+        if (wrap)
+            row_y &= h - 1;
+        else if (row_y >= h)
+            break;
+        qword bits = (qword) rows[i] << 48, hi, lo;
+        if (x < 64) {
+            hi = bits >> x;
+            lo = x ? bits << (64 - x) : 0;
+        } else {
+            hi = 0;
+            lo = bits >> (x - 64);
+        }
+        lo &= clip;
+        hi |= (bits << spill_shift) & spill_mask;
+        qword* row = plane[row_y];
+        hit |= ((row[0] & hi) | (row[1] & lo)) != 0;
+        row[0] ^= hi;
+        row[1] ^= lo;
+    }
+    return hit;
+}
+
+template bool gfx_draw<false>(gfx_plane, unsigned int, unsigned int,
+                              const word*, unsigned int, unsigned int,
+                              unsigned int);
+template bool gfx_draw<true>(gfx_plane, unsigned int, unsigned int,
+                             const word*, unsigned int, unsigned int,
+                             unsigned int);
+
+// ----------------------------------------------------------------------------
+void gfx_clear(gfx_plane plane) {
+    memset(plane, 0, sizeof(gfx_plane));
+}
+
+// ----------------------------------------------------------------------------
+void gfx_scroll_down(gfx_plane plane, unsigned int n, unsigned int h) {
+    if (n > h)
+        n = h;
+    memmove(plane[n], plane[0], (h - n) * sizeof(plane[0]));
+    memset(plane[0], 0, n * sizeof(plane[0]));
+}
+
+// ----------------------------------------------------------------------------
+void gfx_scroll_up(gfx_plane plane, unsigned int n, unsigned int h) {
+    if (n > h)
+        n = h;
+    memmove(plane[0], plane[n], (h - n) * sizeof(plane[0]));
+    memset(plane[h - n], 0, n * sizeof(plane[0]));
+}
+
+// ----------------------------------------------------------------------------
+void gfx_scroll_right(gfx_plane plane, unsigned int n, unsigned int w,
+                      unsigned int h) {
+    /* shift each row right by 0 < n < 64 pixels as one 128-bit value; the
+     * loop has no cross-row dependencies, so it vectorises
+     */
+    qword clip = w > 64 ? ~0ULL : 0;
+    for (unsigned int y = 0; y < h; ++y) {
+        plane[y][1] = ((plane[y][1] >> n) | (plane[y][0] << (64 - n))) & clip;
+        plane[y][0] >>= n;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void gfx_scroll_left(gfx_plane plane, unsigned int n, unsigned int h) {
+    for (unsigned int y = 0; y < h; ++y) {
+        plane[y][0] = (plane[y][0] << n) | (plane[y][1] >> (64 - n));
+        plane[y][1] <<= n;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void gfx_unpack(const vmstate* state, byte* pixels) {
+    /* expand the visible display into one byte per pixel, row major, for
+     * front-ends: bit 0 is plane 0 and bit 1 is plane 1, so classic ROMs
+     * only ever produce 0 or 1
+     */
+    unsigned int w = gfx_width(state), h = gfx_height(state);
+    for (unsigned int y = 0; y < h; ++y) {
+        for (unsigned int x = 0; x < w; ++x) {
+            unsigned int word_idx = x / 64, shift = 63 - x % 64;
+            byte p = 0;
+            for (unsigned int plane = 0; plane < GFX_PLANES; ++plane)
+                p |= ((state->gfx[plane][y][word_idx] >> shift) & 1) << plane;
+            *pixels++ = p;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef __GFX_H__
+#define __GFX_H__
+
+#include "def.h"
+
+/* The framebuffer is packed one bit per pixel, with a 128 pixel row held in
+ * GFX_ROW_WORDS 64-bit words (leftmost pixel in the top bit). Sprites,
+ * scrolls and clears then touch a couple of words per row rather than a
+ * byte per pixel, so hi-res and multi-plane ROMs cost about the same as
+ * classic ones. Each kernel below works on a single plane.
+ */
+typedef qword gfx_plane[GFX_HIRES_H][GFX_ROW_WORDS];
+
+inline unsigned int gfx_width(const vmstate* state) {
+    return state->hires ? GFX_HIRES_W : GFX_W;
+}
+
+inline unsigned int gfx_height(const vmstate* state) {
+    return state->hires ? GFX_HIRES_H : GFX_H;
+}
+
+template <bool wrap>
+bool gfx_draw(gfx_plane plane, unsigned int x, unsigned int y,
+              const word* rows, unsigned int n, unsigned int w,
+              unsigned int h);
+void gfx_clear(gfx_plane plane);
+void gfx_scroll_down(gfx_plane plane, unsigned int n, unsigned int h);
+void gfx_scroll_up(gfx_plane plane, unsigned int n, unsigned int h);
+void gfx_scroll_right(gfx_plane plane, unsigned int n, unsigned int w,
+                      unsigned int h);
+void gfx_scroll_left(gfx_plane plane, unsigned int n, unsigned int h);
+void gfx_unpack(const vmstate* state, byte* pixels);
+
+#endif
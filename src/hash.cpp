@@ -0,0 +1,91 @@
+#include "hash.h"
+#include <string.h>
+
+/* A small 64-bit multiply/rotate hash (murmur-style), consuming input eight
+ * bytes at a time. It is not cryptographic; it only has to be fast and to
+ * change whenever a single bit of the state does.
+ */
+static const qword HASH_K1 = 0x9E3779B97F4A7C15ULL,
+                   HASH_K2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline qword rotl(qword v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline qword mix(qword h, qword v) {
+    h ^= rotl(v * HASH_K1, 31) * HASH_K2;
+    return rotl(h, 27) * 5 + 0x52DCE729;
+}
+
+static inline qword finalise(qword h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// ----------------------------------------------------------------------------
+qword hash_bytes(const byte* buf, unsigned int len, qword seed) {
+    qword h = seed ^ (len * HASH_K2);
+    unsigned int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        qword v;
+        memcpy(&v, buf + i, 8); // unaligned-safe, compiles to a single load
+        h = mix(h, v);
+    }
+    qword tail = 0;
+    for (unsigned int shift = 0; i < len; ++i, shift += 8)
+        tail |= (qword) buf[i] << shift;
+    h = mix(h, tail);
+    return finalise(h);
+}
+
+// ----------------------------------------------------------------------------
+qword hash_gfx(const vmstate* state) {
+    // the resolution decides which part of the planes is on screen
+    return hash_bytes((const byte*) state->gfx, sizeof(state->gfx),
+                      state->hires);
+}
+
+// ----------------------------------------------------------------------------
+static qword hash_fields(const vmstate* state, bool whole) {
+    /* hash the observable machine state field by field (hashing the struct
+     * as raw bytes would pick up padding), chaining each into the next.
+     * Unless `whole`, the keys held and the cycle count are left out.
+     */
+    qword h = hash_gfx(state);
+    h = hash_bytes(state->memory,    state->mem_mask + 1, h);
+    h = hash_bytes(state->registers, NUM_REGISTERS, h);
+    if (whole)
+        h = hash_bytes(state->key,   KEY_SIZE,      h);
+    h = hash_bytes((const byte*) state->stack, sizeof(state->stack), h);
+    h = hash_bytes(state->flags,     sizeof(state->flags),   h);
+    h = hash_bytes(state->pattern,   sizeof(state->pattern), h);
+    word misc[] = {
+        state->ip, state->sp, state->index, state->curr_opcode,
+        state->delay_timer, state->sound_timer, state->on,
+        state->waiting_key, state->wait_reg, state->mode, state->quirks,
+        state->planes, state->pitch
+    };
+    h = hash_bytes((const byte*) misc, sizeof(misc), h);
+    qword counters[] = { whole ? (qword) state->cycles : 0, state->rng };
+    h = hash_bytes((const byte*) counters, sizeof(counters), h);
+    return h;
+}
+
+// ----------------------------------------------------------------------------
+qword hash_state(const vmstate* state) {
+    return hash_fields(state, true);
+}
+
+// ----------------------------------------------------------------------------
+qword hash_position(const vmstate* state) {
+    /* the state as a search over inputs sees it (see search.h), at a frame
+     * boundary: the same position reached sooner or later is the same
+     * position, and the keys held are about to be replaced by the next
+     * input, having had no effect past the frame they were read in
+     */
+    return hash_fields(state, false);
+}
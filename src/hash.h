@@ -0,0 +1,11 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "def.h"
+
+qword hash_bytes(const byte* buf, unsigned int len, qword seed);
+qword hash_gfx(const vmstate* state);
+qword hash_state(const vmstate* state);
+qword hash_position(const vmstate* state);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __HASHSET_H__
+#define __HASHSET_H__
+
+#include "def.h"
+#include <atomic>
+#include <stddef.h>
+
+/* Concurrent set of 64-bit hashes, for many threads to deduplicate states
+ * into at once.
+ *
+ * Open addressing with linear probing over a fixed, power of two table of
+ * atomic slots; a hash is claimed with a single compare-and-swap, so
+ * inserts never lock or allocate. Nothing is ever removed. 0 marks an
+ * empty slot, so a hash of 0 is stored as 1. The table doesn't grow: size
+ * it at twice the most hashes it will hold, and `insert` fails when it
+ * is full.
+ */
+class concurrent_set {
+    std::atomic<qword>* slots;
+    size_t mask;
+
+    public:
+    concurrent_set(size_t capacity) {
+        // rounded up to a power of two
+        size_t n = 16;
+        while (n < capacity)
+            n *= 2;
+        slots = new std::atomic<qword>[n];
+        mask  = n - 1;
+        clear();
+    }
+
+    ~concurrent_set() {
+        delete[] slots;
+    }
+
+    bool insert(qword h) {
+        // true if `h` is new; false if it was there, or the set is full
+        if (!h)
+            h = 1;
+        size_t i = h & mask;
+        for (size_t probes = 0; probes <= mask; ++probes) {
+            qword seen = slots[i].load(std::memory_order_relaxed);
+            if (seen == 0 &&
+                slots[i].compare_exchange_strong(seen, h,
+                                                 std::memory_order_relaxed))
+                return true;
+            // lost the slot to another insert, which may have been `h`
+            if (seen == h)
+                return false;
+            i = (i + 1) & mask;
+        }
+        return false;
+    }
+
+    bool contains(qword h) const {
+        if (!h)
+            h = 1;
+        size_t i = h & mask;
+        for (size_t probes = 0; probes <= mask; ++probes) {
+            qword seen = slots[i].load(std::memory_order_relaxed);
+            if (seen == h)
+                return true;
+            if (seen == 0)
+                return false;
+            i = (i + 1) & mask;
+        }
+        return false;
+    }
+
+    void clear() {
+        // not safe against concurrent inserts
+        for (size_t i = 0; i <= mask; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    private:
+    concurrent_set(const concurrent_set&);            // owns its slots
+    concurrent_set& operator=(const concurrent_set&);
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "heatmap.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iomanip>
+#include <sstream>
+
+// PPM cells: addresses per row, and pixels per address side
+const unsigned int HEAT_ROW   = 64;
+const unsigned int HEAT_CELL  = 8;
+
+// ----------------------------------------------------------------------------
+static void touch(mem_heatmap* heat, vmstate* state, word pc, word addr,
+                  unsigned int len, heat_access kind) {
+    /* count `len` bytes from `addr` (wrapping, as the handlers do) as
+     * accessed, and check them against the watches
+     */
+    qword* counts = kind == access_read  ? heat->reads
+                  : kind == access_write ? heat->writes : heat->execs;
+    for (unsigned int i = 0; i < len; ++i) {
+        word a = (addr + i) & state->mem_mask;
+        ++counts[a];
+        for (unsigned int w = 0; w < heat->num_watches; ++w) {
+            heat_watch* watch = &heat->watches[w];
+            if (!(watch->access & kind) || a < watch->lo || a > watch->hi ||
+                (watch->value >= 0 && state->memory[a] != watch->value) ||
+                watch->hits++ < watch->skip)
+                continue;
+            if (!(state->faults & fault_watch)) {
+                // the first hit of the instruction is the one reported
+                state->faults   |= fault_watch;
+                heat->hit        = w;
+                heat->hit_addr   = a;
+                heat->hit_pc     = pc;
+                heat->hit_access = kind;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+void heat_record(mem_heatmap* heat, vmstate* state, word pc, word index) {
+    /* count what the instruction at `pc` just accessed; `index` is the
+     * index register from before it ran
+     */
+    c8opcode op = state->curr_opcode;
+    touch(heat, state, pc, pc, 2, access_exec);
+    if (state->faults & fault_invalid_opcode)
+        return; // it didn't run
+    unsigned int x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4, n = op & 0xF;
+    bool xo = state->mode == mode_xochip;
+    switch (op & 0xF000) {
+        case 0x5000:
+            if (xo && (n == 0x2 || n == 0x3)) {
+                touch(heat, state, pc, index, (x > y ? x - y : y - x) + 1,
+                      n == 0x2 ? access_write : access_read);
+            }
+            break;
+        case 0xD000: {
+            unsigned int rows = n == 0 && state->mode != mode_chip8 ? 32 : n;
+            unsigned int planes = (state->planes & 0x1) +
+                                  ((state->planes >> 1) & 0x1);
+            touch(heat, state, pc, index, rows * planes, access_read);
+            break;
+        }
+        case 0xF000:
+            switch (op & 0x00FF) {
+                case 0x33:
+                    touch(heat, state, pc, index, 3, access_write);
+                    break;
+                case 0x55:
+                    touch(heat, state, pc, index, x + 1, access_write);
+                    break;
+                case 0x65:
+                    touch(heat, state, pc, index, x + 1, access_read);
+                    break;
+                case 0x00:
+                    if (xo && x == 0)
+                        touch(heat, state, pc, pc + 2, 2, access_exec);
+                    break;
+                case 0x02:
+                    if (xo && x == 0)
+                        touch(heat, state, pc, index, 16, access_read);
+                    break;
+            }
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void heatmap_clear(mem_heatmap* heat) {
+    /* zero every count and drop every watch
+     */
+    memset(heat, 0, sizeof(*heat));
+}
+
+// ----------------------------------------------------------------------------
+bool heatmap_watch(mem_heatmap* heat, const heat_watch& watch) {
+    if (heat->num_watches == HEAT_MAX_WATCHES || watch.lo > watch.hi ||
+        !watch.access)
+        return false;
+    heat->watches[heat->num_watches] = watch;
+    heat->watches[heat->num_watches].hits = 0;
+    ++heat->num_watches;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool parse_watch(const std::string& spec, heat_watch* watch) {
+    /* <addr>[-<addr>][:<r|w|x>...][=<value>][@<skip>], numbers in hex but
+     * the skip count. The access defaults to w.
+     *
+     *     300-30f:rw=ff@2   the third read or write of 0xFF in 300-30f
+     */
+    const char* s = spec.c_str();
+    char* end;
+    watch->lo     = (word) strtoul(s, &end, 16);
+    watch->hi     = watch->lo;
+    watch->access = access_write;
+    watch->value  = -1;
+    watch->skip   = 0;
+    watch->hits   = 0;
+    if (end == s || strtoul(s, NULL, 16) > 0xFFFF)
+        return false;
+    if (*end == '-') {
+        s = end + 1;
+        unsigned long hi = strtoul(s, &end, 16);
+        if (end == s || hi > 0xFFFF || hi < watch->lo)
+            return false;
+        watch->hi = (word) hi;
+    }
+    if (*end == ':') {
+        watch->access = 0;
+        for (++end; *end == 'r' || *end == 'w' || *end == 'x'; ++end) {
+            watch->access |= *end == 'r' ? access_read
+                           : *end == 'w' ? access_write : access_exec;
+        }
+        if (!watch->access)
+            return false;
+    }
+    if (*end == '=') {
+        s = end + 1;
+        unsigned long value = strtoul(s, &end, 16);
+        if (end == s || value > 0xFF)
+            return false;
+        watch->value = (int) value;
+    }
+    if (*end == '@') {
+        s = end + 1;
+        watch->skip = strtoull(s, &end, 10);
+        if (end == s)
+            return false;
+    }
+    return *end == '\0';
+}
+
+// ----------------------------------------------------------------------------
+std::string watch_name(const heat_watch& watch) {
+    // as `parse_watch` reads it
+    std::ostringstream out;
+    out << std::hex << watch.lo;
+    if (watch.hi != watch.lo)
+        out << "-" << watch.hi;
+    out << ":";
+    if (watch.access & access_read)
+        out << "r";
+    if (watch.access & access_write)
+        out << "w";
+    if (watch.access & access_exec)
+        out << "x";
+    if (watch.value >= 0)
+        out << "=" << watch.value;
+    if (watch.skip)
+        out << "@" << std::dec << watch.skip;
+    return out.str();
+}
+
+// ----------------------------------------------------------------------------
+void heatmap_csv(const mem_heatmap* heat, const vmstate* state,
+                 std::ostream& out) {
+    /* one row per address the guest touched at all, in address order
+     */
+    out << "addr,reads,writes,execs" << std::endl;
+    for (unsigned int a = 0; a <= state->mem_mask; ++a) {
+        if (!heat->reads[a] && !heat->writes[a] && !heat->execs[a])
+            continue;
+        out << "0x" << std::hex << std::uppercase << std::setfill('0')
+            << std::setw(4) << a << std::dec << "," << heat->reads[a] << ","
+            << heat->writes[a] << "," << heat->execs[a] << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static byte shade(qword count, double scale) {
+    // log scaled, so a byte read once still shows next to the main loop
+    return count ? (byte) (55 + 200 * log((double) count + 1) * scale) : 0;
+}
+
+// ----------------------------------------------------------------------------
+void heatmap_ppm(const mem_heatmap* heat, const vmstate* state,
+                 std::ostream& out) {
+    /* a binary PPM: HEAT_ROW addresses to a row, each a HEAT_CELL square
+     * whose red is writes, green reads and blue executes
+     */
+    unsigned int size = state->mem_mask + 1, rows = size / HEAT_ROW,
+                 cell = size > MEM_SIZE ? 2 : HEAT_CELL;
+    qword most[3] = { 0, 0, 0 };
+    for (unsigned int a = 0; a < size; ++a) {
+        most[0] = heat->writes[a] > most[0] ? heat->writes[a] : most[0];
+        most[1] = heat->reads[a]  > most[1] ? heat->reads[a]  : most[1];
+        most[2] = heat->execs[a]  > most[2] ? heat->execs[a]  : most[2];
+    }
+    double scale[3];
+    for (unsigned int c = 0; c < 3; ++c)
+        scale[c] = most[c] ? 1.0 / log((double) most[c] + 1) : 0.0;
+    out << "P6\n" << HEAT_ROW * cell << " " << rows * cell << "\n255\n";
+    std::string line(HEAT_ROW * cell * 3, '\0');
+    for (unsigned int r = 0; r < rows; ++r) {
+        for (unsigned int col = 0; col < HEAT_ROW; ++col) {
+            unsigned int a = r * HEAT_ROW + col;
+            byte rgb[3] = { shade(heat->writes[a], scale[0]),
+                            shade(heat->reads[a], scale[1]),
+                            shade(heat->execs[a], scale[2]) };
+            for (unsigned int px = 0; px < cell; ++px)
+                memcpy(&line[(col * cell + px) * 3], rgb, 3);
+        }
+        for (unsigned int px = 0; px < cell; ++px)
+            out.write(line.data(), line.size());
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+
+#include "def.h"
+#include <ostream>
+#include <string>
+
+/* Memory access heatmap: how often the guest read, wrote and executed each
+ * address, for where its sprite data lives, whether it modifies its own
+ * code, and what a code cache would have to invalidate.
+ *
+ * Like profiling (see profile.h) counting is a policy of the interpreter
+ * core, chosen by `C8VM::set_heatmap`: with no heatmap set the core is the
+ * one instantiated with `heat_off`, whose `access` is empty and compiles
+ * away. With one set, every instruction counts its two bytes as executed,
+ * then the bytes its opcode touched, worked out from the opcode and the
+ * index as it was before it ran: DXYN's sprite rows (once per plane drawn),
+ * FX33, FX55 and FX65, and on XO-CHIP 5XY2, 5XY3, F002 and F000's second
+ * word. FX29 and FX30 only point the index at a glyph, which is counted
+ * when it's drawn. Idle loops are run rather than skipped, so every access
+ * is counted.
+ *
+ * Watchpoints are conditional: an address range, the kinds of access, and
+ * optionally the byte value at the address after the access (the value
+ * written, or read) and a number of matching accesses to let pass first.
+ * A hit stops `run` with stop_watchpoint once the instruction has run; the
+ * heatmap says which watch, where and by whom.
+ */
+const unsigned int HEAT_MAX_WATCHES = 8;
+
+enum heat_access {
+    access_read  = 0x1,
+    access_write = 0x2,
+    access_exec  = 0x4,
+};
+
+typedef struct heat_watch {
+    word lo, hi;        // addresses, inclusive
+    byte access;        // heat_access bits that match
+    int value;          // the byte there must be this; -1 for any
+    qword skip;         // matching accesses to let pass first
+    qword hits;         // matching accesses so far
+} heat_watch;
+
+typedef struct mem_heatmap {
+    qword reads[XO_MEM_SIZE];
+    qword writes[XO_MEM_SIZE];
+    qword execs[XO_MEM_SIZE];
+    heat_watch watches[HEAT_MAX_WATCHES];
+    unsigned int num_watches;
+    // the last watchpoint hit
+    unsigned int hit;   // index into `watches`
+    word hit_addr, hit_pc;
+    byte hit_access;
+} mem_heatmap;
+
+void heat_record(mem_heatmap* heat, vmstate* state, word pc, word index);
+
+struct heat_off {
+    static const bool enabled = false;
+    static void access(mem_heatmap*, vmstate*, word, word) {}
+};
+
+struct heat_on {
+    static const bool enabled = true;
+    static void access(mem_heatmap* heat, vmstate* state, word pc,
+                       word index) {
+        heat_record(heat, state, pc, index);
+    }
+};
+
+void heatmap_clear(mem_heatmap* heat);
+bool heatmap_watch(mem_heatmap* heat, const heat_watch& watch);
+bool parse_watch(const std::string& spec, heat_watch* watch);
+std::string watch_name(const heat_watch& watch);
+void heatmap_csv(const mem_heatmap* heat, const vmstate* state,
+                 std::ostream& out);
+void heatmap_ppm(const mem_heatmap* heat, const vmstate* state,
+                 std::ostream& out);
+
+#endif
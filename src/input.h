@@ -0,0 +1,29 @@
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include "def.h"
+#include "spsc.h"
+
+/* Key input travels from the host (e.g. the GLUT thread) to the vm through
+ * a lock-free queue, and is applied only on frame boundaries, so the guest
+ * never sees the key array change part way through a frame and a run can be
+ * reproduced from the (frame, key, down) triples alone.
+ */
+const unsigned int INPUT_QUEUE_SIZE = 256;
+const long         INPUT_NEXT_FRAME = -1;
+
+typedef struct key_event {
+    qword stamp;  // monotonic_ns() when posted, for latency accounting
+    long frame;   // frame to apply the event at, or INPUT_NEXT_FRAME
+    byte key;
+    bool down;
+} key_event;
+
+typedef struct input_stats {
+    qword applied;            // # of events applied
+    qword total_ns, max_ns;   // post -> apply latency
+} input_stats;
+
+typedef spsc_queue<key_event, INPUT_QUEUE_SIZE> input_queue;
+
+#endif
@@ -1,9 +1,9 @@
 #include "def.h"
 #include "iset.h"
+#include "gfx.h"
+#include "metrics.h"
 #include <random>
-#include <iostream>
 #include "stdlib.h"
-#include "debug.h"
 
 /* CHIP-8 has 35 opcodes, which are all two bytes long. The most significant
  * byte is stored first. The opcodes are listed below, in hexadecimal and with
@@ -13,29 +13,56 @@
  *     NN: 8-bit constant
  *     N: 4-bit constant
  *     X and Y: 4-bit register identifier
+ *
+ * The SUPER-CHIP and XO-CHIP extensions follow the classic set, and are only
+ * decoded when the vm is in the matching `machine_mode`. Handlers whose
+ * behaviour depends on the quirk profile are templates over it (quirks.h).
  */
+static const metric_id metric_draws = metric_counter(
+        "c8vm_sprite_draws_total", "DXYN sprite draws");
+// draws not yet in metric_draws; the vm flushes them once per `run`
+static thread_local qword draws;
+
+static inline word mem_addr(const vmstate* state, unsigned int addr) {
+    // memory accesses wrap at the machine's memory size, so a stray index
+    // can never reach outside `memory`
+    return addr & state->mem_mask;
+}
+
+static inline void skip_next(vmstate* state) {
+    /* skip the next instruction; on XO-CHIP that may be the four byte long
+     * F000 NNNN
+     */
+    word next = state->memory[mem_addr(state, state->ip)] << 8 |
+                state->memory[mem_addr(state, state->ip + 1)];
+    state->ip += (state->mode == mode_xochip && next == 0xF000) ? 0x4 : 0x2;
+}
+
+// ----------------------------------------------------------------------------
 void iset::call_prog(vmstate* state) {
     /* Opcode: 0NNN
      * Calls RCA 1802 program at address NNN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "call_prog (0NNN)");
-#endif
     return;
 }
 
+// ----------------------------------------------------------------------------
+void iset::invalid_opcode(vmstate* state) {
+    /* Anything that doesn't decode; raises fault_invalid_opcode
+     */
+    fault(state, true, fault_invalid_opcode, state->ip - 2);
+}
+
 // ----------------------------------------------------------------------------
 void iset::clear_screen(vmstate* state) {
     /* Opcode: 00E0
-     * Call the routine at address NNN
+     * Clear the screen (on XO-CHIP, only the selected planes)
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "clear_screen (00E0)");
-#endif
-    for (unsigned int i = 0; i < GFX_SIZE; ++i) {
-        state->gfx_buffer[i] = 0x0;
-        state->gfx_stale = true;
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (state->planes & (1 << p))
+            gfx_clear(state->gfx[p]);
     }
+    state->gfx_stale = true;
 }
 
 // ----------------------------------------------------------------------------
@@ -43,11 +70,12 @@ void iset::ret_routine(vmstate* state) {
     /* Opcode: 00EE
      * Return from a routine
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "ret (00EE)");
-#endif
+    bool empty = state->sp == 0;
+    fault(state, empty, fault_stack_underflow, state->ip - 2);
+    if (empty)
+        return; // leave the stack as it was, for the post-mortem
     --state->sp;
-    state->ip = state->stack[state->sp];
+    state->ip = state->stack[state->sp % STACK_SIZE];
 }
 
 // ----------------------------------------------------------------------------
@@ -55,9 +83,6 @@ void iset::jump(vmstate* state) {
     /* Opcode: 1NNN
      * Jump to address NNN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "jmp (1NNN)");
-#endif
     word addr = state->curr_opcode & 0x0FFF;
     state->ip = addr;
     return;
@@ -70,10 +95,11 @@ void iset::call_routine(vmstate* state) {
      */
     // save this stack frame, and increase stack pointer for routine being
     // called
-#ifdef DEBUG
-    debug(iset_decode, state, "call (2NNN)");
-#endif
-    state->stack[state->sp] = state->ip;
+    bool full = state->sp >= STACK_SIZE;
+    fault(state, full, fault_stack_overflow, state->ip - 2);
+    if (full)
+        return;
+    state->stack[state->sp % STACK_SIZE] = state->ip;
     ++state->sp;
     word addr = state->curr_opcode & 0x0FFF;
     state->ip = addr;
@@ -84,15 +110,12 @@ void iset::skip_if_equal(vmstate* state) {
     /* Opcode: 3XNN
      * Skip the next instruction if register X is equal to NN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "skip_if_equal (3XNN)");
-#endif
     byte comparison = state->curr_opcode & 0x00FF;
     byte reg = (state->curr_opcode & 0x0F00) >> 8;
     // we increment by two here as memory is an array of bytes and operands
     // are composed of two
     if (state->registers[reg] == comparison)
-        state->ip += 0x2;
+        skip_next(state);
 
 }
 
@@ -101,15 +124,12 @@ void iset::skip_if_not_equal(vmstate* state) {
     /* Opcode: 4XNN
      * Skip the next instruction if register X is not equal to NN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "skip_if_not_equal (4XNN)");
-#endif
     c8register comparison = state->curr_opcode & 0x00FF;
     byte reg = (state->curr_opcode & 0x0F00) >> 8;
     // we increment by two here as memory is an array of bytes and operands
     // are composed of two
     if (state->registers[reg] != comparison)
-        state->ip += 0x2;
+        skip_next(state);
 }
 
 // ----------------------------------------------------------------------------
@@ -117,15 +137,12 @@ void iset::skip_if_equal_regs(vmstate* state) {
     /* Opcode: 5XY0
      * Skip the next instruction if register X is equal to register Y
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "skip_if_equal_regs (5XY0)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
     // we increment by two here as memory is an array of bytes and operands
     // are composed of two
     if (state->registers[regx] == state->registers[regy])
-        state->ip += 0x2;
+        skip_next(state);
 }
 
 // ----------------------------------------------------------------------------
@@ -133,9 +150,6 @@ void iset::set_reg(vmstate* state) {
     /* Opcode: 6XNN
      * Set the register X to NN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_reg (6XNN)");
-#endif
     byte reg = (state->curr_opcode & 0x0F00) >> 8;
     c8register val = state->curr_opcode & 0x00FF;
     state->registers[reg] = val;
@@ -146,9 +160,6 @@ void iset::add_reg(vmstate* state) {
     /* Opcode: 7XNN
      * Add NN to the register X
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "add_reg (7XNN)");
-#endif
     byte reg = (state->curr_opcode & 0x0F00) >> 8;
     c8register val = state->curr_opcode & 0x00FF;
     state->registers[reg] += val;
@@ -159,9 +170,6 @@ void iset::set_regx_regy(vmstate* state) {
     /* Opcode: 8XY0
      * Set register X to the value of register Y
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_regx_regy (8XY0)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
     state->registers[regx] = state->registers[regy];
@@ -172,9 +180,6 @@ void iset::set_regx_or_regy(vmstate* state) {
     /* Opcode: 8XY1
      * Set register X to register X | register Y
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_regx_or_regy (8XY1)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
     state->registers[regx] |= state->registers[regy];
@@ -185,9 +190,6 @@ void iset::set_regx_and_regy(vmstate* state) {
     /* Opcode: 8XY2
      * Set register X to register X & register Y
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_regx_and_regy (8XY2)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
     state->registers[regx] &= state->registers[regy];
@@ -198,9 +200,6 @@ void iset::set_regx_xor_regy(vmstate* state) {
     /* Opcode: 8XY3
      * Set register X to register X ^ register Y
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_regx_xor_regy (8XY3)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
     state->registers[regx] ^= state->registers[regy];
@@ -212,74 +211,70 @@ void iset::set_regx_add_regy(vmstate* state) {
      * Set register X to register X + register Y
      *      [!] register F is set to 1 if there is a carry, else 0
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_regx_add_regy (8XY4)");
-#endif
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
-    if (state->registers[regy] >
-        0xFF - state->registers[regx])
-        state->registers[0xF] = 1; // carry
-    else
-        state->registers[0xF] = 0;
+    c8register carry = state->registers[regy] > 0xFF - state->registers[regx];
 
     state->registers[regx] += state->registers[regy];
+    state->registers[0xF] = carry; // set last, so it wins if X is F
 }
 
 // ----------------------------------------------------------------------------
 void iset::set_regx_sub_regy(vmstate* state) {
     /* Opcode: 8XY5
      * Set register X to register X - register Y
-     *      [!] register F is set to 0 if there is a borrow, else 0
+     *      [!] register F is set to 0 if there is a borrow, else 1
      */
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
-    if (state->registers[regy] < state->registers[regx])
-        state->registers[0xF] = 1; // no borrow
-    else
-        state->registers[0xF] = 0;
+    c8register no_borrow = state->registers[regx] >= state->registers[regy];
 
     state->registers[regx] -= state->registers[regy];
+    state->registers[0xF] = no_borrow;
 }
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::set_regx_rshift(vmstate* state) {
     /* Opcode: 8XY6
-     * Set register X to register X >> 1
+     * Set register X to register X >> 1 (register Y >> 1 with shift_vy)
      *      [!] register F is set to the value of the LSB before the shift
      */
-    byte regx = (state->curr_opcode & 0x0F00) >> 8;
-    state->registers[0xF] = state->registers[regx] & 0x00F;
+    byte regx = (state->curr_opcode & 0x0F00) >> 8,
+         regy = (state->curr_opcode & 0x00F0) >> 4;
+    c8register val = state->registers[Q::shift_vy ? regy : regx];
 
-    state->registers[regx] >>= 1;
+    state->registers[regx] = val >> 1;
+    state->registers[0xF]  = val & 0x1;
 }
 
 // ----------------------------------------------------------------------------
 void iset::set_regx_regy_sub_regx(vmstate* state) {
     /* Opcode: 8XY7
      * Set register X to register Y - register X
-     *      [!] register F is set to 0 if there is a borrow, else 0
+     *      [!] register F is set to 0 if there is a borrow, else 1
      */
     byte regx = (state->curr_opcode & 0x0F00) >> 8,
          regy = (state->curr_opcode & 0x00F0) >> 4;
-    if (state->registers[regy] > state->registers[regx])
-        state->registers[0xF] = 1; // no borrow
-    else
-        state->registers[0xF] = 0;
+    c8register no_borrow = state->registers[regy] >= state->registers[regx];
 
     state->registers[regx] = state->registers[regy] - state->registers[regx];
+    state->registers[0xF] = no_borrow;
 }
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::set_regx_lshift(vmstate* state) {
     /* Opcode: 8XYE
-     * Set register X to register X << 1
+     * Set register X to register X << 1 (register Y << 1 with shift_vy)
      *      [!] register F is set to the value of the MSB before the shift
      */
-    byte regx = (state->curr_opcode & 0x0F00) >> 8;
-    state->registers[0xF] = (state->registers[regx] & 0xF00) >> 8;
+    byte regx = (state->curr_opcode & 0x0F00) >> 8,
+         regy = (state->curr_opcode & 0x00F0) >> 4;
+    c8register val = state->registers[Q::shift_vy ? regy : regx];
 
-    state->registers[regx] <<= 1;
+    state->registers[regx] = val << 1;
+    state->registers[0xF]  = val >> 7;
 }
 
 // ----------------------------------------------------------------------------
@@ -292,7 +287,7 @@ void iset::skip_if_not_equal_regs(vmstate* state) {
     // we increment by two here as memory is an array of bytes and operands
     // are composed of two
     if (state->registers[regx] != state->registers[regy])
-        state->ip += 0x2;
+        skip_next(state);
 }
 
 // ----------------------------------------------------------------------------
@@ -300,21 +295,20 @@ void iset::set_index(vmstate* state) {
     /* Opcode: ANNN
      * Set the index register to NNN
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_index (ANNN)");
-#endif
     word addr = state->curr_opcode & 0x0FFF;
 
     state->index = addr;
 }
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::jump_offset(vmstate* state) {
     /* Opcode: BNNN
-     * Jump to the address NNN + register 0
+     * Jump to the address NNN + register 0 (XNN + register X with jump_vx)
      */
     word addr = state->curr_opcode & 0x0FFF;
-    addr += state->registers[0];
+    byte reg  = Q::jump_vx ? (state->curr_opcode & 0x0F00) >> 8 : 0x0;
+    addr += state->registers[reg];
 
     state->ip = addr;
 }
@@ -324,39 +318,51 @@ void iset::set_reg_rand_masked(vmstate* state) {
     /* Opcode: CXNN
      * Set VX to a random number and (& mask) NN.
      */
-#ifdef DEBUG
-    debug(iset_decode, state, "set_reg_rand_masked (CXNN)");
-#endif
     byte mask = state->curr_opcode & 0x00FF;
-    byte val  = (byte) std::rand();
-    state->registers[0] = val & mask;
+    byte reg  = (state->curr_opcode & 0x0F00) >> 8;
+    // xorshift64 on the vm's own state rather than std::rand, so that runs
+    // are reproducible and vms on different threads don't share a generator
+    state->rng ^= state->rng << 13;
+    state->rng ^= state->rng >> 7;
+    state->rng ^= state->rng << 17;
+    byte val  = (byte) (state->rng >> 24);
+    state->registers[reg] = val & mask;
 }
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::draw_sprite(vmstate* state) {
     /* Opcode: DXYN
      * Draw the sprite found at [index] to the coordinates taken from
      * [X],[Y]. The sprite is N rows tall. If there is collision, set
      * register F to 1.
-     */
-#ifdef DEBUG
-    debug(iset_decode, state, "draw_sprite (DXYN)");
-#endif
-    state->registers[0xF] = 0;
-    c8register x = state->registers[(state->curr_opcode & 0x0F00) >> 8],
-               y = state->registers[(state->curr_opcode & 0x00F0) >> 4];
-    int n = state->curr_opcode & 0x000F;
-    byte pixel_row;
-    for (byte yoff = 0; yoff < n; ++yoff) {
-        pixel_row = state->memory[state->index + yoff];
-        for (byte xoff = 0; xoff < 8; ++xoff) {
-            if ((pixel_row & (0x80 >> xoff)) != 0) {
-                if (state->gfx_buffer[(x + xoff + ((y + yoff) * 64))] == 1)
-                    state->registers[0xF] = 1;
-                state->gfx_buffer[x + xoff + ((y + yoff) * 64)] ^= 1;
-            }
+     *
+     * On SCHIP/XO-CHIP, DXY0 draws a 16x16 sprite (two bytes per row). On
+     * XO-CHIP a sprite is drawn once per selected plane, each plane taking
+     * the next sprite's worth of bytes from [index].
+     */
+    ++draws;
+    unsigned int w = gfx_width(state), h = gfx_height(state);
+    unsigned int x = state->registers[(state->curr_opcode & 0x0F00) >> 8] % w,
+                 y = state->registers[(state->curr_opcode & 0x00F0) >> 4] % h;
+    unsigned int n = state->curr_opcode & 0x000F;
+    bool wide = n == 0 && state->mode != mode_chip8;
+    if (wide)
+        n = 16;
+    word rows[16];
+    unsigned int addr = state->index;
+    bool hit = false;
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (!(state->planes & (1 << p)))
+            continue;
+        for (unsigned int i = 0; i < n; ++i) {
+            rows[i] = state->memory[mem_addr(state, addr++)] << 8;
+            if (wide)
+                rows[i] |= state->memory[mem_addr(state, addr++)];
         }
+        hit |= gfx_draw<Q::wrap_sprites>(state->gfx[p], x, y, rows, n, w, h);
     }
+    state->registers[0xF] = hit;
     state->gfx_stale = true; // let the vm know to redraw the screen
 }
 
@@ -365,9 +371,9 @@ void iset::skip_if_key_pressed(vmstate* state) {
     /* Opcode: EX9E
      * Skip the next instruction if the key in register X is pressed
      */
-    word key = (state->curr_opcode & 0x0F00) >> 8;
+    word key = state->registers[(state->curr_opcode & 0x0F00) >> 8] & 0xF;
     if (state->key[key])
-        state->ip += 0x2;
+        skip_next(state);
 }
 
 // ----------------------------------------------------------------------------
@@ -375,9 +381,9 @@ void iset::skip_if_key_not_pressed(vmstate* state) {
     /* Opcode: EXA1
      * Skip the next instruction if the key in register X is not pressed
      */
-    word key = (state->curr_opcode & 0x0F00) >> 8;
+    word key = state->registers[(state->curr_opcode & 0x0F00) >> 8] & 0xF;
     if (!state->key[key])
-        state->ip += 0x2;
+        skip_next(state);
 }
 
 // ----------------------------------------------------------------------------
@@ -393,16 +399,21 @@ void iset::set_reg_delay(vmstate* state) {
 void iset::wait_key_press_store(vmstate* state) {
     /* Opcode: FX0A
      * Wait for a key press, then store in the register X
-     */
-    bool key_press = false;
-    for (int i = 0; i < 0xF; ++i) {
-        if (state->key[i]) {
-            key_press = true;
-            break;
+     *
+     * Rather than rewinding ip and re-executing, this puts the vm into a
+     * blocked state: `do_cycle` calls back in here (without fetching) until
+     * a key is down, and hosts can park until the next key event.
+     */
+    if (!state->waiting_key)
+        state->wait_reg = (state->curr_opcode & 0x0F00) >> 8;
+    for (byte key = 0; key < KEY_SIZE; ++key) {
+        if (state->key[key]) {
+            state->registers[state->wait_reg] = key;
+            state->waiting_key = false;
+            return;
         }
     }
-    if (!key_press) // just execute another cycle rather than busy waiting
-        state->ip -= 0x2;
+    state->waiting_key = true;
 }
 
 // ----------------------------------------------------------------------------
@@ -440,7 +451,7 @@ void iset::get_sprite_regx(vmstate* state) {
      * index at the character of that fontset as stored in register X)
      */
     c8register* x = &state->registers[(state->curr_opcode & 0x0F00) >> 8];
-    state->index = *x * 0x5;
+    state->index = FONT_START + (*x & 0xF) * 0x5;
 }
 
 // ----------------------------------------------------------------------------
@@ -453,34 +464,358 @@ void iset::split_decimal(vmstate* state) {
     word ones = *x % 10,
          tens = (*x % 100) / 10,
          hundreds = (*x % 1000) / 100;
-    state->memory[state->index]   = hundreds;
-    state->memory[state->index+1] = tens;
-    state->memory[state->index+2] = ones;
+    state->memory[mem_addr(state, state->index)]     = hundreds;
+    state->memory[mem_addr(state, state->index + 1)] = tens;
+    state->memory[mem_addr(state, state->index + 2)] = ones;
 }
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::dump_regs_to_regx(vmstate* state) {
     /* Opcode: FX55
-     * Dump values of registers from register 0 -> register X in the memory
-     * starting at [index]
+     * Dump values of registers from register 0 -> register X (inclusive) in
+     * the memory starting at [index]. With load_store_inc_i, index is left
+     * just past the last byte written.
      */
     word start_loc = state->index;
     int end_reg = (state->curr_opcode & 0x0F00) >> 8;
     word loc = start_loc;
-    for (int reg = 0; reg < end_reg; ++reg, ++loc)
-        state->memory[loc] = state->registers[reg];
+    for (int reg = 0; reg <= end_reg; ++reg, ++loc)
+        state->memory[mem_addr(state, loc)] = state->registers[reg];
+    if (Q::load_store_inc_i)
+        state->index = loc;
 }
 
 
 // ----------------------------------------------------------------------------
+template <class Q>
 void iset::slurp_regs_to_regx(vmstate* state) {
     /* Opcode: FX65
-     * Set values of registers from register 0 -> register X to values in
-     * memory starting at [index]
+     * Set values of registers from register 0 -> register X (inclusive) to
+     * values in memory starting at [index]. With load_store_inc_i, index is
+     * left just past the last byte read.
      */
     word start_loc = state->index;
     int end_reg = (state->curr_opcode & 0x0F00) >> 8;
     word loc = start_loc;
-    for (int reg = 0; reg < end_reg; ++reg, ++loc)
-        state->registers[reg] = state->memory[loc] ;
+    for (int reg = 0; reg <= end_reg; ++reg, ++loc)
+        state->registers[reg] = state->memory[mem_addr(state, loc)];
+    if (Q::load_store_inc_i)
+        state->index = loc;
+}
+
+// ----------------------------------------------------------------------------
+void iset::scroll_down(vmstate* state) {
+    /* Opcode: 00CN (SCHIP)
+     * Scroll the display down N pixels
+     */
+    unsigned int n = state->curr_opcode & 0x000F, h = gfx_height(state);
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (state->planes & (1 << p))
+            gfx_scroll_down(state->gfx[p], n, h);
+    }
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::scroll_up(vmstate* state) {
+    /* Opcode: 00DN (XO-CHIP)
+     * Scroll the display up N pixels
+     */
+    unsigned int n = state->curr_opcode & 0x000F, h = gfx_height(state);
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (state->planes & (1 << p))
+            gfx_scroll_up(state->gfx[p], n, h);
+    }
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::scroll_right(vmstate* state) {
+    /* Opcode: 00FB (SCHIP)
+     * Scroll the display right 4 pixels
+     */
+    unsigned int w = gfx_width(state), h = gfx_height(state);
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (state->planes & (1 << p))
+            gfx_scroll_right(state->gfx[p], 4, w, h);
+    }
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::scroll_left(vmstate* state) {
+    /* Opcode: 00FC (SCHIP)
+     * Scroll the display left 4 pixels
+     */
+    unsigned int h = gfx_height(state);
+    for (unsigned int p = 0; p < GFX_PLANES; ++p) {
+        if (state->planes & (1 << p))
+            gfx_scroll_left(state->gfx[p], 4, h);
+    }
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::halt(vmstate* state) {
+    /* Opcode: 00FD (SCHIP)
+     * Stop the interpreter
+     */
+    state->on = false;
+}
+
+// ----------------------------------------------------------------------------
+void iset::set_lores(vmstate* state) {
+    /* Opcode: 00FE (SCHIP)
+     * Switch to the 64x32 display; the screen is cleared
+     */
+    state->hires = false;
+    for (unsigned int p = 0; p < GFX_PLANES; ++p)
+        gfx_clear(state->gfx[p]);
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::set_hires(vmstate* state) {
+    /* Opcode: 00FF (SCHIP)
+     * Switch to the 128x64 display; the screen is cleared
+     */
+    state->hires = true;
+    for (unsigned int p = 0; p < GFX_PLANES; ++p)
+        gfx_clear(state->gfx[p]);
+    state->gfx_stale = true;
+}
+
+// ----------------------------------------------------------------------------
+void iset::save_regs_range(vmstate* state) {
+    /* Opcode: 5XY2 (XO-CHIP)
+     * Store registers X to Y (either way round) in memory starting at
+     * [index]; index is not changed
+     */
+    int regx = (state->curr_opcode & 0x0F00) >> 8,
+        regy = (state->curr_opcode & 0x00F0) >> 4,
+        step = regx <= regy ? 1 : -1;
+    word loc = state->index;
+    for (int reg = regx; ; reg += step, ++loc) {
+        state->memory[mem_addr(state, loc)] = state->registers[reg];
+        if (reg == regy)
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void iset::load_regs_range(vmstate* state) {
+    /* Opcode: 5XY3 (XO-CHIP)
+     * Load registers X to Y (either way round) from memory starting at
+     * [index]; index is not changed
+     */
+    int regx = (state->curr_opcode & 0x0F00) >> 8,
+        regy = (state->curr_opcode & 0x00F0) >> 4,
+        step = regx <= regy ? 1 : -1;
+    word loc = state->index;
+    for (int reg = regx; ; reg += step, ++loc) {
+        state->registers[reg] = state->memory[mem_addr(state, loc)];
+        if (reg == regy)
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void iset::set_index_long(vmstate* state) {
+    /* Opcode: F000 NNNN (XO-CHIP)
+     * Set the index register to the 16-bit address in the following word
+     */
+    state->index = state->memory[mem_addr(state, state->ip)] << 8 |
+                   state->memory[mem_addr(state, state->ip + 1)];
+    state->ip += 0x2;
+}
+
+// ----------------------------------------------------------------------------
+void iset::select_planes(vmstate* state) {
+    /* Opcode: FN01 (XO-CHIP)
+     * Select the bit planes (mask N) that draw, clear and scroll act on
+     */
+    state->planes = ((state->curr_opcode & 0x0F00) >> 8) &
+                    ((1 << GFX_PLANES) - 1);
+}
+
+// ----------------------------------------------------------------------------
+void iset::load_audio_pattern(vmstate* state) {
+    /* Opcode: F002 (XO-CHIP)
+     * Load the 16 byte audio pattern from [index]
+     */
+    for (unsigned int i = 0; i < sizeof(state->pattern); ++i)
+        state->pattern[i] = state->memory[mem_addr(state, state->index + i)];
 }
+
+// ----------------------------------------------------------------------------
+void iset::get_big_sprite_regx(vmstate* state) {
+    /* Opcode: FX30 (SCHIP)
+     * Point index at the 8x10 font character for the digit in register X
+     */
+    c8register* x = &state->registers[(state->curr_opcode & 0x0F00) >> 8];
+    state->index = BIG_FONT_START + (*x & 0xF) * 10;
+}
+
+// ----------------------------------------------------------------------------
+void iset::set_pitch(vmstate* state) {
+    /* Opcode: FX3A (XO-CHIP)
+     * Set the audio pattern playback pitch to register X
+     */
+    state->pitch = state->registers[(state->curr_opcode & 0x0F00) >> 8];
+}
+
+// ----------------------------------------------------------------------------
+void iset::save_flags(vmstate* state) {
+    /* Opcode: FX75 (SCHIP)
+     * Store registers 0 -> X in the user flags
+     */
+    int end_reg = (state->curr_opcode & 0x0F00) >> 8;
+    for (int reg = 0; reg <= end_reg; ++reg)
+        state->flags[reg] = state->registers[reg];
+}
+
+// ----------------------------------------------------------------------------
+void iset::load_flags(vmstate* state) {
+    /* Opcode: FX85 (SCHIP)
+     * Load registers 0 -> X from the user flags
+     */
+    int end_reg = (state->curr_opcode & 0x0F00) >> 8;
+    for (int reg = 0; reg <= end_reg; ++reg)
+        state->registers[reg] = state->flags[reg];
+}
+
+// ----------------------------------------------------------------------------
+iset::op_class iset::classify(c8opcode op, byte mode) {
+    /* which handler `C8VM::cycle` dispatches `op` to in `mode`; keep the two
+     * in step
+     */
+    byte first  = (op & 0xF000) >> 12,
+         second = (op & 0x0F00) >> 8,
+         third  = (op & 0x00F0) >> 4,
+         fourth =  op & 0x000F;
+    switch (first) {
+        case 0x0:
+            if (third == 0xE && fourth == 0x0)      return op_clear_screen;
+            if (third == 0xE && fourth == 0xE)      return op_ret_routine;
+            if (mode == mode_chip8 || second != 0x0) return op_call_prog;
+            if (third == 0xC)                       return op_scroll_down;
+            if (third == 0xD && mode == mode_xochip) return op_scroll_up;
+            if (third == 0xF && fourth == 0xB)      return op_scroll_right;
+            if (third == 0xF && fourth == 0xC)      return op_scroll_left;
+            if (third == 0xF && fourth == 0xD)      return op_halt;
+            if (third == 0xF && fourth == 0xE)      return op_set_lores;
+            if (third == 0xF && fourth == 0xF)      return op_set_hires;
+            return op_call_prog;
+        case 0x1: return op_jump;
+        case 0x2: return op_call_routine;
+        case 0x3: return op_skip_if_equal;
+        case 0x4: return op_skip_if_not_equal;
+        case 0x5:
+            if (mode == mode_xochip && fourth == 0x2) return op_save_regs_range;
+            if (mode == mode_xochip && fourth == 0x3) return op_load_regs_range;
+            return op_skip_if_equal_regs;
+        case 0x6: return op_set_reg;
+        case 0x7: return op_add_reg;
+        case 0x8:
+            switch (fourth) {
+                case 0x0: return op_set_regx_regy;
+                case 0x1: return op_set_regx_or_regy;
+                case 0x2: return op_set_regx_and_regy;
+                case 0x3: return op_set_regx_xor_regy;
+                case 0x4: return op_set_regx_add_regy;
+                case 0x5: return op_set_regx_sub_regy;
+                case 0x6: return op_set_regx_rshift;
+                case 0x7: return op_set_regx_regy_sub_regx;
+                case 0xE: return op_set_regx_lshift;
+                default:  return op_invalid_opcode;
+            }
+        case 0x9: return op_skip_if_not_equal_regs;
+        case 0xA: return op_set_index;
+        case 0xB: return op_jump_offset;
+        case 0xC: return op_set_reg_rand_masked;
+        case 0xD: return op_draw_sprite;
+        case 0xE:
+            if (third == 0x9 && fourth == 0xE)
+                return op_skip_if_key_pressed;
+            if (third == 0xA && fourth == 0x1)
+                return op_skip_if_key_not_pressed;
+            return op_invalid_opcode;
+        default:
+            break;
+    }
+    switch (third) {
+        case 0x0:
+            if (fourth == 0x7)                  return op_set_reg_delay;
+            if (fourth == 0xA)                  return op_wait_key_press_store;
+            if (mode != mode_xochip)            return op_invalid_opcode;
+            if (fourth == 0x0 && second == 0x0) return op_set_index_long;
+            if (fourth == 0x1)                  return op_select_planes;
+            if (fourth == 0x2 && second == 0x0) return op_load_audio_pattern;
+            return op_invalid_opcode;
+        case 0x1:
+            if (fourth == 0x5) return op_set_delay_regx;
+            if (fourth == 0x8) return op_set_sound_regx;
+            if (fourth == 0xE) return op_add_regx_to_index;
+            return op_invalid_opcode;
+        case 0x2: return op_get_sprite_regx;
+        case 0x3:
+            if (fourth == 0x0 && mode != mode_chip8)
+                return op_get_big_sprite_regx;
+            if (fourth == 0xA && mode == mode_xochip)
+                return op_set_pitch;
+            return op_split_decimal;
+        case 0x5: return op_dump_regs_to_regx;
+        case 0x6: return op_slurp_regs_to_regx;
+        case 0x7: return mode != mode_chip8 ? op_save_flags : op_invalid_opcode;
+        case 0x8: return mode != mode_chip8 ? op_load_flags : op_invalid_opcode;
+        default:  return op_invalid_opcode;
+    }
+}
+
+// ----------------------------------------------------------------------------
+const char* iset::op_name(op_class c) {
+    static const char* names[num_op_classes] = {
+        "call_prog", "clear_screen", "ret_routine", "jump",
+        "call_routine", "skip_if_equal", "skip_if_not_equal",
+        "skip_if_equal_regs", "set_reg", "add_reg", "set_regx_regy",
+        "set_regx_or_regy", "set_regx_and_regy", "set_regx_xor_regy",
+        "set_regx_add_regy", "set_regx_sub_regy", "set_regx_rshift",
+        "set_regx_regy_sub_regx", "set_regx_lshift",
+        "skip_if_not_equal_regs", "set_index", "jump_offset",
+        "set_reg_rand_masked", "draw_sprite", "skip_if_key_pressed",
+        "skip_if_key_not_pressed", "set_reg_delay",
+        "wait_key_press_store", "set_delay_regx", "set_sound_regx",
+        "add_regx_to_index", "get_sprite_regx", "split_decimal",
+        "dump_regs_to_regx", "slurp_regs_to_regx",
+        "scroll_down", "scroll_right", "scroll_left", "halt",
+        "set_lores", "set_hires", "get_big_sprite_regx", "save_flags",
+        "load_flags",
+        "scroll_up", "save_regs_range", "load_regs_range",
+        "set_index_long", "select_planes", "load_audio_pattern",
+        "set_pitch",
+        "invalid_opcode",
+    };
+    return c < num_op_classes ? names[c] : "?";
+}
+
+// ----------------------------------------------------------------------------
+void iset::flush_metrics() {
+    if (draws)
+        metric_add(metric_draws, draws);
+    draws = 0;
+}
+
+// ----------------------------------------------------------------------------
+// every quirk dependent handler, for every profile
+#define ISET_INSTANTIATE(Q) \
+    template void iset::set_regx_rshift<Q>(vmstate* state); \
+    template void iset::set_regx_lshift<Q>(vmstate* state); \
+    template void iset::jump_offset<Q>(vmstate* state); \
+    template void iset::draw_sprite<Q>(vmstate* state); \
+    template void iset::dump_regs_to_regx<Q>(vmstate* state); \
+    template void iset::slurp_regs_to_regx<Q>(vmstate* state);
+
+ISET_INSTANTIATE(quirks_vip)
+ISET_INSTANTIATE(quirks_schip)
+ISET_INSTANTIATE(quirks_modern)
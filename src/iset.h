@@ -1,7 +1,20 @@
 #ifndef __ISET_H__
 #define __ISET_H__
+#include "def.h"
+#include "quirks.h"
+
 namespace iset {
+    inline void fault(vmstate* state, bool cond, byte code, word addr) {
+        /* raise `code` if `cond`, without branching: faults are sticky, and
+         * `fault_ip` keeps the address of the first one
+         */
+        bool first = cond & (state->faults == 0);
+        state->fault_ip = first ? addr : state->fault_ip;
+        state->faults  |= (byte) -cond & code;
+    }
+
     void call_prog(vmstate* state);
+    void invalid_opcode(vmstate* state);
     void clear_screen(vmstate* state);
     void ret_routine(vmstate* state);
     void jump(vmstate* state);
@@ -17,14 +30,14 @@ namespace iset {
     void set_regx_xor_regy(vmstate* state);
     void set_regx_add_regy(vmstate* state);
     void set_regx_sub_regy(vmstate* state);
-    void set_regx_rshift(vmstate* state);
+    template <class Q> void set_regx_rshift(vmstate* state);
     void set_regx_regy_sub_regx(vmstate* state);
-    void set_regx_lshift(vmstate* state);
+    template <class Q> void set_regx_lshift(vmstate* state);
     void skip_if_not_equal_regs(vmstate* state);
     void set_index(vmstate* state);
-    void jump_offset(vmstate* state);
+    template <class Q> void jump_offset(vmstate* state);
     void set_reg_rand_masked(vmstate* state);
-    void draw_sprite(vmstate* state);
+    template <class Q> void draw_sprite(vmstate* state);
     void skip_if_key_pressed(vmstate* state);
     void skip_if_key_not_pressed(vmstate* state);
     void set_reg_delay(vmstate* state);
@@ -34,7 +47,56 @@ namespace iset {
     void add_regx_to_index(vmstate* state);
     void get_sprite_regx(vmstate* state);
     void split_decimal(vmstate* state);
-    void dump_regs_to_regx(vmstate* state);
-    void slurp_regs_to_regx(vmstate* state);
+    template <class Q> void dump_regs_to_regx(vmstate* state);
+    template <class Q> void slurp_regs_to_regx(vmstate* state);
+
+    // SUPER-CHIP
+    void scroll_down(vmstate* state);
+    void scroll_right(vmstate* state);
+    void scroll_left(vmstate* state);
+    void halt(vmstate* state);
+    void set_lores(vmstate* state);
+    void set_hires(vmstate* state);
+    void get_big_sprite_regx(vmstate* state);
+    void save_flags(vmstate* state);
+    void load_flags(vmstate* state);
+
+    // XO-CHIP
+    void scroll_up(vmstate* state);
+    void save_regs_range(vmstate* state);
+    void load_regs_range(vmstate* state);
+    void set_index_long(vmstate* state);
+    void select_planes(vmstate* state);
+    void load_audio_pattern(vmstate* state);
+    void set_pitch(vmstate* state);
+
+    // the handler each opcode decodes to, named after it
+    enum op_class {
+        op_call_prog, op_clear_screen, op_ret_routine, op_jump,
+        op_call_routine, op_skip_if_equal, op_skip_if_not_equal,
+        op_skip_if_equal_regs, op_set_reg, op_add_reg, op_set_regx_regy,
+        op_set_regx_or_regy, op_set_regx_and_regy, op_set_regx_xor_regy,
+        op_set_regx_add_regy, op_set_regx_sub_regy, op_set_regx_rshift,
+        op_set_regx_regy_sub_regx, op_set_regx_lshift,
+        op_skip_if_not_equal_regs, op_set_index, op_jump_offset,
+        op_set_reg_rand_masked, op_draw_sprite, op_skip_if_key_pressed,
+        op_skip_if_key_not_pressed, op_set_reg_delay,
+        op_wait_key_press_store, op_set_delay_regx, op_set_sound_regx,
+        op_add_regx_to_index, op_get_sprite_regx, op_split_decimal,
+        op_dump_regs_to_regx, op_slurp_regs_to_regx,
+        op_scroll_down, op_scroll_right, op_scroll_left, op_halt,
+        op_set_lores, op_set_hires, op_get_big_sprite_regx, op_save_flags,
+        op_load_flags,
+        op_scroll_up, op_save_regs_range, op_load_regs_range,
+        op_set_index_long, op_select_planes, op_load_audio_pattern,
+        op_set_pitch,
+        op_invalid_opcode,
+        num_op_classes
+    };
+    op_class classify(c8opcode op, byte mode);
+    const char* op_name(op_class c);
+
+    // add the sprite draws counted on this thread to the process metrics
+    void flush_metrics();
 };
 #endif
@@ -0,0 +1,218 @@
+#include "latency.h"
+#include "iset.h"
+#include "clock.h"
+#include <iomanip>
+#include <string.h>
+
+static const char* stage_names[num_latency_stages] = {
+    "queue", "observe", "draw", "present", "total"
+};
+
+static const metric_id stage_metrics[num_latency_stages] = {
+    metric_histogram("c8vm_input_queue_nanoseconds",
+                     "Key event posted to applied at a frame boundary"),
+    metric_histogram("c8vm_input_observe_nanoseconds",
+                     "Key event applied to read by EX9E/EXA1/FX0A"),
+    metric_histogram("c8vm_input_draw_nanoseconds",
+                     "Key event read to the next screen change"),
+    metric_histogram("c8vm_input_present_nanoseconds",
+                     "Screen change to the frame being presented"),
+    metric_histogram("c8vm_input_to_photon_nanoseconds",
+                     "Key event posted to its effect being presented"),
+};
+
+// ----------------------------------------------------------------------------
+const char* latency_stage_name(latency_stage stage) {
+    return stage < num_latency_stages ? stage_names[stage] : "invalid";
+}
+
+// ----------------------------------------------------------------------------
+static bool changes_screen(c8opcode op, byte mode) {
+    switch (iset::classify(op, mode)) {
+        case iset::op_clear_screen:
+        case iset::op_draw_sprite:
+        case iset::op_scroll_down:
+        case iset::op_scroll_up:
+        case iset::op_scroll_right:
+        case iset::op_scroll_left:
+        case iset::op_set_lores:
+        case iset::op_set_hires:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ----------------------------------------------------------------------------
+input_latency::input_latency() {
+    hist = new hist_snapshot[num_latency_stages];
+    clear();
+}
+
+// ----------------------------------------------------------------------------
+input_latency::~input_latency() {
+    delete[] hist;
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::clear() {
+    num_pending = observing = drawing = 0;
+    memset(hist, 0, num_latency_stages * sizeof(hist_snapshot));
+    memset(max_ns, 0, sizeof(max_ns));
+    expired = dropped = 0;
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::remove(unsigned int i) {
+    // keeps the rest in the order they were applied
+    if (pending[i].stage == stage_observe)
+        --observing;
+    else if (pending[i].stage == stage_draw)
+        --drawing;
+    memmove(&pending[i], &pending[i + 1],
+            (num_pending - i - 1) * sizeof(latency_event));
+    --num_pending;
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::finish(latency_stage stage, const latency_event& e,
+                           qword now) {
+    qword ns = now - e.stamp[stage];
+    hist_snapshot& h = hist[stage];
+    ++h.buckets[hist_bucket(ns)];
+    ++h.count;
+    h.sum += ns;
+    if (ns > max_ns[stage])
+        max_ns[stage] = ns;
+    metric_observe(stage_metrics[stage], ns);
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::applied(const key_event& e, long frame, qword now) {
+    /* `e` has just been applied to the key array, at the start of `frame`.
+     * With too many events in flight the oldest is given up on.
+     */
+    if (num_pending == LATENCY_MAX_PENDING) {
+        remove(0);
+        ++dropped;
+    }
+    latency_event& p = pending[num_pending++];
+    p.key   = e.key & 0xF;
+    p.stage = stage_observe;
+    p.frame = frame;
+    p.stamp[stage_queue] = p.stamp[stage_total] = e.stamp;
+    p.stamp[stage_observe] = now;
+    finish(stage_queue, p, now);
+    ++observing;
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::frame(long frame) {
+    /* at the start of each frame: give up on events that have been in
+     * flight too long
+     */
+    for (unsigned int i = 0; i < num_pending;) {
+        if (frame - pending[i].frame < LATENCY_EXPIRE_FRAMES) {
+            ++i;
+            continue;
+        }
+        remove(i);
+        ++expired;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::advance(const vmstate* state) {
+    /* the instruction just run may have read a key an event is waiting to
+     * be seen on, or changed the screen after one was seen
+     */
+    c8opcode op = state->curr_opcode;
+    bool waited = (op & 0xF0FF) == 0xF00A,
+         polled = (op & 0xF0FF) == 0xE09E || (op & 0xF0FF) == 0xE0A1,
+         drew   = drawing && changes_screen(op, state->mode);
+    if (!waited && !polled && !drew)
+        return;
+    byte key = state->registers[(op & 0x0F00) >> 8] & 0xF;
+    qword now = monotonic_ns();
+    for (unsigned int i = 0; i < num_pending; ++i) {
+        latency_event& e = pending[i];
+        if (e.stage == stage_observe && (waited || (polled && e.key == key))) {
+            finish(stage_observe, e, now);
+            e.stage = stage_draw;
+            e.stamp[stage_draw] = now;
+            --observing;
+            ++drawing;
+        } else if (e.stage == stage_draw && drew) {
+            finish(stage_draw, e, now);
+            e.stage = stage_present;
+            e.stamp[stage_present] = now;
+            --drawing;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::presented() {
+    /* the host has just shown the current frame: every event whose screen
+     * change was waiting on it is done
+     */
+    qword now = 0;
+    for (unsigned int i = 0; i < num_pending;) {
+        if (pending[i].stage != stage_present) {
+            ++i;
+            continue;
+        }
+        if (!now)
+            now = monotonic_ns();
+        finish(stage_present, pending[i], now);
+        finish(stage_total, pending[i], now);
+        remove(i);
+    }
+}
+
+// ----------------------------------------------------------------------------
+const hist_snapshot* input_latency::get_histogram(latency_stage stage) {
+    return &hist[stage];
+}
+
+// ----------------------------------------------------------------------------
+qword input_latency::get_max(latency_stage stage) {
+    return max_ns[stage];
+}
+
+// ----------------------------------------------------------------------------
+qword input_latency::get_expired() {
+    return expired;
+}
+
+// ----------------------------------------------------------------------------
+qword input_latency::get_dropped() {
+    return dropped;
+}
+
+// ----------------------------------------------------------------------------
+void input_latency::report(std::ostream& out) {
+    /* a table of each stage, in microseconds:
+     *
+     *   stage        count    mean     p50     p99     max
+     *   queue           12      41      40      88      93
+     *   ...
+     */
+    std::ios::fmtflags flags = out.flags();
+    out << std::dec << "input latency (us), " << hist[stage_queue].count
+        << " events, " << expired << " expired, " << dropped << " dropped"
+        << std::endl << "  " << std::left << std::setw(9) << "stage"
+        << std::right << std::setw(8) << "count" << std::setw(10) << "mean"
+        << std::setw(10) << "p50" << std::setw(10) << "p99"
+        << std::setw(10) << "max" << std::endl;
+    for (unsigned int s = 0; s < num_latency_stages; ++s) {
+        const hist_snapshot& h = hist[s];
+        out << "  " << std::left << std::setw(9) << stage_names[s]
+            << std::right << std::setw(8) << h.count << std::setw(10)
+            << (h.count ? h.sum / h.count / 1000 : 0) << std::setw(10)
+            << hist_quantile(&h, 0.5) / 1000 << std::setw(10)
+            << hist_quantile(&h, 0.99) / 1000 << std::setw(10)
+            << max_ns[s] / 1000 << std::endl;
+    }
+    out.flags(flags);
+}
@@ -0,0 +1,78 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include "def.h"
+#include "input.h"
+#include "metrics.h"
+#include <ostream>
+
+/* Input-to-photon latency: each key event is followed from the host to
+ * the screen, and the time spent in each stage recorded:
+ *
+ *     queue      posted (`post_key`) -> applied at a frame boundary
+ *     observe    applied -> the first EX9E/EXA1 on its key, or FX0A
+ *     draw       observed -> the first instruction that changes the screen
+ *     present    drawn -> the host showing the frame (`C8VM::presented`)
+ *     total      posted -> presented
+ *
+ * An event that isn't carried through within LATENCY_EXPIRE_FRAMES frames
+ * of being applied (say, a key the guest never polls, or a key press that
+ * doesn't change the screen) is dropped and counted as expired. Timing is
+ * all monotonic_ns(), taken only when an event moves on, and the per
+ * instruction check is a single branch while nothing is in flight.
+ *
+ * Every stage is also published as a c8vm_input_*_nanoseconds histogram in
+ * the metrics registry.
+ */
+const unsigned int LATENCY_MAX_PENDING   = 32;
+const long         LATENCY_EXPIRE_FRAMES = 60;
+
+enum latency_stage {
+    stage_queue, stage_observe, stage_draw, stage_present, stage_total,
+    num_latency_stages
+};
+
+typedef struct latency_event {
+    byte key;
+    byte stage;             // the stage it is waiting to complete
+    long frame;             // frame it was applied at
+    qword stamp[num_latency_stages]; // when each stage began
+} latency_event;
+
+class input_latency {
+    latency_event pending[LATENCY_MAX_PENDING];
+    unsigned int num_pending;
+    unsigned int observing, drawing; // events waiting on a key read, a draw
+    hist_snapshot* hist;             // [num_latency_stages]
+    qword max_ns[num_latency_stages];
+    qword expired, dropped;
+
+    public:
+    input_latency();
+    ~input_latency();
+    void clear();
+    void applied(const key_event& e, long frame, qword now);
+    void frame(long frame);
+    void executed(const vmstate* state) {
+        // after every instruction: only look closer while events are due
+        if (observing | drawing)
+            advance(state);
+    }
+    void presented();
+    const hist_snapshot* get_histogram(latency_stage stage);
+    qword get_max(latency_stage stage);
+    qword get_expired();
+    qword get_dropped();
+    void report(std::ostream& out);
+
+    private:
+    void advance(const vmstate* state);
+    void finish(latency_stage stage, const latency_event& e, qword now);
+    void remove(unsigned int i);
+    input_latency(const input_latency&);        // not copyable: owns hist
+    input_latency& operator=(const input_latency&);
+};
+
+const char* latency_stage_name(latency_stage stage);
+
+#endif
@@ -0,0 +1,322 @@
+#include "lockstep.h"
+#include "clock.h"
+#include "debug.h"
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+
+static const char* engine_names[num_engine_kinds] = {
+    "step", "run", "profile", "breakpoint"
+};
+
+// ----------------------------------------------------------------------------
+const char* engine_name(engine_kind kind) {
+    return kind < num_engine_kinds ? engine_names[kind] : "invalid";
+}
+
+// ----------------------------------------------------------------------------
+bool parse_engine(const std::string& name, engine_kind* kind) {
+    for (unsigned int k = 0; k < num_engine_kinds; ++k) {
+        if (name == engine_names[k]) {
+            *kind = (engine_kind) k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+lockstep_engine::lockstep_engine(engine_kind kind) : kind(kind),
+                                                     profile(NULL) {
+    if (kind == engine_profile) {
+        profile = new vm_profile;
+        profile_clear(profile, 1);
+    }
+}
+
+// ----------------------------------------------------------------------------
+lockstep_engine::~lockstep_engine() {
+    vm.set_profile(NULL);
+    delete profile;
+}
+
+// ----------------------------------------------------------------------------
+bool lockstep_engine::load(const std::string& rom, machine_mode mode,
+                           bool have_quirks, quirk_profile quirks) {
+    vm.set_mode(mode);
+    if (have_quirks)
+        vm.set_quirks(quirks);
+    if (!vm.load(rom))
+        return false;
+    if (profile)
+        vm.set_profile(profile);
+    if (kind == engine_breakpoint) {
+        // anywhere: the point is to run the breakpoint checking core
+        vm.clear_breakpoints();
+        vm.set_breakpoint(0x000);
+    }
+    vm.start();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void lockstep_engine::advance(long cycles) {
+    /* run `cycles` more instructions, or until the vm stops
+     */
+    long target = vm.get_state()->cycles + cycles;
+    if (kind == engine_step) {
+        while (vm.get_state()->cycles < target && vm.is_on())
+            vm.do_cycle();
+        return;
+    }
+    while (vm.get_state()->cycles < target && vm.is_on())
+        vm.run(target - vm.get_state()->cycles, 0);
+}
+
+// ----------------------------------------------------------------------------
+C8VM& lockstep_engine::get_vm() {
+    return vm;
+}
+
+// ----------------------------------------------------------------------------
+engine_kind lockstep_engine::get_kind() {
+    return kind;
+}
+
+// ----------------------------------------------------------------------------
+bool states_equal(const vmstate* a, const vmstate* b) {
+    /* every field but the quirk profile, which belongs to the engine, and
+     * only the memory the machine can address; compared one by one as
+     * padding between them is undefined
+     */
+    return a->curr_opcode == b->curr_opcode && a->ip == b->ip &&
+        a->sp == b->sp && a->index == b->index &&
+        a->mem_mask == b->mem_mask && a->mode == b->mode &&
+        a->hires == b->hires &&
+        a->planes == b->planes && a->pitch == b->pitch &&
+        a->delay_timer == b->delay_timer &&
+        a->sound_timer == b->sound_timer &&
+        a->frequency == b->frequency && a->on == b->on &&
+        a->cycles == b->cycles && a->gfx_stale == b->gfx_stale &&
+        a->waiting_key == b->waiting_key && a->wait_reg == b->wait_reg &&
+        a->rng == b->rng && a->faults == b->faults &&
+        a->fault_ip == b->fault_ip &&
+        memcmp(a->registers, b->registers, sizeof(a->registers)) == 0 &&
+        memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+        memcmp(a->flags, b->flags, sizeof(a->flags)) == 0 &&
+        memcmp(a->pattern, b->pattern, sizeof(a->pattern)) == 0 &&
+        memcmp(a->key, b->key, sizeof(a->key)) == 0 &&
+        memcmp(a->gfx, b->gfx, sizeof(a->gfx)) == 0 &&
+        memcmp(a->memory, b->memory, a->mem_mask + 1) == 0;
+}
+
+// ----------------------------------------------------------------------------
+static void diff_row(std::ostream& out, const std::string& field, qword a,
+                     qword b, bool always) {
+    if (a == b && !always)
+        return;
+    out << "  " << std::left << std::setw(14) << field << std::right
+        << std::hex << std::setfill('0') << std::setw(16) << a << "  "
+        << std::setw(16) << b << std::setfill(' ') << std::dec
+        << (a != b ? "  *" : "") << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+void print_state_diff(const vmstate* a, const vmstate* b, const char* name_a,
+                      const char* name_b, std::ostream& out) {
+    /* both states side by side: the registers always, everything else only
+     * where they differ (marked with a *). Memory and the framebuffer are
+     * summarised as the first differing byte or word.
+     */
+    std::ios::fmtflags flags = out.flags();
+    out << "  " << std::left << std::setw(14) << "field" << std::right
+        << std::setw(16) << name_a << "  " << std::setw(16) << name_b
+        << std::endl;
+    diff_row(out, "cycles", a->cycles, b->cycles, true);
+    diff_row(out, "pc", a->ip, b->ip, true);
+    diff_row(out, "opcode", a->curr_opcode, b->curr_opcode, true);
+    diff_row(out, "I", a->index, b->index, true);
+    diff_row(out, "sp", a->sp, b->sp, true);
+    for (unsigned int r = 0; r < 16; ++r) {
+        std::ostringstream name;
+        name << "V" << std::hex << std::uppercase << r;
+        diff_row(out, name.str(), a->registers[r], b->registers[r], true);
+    }
+    diff_row(out, "delay_timer", a->delay_timer, b->delay_timer, false);
+    diff_row(out, "sound_timer", a->sound_timer, b->sound_timer, false);
+    for (unsigned int i = 0; i < STACK_SIZE; ++i) {
+        std::ostringstream name;
+        name << "stack[" << i << "]";
+        diff_row(out, name.str(), a->stack[i], b->stack[i], false);
+    }
+    diff_row(out, "mode", a->mode, b->mode, false);
+    diff_row(out, "quirks", a->quirks, b->quirks, false);
+    diff_row(out, "hires", a->hires, b->hires, false);
+    diff_row(out, "planes", a->planes, b->planes, false);
+    diff_row(out, "pitch", a->pitch, b->pitch, false);
+    diff_row(out, "on", a->on, b->on, false);
+    diff_row(out, "gfx_stale", a->gfx_stale, b->gfx_stale, false);
+    diff_row(out, "waiting_key", a->waiting_key, b->waiting_key, false);
+    diff_row(out, "wait_reg", a->wait_reg, b->wait_reg, false);
+    diff_row(out, "rng", a->rng, b->rng, false);
+    diff_row(out, "faults", a->faults, b->faults, false);
+    diff_row(out, "fault_ip", a->fault_ip, b->fault_ip, false);
+    for (unsigned int k = 0; k < KEY_SIZE; ++k) {
+        std::ostringstream name;
+        name << "key[" << std::hex << k << "]";
+        diff_row(out, name.str(), a->key[k], b->key[k], false);
+    }
+    for (unsigned int i = 0; i < 16; ++i) {
+        std::ostringstream name;
+        name << "flags[" << i << "]";
+        diff_row(out, name.str(), a->flags[i], b->flags[i], false);
+        name.str("");
+        name << "pattern[" << i << "]";
+        diff_row(out, name.str(), a->pattern[i], b->pattern[i], false);
+    }
+    unsigned int size = (a->mem_mask < b->mem_mask ? a->mem_mask
+                                                   : b->mem_mask) + 1;
+    for (unsigned int addr = 0; addr < size; ++addr) {
+        if (a->memory[addr] != b->memory[addr]) {
+            std::ostringstream name;
+            name << "mem[" << std::hex << std::setfill('0') << std::setw(4)
+                << addr << "]";
+            diff_row(out, name.str(), a->memory[addr], b->memory[addr],
+                     false);
+            break;
+        }
+    }
+    const qword* ga = &a->gfx[0][0][0];
+    const qword* gb = &b->gfx[0][0][0];
+    for (unsigned int w = 0; w < sizeof(a->gfx) / sizeof(qword); ++w) {
+        if (ga[w] != gb[w]) {
+            std::ostringstream name;
+            name << "gfx[" << w / (GFX_HIRES_H * GFX_ROW_WORDS) << "]["
+                << w / GFX_ROW_WORDS % GFX_HIRES_H << "]["
+                << w % GFX_ROW_WORDS << "]";
+            diff_row(out, name.str(), ga[w], gb[w], false);
+            break;
+        }
+    }
+    out.flags(flags);
+}
+
+typedef struct lockstep_pair {
+    lockstep_engine* a;
+    lockstep_engine* b;
+    const std::vector<script_event>* events;
+    unsigned int next;      // first event not yet posted
+} lockstep_pair;
+
+// ----------------------------------------------------------------------------
+static void drive(lockstep_pair& p, long cycles) {
+    /* advance both engines `cycles` instructions, posting each scripted
+     * key event to both just before the frame it is due at starts
+     */
+    C8VM& vm = p.a->get_vm();
+    long target = vm.get_state()->cycles + cycles;
+    const std::vector<script_event>& events = *p.events;
+    for (;;) {
+        long now = vm.get_state()->cycles;
+        while (p.next < events.size() &&
+               events[p.next].frame * CYCLES_PER_FRAME <= now) {
+            const script_event& e = events[p.next++];
+            vm.post_key_at(e.frame, e.key, e.down);
+            p.b->get_vm().post_key_at(e.frame, e.key, e.down);
+        }
+        long until = target;
+        if (p.next < events.size() &&
+            events[p.next].frame * CYCLES_PER_FRAME < until)
+            until = events[p.next].frame * CYCLES_PER_FRAME;
+        p.a->advance(until - now);
+        p.b->advance(until - now);
+        if (until == target || vm.get_state()->cycles != until)
+            return; // done, or stopped early
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void wind_back(lockstep_pair& p, const vmstate* checkpoint) {
+    /* put both engines back to `checkpoint`, each keeping its own quirk
+     * profile, with every event not yet applied there queued again
+     */
+    quirk_profile qa = p.a->get_vm().get_quirks();
+    quirk_profile qb = p.b->get_vm().get_quirks();
+    p.a->get_vm().set_state(checkpoint);
+    p.b->get_vm().set_state(checkpoint);
+    p.a->get_vm().set_quirks(qa);
+    p.b->get_vm().set_quirks(qb);
+    p.a->get_vm().clear_input();
+    p.b->get_vm().clear_input();
+    const std::vector<script_event>& events = *p.events;
+    p.next = 0;
+    while (p.next < events.size() &&
+           events[p.next].frame * CYCLES_PER_FRAME < checkpoint->cycles)
+        ++p.next;
+}
+
+// ----------------------------------------------------------------------------
+bool lockstep_run(lockstep_engine& a, lockstep_engine& b,
+                  const std::vector<script_event>& events, long cycles,
+                  long interval, lockstep_result* result, std::ostream& out) {
+    /* run both (already loaded) engines for `cycles` instructions, or
+     * until they stop; true if they agreed throughout. `events` must be in
+     * frame order. On divergence the first differing instruction and both
+     * states after it are written to `out`.
+     */
+    lockstep_pair p = { &a, &b, &events, 0 };
+    vmstate* checkpoint = new vmstate;
+    memcpy(checkpoint, a.get_vm().get_state(),
+           state_size(a.get_vm().get_state()));
+    result->diverged = false;
+    result->pc       = 0;
+    result->opcode   = 0;
+    qword t0 = monotonic_ns();
+    long start = checkpoint->cycles, done = 0;
+    while (done < cycles) {
+        long n = interval < cycles - done ? interval : cycles - done;
+        drive(p, n);
+        if (!states_equal(a.get_vm().get_state(), b.get_vm().get_state())) {
+            // bisect (lo, hi] for the first instruction they differ after
+            long lo = 0, hi = n;
+            while (hi - lo > 1) {
+                long mid = lo + (hi - lo) / 2;
+                wind_back(p, checkpoint);
+                drive(p, mid);
+                if (states_equal(a.get_vm().get_state(),
+                                 b.get_vm().get_state()))
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            wind_back(p, checkpoint);
+            drive(p, lo);
+            const vmstate* s = a.get_vm().get_state();
+            result->pc       = s->ip;
+            result->opcode   = s->memory[s->ip & s->mem_mask] << 8 |
+                               s->memory[(s->ip + 1) & s->mem_mask];
+            drive(p, 1);
+            result->diverged = true;
+            result->cycles   = checkpoint->cycles - start + hi;
+            out << "diverged at instruction " << result->cycles << ", 0x"
+                << std::hex << std::setfill('0') << std::setw(4)
+                << result->pc << ": " << std::setw(4) << result->opcode
+                << std::dec << std::setfill(' ') << "  "
+                << disassemble(result->opcode, s->mode) << std::endl;
+            print_state_diff(a.get_vm().get_state(), b.get_vm().get_state(),
+                             engine_name(a.get_kind()),
+                             engine_name(b.get_kind()), out);
+            break;
+        }
+        done += n;
+        memcpy(checkpoint, a.get_vm().get_state(),
+               state_size(a.get_vm().get_state()));
+        if (!a.get_vm().is_on())
+            break; // both stopped, in the same place
+    }
+    result->ns = monotonic_ns() - t0;
+    if (!result->diverged)
+        result->cycles = a.get_vm().get_state()->cycles - start;
+    delete checkpoint;
+    return !result->diverged;
+}
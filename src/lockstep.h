@@ -0,0 +1,75 @@
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#include "c8.h"
+#include "rom.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Differential execution: two engines run the same ROM and key script side
+ * by side, and their full states are compared every `interval`
+ * instructions. On the first mismatch both are wound back to the last
+ * state they agreed on and the interval is bisected, re-running from there,
+ * down to the single instruction after which they first differ; that
+ * instruction and both states are then printed.
+ *
+ * An engine is a way of driving C8VM:
+ *
+ *     step        `do_cycle`, one instruction at a time: the reference
+ *     run         `run`, the fast core (idle loops skipped)
+ *     profile     `run` with profiling on: the counting core, no skipping
+ *     breakpoint  `run` with a breakpoint set: the checking core
+ *
+ * New engines plug in here as another engine_kind. The two may also be
+ * loaded with different quirk profiles, to find the first instruction at
+ * which a ROM comes to depend on a quirk.
+ *
+ * At each agreed checkpoint only one state is kept (the two are the same),
+ * so the cost of checking is a state copy and compare per interval.
+ */
+enum engine_kind {
+    engine_step, engine_run, engine_profile, engine_breakpoint,
+    num_engine_kinds
+};
+
+const long LOCKSTEP_INTERVAL = 10000;
+
+class lockstep_engine {
+    C8VM vm;
+    engine_kind kind;
+    vm_profile* profile;
+
+    public:
+    lockstep_engine(engine_kind kind);
+    ~lockstep_engine();
+    bool load(const std::string& rom, machine_mode mode, bool have_quirks,
+              quirk_profile quirks);
+    void advance(long cycles);
+    C8VM& get_vm();
+    engine_kind get_kind();
+
+    private:
+    lockstep_engine(const lockstep_engine&);      // owns profile
+    lockstep_engine& operator=(const lockstep_engine&);
+};
+
+typedef struct lockstep_result {
+    bool diverged;
+    long cycles;    // instructions run; on divergence, up to and including
+                    // the first one the engines disagree after
+    word pc;        // that instruction, on divergence
+    c8opcode opcode;
+    qword ns;
+} lockstep_result;
+
+const char* engine_name(engine_kind kind);
+bool parse_engine(const std::string& name, engine_kind* kind);
+bool states_equal(const vmstate* a, const vmstate* b);
+void print_state_diff(const vmstate* a, const vmstate* b, const char* name_a,
+                      const char* name_b, std::ostream& out);
+bool lockstep_run(lockstep_engine& a, lockstep_engine& b,
+                  const std::vector<script_event>& events, long cycles,
+                  long interval, lockstep_result* result, std::ostream& out);
+
+#endif
@@ -0,0 +1,312 @@
+#include "memscan.h"
+#include <string.h>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* Each kernel turns a 64 byte block of memory and its snapshot into a mask,
+ * bit i set when byte i matches. x86 has no unsigned byte compare, so
+ * "increased" is min(now, then) != now, and "decreased" the same with max.
+ * SSE2 is part of x86-64, so it needs no check; the AVX2 kernels are
+ * compiled for AVX2 whatever the build flags, and only run where
+ * `scan_best_isa` finds the CPU has it.
+ */
+
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+static qword match_scalar(const byte* now, const byte* then, byte value) {
+    qword mask = 0;
+    for (unsigned int i = 0; i < SCAN_BLOCK; ++i) {
+        bool hit = false;
+        switch (P) {
+            case scan_equal:     hit = now[i] == value; break;
+            case scan_changed:   hit = now[i] != then[i]; break;
+            case scan_unchanged: hit = now[i] == then[i]; break;
+            case scan_increased: hit = now[i] > then[i]; break;
+            case scan_decreased: hit = now[i] < then[i]; break;
+            case scan_delta:     hit = now[i] == (byte) (then[i] + value);
+                                 break;
+        }
+        mask |= (qword) hit << i;
+    }
+    return mask;
+}
+
+#if defined(SCAN_X86) && defined(__SSE2__)
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+static inline unsigned int match16(__m128i now, __m128i then, __m128i value) {
+    switch (P) {
+        case scan_equal:
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(now, value));
+        case scan_changed:
+            return ~_mm_movemask_epi8(_mm_cmpeq_epi8(now, then)) & 0xFFFF;
+        case scan_unchanged:
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(now, then));
+        case scan_increased:
+            return ~_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_min_epu8(now, then), now)) & 0xFFFF;
+        case scan_decreased:
+            return ~_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_max_epu8(now, then), now)) & 0xFFFF;
+        case scan_delta:
+            return _mm_movemask_epi8(
+                _mm_cmpeq_epi8(now, _mm_add_epi8(then, value)));
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+static qword match_sse2(const byte* now, const byte* then, byte value) {
+    __m128i v = _mm_set1_epi8((char) value);
+    qword mask = 0;
+    for (unsigned int i = 0; i < SCAN_BLOCK; i += 16) {
+        __m128i n = _mm_loadu_si128((const __m128i*) (now + i));
+        __m128i t = _mm_loadu_si128((const __m128i*) (then + i));
+        mask |= (qword) match16<P>(n, t, v) << i;
+    }
+    return mask;
+}
+#define SCAN_SSE2
+#endif
+
+// ----------------------------------------------------------------------------
+template <scan_predicate P, qword (*match)(const byte*, const byte*, byte)>
+static void scan_blocks(const byte* memory, byte* snapshot, qword* bits,
+                        unsigned int words, byte value) {
+    /* the snapshot only needs to be kept where there are candidates left
+     */
+    for (unsigned int w = 0; w < words; ++w) {
+        if (!bits[w])
+            continue;
+        const byte* now = memory + w * SCAN_BLOCK;
+        byte* then = snapshot + w * SCAN_BLOCK;
+        bits[w] &= match(now, then, value);
+        if (bits[w])
+            memcpy(then, now, SCAN_BLOCK);
+    }
+}
+
+#ifdef SCAN_X86
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+__attribute__((target("avx2")))
+static inline unsigned int match32(__m256i now, __m256i then, __m256i value) {
+    switch (P) {
+        case scan_equal:
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(now, value));
+        case scan_changed:
+            return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(now, then));
+        case scan_unchanged:
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(now, then));
+        case scan_increased:
+            return ~_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(now, then), now));
+        case scan_decreased:
+            return ~_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_max_epu8(now, then), now));
+        case scan_delta:
+            return _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(now, _mm256_add_epi8(then, value)));
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+__attribute__((target("avx2")))
+static void scan_blocks_avx2(const byte* memory, byte* snapshot, qword* bits,
+                             unsigned int words, byte value) {
+    /* as `scan_blocks`, but all of it built for AVX2, so the compares are
+     * inlined into the loop
+     */
+    __m256i v = _mm256_set1_epi8((char) value);
+    for (unsigned int w = 0; w < words; ++w) {
+        if (!bits[w])
+            continue;
+        const byte* now = memory + w * SCAN_BLOCK;
+        byte* then = snapshot + w * SCAN_BLOCK;
+        __m256i n0 = _mm256_loadu_si256((const __m256i*) now);
+        __m256i n1 = _mm256_loadu_si256((const __m256i*) (now + 32));
+        __m256i t0 = _mm256_loadu_si256((const __m256i*) then);
+        __m256i t1 = _mm256_loadu_si256((const __m256i*) (then + 32));
+        bits[w] &= (qword) match32<P>(n0, t0, v) |
+                   (qword) match32<P>(n1, t1, v) << 32;
+        if (bits[w]) {
+            _mm256_storeu_si256((__m256i*) then, n0);
+            _mm256_storeu_si256((__m256i*) (then + 32), n1);
+        }
+    }
+}
+#endif
+
+typedef void (*scan_fn)(const byte*, byte*, qword*, unsigned int, byte);
+
+// ----------------------------------------------------------------------------
+template <scan_predicate P>
+static scan_fn pick(scan_isa isa) {
+    switch (isa) {
+#ifdef SCAN_X86
+        case isa_avx2:
+            return scan_blocks_avx2<P>;
+#endif
+#ifdef SCAN_SSE2
+        case isa_sse2:
+            return scan_blocks<P, match_sse2<P> >;
+#endif
+        default:
+            return scan_blocks<P, match_scalar<P> >;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static scan_fn scanner(scan_predicate predicate, scan_isa isa) {
+    switch (predicate) {
+        case scan_equal:     return pick<scan_equal>(isa);
+        case scan_changed:   return pick<scan_changed>(isa);
+        case scan_unchanged: return pick<scan_unchanged>(isa);
+        case scan_increased: return pick<scan_increased>(isa);
+        case scan_decreased: return pick<scan_decreased>(isa);
+        case scan_delta:     return pick<scan_delta>(isa);
+    }
+    return pick<scan_equal>(isa);
+}
+
+// ----------------------------------------------------------------------------
+scan_isa scan_best_isa() {
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2"))
+        return isa_avx2;
+#endif
+#ifdef SCAN_SSE2
+    return isa_sse2;
+#else
+    return isa_scalar;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+const char* scan_isa_name(scan_isa isa) {
+    switch (isa) {
+        case isa_scalar: return "scalar";
+        case isa_sse2:   return "sse2";
+        case isa_avx2:   return "avx2";
+    }
+    return "?";
+}
+
+// ----------------------------------------------------------------------------
+mem_scan::mem_scan(unsigned int sessions, unsigned int size) {
+    /* `size` bytes of memory from each of `sessions` sessions; a multiple of
+     * SCAN_BLOCK, as MEM_SIZE and XO_MEM_SIZE are. Every address starts a
+     * candidate, against a snapshot of zeros.
+     */
+    this->sessions = sessions;
+    this->size     = size - size % SCAN_BLOCK;
+    this->words    = this->size / SCAN_BLOCK;
+    bits.assign((size_t) sessions * words, ~(qword) 0);
+    snapshots.assign((size_t) sessions * this->size, 0);
+    isa = scan_best_isa();
+}
+
+// ----------------------------------------------------------------------------
+void mem_scan::start(unsigned int session, const byte* memory) {
+    /* start the session's search over: every address a candidate, against
+     * a snapshot of `memory`
+     */
+    if (session >= sessions)
+        return;
+    std::fill(bits.begin() + (size_t) session * words,
+              bits.begin() + (size_t) (session + 1) * words, ~(qword) 0);
+    memcpy(&snapshots[(size_t) session * size], memory, size);
+}
+
+// ----------------------------------------------------------------------------
+void mem_scan::filter(unsigned int session, const byte* memory,
+                      scan_predicate predicate, byte value) {
+    /* keep the session's candidates whose byte in `memory` matches, and
+     * make `memory` their snapshot for the next filter
+     */
+    if (session >= sessions)
+        return;
+    scanner(predicate, isa)(memory, &snapshots[(size_t) session * size],
+                            &bits[(size_t) session * words], words, value);
+}
+
+// ----------------------------------------------------------------------------
+void mem_scan::filter_all(const byte* const* memory,
+                          scan_predicate predicate, byte value) {
+    /* the same filter over every session; `memory[s]` is session s's
+     * memory, or NULL to leave the session be
+     */
+    scan_fn scan = scanner(predicate, isa);
+    for (unsigned int s = 0; s < sessions; ++s) {
+        if (memory[s]) {
+            scan(memory[s], &snapshots[(size_t) s * size],
+                 &bits[(size_t) s * words], words, value);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+unsigned int mem_scan::count(unsigned int session) {
+    if (session >= sessions)
+        return 0;
+    unsigned int n = 0;
+    const qword* b = &bits[(size_t) session * words];
+    for (unsigned int w = 0; w < words; ++w)
+        n += __builtin_popcountll(b[w]);
+    return n;
+}
+
+// ----------------------------------------------------------------------------
+qword mem_scan::total() {
+    // candidates over every session
+    qword n = 0;
+    for (size_t w = 0; w < bits.size(); ++w)
+        n += __builtin_popcountll(bits[w]);
+    return n;
+}
+
+// ----------------------------------------------------------------------------
+bool mem_scan::is_candidate(unsigned int session, word addr) {
+    if (session >= sessions || addr >= size)
+        return false;
+    return (bits[(size_t) session * words + addr / SCAN_BLOCK] >>
+            (addr % SCAN_BLOCK)) & 1;
+}
+
+// ----------------------------------------------------------------------------
+void mem_scan::candidates(unsigned int session, std::vector<word>* out) {
+    // the session's candidate addresses, in order
+    out->clear();
+    if (session >= sessions)
+        return;
+    const qword* b = &bits[(size_t) session * words];
+    for (unsigned int w = 0; w < words; ++w) {
+        for (qword m = b[w]; m; m &= m - 1)
+            out->push_back((word) (w * SCAN_BLOCK + __builtin_ctzll(m)));
+    }
+}
+
+// ----------------------------------------------------------------------------
+const qword* mem_scan::get_bits(unsigned int session) {
+    // SCAN_BLOCK addresses to a word, address 0 the low bit of the first
+    return session < sessions ? &bits[(size_t) session * words] : NULL;
+}
+
+// ----------------------------------------------------------------------------
+void mem_scan::set_isa(scan_isa isa) {
+    // no better than the CPU has
+    scan_isa best = scan_best_isa();
+    this->isa = isa > best ? best : isa;
+}
+
+// ----------------------------------------------------------------------------
+scan_isa mem_scan::get_isa() {
+    return isa;
+}
@@ -0,0 +1,65 @@
+#ifndef __MEMSCAN_H__
+#define __MEMSCAN_H__
+
+#include "def.h"
+#include <vector>
+
+/* Value search over memory snapshots, cheat engine style: to find where a
+ * ROM keeps its score, lives or level, snapshot its memory, let it play,
+ * and keep only the addresses whose byte changed, went up, or went up by
+ * exactly N; a few rounds of that leave a handful of candidates.
+ *
+ * A mem_scan runs the same search over many sessions (vm instances) at
+ * once. Per session it keeps the candidates as a bitset, a bit per address,
+ * and memory as it was at the last filter. A filter compares a session's
+ * memory against that snapshot (or a value) 64 bytes at a time, with SSE2
+ * vector compares or, where the CPU has it, AVX2, and ANDs the matches
+ * into the candidate bits. A 64 byte block with no candidates left is
+ * skipped, snapshot and all, so each round costs less as the search
+ * narrows.
+ */
+const unsigned int SCAN_BLOCK = 64;   // bytes per word of candidate bits
+
+enum scan_predicate {
+    scan_equal,         // the byte is `value`
+    scan_changed,       // it isn't what it was at the last filter
+    scan_unchanged,
+    scan_increased,     // unsigned, above what it was
+    scan_decreased,
+    scan_delta,         // what it was plus `value` (mod 256)
+};
+
+enum scan_isa {
+    isa_scalar,
+    isa_sse2,
+    isa_avx2,
+};
+
+class mem_scan {
+    unsigned int sessions;
+    unsigned int size;          // bytes scanned per session
+    unsigned int words;         // of candidate bits per session
+    std::vector<qword> bits;
+    std::vector<byte> snapshots;
+    scan_isa isa;
+
+    public:
+    mem_scan(unsigned int sessions, unsigned int size);
+    void start(unsigned int session, const byte* memory);
+    void filter(unsigned int session, const byte* memory,
+                scan_predicate predicate, byte value);
+    void filter_all(const byte* const* memory, scan_predicate predicate,
+                    byte value);
+    unsigned int count(unsigned int session);
+    qword total();
+    bool is_candidate(unsigned int session, word addr);
+    void candidates(unsigned int session, std::vector<word>* out);
+    const qword* get_bits(unsigned int session);
+    void set_isa(scan_isa isa);
+    scan_isa get_isa();
+};
+
+scan_isa scan_best_isa();
+const char* scan_isa_name(scan_isa isa);
+
+#endif
@@ -0,0 +1,297 @@
+#include "metrics.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+enum metric_kind { kind_counter, kind_gauge, kind_histogram };
+
+typedef struct metric_info {
+    std::string name, help;
+    metric_kind kind;
+    metric_id id;   // index within its kind
+} metric_info;
+
+/* Registration is rare (once per metric, usually at start up) and takes a
+ * lock; updates never do. A thread takes a shard when it first touches a
+ * metric, and gives it back when it exits: its counts are added into the
+ * `retired` shard, so they outlive it, and the shard, zeroed, goes on the
+ * free list for the next thread. Shards are never freed, so there are only
+ * ever as many as there were threads at once. Taking and giving back a
+ * shard, and reading, take the lock, so no read sees a thread's counts
+ * twice or not at all.
+ */
+typedef struct metric_registry {
+    std::mutex lock;
+    metric_info metrics[MAX_COUNTERS + MAX_GAUGES + MAX_HISTOGRAMS];
+    unsigned int count;
+    unsigned int num[3];    // per kind
+    std::atomic<long long> gauges[MAX_GAUGES];
+    metric_shard retired;   // exited threads' counts; heads the shard list
+    std::vector<metric_shard*> free;
+} metric_registry;
+
+// gives the thread's shard back when it exits (see metric_attach)
+struct metric_owner {
+    metric_shard* shard;
+    ~metric_owner();
+};
+
+thread_local metric_shard* metric_local = NULL;
+static thread_local metric_owner owner = { NULL };
+
+// ----------------------------------------------------------------------------
+static void clear_shard(metric_shard* s) {
+    for (unsigned int i = 0; i < MAX_COUNTERS; ++i)
+        s->counters[i].store(0, std::memory_order_relaxed);
+    for (unsigned int h = 0; h < MAX_HISTOGRAMS; ++h) {
+        for (unsigned int b = 0; b < HIST_BUCKETS; ++b)
+            s->hist[h][b].store(0, std::memory_order_relaxed);
+        s->hist_sum[h].store(0, std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void fold_shard(metric_shard* into, metric_shard* s) {
+    // add `s` into `into` and zero it; the caller holds the lock
+    for (unsigned int i = 0; i < MAX_COUNTERS; ++i)
+        bump(into->counters[i], s->counters[i].load());
+    for (unsigned int h = 0; h < MAX_HISTOGRAMS; ++h) {
+        for (unsigned int b = 0; b < HIST_BUCKETS; ++b)
+            bump(into->hist[h][b], s->hist[h][b].load());
+        bump(into->hist_sum[h], s->hist_sum[h].load());
+    }
+    clear_shard(s);
+}
+
+// ----------------------------------------------------------------------------
+static metric_registry& registry() {
+    // constructed on first use, so metrics can be registered from statics
+    // in any translation unit
+    static metric_registry* r = NULL;
+    static std::once_flag once;
+    std::call_once(once, []() {
+        r = new metric_registry;
+        r->count = 0;
+        r->num[0] = r->num[1] = r->num[2] = 0;
+        for (unsigned int i = 0; i < MAX_GAUGES; ++i)
+            r->gauges[i].store(0);
+        clear_shard(&r->retired);
+        r->retired.next = NULL;
+    });
+    return *r;
+}
+
+// ----------------------------------------------------------------------------
+static metric_id add_metric(const char* name, const char* help,
+                            metric_kind kind) {
+    /* the id of metric `name`, registering it on first use, or
+     * METRIC_NONE if there is no room left for another of its kind
+     */
+    static const unsigned int limits[3] = {
+        MAX_COUNTERS, MAX_GAUGES, MAX_HISTOGRAMS
+    };
+    metric_registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (unsigned int i = 0; i < r.count; ++i) {
+        if (r.metrics[i].kind == kind && r.metrics[i].name == name)
+            return r.metrics[i].id;
+    }
+    if (r.num[kind] == limits[kind])
+        return METRIC_NONE;
+    metric_info& m = r.metrics[r.count++];
+    m.name = name;
+    m.help = help;
+    m.kind = kind;
+    m.id   = r.num[kind]++;
+    return m.id;
+}
+
+// ----------------------------------------------------------------------------
+metric_id metric_counter(const char* name, const char* help) {
+    return add_metric(name, help, kind_counter);
+}
+
+// ----------------------------------------------------------------------------
+metric_id metric_gauge(const char* name, const char* help) {
+    return add_metric(name, help, kind_gauge);
+}
+
+// ----------------------------------------------------------------------------
+metric_id metric_histogram(const char* name, const char* help) {
+    return add_metric(name, help, kind_histogram);
+}
+
+// ----------------------------------------------------------------------------
+metric_shard* metric_attach() {
+    /* give the calling thread its shard, a free one if there is one
+     */
+    metric_registry& r = registry();
+    metric_shard* s;
+    {
+        std::lock_guard<std::mutex> guard(r.lock);
+        if (!r.free.empty()) {
+            s = r.free.back();
+            r.free.pop_back();
+        } else {
+            s = new metric_shard;
+            clear_shard(s);
+            s->next = r.retired.next;
+            r.retired.next = s;
+        }
+    }
+    owner.shard = s;
+    metric_local = s;
+    return s;
+}
+
+// ----------------------------------------------------------------------------
+metric_owner::~metric_owner() {
+    if (!shard)
+        return;
+    metric_registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    fold_shard(&r.retired, shard);
+    r.free.push_back(shard);
+    metric_local = NULL;
+}
+
+// ----------------------------------------------------------------------------
+void metric_set(metric_id id, long long v) {
+    if (id == METRIC_NONE)
+        return;
+    registry().gauges[id].store(v, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+qword metric_read_counter(metric_id id) {
+    if (id == METRIC_NONE)
+        return 0;
+    metric_registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    qword total = 0;
+    for (metric_shard* s = &r.retired; s; s = s->next)
+        total += s->counters[id].load(std::memory_order_relaxed);
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+long long metric_read_gauge(metric_id id) {
+    if (id == METRIC_NONE)
+        return 0;
+    return registry().gauges[id].load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+void metric_read_histogram(metric_id id, hist_snapshot* out) {
+    memset(out, 0, sizeof(*out));
+    if (id == METRIC_NONE)
+        return;
+    metric_registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (metric_shard* s = &r.retired; s; s = s->next) {
+        for (unsigned int b = 0; b < HIST_BUCKETS; ++b) {
+            qword n = s->hist[id][b].load(std::memory_order_relaxed);
+            out->buckets[b] += n;
+            out->count      += n;
+        }
+        out->sum += s->hist_sum[id].load(std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+static qword bucket_low(unsigned int b) {
+    // smallest value that lands in bucket `b` (see hist_bucket)
+    if (b < HIST_SUB_BUCKETS)
+        return b;
+    unsigned int group = b / HIST_SUB_BUCKETS,
+                 sub   = b % HIST_SUB_BUCKETS;
+    return (qword) (HIST_SUB_BUCKETS + sub) << (group - 1);
+}
+
+// ----------------------------------------------------------------------------
+qword hist_quantile(const hist_snapshot* h, double q) {
+    /* the value at quantile `q` (0-1), to the resolution of the buckets:
+     * the low edge of the bucket it falls in
+     */
+    if (h->count == 0)
+        return 0;
+    qword rank = (qword) (q * (h->count - 1)), seen = 0;
+    for (unsigned int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            return bucket_low(b);
+    }
+    return bucket_low(HIST_BUCKETS - 1);
+}
+
+// ----------------------------------------------------------------------------
+void metrics_write_prometheus(std::ostream& out) {
+    /* every metric, in the Prometheus text exposition format. A histogram
+     * gets an `le` bound at 2^k - 1 for each power of two up to its
+     * largest value: values are integers, and those are the exact edges of
+     * its buckets.
+     */
+    static const char* types[3] = { "counter", "gauge", "histogram" };
+    metric_registry& r = registry();
+    unsigned int count;
+    {
+        std::lock_guard<std::mutex> guard(r.lock);
+        count = r.count;
+    }
+    hist_snapshot* h = new hist_snapshot;
+    for (unsigned int i = 0; i < count; ++i) {
+        const metric_info& m = r.metrics[i];
+        out << "# HELP " << m.name << " " << m.help << "\n"
+            << "# TYPE " << m.name << " " << types[m.kind] << "\n";
+        if (m.kind == kind_counter) {
+            out << m.name << " " << metric_read_counter(m.id) << "\n";
+            continue;
+        }
+        if (m.kind == kind_gauge) {
+            out << m.name << " " << metric_read_gauge(m.id) << "\n";
+            continue;
+        }
+        metric_read_histogram(m.id, h);
+        unsigned int last = 0;
+        for (unsigned int b = 0; b < HIST_BUCKETS; ++b) {
+            if (h->buckets[b])
+                last = b;
+        }
+        qword cumulative = 0;
+        unsigned int b = 0;
+        for (unsigned int k = 0; k < 64; ++k) {
+            qword edge = (1ULL << k) - 1;
+            while (b < HIST_BUCKETS && bucket_low(b) <= edge)
+                cumulative += h->buckets[b++];
+            out << m.name << "_bucket{le=\"" << edge << "\"} " << cumulative
+                << "\n";
+            if (b > last)
+                break;
+        }
+        out << m.name << "_bucket{le=\"+Inf\"} " << h->count << "\n"
+            << m.name << "_sum " << h->sum << "\n"
+            << m.name << "_count " << h->count << "\n";
+    }
+    delete h;
+    out.flush();
+}
+
+// ----------------------------------------------------------------------------
+bool metrics_dump(const std::string& path) {
+    /* write the metrics to `path` atomically (through a rename), so a
+     * scraper reading the file never sees half a dump
+     */
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream outfs(tmp.c_str());
+        if (!outfs)
+            return false;
+        metrics_write_prometheus(outfs);
+        if (!outfs)
+            return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
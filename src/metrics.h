@@ -0,0 +1,94 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "def.h"
+#include <atomic>
+#include <ostream>
+#include <string>
+
+/* Process-wide metrics: counters, gauges and log-linear ("HDR style")
+ * histograms, published in the Prometheus text format.
+ *
+ * Metrics are registered by name, usually once into a static, and updated
+ * by id. Every thread updates its own shard of the counters and
+ * histograms, so an update is a plain load and store on memory no other
+ * thread writes: no locks, no read-modify-write atomics, no shared cache
+ * lines. Readers sum the shards. A thread's counts are kept when it exits,
+ * and its shard goes to the next thread. Gauges hold one current value, so
+ * they are a single shared atomic instead.
+ *
+ * Histograms keep HIST_SUB_BUCKETS buckets per power of two (values below
+ * that are exact), about 12% resolution from nanoseconds up to hours, and
+ * are exposed with `le` bounds at each power of two.
+ */
+const unsigned int MAX_COUNTERS     = 64;
+const unsigned int MAX_GAUGES       = 32;
+const unsigned int MAX_HISTOGRAMS   = 16;
+const unsigned int HIST_SUB_BITS    = 3;
+const unsigned int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+const unsigned int HIST_BUCKETS     = (64 - HIST_SUB_BITS + 1) *
+                                      HIST_SUB_BUCKETS;
+
+typedef unsigned int metric_id;
+// what registering gives back once a kind's table is full; updating it does
+// nothing and reading it gives 0
+const metric_id METRIC_NONE = ~0u;
+
+// a histogram summed over every thread
+typedef struct hist_snapshot {
+    qword buckets[HIST_BUCKETS];
+    qword count, sum;
+} hist_snapshot;
+
+typedef struct metric_shard {
+    std::atomic<qword> counters[MAX_COUNTERS];
+    std::atomic<qword> hist[MAX_HISTOGRAMS][HIST_BUCKETS];
+    std::atomic<qword> hist_sum[MAX_HISTOGRAMS];
+    metric_shard* next;
+} metric_shard;
+
+metric_shard* metric_attach();
+extern thread_local metric_shard* metric_local;
+
+inline unsigned int hist_bucket(qword v) {
+    if (v < HIST_SUB_BUCKETS)
+        return (unsigned int) v;
+    unsigned int e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS +
+        ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+inline void bump(std::atomic<qword>& v, qword n) {
+    // only this thread writes `v`, so no read-modify-write is needed
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+metric_id metric_counter(const char* name, const char* help);
+metric_id metric_gauge(const char* name, const char* help);
+metric_id metric_histogram(const char* name, const char* help);
+
+inline void metric_add(metric_id id, qword n) {
+    if (id == METRIC_NONE)
+        return;
+    metric_shard* s = metric_local ? metric_local : metric_attach();
+    bump(s->counters[id], n);
+}
+
+inline void metric_observe(metric_id id, qword v) {
+    if (id == METRIC_NONE)
+        return;
+    metric_shard* s = metric_local ? metric_local : metric_attach();
+    bump(s->hist[id][hist_bucket(v)], 1);
+    bump(s->hist_sum[id], v);
+}
+
+void metric_set(metric_id id, long long v);
+qword metric_read_counter(metric_id id);
+long long metric_read_gauge(metric_id id);
+void metric_read_histogram(metric_id id, hist_snapshot* out);
+qword hist_quantile(const hist_snapshot* h, double q);
+
+void metrics_write_prometheus(std::ostream& out);
+bool metrics_dump(const std::string& path);
+
+#endif
@@ -0,0 +1,219 @@
+#include "profile.h"
+#include "iset.h"
+#include "hash.h"
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+
+typedef struct profile_row {
+    unsigned int key;   // op_class, or address
+    qword count;
+} profile_row;
+
+// ----------------------------------------------------------------------------
+static bool by_count(const profile_row& a, const profile_row& b) {
+    return a.count != b.count ? a.count > b.count : a.key < b.key;
+}
+
+// ----------------------------------------------------------------------------
+static void class_rows(const vm_profile* profile, const vmstate* state,
+                       std::vector<profile_row>& rows) {
+    /* opcode counts summed per handler, busiest first, scaled up to
+     * estimated executions
+     */
+    qword totals[iset::num_op_classes] = { 0 };
+    for (unsigned int op = 0; op < 0x10000; ++op) {
+        if (profile->by_opcode[op])
+            totals[iset::classify(op, state->mode)] += profile->by_opcode[op];
+    }
+    for (unsigned int c = 0; c < iset::num_op_classes; ++c) {
+        if (totals[c] == 0)
+            continue;
+        profile_row r = { c, totals[c] * profile->interval };
+        rows.push_back(r);
+    }
+    std::sort(rows.begin(), rows.end(), by_count);
+}
+
+// ----------------------------------------------------------------------------
+static void address_rows(const vm_profile* profile,
+                         std::vector<profile_row>& rows) {
+    for (unsigned int addr = 0; addr < XO_MEM_SIZE; ++addr) {
+        if (profile->by_pc[addr] == 0)
+            continue;
+        profile_row r = { addr, profile->by_pc[addr] * profile->interval };
+        rows.push_back(r);
+    }
+    std::sort(rows.begin(), rows.end(), by_count);
+}
+
+// ----------------------------------------------------------------------------
+static c8opcode opcode_at(const vmstate* state, word addr) {
+    return state->memory[addr & state->mem_mask] << 8 |
+        state->memory[(addr + 1) & state->mem_mask];
+}
+
+// ----------------------------------------------------------------------------
+size_t stack_key_hash::operator()(const stack_key& k) const {
+    return hash_bytes((const byte*) k.frames, k.depth * sizeof(word),
+                      k.depth);
+}
+
+// ----------------------------------------------------------------------------
+bool stack_key_equal::operator()(const stack_key& a,
+                                 const stack_key& b) const {
+    return a.depth == b.depth &&
+        memcmp(a.frames, b.frames, a.depth * sizeof(word)) == 0;
+}
+
+// ----------------------------------------------------------------------------
+stack_samples::stack_samples() : total(0) {
+}
+
+// ----------------------------------------------------------------------------
+void stack_samples::record(const vmstate* state, word pc) {
+    /* `stack[]` holds return addresses; the 2NNN just before each names
+     * the routine that frame is in. A frame whose call has since been
+     * overwritten is named after its call site instead.
+     */
+    stack_key k;
+    unsigned int depth = state->sp < STACK_SIZE ? state->sp : STACK_SIZE;
+    for (unsigned int i = 0; i < depth; ++i) {
+        word site = state->stack[i] - 2;
+        c8opcode op = opcode_at(state, site);
+        k.frames[i] = (op & 0xF000) == 0x2000 ? op & 0x0FFF : site;
+    }
+    k.frames[depth] = pc;
+    k.depth = depth + 1;
+    ++counts[k];
+    ++total;
+}
+
+// ----------------------------------------------------------------------------
+void stack_samples::clear() {
+    counts.clear();
+    total = 0;
+}
+
+// ----------------------------------------------------------------------------
+qword stack_samples::get_total() {
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+unsigned long stack_samples::get_distinct() {
+    return counts.size();
+}
+
+// ----------------------------------------------------------------------------
+void stack_samples::write_folded(std::ostream& out) {
+    /* one line per distinct stack, sorted, in the folded format that
+     * flamegraph.pl and friends read:
+     *
+     *   main;sub_2a0;sub_31c;0x0320 42
+     *
+     * `main` is the code outside any routine, and the last frame is the pc.
+     */
+    std::vector<std::string> lines;
+    for (std::unordered_map<stack_key, qword, stack_key_hash,
+                            stack_key_equal>::const_iterator it =
+            counts.begin(); it != counts.end(); ++it) {
+        std::ostringstream line;
+        line << "main" << std::hex << std::setfill('0');
+        for (unsigned int i = 0; i + 1 < it->first.depth; ++i)
+            line << ";sub_" << std::setw(3) << it->first.frames[i];
+        line << ";0x" << std::setw(4)
+            << it->first.frames[it->first.depth - 1] << " " << std::dec
+            << it->second;
+        lines.push_back(line.str());
+    }
+    std::sort(lines.begin(), lines.end());
+    for (unsigned int i = 0; i < lines.size(); ++i)
+        out << lines[i] << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+void profile_clear(vm_profile* profile, unsigned int interval) {
+    /* zero every count, and count every `interval`'th instruction from now
+     * on (1 for all of them). Stack sampling is off until `stacks` is set.
+     */
+    memset(profile->by_opcode, 0, sizeof(profile->by_opcode));
+    memset(profile->by_pc, 0, sizeof(profile->by_pc));
+    profile->counted   = 0;
+    profile->interval  = interval > 0 ? interval : 1;
+    profile->countdown = profile->interval;
+    profile->stacks    = NULL;
+}
+
+// ----------------------------------------------------------------------------
+void profile_report(const vm_profile* profile, const vmstate* state,
+                    unsigned int top, std::ostream& out) {
+    /* handler classes, then the `top` busiest addresses (with the opcode
+     * now at each, from `state`), busiest first
+     */
+    qword total = profile->counted * profile->interval;
+    std::vector<profile_row> classes, addrs;
+    class_rows(profile, state, classes);
+    address_rows(profile, addrs);
+    std::ios::fmtflags flags = out.flags();
+    out << std::dec << "instructions: " << total;
+    if (profile->interval > 1)
+        out << " (sampled 1 in " << profile->interval << ")";
+    out << std::endl << std::fixed << std::setprecision(2)
+        << std::endl << "  " << std::left << std::setw(26) << "handler"
+        << std::right << std::setw(14) << "count" << std::setw(9) << "%"
+        << std::endl;
+    for (unsigned int i = 0; i < classes.size(); ++i) {
+        out << "  " << std::left << std::setw(26)
+            << iset::op_name((iset::op_class) classes[i].key) << std::right
+            << std::setw(14) << classes[i].count << std::setw(9)
+            << 100.0 * classes[i].count / total << std::endl;
+    }
+    out << std::endl << "  addr  opcode  " << std::left << std::setw(24)
+        << "handler" << std::right << std::setw(14) << "count"
+        << std::setw(9) << "%" << std::endl;
+    for (unsigned int i = 0; i < addrs.size() && i < top; ++i) {
+        c8opcode op = opcode_at(state, addrs[i].key);
+        out << "  " << std::hex << std::setfill('0') << std::setw(4)
+            << addrs[i].key << "  " << std::setw(4) << op << std::dec
+            << std::setfill(' ') << "    " << std::left << std::setw(24)
+            << iset::op_name(iset::classify(op, state->mode)) << std::right
+            << std::setw(14) << addrs[i].count << std::setw(9)
+            << 100.0 * addrs[i].count / total << std::endl;
+    }
+    out.flags(flags);
+}
+
+// ----------------------------------------------------------------------------
+void profile_json(const vm_profile* profile, const vmstate* state,
+                  std::ostream& out) {
+    /* the same, as one JSON object, with every executed address:
+     *
+     *   {"interval": 1, "instructions": 1234,
+     *    "handlers": [{"name": "jump", "count": 600}, ...],
+     *    "addresses": [{"addr": 518, "opcode": 4614, "count": 600}, ...]}
+     */
+    std::vector<profile_row> classes, addrs;
+    class_rows(profile, state, classes);
+    address_rows(profile, addrs);
+    std::ios::fmtflags flags = out.flags();
+    out << std::dec << "{\"interval\": " << profile->interval
+        << ", \"instructions\": " << profile->counted * profile->interval
+        << "," << std::endl << " \"handlers\": [";
+    for (unsigned int i = 0; i < classes.size(); ++i) {
+        out << (i ? ", " : "") << "{\"name\": \""
+            << iset::op_name((iset::op_class) classes[i].key)
+            << "\", \"count\": " << classes[i].count << "}";
+    }
+    out << "]," << std::endl << " \"addresses\": [";
+    for (unsigned int i = 0; i < addrs.size(); ++i) {
+        out << (i ? "," : "") << std::endl << "  {\"addr\": " << addrs[i].key
+            << ", \"opcode\": " << opcode_at(state, addrs[i].key)
+            << ", \"count\": " << addrs[i].count << "}";
+    }
+    out << "]}" << std::endl;
+    out.flags(flags);
+}
@@ -0,0 +1,102 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "def.h"
+#include <ostream>
+#include <unordered_map>
+
+/* Execution profile: how often each opcode, and each guest address, was
+ * executed. Counting is a policy of the interpreter core (see
+ * `C8VM::set_profile`): the core is instantiated once per policy, so with
+ * profiling off `profile_off::count` is an empty inline and the counting
+ * compiles away entirely.
+ *
+ * Opcodes are counted whole and only grouped into handler classes when
+ * reporting, which keeps the hot path to two increments. With `interval`
+ * above 1 only every interval'th instruction is counted; the report scales
+ * such samples back up.
+ *
+ * While profiling, idle loops are run rather than skipped, so that the
+ * counts reflect every instruction the guest executed. Instructions are
+ * counted as they are fetched, so frames blocked in FX0A don't show.
+ *
+ * With `stacks` set, each counted instruction also samples the guest call
+ * stack (the routines `stack[]` returns into, and the pc), aggregated per
+ * distinct stack and written out as folded stacks for flame graph tools.
+ * Sampling goes by instruction count, so it is deterministic: the same ROM
+ * and input give the same samples.
+ */
+// prime, so that sampling doesn't lock step with a loop
+const unsigned int PROFILE_STACK_INTERVAL = 97;
+
+// a sampled guest stack: the entry point of each active routine, outermost
+// first, then the pc
+typedef struct stack_key {
+    word depth;
+    word frames[STACK_SIZE + 1];
+} stack_key;
+
+struct stack_key_hash {
+    size_t operator()(const stack_key& k) const;
+};
+
+struct stack_key_equal {
+    bool operator()(const stack_key& a, const stack_key& b) const;
+};
+
+class stack_samples {
+    std::unordered_map<stack_key, qword, stack_key_hash, stack_key_equal>
+        counts;
+    qword total;
+
+    public:
+    stack_samples();
+    void record(const vmstate* state, word pc);
+    void clear();
+    qword get_total();
+    unsigned long get_distinct();
+    void write_folded(std::ostream& out);
+};
+
+typedef struct vm_profile {
+    qword by_opcode[0x10000];     // executions of each opcode
+    qword by_pc[XO_MEM_SIZE];     // executions at each address
+    qword counted;                // sum of either array
+    unsigned int interval;        // count every interval'th instruction
+    unsigned int countdown;
+    stack_samples* stacks;        // NULL not to sample stacks
+} vm_profile;
+
+struct profile_off {
+    static const bool enabled = false;
+    static void count(vm_profile*, const vmstate*, word) {}
+};
+
+struct profile_every {
+    static const bool enabled = true;
+    static void count(vm_profile* p, const vmstate* state, word pc) {
+        ++p->by_opcode[state->curr_opcode];
+        ++p->by_pc[pc];
+        ++p->counted;
+        if (p->stacks)
+            p->stacks->record(state, pc);
+    }
+};
+
+struct profile_sampled {
+    static const bool enabled = true;
+    static void count(vm_profile* p, const vmstate* state, word pc) {
+        if (--p->countdown != 0)
+            return;
+        p->countdown = p->interval;
+        profile_every::count(p, state, pc);
+    }
+};
+
+void profile_clear(vm_profile* profile, unsigned int interval);
+void profile_report(const vm_profile* profile, const vmstate* state,
+                    unsigned int top, std::ostream& out);
+void profile_json(const vm_profile* profile, const vmstate* state,
+                  std::ostream& out);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __QUIRKS_H__
+#define __QUIRKS_H__
+
+/* Quirk profiles: the places where CHIP-8 interpreters disagree, and which
+ * ROMs end up depending on. Each profile is a set of compile time
+ * constants; the interpreter core is instantiated once per profile, so the
+ * choice costs nothing per instruction.
+ *
+ *     shift_vy          8XY6/8XYE shift VY into VX (else VX in place)
+ *     load_store_inc_i  FX55/FX65 leave I pointing past the last register
+ *     jump_vx           BXNN jumps to XNN + VX (else BNNN to NNN + V0)
+ *     wrap_sprites      sprites wrap around the screen edges (else clip)
+ */
+typedef struct quirks_vip {         // the original COSMAC VIP interpreter
+    static const bool shift_vy         = true;
+    static const bool load_store_inc_i = true;
+    static const bool jump_vx          = false;
+    static const bool wrap_sprites     = false;
+} quirks_vip;
+
+typedef struct quirks_schip {       // SUPER-CHIP 1.1 on the HP48
+    static const bool shift_vy         = false;
+    static const bool load_store_inc_i = false;
+    static const bool jump_vx          = true;
+    static const bool wrap_sprites     = false;
+} quirks_schip;
+
+typedef struct quirks_modern {      // Octo and XO-CHIP
+    static const bool shift_vy         = true;
+    static const bool load_store_inc_i = true;
+    static const bool jump_vx          = false;
+    static const bool wrap_sprites     = true;
+} quirks_modern;
+
+#endif
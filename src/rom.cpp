@@ -0,0 +1,155 @@
+#include "rom.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+rom_file::rom_file() : data(NULL), size(0) {
+}
+
+// ----------------------------------------------------------------------------
+rom_file::~rom_file() {
+    close();
+}
+
+// ----------------------------------------------------------------------------
+bool rom_file::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if (size > 0) {
+        void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return false;
+        }
+        data = (const byte*) p;
+    }
+    ::close(fd); // the mapping keeps its own reference to the file
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void rom_file::close() {
+    if (data)
+        munmap((void*) data, size);
+    data = NULL;
+    size = 0;
+}
+
+// ----------------------------------------------------------------------------
+const byte* rom_file::get_data() {
+    return data;
+}
+
+// ----------------------------------------------------------------------------
+unsigned long rom_file::get_size() {
+    return size;
+}
+
+// ----------------------------------------------------------------------------
+bool has_suffix(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// ----------------------------------------------------------------------------
+bool is_rom(const std::string& path) {
+    return has_suffix(path, ".ch8") || has_suffix(path, ".sc8") ||
+        has_suffix(path, ".xo8");
+}
+
+// ----------------------------------------------------------------------------
+bool list_roms(const std::string& dir, std::vector<std::string>& roms) {
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    std::vector<std::string> found;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        std::string file(ent->d_name);
+        if (is_rom(file))
+            found.push_back(dir + "/" + file);
+    }
+    closedir(d);
+    std::sort(found.begin(), found.end());
+    roms.insert(roms.end(), found.begin(), found.end());
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void find_roms(const std::string& path, std::vector<std::string>& roms) {
+    if (!list_roms(path, roms))
+        roms.push_back(path);
+}
+
+// ----------------------------------------------------------------------------
+void read_keys(const std::string& path, std::vector<script_event>& events) {
+    std::ifstream infs(path.c_str());
+    std::string line;
+    while (std::getline(infs, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream ls(line);
+        script_event e;
+        char kind;
+        unsigned int key;
+        if (!(ls >> e.frame >> kind >> std::hex >> key))
+            continue;
+        e.key  = key & 0xF;
+        e.down = kind == 'd';
+        events.push_back(e);
+    }
+    std::stable_sort(events.begin(), events.end(),
+            [](const script_event& a, const script_event& b) {
+                return a.frame < b.frame;
+            });
+}
+
+// ----------------------------------------------------------------------------
+machine_mode mode_for_rom(const std::string& path) {
+    if (has_suffix(path, ".sc8"))
+        return mode_schip;
+    if (has_suffix(path, ".xo8"))
+        return mode_xochip;
+    return mode_chip8;
+}
+
+// ----------------------------------------------------------------------------
+bool parse_mode(const std::string& name, machine_mode* mode) {
+    if (name == "chip8")
+        *mode = mode_chip8;
+    else if (name == "schip")
+        *mode = mode_schip;
+    else if (name == "xochip")
+        *mode = mode_xochip;
+    else
+        return false;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool parse_quirks(const std::string& name, quirk_profile* profile) {
+    if (name == "vip")
+        *profile = profile_vip;
+    else if (name == "schip")
+        *profile = profile_schip;
+    else if (name == "modern")
+        *profile = profile_modern;
+    else
+        return false;
+    return true;
+}
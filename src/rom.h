@@ -0,0 +1,54 @@
+#ifndef __ROM_H__
+#define __ROM_H__
+
+#include "def.h"
+#include <string>
+#include <vector>
+
+/* A ROM file mapped read-only into memory, so it can be handed straight to
+ * `C8VM::load` without being read or copied first. The mapping lives as
+ * long as the rom_file does.
+ */
+class rom_file {
+    const byte* data;
+    unsigned long size;
+
+    public:
+    rom_file();
+    ~rom_file();
+    bool open(const std::string& path);
+    void close();
+    const byte* get_data();
+    unsigned long get_size();
+
+    private:
+    rom_file(const rom_file&);            // not copyable: owns the mapping
+    rom_file& operator=(const rom_file&);
+};
+
+// a key press or release scripted for the start of `frame`
+typedef struct script_event {
+    long frame;
+    byte key;
+    bool down;
+} script_event;
+
+bool has_suffix(const std::string& s, const std::string& suffix);
+// .ch8, .sc8 or .xo8
+bool is_rom(const std::string& path);
+// every ROM in `dir`, sorted by name; false if `dir` can't be opened
+bool list_roms(const std::string& dir, std::vector<std::string>& roms);
+// `path` itself, or every ROM in it if it is a directory
+void find_roms(const std::string& path, std::vector<std::string>& roms);
+// a .keys script, one "<frame> <d|u> <key (hex)>" per line, sorted by frame;
+// lines starting with '#' are skipped, and a missing file is an empty script
+void read_keys(const std::string& path, std::vector<script_event>& events);
+// machine variant from the usual file extensions: .sc8 is SUPER-CHIP, .xo8
+// is XO-CHIP, anything else classic CHIP-8
+machine_mode mode_for_rom(const std::string& path);
+// parse "chip8", "schip" or "xochip"
+bool parse_mode(const std::string& name, machine_mode* mode);
+// parse "vip", "schip" or "modern"
+bool parse_quirks(const std::string& name, quirk_profile* profile);
+
+#endif
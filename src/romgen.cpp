@@ -0,0 +1,323 @@
+#include "romgen.h"
+#include "c8.h"
+#include "hash.h"
+#include <vector>
+#include <string.h>
+#include "stdlib.h"
+
+static const char* kind_names[num_romgen_kinds] = {
+    "alu", "branch", "call", "draw", "memory", "smc", "timer"
+};
+
+// largest group, in bytes: a forward jump over three alu instructions
+static const unsigned int MAX_GROUP_SIZE = 8;
+
+typedef struct romgen {
+    const romgen_shape* shape;
+    qword rng;
+    std::vector<byte> code;
+    std::vector<unsigned int> calls;  // offsets of 2NNN to patch
+    unsigned int total;               // sum of weights
+} romgen;
+
+// ----------------------------------------------------------------------------
+static qword next(romgen& g) {
+    // xorshift64*, so a seed gives the same program on every platform
+    g.rng ^= g.rng >> 12;
+    g.rng ^= g.rng << 25;
+    g.rng ^= g.rng >> 27;
+    return g.rng * 0x2545F4914F6CDD1DULL;
+}
+
+// ----------------------------------------------------------------------------
+static unsigned int pick(romgen& g, unsigned int n) {
+    return (unsigned int) ((next(g) >> 32) % n);
+}
+
+// ----------------------------------------------------------------------------
+static word here(const romgen& g) {
+    return PROG_START + g.code.size();
+}
+
+// ----------------------------------------------------------------------------
+static void emit(romgen& g, c8opcode op) {
+    g.code.push_back(op >> 8);
+    g.code.push_back(op & 0xFF);
+}
+
+// ----------------------------------------------------------------------------
+static void emit_alu(romgen& g) {
+    static const c8opcode ops[] = {
+        0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006, 0x8007,
+        0x800E
+    };
+    unsigned int x = pick(g, 16), y = pick(g, 16);
+    switch (pick(g, 4)) {
+        case 0:
+            emit(g, 0x6000 | x << 8 | pick(g, 256));
+            break;
+        case 1:
+            emit(g, 0x7000 | x << 8 | pick(g, 256));
+            break;
+        default:
+            emit(g, ops[pick(g, 9)] | x << 8 | y << 4);
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void emit_branch(romgen& g) {
+    unsigned int x = pick(g, 16), y = pick(g, 16);
+    switch (pick(g, 7)) {
+        case 0: emit(g, 0x3000 | x << 8 | pick(g, 256)); break;
+        case 1: emit(g, 0x4000 | x << 8 | pick(g, 256)); break;
+        case 2: emit(g, 0x5000 | x << 8 | y << 4); break;
+        case 3: emit(g, 0x9000 | x << 8 | y << 4); break;
+        case 4: emit(g, 0xE09E | x << 8); break;
+        case 5: emit(g, 0xE0A1 | x << 8); break;
+        default: {
+            // forward over 1-3 instructions
+            unsigned int n = 1 + pick(g, 3);
+            emit(g, 0x1000 | (here(g) + 2 + 2 * n));
+            for (unsigned int i = 0; i < n; ++i)
+                emit_alu(g);
+            return;
+        }
+    }
+    emit_alu(g); // the instruction a skip may pass over
+}
+
+// ----------------------------------------------------------------------------
+static void emit_draw(romgen& g) {
+    unsigned int x = pick(g, 16), y = pick(g, 16);
+    unsigned int r = pick(g, 16);
+    if (r == 0) {
+        emit(g, 0x00E0);
+        return;
+    }
+    if (r < 8)
+        emit(g, 0xF029 | x << 8);  // a font digit
+    else
+        emit(g, 0xA000 | (ROMGEN_SCRATCH + pick(g, 0x100)));
+    emit(g, 0xD000 | x << 8 | y << 4 | (1 + pick(g, 15)));
+}
+
+// ----------------------------------------------------------------------------
+static void emit_memory(romgen& g) {
+    unsigned int x = pick(g, 16);
+    emit(g, 0xA000 | (ROMGEN_SCRATCH + pick(g, 0x100)));
+    switch (pick(g, 4)) {
+        case 0:
+            emit(g, 0xF033 | x << 8);
+            break;
+        case 1:
+            emit(g, 0xF055 | x << 8);
+            break;
+        case 2:
+            emit(g, 0xF065 | x << 8);
+            break;
+        default:
+            emit(g, 0xF01E | x << 8);
+            emit(g, 0xF065 | pick(g, 4) << 8);
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void emit_smc(romgen& g) {
+    /* store V0 into the operand of a 6XNN two instructions on, so what that
+     * instruction loads depends on what ran before it
+     */
+    emit(g, 0xA000 | (here(g) + 5));
+    emit(g, 0xF055);
+    emit(g, 0x6000 | pick(g, 16) << 8 | pick(g, 256));
+}
+
+// ----------------------------------------------------------------------------
+static void emit_timer(romgen& g) {
+    unsigned int x = pick(g, 16);
+    switch (pick(g, 4)) {
+        case 0: emit(g, 0xF007 | x << 8); break;
+        case 1: emit(g, 0xF015 | x << 8); break;
+        case 2: emit(g, 0xF018 | x << 8); break;
+        default: emit(g, 0xC000 | x << 8 | pick(g, 256)); break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void emit_group(romgen& g, bool calls) {
+    unsigned int r = pick(g, g.total);
+    unsigned int kind = 0;
+    while (r >= g.shape->weights[kind])
+        r -= g.shape->weights[kind++];
+    switch (kind) {
+        case gen_alu:    emit_alu(g); break;
+        case gen_branch: emit_branch(g); break;
+        case gen_draw:   emit_draw(g); break;
+        case gen_memory: emit_memory(g); break;
+        case gen_smc:    emit_smc(g); break;
+        case gen_timer:  emit_timer(g); break;
+        case gen_call:
+            if (calls) {
+                g.calls.push_back(g.code.size());
+                emit(g, 0x2000);
+            } else {
+                emit_alu(g);
+            }
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool romgen_preset(const std::string& name, romgen_shape* shape) {
+    /* named shapes, each stressing one part of the interpreter (bar
+     * `mixed`):
+     *
+     *     mixed    a bit of everything
+     *     decode   register arithmetic and skips: fetch and dispatch
+     *     branch   skips and jumps
+     *     calls    2NNN/00EE down a full depth stack
+     *     draw     sprite drawing
+     *     memory   loads and stores through I
+     *     smc      self-modifying stores into the code
+     */
+    static const struct {
+        const char* name;
+        unsigned int weights[num_romgen_kinds];
+        unsigned int call_depth;
+    } presets[] = {
+        //             alu br  call draw mem smc timer
+        { "mixed",  { 40, 15,  5,  10,  15,  5, 10 },  4 },
+        { "decode", { 70, 20,  0,   0,   0,  0, 10 },  0 },
+        { "branch", { 20, 80,  0,   0,   0,  0,  0 },  0 },
+        { "calls",  { 50,  0, 50,   0,   0,  0,  0 }, STACK_SIZE },
+        { "draw",   { 20,  0,  0,  80,   0,  0,  0 },  0 },
+        { "memory", { 20,  0,  0,   0,  80,  0,  0 },  0 },
+        { "smc",    { 40,  0,  0,   0,   0, 60,  0 },  0 },
+    };
+    for (unsigned int i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i) {
+        if (name != presets[i].name)
+            continue;
+        memcpy(shape->weights, presets[i].weights, sizeof(shape->weights));
+        shape->length         = 256;
+        shape->call_depth     = presets[i].call_depth;
+        shape->routine_length = 8;
+        return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+bool romgen_parse_weights(const std::string& spec, romgen_shape* shape) {
+    /* "alu:60,draw:30,smc:10": every kind not listed gets weight 0
+     */
+    unsigned int weights[num_romgen_kinds] = { 0 }, total = 0;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos)
+            return false;
+        std::string name = item.substr(0, colon);
+        unsigned int kind = 0;
+        while (kind < num_romgen_kinds && name != kind_names[kind])
+            ++kind;
+        if (kind == num_romgen_kinds)
+            return false;
+        weights[kind] = atoi(item.c_str() + colon + 1);
+        total += weights[kind];
+        pos = end + 1;
+    }
+    if (total == 0)
+        return false;
+    memcpy(shape->weights, weights, sizeof(weights));
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+const char* romgen_kind_name(romgen_kind kind) {
+    return kind < num_romgen_kinds ? kind_names[kind] : "invalid";
+}
+
+// ----------------------------------------------------------------------------
+static long routines_size(const romgen_shape& shape) {
+    // the most the call chain can take, each routine ending in 2NNN 00EE
+    long depth = shape.call_depth < STACK_SIZE ? shape.call_depth
+                                               : STACK_SIZE;
+    return depth * ((long) shape.routine_length * MAX_GROUP_SIZE + 4);
+}
+
+// ----------------------------------------------------------------------------
+bool romgen_fits(const romgen_shape& shape) {
+    // the routines, and the main loop's jump back, fit below the scratch
+    return routines_size(shape) + 2 <= (long) ROMGEN_SCRATCH - PROG_START;
+}
+
+// ----------------------------------------------------------------------------
+std::string romgen_generate(const romgen_shape& shape, qword seed) {
+    /* the program for `shape` and `seed`: the main loop at PROG_START, then
+     * the routines. The main loop is cut short if the program would not
+     * fit below ROMGEN_SCRATCH; "" if the routines alone don't (see
+     * `romgen_fits`).
+     */
+    romgen g;
+    g.shape = &shape;
+    g.rng   = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (g.rng == 0)
+        g.rng = 1;
+    g.total = 0;
+    for (unsigned int k = 0; k < num_romgen_kinds; ++k)
+        g.total += shape.weights[k];
+    if (g.total == 0 || !romgen_fits(shape))
+        return std::string();
+    unsigned int depth = shape.call_depth < STACK_SIZE ? shape.call_depth
+                                                       : STACK_SIZE;
+    long room = (long) ROMGEN_SCRATCH - PROG_START - routines_size(shape) - 2;
+
+    for (unsigned int i = 0; i < shape.length; ++i) {
+        if ((long) (g.code.size() + MAX_GROUP_SIZE) > room)
+            break;
+        emit_group(g, depth > 0);
+    }
+    emit(g, 0x1000 | PROG_START);
+
+    // each routine calls the next, so the chain is `depth` frames deep
+    std::vector<unsigned int> main_calls = g.calls;
+    word first = here(g);
+    for (unsigned int r = 0; r < depth; ++r) {
+        for (unsigned int i = 0; i < shape.routine_length; ++i)
+            emit_group(g, false);
+        if (r + 1 < depth)
+            emit(g, 0x2000 | (here(g) + 4));
+        emit(g, 0x00EE);
+    }
+    for (unsigned int i = 0; i < main_calls.size(); ++i) {
+        g.code[main_calls[i]]     = 0x20 | first >> 8;
+        g.code[main_calls[i] + 1] = first & 0xFF;
+    }
+    return std::string((const char*) &g.code[0], g.code.size());
+}
+
+// ----------------------------------------------------------------------------
+bool romgen_reference(const std::string& rom, long cycles, qword* hash) {
+    /* run `rom` as CHIP-8 with the default quirks for `cycles` instructions
+     * and hash the final state; false if it would not load or stopped early
+     */
+    C8VM vm;
+    vm.set_mode(mode_chip8);
+    if (!vm.load(rom))
+        return false;
+    vm.start();
+    long done = 0;
+    while (done < cycles) {
+        stop_reason r = vm.run(cycles - done, 0);
+        done += r.cycles;
+        if (r.kind == stop_fault || r.kind == stop_halted)
+            return false;
+    }
+    *hash = hash_state(vm.get_state());
+    return true;
+}
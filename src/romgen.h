@@ -0,0 +1,50 @@
+#ifndef __ROMGEN_H__
+#define __ROMGEN_H__
+
+#include "def.h"
+#include <string>
+
+/* Synthetic CHIP-8 programs, for benchmarking one part of the interpreter
+ * at a time with a known mix of instructions.
+ *
+ * A program is a main loop of `length` instruction groups, picked at random
+ * by `weights`, followed by a chain of `call_depth` subroutines, each
+ * calling the next. A group is a short run of instructions that is valid
+ * wherever it lands:
+ *
+ *     alu      6XNN, 7XNN, 8XY0-8XY7, 8XYE
+ *     branch   a skip (3XNN, 4XNN, 5XY0, 9XY0, EX9E, EXA1) over one alu
+ *              instruction, or a 1NNN forward over a few
+ *     call     2NNN into the first routine, so the stack reaches
+ *              `call_depth` (at most STACK_SIZE)
+ *     draw     ANNN or FX29, then DXYN; now and then 00E0
+ *     memory   ANNN into the scratch area, then FX33, FX55 or FX65
+ *     smc      FX55 over the operand of a 6XNN further on: self-modifying
+ *     timer    FX07, FX15, FX18, CXNN
+ *
+ * Memory writes only go to the scratch area above the code (or, for smc,
+ * to its own target), so programs never fault, block or halt, and run
+ * forever. The same shape and seed always give the same bytes.
+ */
+enum romgen_kind {
+    gen_alu, gen_branch, gen_call, gen_draw, gen_memory, gen_smc, gen_timer,
+    num_romgen_kinds
+};
+
+const word ROMGEN_SCRATCH = 0xE00;  // code stays below, data above
+
+typedef struct romgen_shape {
+    unsigned int weights[num_romgen_kinds]; // relative frequency per group
+    unsigned int length;          // groups in the main loop
+    unsigned int call_depth;      // routines in the call chain
+    unsigned int routine_length;  // groups in each routine
+} romgen_shape;
+
+bool romgen_preset(const std::string& name, romgen_shape* shape);
+bool romgen_parse_weights(const std::string& spec, romgen_shape* shape);
+const char* romgen_kind_name(romgen_kind kind);
+bool romgen_fits(const romgen_shape& shape);
+std::string romgen_generate(const romgen_shape& shape, qword seed);
+bool romgen_reference(const std::string& rom, long cycles, qword* hash);
+
+#endif
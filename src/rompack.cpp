@@ -0,0 +1,253 @@
+#include "rompack.h"
+#include "hash.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+static_assert(sizeof(pack_header) == 72, "pack_header is an on-disk format");
+static_assert(sizeof(pack_entry)  == 40, "pack_entry is an on-disk format");
+
+// ----------------------------------------------------------------------------
+static qword name_hash(const char* name, unsigned int len) {
+    return hash_bytes((const byte*) name, len, PACK_NAME_SEED);
+}
+
+// ----------------------------------------------------------------------------
+static uint64_t align_page(uint64_t off) {
+    return (off + PACK_PAGE - 1) & ~(uint64_t) (PACK_PAGE - 1);
+}
+
+// ----------------------------------------------------------------------------
+static void insert_slot(std::vector<uint32_t>& slots, qword h, uint32_t entry) {
+    uint32_t mask = slots.size() - 1;
+    for (uint32_t i = h & mask; ; i = (i + 1) & mask) {
+        if (slots[i] == 0) {
+            slots[i] = entry + 1;
+            return;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool write_rom_pack(const std::string& path,
+        const std::vector<pack_input>& roms) {
+    /* order the ROMs by (content hash, name), lay the tables out, then give
+     * each distinct payload its own page
+     */
+    std::vector<std::pair<std::pair<qword, std::string>, unsigned int> > order;
+    for (unsigned int i = 0; i < roms.size(); ++i) {
+        qword h = hash_bytes((const byte*) roms[i].data.data(),
+                             roms[i].data.size(), 0);
+        order.push_back(std::make_pair(std::make_pair(h, roms[i].name), i));
+    }
+    std::sort(order.begin(), order.end());
+
+    pack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.count   = order.size();
+    header.slots   = 1;
+    while (header.slots < 2 * header.count)
+        header.slots <<= 1;
+    header.entries_off    = sizeof(pack_header);
+    header.name_slots_off = header.entries_off +
+                            header.count * sizeof(pack_entry);
+    header.hash_slots_off = header.name_slots_off +
+                            header.slots * sizeof(uint32_t);
+    header.names_off      = header.hash_slots_off +
+                            header.slots * sizeof(uint32_t);
+
+    std::vector<pack_entry> entries(header.count);
+    std::vector<uint32_t> name_slots(header.slots, 0), hash_slots(header.slots, 0);
+    std::string names;
+    std::vector<unsigned int> payloads; // index into `roms` of each page
+    std::map<std::string, uint64_t> placed; // payload -> page offset
+    uint64_t names_len = 0;
+    for (unsigned int i = 0; i < order.size(); ++i)
+        names_len += roms[order[i].second].name.size();
+    header.data_off = align_page(header.names_off + names_len);
+
+    uint64_t data_end = header.data_off;
+    for (unsigned int i = 0; i < order.size(); ++i) {
+        const pack_input& rom = roms[order[i].second];
+        pack_entry& e = entries[i];
+        memset(&e, 0, sizeof(e));
+        e.hash      = order[i].first.first;
+        e.name_hash = name_hash(rom.name.data(), rom.name.size());
+        e.size      = rom.data.size();
+        e.name_off  = names.size();
+        e.name_len  = rom.name.size();
+        e.mode      = rom.mode;
+        names += rom.name;
+
+        std::map<std::string, uint64_t>::iterator p = placed.find(rom.data);
+        if (p == placed.end()) {
+            e.data_off = data_end;
+            placed[rom.data] = data_end;
+            payloads.push_back(order[i].second);
+            data_end = align_page(data_end + rom.data.size());
+        } else {
+            e.data_off = p->second;
+        }
+        insert_slot(name_slots, e.name_hash, i);
+        // entries are hash ordered, so the first of a run of duplicates wins
+        if (i == 0 || entries[i - 1].hash != e.hash)
+            insert_slot(hash_slots, e.hash, i);
+    }
+    header.file_size = data_end;
+
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out)
+        return false;
+    out.write((const char*) &header, sizeof(header));
+    if (!entries.empty())
+        out.write((const char*) &entries[0],
+                  entries.size() * sizeof(pack_entry));
+    out.write((const char*) &name_slots[0], name_slots.size() * sizeof(uint32_t));
+    out.write((const char*) &hash_slots[0], hash_slots.size() * sizeof(uint32_t));
+    out.write(names.data(), names.size());
+    uint64_t pos = header.names_off + names.size();
+    for (unsigned int i = 0; i < payloads.size(); ++i) {
+        const std::string& data = roms[payloads[i]].data;
+        for (; pos < align_page(pos); ++pos)
+            out.put(0);
+        out.write(data.data(), data.size());
+        pos += data.size();
+    }
+    for (; pos < header.file_size; ++pos)
+        out.put(0);
+    return out.good();
+}
+
+// ----------------------------------------------------------------------------
+rom_pack::rom_pack() : base(NULL), size(0), header(NULL), entries(NULL),
+    name_slots(NULL), hash_slots(NULL) {
+}
+
+// ----------------------------------------------------------------------------
+rom_pack::~rom_pack() {
+    close();
+}
+
+// ----------------------------------------------------------------------------
+bool rom_pack::open(const std::string& path) {
+    /* map the whole pack and check the header; nothing is read per ROM, so
+     * this costs the same for ten ROMs or a hundred thousand
+     */
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (unsigned long) st.st_size < sizeof(pack_header)) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    base = (const byte*) p;
+    size = st.st_size;
+
+    // offsets are checked against what's left after them, as an offset
+    // near 2^64 would wrap a sum past the check
+    const pack_header* h = (const pack_header*) base;
+    uint64_t slots_len = (uint64_t) h->slots * sizeof(uint32_t);
+    if (memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != PACK_VERSION || h->file_size != size ||
+        h->slots == 0 || (h->slots & (h->slots - 1)) != 0 ||
+        h->slots < 2 * (uint64_t) h->count ||
+        h->entries_off > size ||
+        (uint64_t) h->count * sizeof(pack_entry) > size - h->entries_off ||
+        h->name_slots_off > size || slots_len > size - h->name_slots_off ||
+        h->hash_slots_off > size || slots_len > size - h->hash_slots_off ||
+        h->data_off > size || h->names_off > h->data_off ||
+        h->entries_off % 8 != 0 || h->name_slots_off % 4 != 0 ||
+        h->hash_slots_off % 4 != 0) {
+        close();
+        return false;
+    }
+    header     = h;
+    entries    = (const pack_entry*) (base + h->entries_off);
+    name_slots = (const uint32_t*) (base + h->name_slots_off);
+    hash_slots = (const uint32_t*) (base + h->hash_slots_off);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void rom_pack::close() {
+    if (base)
+        munmap((void*) base, size);
+    base       = NULL;
+    size       = 0;
+    header     = NULL;
+    entries    = NULL;
+    name_slots = NULL;
+    hash_slots = NULL;
+}
+
+// ----------------------------------------------------------------------------
+unsigned int rom_pack::get_count() {
+    return header ? header->count : 0;
+}
+
+// ----------------------------------------------------------------------------
+bool rom_pack::get(unsigned int i, rom_span* out) {
+    if (!header || i >= header->count)
+        return false;
+    const pack_entry& e = entries[i];
+    uint64_t names_len = header->data_off - header->names_off;
+    if (e.data_off > size || e.size > size - e.data_off ||
+        e.name_off > names_len || e.name_len > names_len - e.name_off ||
+        e.mode > mode_xochip)
+        return false; // corrupt entry
+    out->data     = base + e.data_off;
+    out->size     = e.size;
+    out->name     = (const char*) (base + header->names_off + e.name_off);
+    out->name_len = e.name_len;
+    out->hash     = e.hash;
+    out->mode     = (machine_mode) e.mode;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool rom_pack::find(const std::string& name, rom_span* out) {
+    if (!header)
+        return false;
+    qword h = name_hash(name.data(), name.size());
+    uint32_t mask = header->slots - 1;
+    for (uint32_t i = h & mask, probes = 0; probes < header->slots;
+            i = (i + 1) & mask, ++probes) {
+        uint32_t slot = name_slots[i];
+        if (slot == 0 || slot > header->count)
+            return false;
+        if (entries[slot - 1].name_hash == h && get(slot - 1, out) &&
+            out->name_len == name.size() &&
+            memcmp(out->name, name.data(), name.size()) == 0)
+            return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+bool rom_pack::find_hash(qword hash, rom_span* out) {
+    if (!header)
+        return false;
+    uint32_t mask = header->slots - 1;
+    for (uint32_t i = hash & mask, probes = 0; probes < header->slots;
+            i = (i + 1) & mask, ++probes) {
+        uint32_t slot = hash_slots[i];
+        if (slot == 0 || slot > header->count)
+            return false;
+        if (entries[slot - 1].hash == hash)
+            return get(slot - 1, out);
+    }
+    return false;
+}
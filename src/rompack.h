@@ -0,0 +1,89 @@
+#ifndef __ROMPACK_H__
+#define __ROMPACK_H__
+
+#include "def.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* ROM pack: many ROMs in one file, so batch jobs open and map one file
+ * instead of tens of thousands.
+ *
+ *     header      pack_header, 72 bytes
+ *     entries     pack_entry[count], sorted by (content hash, name)
+ *     name slots  uint32_t[slots], open-addressed table: name hash -> entry
+ *     hash slots  uint32_t[slots], open-addressed table: content hash -> entry
+ *     names       the names, back to back (not NUL terminated)
+ *     data        ROM payloads, each starting on a PACK_PAGE boundary;
+ *                 identical ROMs share one payload
+ *
+ * Each entry records the machine mode its ROM is for (0, CHIP-8, in packs
+ * from before there were modes), for loaders to `set_mode` before `load`.
+ *
+ * Slots hold entry index + 1 (0 is empty); `slots` is a power of two at
+ * least twice `count`, so lookups probe ~1 slot. Structures are written
+ * as-is, so packs are little endian and only portable between little
+ * endian hosts. Opening a pack only checks the header and table extents;
+ * entries are bounds checked as they're looked up.
+ */
+const char         PACK_MAGIC[8] = { 'C', '8', 'V', 'M', 'P', 'A', 'C', 'K' };
+const uint32_t     PACK_VERSION  = 1;
+const unsigned int PACK_PAGE     = 4096;
+const qword        PACK_NAME_SEED = 0x6E616D65ULL; // "name"
+
+typedef struct pack_header {
+    char magic[8];
+    uint32_t version, count, slots, reserved;
+    uint64_t entries_off, name_slots_off, hash_slots_off, names_off,
+             data_off, file_size;
+} pack_header;
+
+typedef struct pack_entry {
+    uint64_t hash, name_hash;   // hash_bytes of the ROM / of its name
+    uint64_t data_off;
+    uint32_t size, name_off, name_len;
+    uint32_t mode;              // machine_mode to load it in
+} pack_entry;
+
+// a ROM inside a mapped pack; valid while the pack stays open
+typedef struct rom_span {
+    const byte* data;
+    unsigned long size;
+    const char* name;           // not NUL terminated
+    unsigned int name_len;
+    qword hash;
+    machine_mode mode;
+} rom_span;
+
+// a ROM to be written into a pack
+typedef struct pack_input {
+    std::string name;
+    std::string data;
+    machine_mode mode;
+} pack_input;
+
+bool write_rom_pack(const std::string& path, const std::vector<pack_input>& roms);
+
+class rom_pack {
+    const byte* base;
+    unsigned long size;
+    const pack_header* header;
+    const pack_entry* entries;
+    const uint32_t *name_slots, *hash_slots;
+
+    public:
+    rom_pack();
+    ~rom_pack();
+    bool open(const std::string& path);
+    void close();
+    unsigned int get_count();
+    bool get(unsigned int i, rom_span* out);
+    bool find(const std::string& name, rom_span* out);
+    bool find_hash(qword hash, rom_span* out);
+
+    private:
+    rom_pack(const rom_pack&);            // not copyable: owns the mapping
+    rom_pack& operator=(const rom_pack&);
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "search.h"
+#include "hash.h"
+#include "hashset.h"
+#include "clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+/* Frontier states are kept packed: the `state_size` bytes of the vmstate in
+ * use, so about 6 KB rather than 68 outside XO-CHIP. Every state in a
+ * search has the root's memory size, so packed states are all one `stride`
+ * long (rounded up to keep each aligned) and a level is a flat array of
+ * them.
+ */
+typedef struct search_node {
+    unsigned int parent;    // node index; the root is its own parent
+    byte input;             // index into the inputs, that got here from it
+} search_node;
+
+typedef struct search_child {
+    unsigned int parent;    // frontier slot
+    byte input;
+    unsigned int worker;
+    size_t at;              // its packed state in the worker's `packed`
+    qword hash;             // its `hash_position`
+} search_child;
+
+typedef struct search_worker {
+    C8VM vm;
+    std::vector<byte> packed;
+    std::vector<search_child> children;
+    qword expanded, duplicates, dead;
+    bool found;
+    unsigned int found_parent;
+    byte found_input;
+} search_worker;
+
+// what every worker shares while a level is expanded
+typedef struct search_level {
+    const search_config* config;
+    const byte* frontier;
+    unsigned int width;
+    unsigned int mem_size;
+    size_t stride;
+    const concurrent_set* seen;         // every earlier level's, read only
+    std::atomic<unsigned int> next;     // frontier slot to expand next
+} search_level;
+
+/* The threads are started once per search and handed each level in turn:
+ * `search_run` bumps `generation` to start one, expands its own share on
+ * the calling thread, and waits for `busy` to come back to zero.
+ */
+typedef struct search_pool {
+    std::mutex lock;
+    std::condition_variable start, done;
+    unsigned int generation;    // levels handed out
+    unsigned int busy;          // threads still expanding this level
+    bool quit;
+    search_worker* workers;
+    search_level* level;
+} search_pool;
+
+// ----------------------------------------------------------------------------
+static void expand(search_worker* w, unsigned int id, search_level* level) {
+    /* take frontier states until there are none left, and run each input
+     * from each; keep the children no earlier level has seen. Children of
+     * this level are deduplicated afterwards, in order, by `search_run`.
+     */
+    const search_config& config = *level->config;
+    for (;;) {
+        unsigned int slot = level->next.fetch_add(1);
+        if (slot >= level->width)
+            break;
+        const byte* parent = level->frontier + slot * level->stride;
+        for (unsigned int i = 0; i < config.inputs.size(); ++i) {
+            w->vm.set_state((const vmstate*) parent);
+            vmstate* s = w->vm.edit_state();
+            for (unsigned int k = 0; k < KEY_SIZE; ++k)
+                s->key[k] = (config.inputs[i] >> k) & 0x1;
+            stop_reason r = w->vm.run(0, 1);
+            ++w->expanded;
+            const vmstate* child = w->vm.get_state();
+            if (r.kind == stop_fault || !child->on ||
+                child->mem_mask + 1u != level->mem_size) {
+                ++w->dead;
+                continue;
+            }
+            qword hash = hash_position(child);
+            if (level->seen->contains(hash)) {
+                ++w->duplicates;
+                continue;
+            }
+            if (config.have_goal && !w->found &&
+                goal_met(config.goal, child)) {
+                // this worker's first is its earliest in frontier order,
+                // and a position's first path is the one kept
+                w->found        = true;
+                w->found_parent = slot;
+                w->found_input  = i;
+            }
+            search_child c;
+            c.parent = slot;
+            c.input  = i;
+            c.worker = id;
+            c.hash   = hash;
+            c.at     = w->packed.size();
+            w->packed.resize(c.at + level->stride);
+            memcpy(&w->packed[c.at], child, state_size(child));
+            w->children.push_back(c);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void search_thread(search_pool* pool, unsigned int id) {
+    // expand every level handed out, until told to quit
+    unsigned int done_with = 0;
+    std::unique_lock<std::mutex> guard(pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == done_with)
+            pool->start.wait(guard);
+        if (pool->quit)
+            return;
+        done_with = pool->generation;
+        guard.unlock();
+        expand(&pool->workers[id], id, pool->level);
+        guard.lock();
+        if (--pool->busy == 0)
+            pool->done.notify_one();
+    }
+}
+
+// ----------------------------------------------------------------------------
+static bool child_before(const search_child& a, const search_child& b) {
+    return a.parent != b.parent ? a.parent < b.parent : a.input < b.input;
+}
+
+// ----------------------------------------------------------------------------
+void search_defaults(search_config* config) {
+    /* each key alone, up to an hour of frames; the widest levels packed
+     * are about 100 MB outside XO-CHIP
+     */
+    config->inputs.clear();
+    for (unsigned int k = 0; k < KEY_SIZE; ++k)
+        config->inputs.push_back(1 << k);
+    config->max_depth  = 216000;
+    config->max_states = 1000000;
+    config->max_width  = 1024;
+    config->jobs       = std::thread::hardware_concurrency();
+    config->have_goal  = false;
+}
+
+// ----------------------------------------------------------------------------
+bool parse_goal(const std::string& spec, search_goal* goal) {
+    /* <addr>=<value> or <addr>>=<value>, or vX for register X; in hex
+     *
+     *     v3>=10      V3 at 0x10 or more
+     *     1f0=ff      the byte at 0x1F0 is 0xFF
+     */
+    const char* s = spec.c_str();
+    char* end;
+    goal->reg = s[0] == 'v' || s[0] == 'V';
+    if (goal->reg)
+        ++s;
+    unsigned long where = strtoul(s, &end, 16);
+    if (end == s || where > (goal->reg ? 0xFu : 0xFFFFu))
+        return false;
+    goal->where = (word) where;
+    if (end[0] == '>' && end[1] == '=') {
+        goal->exact = false;
+        end += 2;
+    } else if (end[0] == '=') {
+        goal->exact = true;
+        end += 1;
+    } else {
+        return false;
+    }
+    s = end;
+    unsigned long value = strtoul(s, &end, 16);
+    if (end == s || value > 0xFF || *end != '\0')
+        return false;
+    goal->value = (byte) value;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool parse_inputs(const std::string& spec, std::vector<word>* inputs) {
+    // key masks in hex, comma separated: "0,20,100" is nothing, 5 and 8
+    inputs->clear();
+    const char* s = spec.c_str();
+    for (;;) {
+        char* end;
+        unsigned long mask = strtoul(s, &end, 16);
+        if (end == s || mask > 0xFFFF ||
+            inputs->size() == SEARCH_MAX_INPUTS)
+            return false;
+        inputs->push_back((word) mask);
+        if (*end == '\0')
+            return true;
+        if (*end != ',')
+            return false;
+        s = end + 1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool goal_met(const search_goal& goal, const vmstate* state) {
+    byte v = goal.reg ? state->registers[goal.where & 0xF]
+                      : state->memory[goal.where & state->mem_mask];
+    return goal.exact ? v == goal.value : v >= goal.value;
+}
+
+// ----------------------------------------------------------------------------
+bool search_run(const vmstate* root, const search_config& config,
+                search_stats* stats, search_progress progress, void* arg) {
+    /* search from `root`, filling in `stats`; false if the configuration
+     * can't be run. `progress`, if set, is called after every level.
+     */
+    stats->expanded = stats->unique = stats->duplicates = 0;
+    stats->dead = stats->dropped = 0;
+    stats->depth = 0;
+    stats->ns = 0;
+    stats->found = false;
+    stats->path.clear();
+    if (config.inputs.empty() || config.inputs.size() > SEARCH_MAX_INPUTS ||
+        !config.max_width)
+        return false;
+    qword t0 = monotonic_ns();
+
+    search_level level;
+    level.config   = &config;
+    level.mem_size = root->mem_mask + 1;
+    level.stride   = state_size(root) + alignof(vmstate) - 1;
+    level.stride  -= level.stride % alignof(vmstate);
+    // room for every state kept, with the last level's overshoot, and for
+    // every child of a level, at most half full
+    concurrent_set seen(2 * ((qword) config.max_states + config.max_width));
+    concurrent_set fresh(2 * (qword) config.max_width * config.inputs.size());
+    level.seen = &seen;
+    seen.insert(hash_position(root));
+    stats->unique = 1;
+    if (config.have_goal && goal_met(config.goal, root)) {
+        stats->found = true;
+        stats->ns    = monotonic_ns() - t0;
+        return true;
+    }
+
+    std::vector<byte> frontier(level.stride);
+    memcpy(&frontier[0], root, state_size(root));
+    std::vector<unsigned int> frontier_nodes(1, 0);
+    std::vector<search_node> nodes(1);
+    nodes[0].parent = 0;
+    nodes[0].input  = 0;
+    unsigned int jobs = config.jobs ? config.jobs : 1;
+    // a vm's input queue is cache line aligned, which plain new doesn't
+    // honour
+    void* mem;
+    if (posix_memalign(&mem, 64, jobs * sizeof(search_worker)) != 0)
+        return false;
+    search_worker* workers = (search_worker*) mem;
+    for (unsigned int j = 0; j < jobs; ++j) {
+        new (&workers[j]) search_worker;
+        workers[j].vm.set_state(root);
+    }
+    search_pool pool;
+    pool.generation = 0;
+    pool.busy       = 0;
+    pool.quit       = false;
+    pool.workers    = workers;
+    pool.level      = &level;
+    std::vector<std::thread> threads;
+    for (unsigned int j = 1; j < jobs; ++j)
+        threads.push_back(std::thread(search_thread, &pool, j));
+
+    while (stats->depth < config.max_depth && !frontier_nodes.empty() &&
+           stats->unique < config.max_states) {
+        level.frontier = &frontier[0];
+        level.width    = frontier_nodes.size();
+        level.next     = 0;
+        for (unsigned int j = 0; j < jobs; ++j) {
+            search_worker* w = &workers[j];
+            w->packed.clear();
+            w->children.clear();
+            w->expanded = w->duplicates = w->dead = 0;
+            w->found = false;
+        }
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            ++pool.generation;
+            pool.busy = threads.size();
+        }
+        pool.start.notify_all();
+        expand(&workers[0], 0, &level);
+        {
+            std::unique_lock<std::mutex> guard(pool.lock);
+            while (pool.busy)
+                pool.done.wait(guard);
+        }
+
+        std::vector<search_child> children;
+        search_child goal = { 0, 0, 0, 0, 0 };
+        for (unsigned int j = 0; j < jobs; ++j) {
+            search_worker* w = &workers[j];
+            stats->expanded   += w->expanded;
+            stats->duplicates += w->duplicates;
+            stats->dead       += w->dead;
+            children.insert(children.end(), w->children.begin(),
+                            w->children.end());
+            if (w->found) {
+                search_child c;
+                c.parent = w->found_parent;
+                c.input  = w->found_input;
+                if (!stats->found || child_before(c, goal))
+                    goal = c;
+                stats->found = true;
+            }
+        }
+        ++stats->depth;
+        if (stats->found) {
+            stats->path.push_back(config.inputs[goal.input]);
+            for (unsigned int n = frontier_nodes[goal.parent]; n;
+                 n = nodes[n].parent)
+                stats->path.push_back(config.inputs[nodes[n].input]);
+            std::reverse(stats->path.begin(), stats->path.end());
+            break;
+        }
+
+        /* the next level, in frontier order whichever thread found what:
+         * the first path to each position is kept, and only the first
+         * `max_width` positions are marked seen, so one cut off here can
+         * still be reached at a later level
+         */
+        std::sort(children.begin(), children.end(), child_before);
+        fresh.clear();
+        std::vector<byte> next;
+        std::vector<unsigned int> next_nodes;
+        next.reserve(std::min<size_t>(children.size(), config.max_width) *
+                     level.stride);
+        for (size_t c = 0; c < children.size(); ++c) {
+            const search_child& child = children[c];
+            if (!fresh.insert(child.hash)) {
+                ++stats->duplicates;
+                continue;
+            }
+            if (next_nodes.size() == config.max_width) {
+                ++stats->dropped;
+                continue;
+            }
+            seen.insert(child.hash);
+            next.resize(next.size() + level.stride);
+            memcpy(&next[next.size() - level.stride],
+                   &workers[child.worker].packed[child.at], level.stride);
+            search_node node;
+            node.parent = frontier_nodes[child.parent];
+            node.input  = child.input;
+            next_nodes.push_back(nodes.size());
+            nodes.push_back(node);
+        }
+        stats->unique += next_nodes.size();
+        frontier.swap(next);
+        frontier_nodes.swap(next_nodes);
+        if (progress) {
+            stats->ns = monotonic_ns() - t0;
+            progress(*stats, frontier_nodes.size(), arg);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.quit = true;
+    }
+    pool.start.notify_all();
+    for (unsigned int j = 0; j < threads.size(); ++j)
+        threads[j].join();
+    for (unsigned int j = 0; j < jobs; ++j)
+        workers[j].~search_worker();
+    free(workers);
+    stats->ns = monotonic_ns() - t0;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+double states_per_second(const search_stats& stats) {
+    // frames run, that is states expanded into, per second
+    return stats.ns ? stats.expanded * 1e9 / stats.ns : 0.0;
+}
@@ -0,0 +1,72 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include "c8.h"
+#include <string>
+#include <vector>
+
+/* State-space search over inputs: which keys, held for which frames, get
+ * the guest to a goal (a score, a level, a register reaching a value).
+ *
+ * The search is breadth first, a frame per level. Every state on the
+ * frontier is expanded by loading it into a vm, holding each of the
+ * `inputs` (a key mask each, bit k for key k) for one frame, and running
+ * that frame. A child that faults or switches the vm off is a dead end.
+ * The rest are deduplicated on `hash_position` (see hash.h), which leaves
+ * out the cycle count and the keys held: against a concurrent_set (see
+ * hashset.h) of the positions kept at earlier levels, which the threads
+ * only read, and then against each other, in the order of their parents
+ * and inputs, keeping the first path to each. The first `max_width` make
+ * up the next level and join the set; a position cut off is not marked
+ * seen, so it can still be reached at a later level.
+ *
+ * Each level's frontier is split over `jobs` threads, started once per
+ * search, each with its own vm; as nothing a thread does decides what is
+ * kept, the search finds the same states and path however many there
+ * are. The search stops at the goal, at `max_depth` frames, or once
+ * `max_states` unique states have been seen, checked between levels.
+ */
+const unsigned int SEARCH_MAX_INPUTS = 16;
+
+typedef struct search_goal {
+    bool reg;           // a register, rather than a byte of memory
+    word where;         // the address or register number
+    bool exact;         // == value, rather than >= value
+    byte value;
+} search_goal;
+
+typedef struct search_config {
+    std::vector<word> inputs;   // at most SEARCH_MAX_INPUTS
+    unsigned int max_depth;
+    qword max_states;
+    unsigned int max_width;
+    unsigned int jobs;
+    bool have_goal;
+    search_goal goal;
+} search_config;
+
+typedef struct search_stats {
+    qword expanded;         // frames run: states expanded times inputs
+    qword unique;           // states kept, the root included
+    qword duplicates;
+    qword dead;
+    qword dropped;          // new positions past `max_width`
+    unsigned int depth;     // levels completed
+    qword ns;
+    bool found;
+    std::vector<word> path; // the inputs from the root to the goal
+} search_stats;
+
+// called after each level, e.g. to print progress
+typedef void (*search_progress)(const search_stats& stats,
+                                unsigned int width, void* arg);
+
+void search_defaults(search_config* config);
+bool parse_goal(const std::string& spec, search_goal* goal);
+bool parse_inputs(const std::string& spec, std::vector<word>* inputs);
+bool goal_met(const search_goal& goal, const vmstate* state);
+bool search_run(const vmstate* root, const search_config& config,
+                search_stats* stats, search_progress progress, void* arg);
+double states_per_second(const search_stats& stats);
+
+#endif
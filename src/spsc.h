@@ -0,0 +1,86 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <atomic>
+
+/* Bounded single-producer/single-consumer ring buffer.
+ *
+ * Exactly one thread may push and exactly one (possibly different) thread
+ * may pop. Neither side ever blocks, locks or allocates; `push` fails when
+ * the ring is full and `pop` fails when it is empty. N must be a power of
+ * two. head/tail are free-running counters (masked on access) kept on their
+ * own cache lines so the two sides don't false-share.
+ */
+template <typename T, unsigned int N>
+class spsc_queue {
+    static_assert((N & (N - 1)) == 0, "spsc_queue size must be a power of 2");
+
+    T buf[N];
+    alignas(64) std::atomic<unsigned int> head; // next slot to pop
+    alignas(64) std::atomic<unsigned int> tail; // next slot to push
+
+    public:
+    spsc_queue() : head(0), tail(0) {}
+
+    bool push(const T& v) {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        buf[t & (N - 1)] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool peek(T& v) {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        v = buf[h & (N - 1)];
+        return true;
+    }
+
+    bool pop(T& v) {
+        if (!peek(v))
+            return false;
+        head.store(head.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+        return true;
+    }
+
+    unsigned int push(const T* v, unsigned int n) {
+        // push up to n items in one go, returning how many fit
+        unsigned int t = tail.load(std::memory_order_relaxed),
+                     space = N - (t - head.load(std::memory_order_acquire));
+        if (n > space)
+            n = space;
+        for (unsigned int i = 0; i < n; ++i)
+            buf[(t + i) & (N - 1)] = v[i];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    unsigned int pop(T* v, unsigned int n) {
+        // pop up to n items in one go, returning how many there were
+        unsigned int h = head.load(std::memory_order_relaxed),
+                     avail = tail.load(std::memory_order_acquire) - h;
+        if (n > avail)
+            n = avail;
+        for (unsigned int i = 0; i < n; ++i)
+            v[i] = buf[(h + i) & (N - 1)];
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    unsigned int size() {
+        return tail.load(std::memory_order_acquire) -
+               head.load(std::memory_order_acquire);
+    }
+
+    void clear() {
+        // consumer side only
+        head.store(tail.load(std::memory_order_acquire),
+                   std::memory_order_release);
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "trace.h"
+#include <fstream>
+#include <string.h>
+
+// ----------------------------------------------------------------------------
+trace_ring::trace_ring(unsigned int capacity) : head(0) {
+    /* holds the last `capacity` instructions, rounded up to a power of two
+     */
+    unsigned int size = 1;
+    while (size < capacity && size < (1u << 31))
+        size <<= 1;
+    records = new trace_record[size];
+    mask    = size - 1;
+}
+
+// ----------------------------------------------------------------------------
+trace_ring::~trace_ring() {
+    delete[] records;
+}
+
+// ----------------------------------------------------------------------------
+void trace_ring::clear() {
+    head = 0;
+}
+
+// ----------------------------------------------------------------------------
+unsigned int trace_ring::get_capacity() {
+    return mask + 1;
+}
+
+// ----------------------------------------------------------------------------
+unsigned int trace_ring::get_count() {
+    return head < (qword) mask + 1 ? (unsigned int) head : mask + 1;
+}
+
+// ----------------------------------------------------------------------------
+const trace_record& trace_ring::get(unsigned int i) {
+    return records[(head - get_count() + i) & mask];
+}
+
+// ----------------------------------------------------------------------------
+bool trace_ring::dump(const std::string& path, byte mode) {
+    /* write the held records, oldest first, for a vm running in `mode`
+     */
+    std::ofstream outfs(path.c_str(), std::ios::binary);
+    if (!outfs)
+        return false;
+    trace_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.count   = get_count();
+    hdr.mode    = mode;
+    outfs.write((const char*) &hdr, sizeof(hdr));
+    // the ring wraps at most once: the older part, then the newer
+    unsigned int first = (head - hdr.count) & mask,
+                 run   = hdr.count < mask + 1 - first ? hdr.count
+                                                      : mask + 1 - first;
+    outfs.write((const char*) &records[first], run * sizeof(trace_record));
+    outfs.write((const char*) records,
+                (hdr.count - run) * sizeof(trace_record));
+    return (bool) outfs;
+}
+
+// ----------------------------------------------------------------------------
+bool read_trace(const std::string& path, std::vector<trace_record>& records,
+                byte* mode) {
+    std::ifstream infs(path.c_str(), std::ios::binary);
+    trace_header hdr;
+    if (!infs.read((char*) &hdr, sizeof(hdr)) ||
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != TRACE_VERSION)
+        return false;
+    // don't trust `count` further than the file goes
+    std::streamoff start = infs.tellg();
+    infs.seekg(0, std::ios::end);
+    if (infs.tellg() - start < (std::streamoff) hdr.count *
+                               (std::streamoff) sizeof(trace_record))
+        return false;
+    infs.seekg(start);
+    records.resize(hdr.count);
+    if (hdr.count > 0 &&
+        !infs.read((char*) &records[0], hdr.count * sizeof(trace_record)))
+        return false;
+    *mode = hdr.mode;
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "def.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Execution trace: a fixed-size ring of 16 byte binary records, one per
+ * instruction executed, overwriting the oldest. Recording is a handful of
+ * stores into memory that stays in cache, so a trace can be left running
+ * for a whole session and dumped when something goes wrong (c8vm dumps it
+ * on a fault); c8trace turns a dump back into readable disassembly.
+ *
+ * Each record holds what the instruction left behind in the registers it
+ * is most likely to have changed: VX (X from the opcode), VF and I.
+ * Iterations of idle loops that the vm skips aren't recorded, and show up
+ * as a jump in `cycle`.
+ *
+ * Dump file:
+ *
+ *     header      trace_header, 24 bytes
+ *     records     trace_record[count], oldest first
+ *
+ * written as-is, so dumps are little endian.
+ */
+const char     TRACE_MAGIC[8] = { 'C', '8', 'V', 'M', 'T', 'R', 'C', 'E' };
+const uint32_t TRACE_VERSION  = 1;
+const unsigned int TRACE_DEFAULT_SIZE = 1 << 16;
+
+typedef struct trace_record {
+    uint64_t cycle;     // instructions executed before this one
+    uint16_t pc, opcode;
+    uint8_t  vx, vf;    // after the instruction
+    uint16_t index;
+} trace_record;
+
+typedef struct trace_header {
+    char magic[8];
+    uint32_t version, count;
+    uint8_t  mode, reserved[7];
+} trace_header;
+
+class trace_ring {
+    trace_record* records;
+    qword head;             // records ever pushed
+    unsigned int mask;      // capacity - 1
+
+    public:
+    trace_ring(unsigned int capacity);
+    ~trace_ring();
+    void push(const vmstate* state, word pc) {
+        trace_record& r = records[head++ & mask];
+        r.cycle  = state->cycles;
+        r.pc     = pc;
+        r.opcode = state->curr_opcode;
+        r.vx     = state->registers[(state->curr_opcode >> 8) & 0xF];
+        r.vf     = state->registers[0xF];
+        r.index  = state->index;
+    }
+    void clear();
+    unsigned int get_capacity();
+    unsigned int get_count();
+    const trace_record& get(unsigned int i); // 0 is the oldest held
+    bool dump(const std::string& path, byte mode);
+
+    private:
+    trace_ring(const trace_ring&);            // not copyable: owns records
+    trace_ring& operator=(const trace_ring&);
+};
+
+bool read_trace(const std::string& path, std::vector<trace_record>& records,
+                byte* mode);
+
+#endif